@@ -1,7 +1,10 @@
 #include "binaryfusefilter.h"
+#include "binary_fuse_parallel.h"
 #include "xorfilter.h"
 #include <assert.h>
+#include <sys/resource.h>
 #include <time.h>
+#include <unistd.h>
 
 bool testxor8(size_t size) {
   printf("testing xor8 ");
@@ -116,6 +119,51 @@ bool testbufferedxor16(size_t size) {
   return true;
 }
 
+// peak resident memory of the process, in bytes
+static double peak_rss_bytes(void) {
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+#if defined(__APPLE__)
+  return (double)usage.ru_maxrss;
+#else
+  return (double)usage.ru_maxrss * 1024.0; // kilobytes
+#endif
+}
+
+// binary_fuse8_populate_lowmem against binary_fuse8_populate, in time and in
+// temporary memory: the growth of the peak resident memory. The peak never
+// goes down, so this runs first, and the mode that needs less memory first.
+bool testbinaryfuselowmem(size_t size) {
+  printf("testing binary fuse8 populate_lowmem ");
+  printf("size = %zu \n", size);
+
+  binary_fuse8_t filter;
+  binary_fuse8_allocate((uint32_t)size, &filter);
+  uint64_t *big_set = (uint64_t *)malloc(sizeof(uint64_t) * size);
+  for (size_t i = 0; i < size; i++) {
+    big_set[i] = i; // we use contiguous values
+  }
+  memset(filter.Fingerprints, 0, filter.ArrayLength); // the filter is not temporary
+  double base = peak_rss_bytes();
+  double t0 = binary_fuse_wall_seconds();
+  bool constructed = binary_fuse8_populate_lowmem(big_set, (uint32_t)size, &filter);
+  double seconds = binary_fuse_wall_seconds() - t0;
+  if(!constructed) { return false; }
+  double lowmem = peak_rss_bytes() - base;
+  printf("populate_lowmem    %f seconds, peak RSS +%.0f MB, %.1f bytes per key\n", seconds,
+         lowmem / 1e6, lowmem / (double)size);
+  t0 = binary_fuse_wall_seconds();
+  constructed = binary_fuse8_populate(big_set, (uint32_t)size, &filter);
+  seconds = binary_fuse_wall_seconds() - t0;
+  if(!constructed) { return false; }
+  double standard = peak_rss_bytes() - base;
+  printf("populate           %f seconds, peak RSS +%.0f MB, %.1f bytes per key\n", seconds,
+         standard / 1e6, standard / (double)size);
+  binary_fuse8_free(&filter);
+  free(big_set);
+  return true;
+}
+
 bool testbinaryfuse8(size_t size) {
   printf("testing binary fuse8 ");
   printf("size = %zu \n", size);
@@ -174,7 +222,242 @@ bool testbinaryfuse16(size_t size) {
   return true;
 }
 
+// an 8-bit and a 16-bit filter over the same keys: two populate calls
+// against a single binary_fuse_populate_multi
+bool testbinaryfusemulti(size_t size) {
+  printf("testing binary fuse8 + fuse16 ");
+  printf("size = %zu \n", size);
+
+  binary_fuse8_t filter8;
+  binary_fuse16_t filter16;
+
+  binary_fuse8_allocate((uint32_t)size, &filter8);
+  binary_fuse16_allocate((uint32_t)size, &filter16);
+  uint64_t *big_set = (uint64_t *)malloc(sizeof(uint64_t) * size);
+  for (size_t i = 0; i < size; i++) {
+    big_set[i] = i; // we use contiguous values
+  }
+  bool constructed = binary_fuse_populate_multi(big_set, (uint32_t)size, &filter8,
+                                                &filter16, NULL); // warm the cache
+  if(!constructed) { return false; }
+  for (size_t times = 0; times < 5; times++) {
+    clock_t t;
+    t = clock();
+    binary_fuse8_populate(big_set, (uint32_t)size, &filter8);
+    binary_fuse16_populate(big_set, (uint32_t)size, &filter16);
+    t = clock() - t;
+    double separate = ((double)t) / CLOCKS_PER_SEC; // in seconds
+    t = clock();
+    binary_fuse_populate_multi(big_set, (uint32_t)size, &filter8, &filter16, NULL);
+    t = clock() - t;
+    double multi = ((double)t) / CLOCKS_PER_SEC; // in seconds
+    printf("It took %f seconds (two populate calls) and %f seconds (populate_multi) "
+           "to build both over %zu values. \n",
+           separate, multi, size);
+  }
+  binary_fuse8_free(&filter8);
+  binary_fuse16_free(&filter16);
+  free(big_set);
+  return true;
+}
+
+// binary_fuse8_populate against binary_fuse8_populate_parallel with 1, 2, 4...
+// threads, in wall-clock time
+bool testbinaryfuseparallel(size_t size, size_t max_threads) {
+  printf("testing binary fuse8 populate_parallel ");
+  printf("size = %zu \n", size);
+
+  binary_fuse8_t filter;
+  binary_fuse8_allocate((uint32_t)size, &filter);
+  uint64_t *big_set = (uint64_t *)malloc(sizeof(uint64_t) * size);
+  for (size_t i = 0; i < size; i++) {
+    big_set[i] = i; // we use contiguous values
+  }
+  bool constructed = binary_fuse8_populate(big_set, (uint32_t)size, &filter); // warm the cache
+  if(!constructed) { return false; }
+  double t0 = binary_fuse_wall_seconds();
+  binary_fuse8_populate(big_set, (uint32_t)size, &filter);
+  double serial = binary_fuse_wall_seconds() - t0;
+  printf("populate           %f seconds\n", serial);
+  for (size_t nthreads = 1; nthreads <= max_threads; nthreads *= 2) {
+    t0 = binary_fuse_wall_seconds();
+    constructed = binary_fuse8_populate_parallel(big_set, (uint32_t)size, &filter, nthreads);
+    double seconds = binary_fuse_wall_seconds() - t0;
+    if(!constructed) { return false; }
+    printf("populate_parallel  %f seconds with %3zu threads, speedup %.2f\n", seconds, nthreads,
+           serial / seconds);
+  }
+  binary_fuse8_free(&filter);
+  free(big_set);
+  return true;
+}
+
+// xor16_populate against xor16_populate_parallel with 1, 2, 4... threads, in
+// wall-clock time
+bool testxor16parallel(size_t size, size_t max_threads) {
+  printf("testing xor16 populate_parallel ");
+  printf("size = %zu \n", size);
+
+  xor16_t filter;
+  xor16_allocate((uint32_t)size, &filter);
+  uint64_t *big_set = (uint64_t *)malloc(sizeof(uint64_t) * size);
+  for (size_t i = 0; i < size; i++) {
+    big_set[i] = i; // we use contiguous values
+  }
+  bool constructed = xor16_populate(big_set, (uint32_t)size, &filter); // warm the cache
+  if(!constructed) { return false; }
+  double t0 = binary_fuse_wall_seconds();
+  xor16_populate(big_set, (uint32_t)size, &filter);
+  double serial = binary_fuse_wall_seconds() - t0;
+  printf("populate           %f seconds\n", serial);
+  for (size_t nthreads = 1; nthreads <= max_threads; nthreads *= 2) {
+    t0 = binary_fuse_wall_seconds();
+    constructed = xor16_populate_parallel(big_set, (uint32_t)size, &filter, nthreads);
+    double seconds = binary_fuse_wall_seconds() - t0;
+    if(!constructed) { return false; }
+    printf("populate_parallel  %f seconds with %3zu threads, speedup %.2f\n", seconds, nthreads,
+           serial / seconds);
+  }
+  xor16_free(&filter);
+  free(big_set);
+  return true;
+}
+
+// binary_fuse8_populate against a set of 64 shards built with 1, 2, 4...
+// threads, in wall-clock time, and the cost of a query
+bool testbinaryfusesharded(size_t size, size_t max_threads) {
+  printf("testing sharded binary fuse8 populate_parallel ");
+  printf("size = %zu \n", size);
+
+  binary_fuse8_t filter;
+  binary_fuse8_allocate((uint32_t)size, &filter);
+  uint64_t *big_set = (uint64_t *)malloc(sizeof(uint64_t) * size);
+  for (size_t i = 0; i < size; i++) {
+    big_set[i] = i; // we use contiguous values
+  }
+  bool constructed = binary_fuse8_populate(big_set, (uint32_t)size, &filter); // warm the cache
+  if(!constructed) { return false; }
+  double t0 = binary_fuse_wall_seconds();
+  binary_fuse8_populate(big_set, (uint32_t)size, &filter);
+  double serial = binary_fuse_wall_seconds() - t0;
+  printf("populate           %f seconds\n", serial);
+  binary_fuse_sharded_t sharded;
+  if (!binary_fuse_sharded_allocate(size, 64, &sharded)) { return false; }
+  for (size_t nthreads = 1; nthreads <= max_threads; nthreads *= 2) {
+    t0 = binary_fuse_wall_seconds();
+    constructed = binary_fuse_sharded_populate_parallel(big_set, size, &sharded, nthreads);
+    double seconds = binary_fuse_wall_seconds() - t0;
+    if(!constructed) { return false; }
+    printf("populate_parallel  %f seconds with %3zu threads, speedup %.2f\n", seconds, nthreads,
+           serial / seconds);
+  }
+  size_t matches = 0;
+  t0 = binary_fuse_wall_seconds();
+  for (size_t i = 0; i < size; i++) {
+    matches += binary_fuse8_contain(big_set[i], &filter);
+  }
+  double single = binary_fuse_wall_seconds() - t0;
+  t0 = binary_fuse_wall_seconds();
+  for (size_t i = 0; i < size; i++) {
+    matches += binary_fuse_sharded_contain(big_set[i], &sharded);
+  }
+  double seconds = binary_fuse_wall_seconds() - t0;
+  if (matches != 2 * size) { return false; }
+  printf("contain %.2f ns per key, sharded %.2f ns per key, %.2f bits per key\n",
+         single * 1e9 / (double)size, seconds * 1e9 / (double)size,
+         (double)binary_fuse_sharded_size_in_bytes(&sharded) * 8.0 / (double)size);
+  binary_fuse_sharded_free(&sharded);
+  binary_fuse8_free(&filter);
+  free(big_set);
+  return true;
+}
+
+// rebuilding 'count' filters of 'size' keys, with a scratch memory allocated
+// by every construction and with one workspace kept across them
+bool testworkspace(size_t count, size_t size) {
+  printf("testing construction workspaces ");
+  printf("%zu filters of size = %zu \n", count, size);
+
+  binary_fuse8_t filter;
+  xor8_t xfilter;
+  binary_fuse_workspace_t workspace;
+  xor_workspace_t xworkspace;
+  if (!binary_fuse8_allocate((uint32_t)size, &filter) ||
+      !xor8_allocate((uint32_t)size, &xfilter) ||
+      !binary_fuse_workspace_allocate((uint32_t)size, &workspace) ||
+      !xor_workspace_allocate((uint32_t)size, &xworkspace)) {
+    return false;
+  }
+  uint64_t *big_set = (uint64_t *)malloc(sizeof(uint64_t) * size);
+  // every mode builds the same sequence of filters, one mode after the other
+  double seconds[4] = {0, 0, 0, 0};
+  for (int mode = 0; mode < 4; mode++) {
+    uint64_t rng = 1234;
+    for (size_t c = 0; c < count; c++) {
+      for (size_t i = 0; i < size; i++) {
+        big_set[i] = binary_fuse_rng_splitmix64(&rng);
+      }
+      double t0 = binary_fuse_wall_seconds();
+      bool constructed;
+      if (mode == 0) {
+        constructed = binary_fuse8_populate(big_set, (uint32_t)size, &filter);
+      } else if (mode == 1) {
+        constructed = binary_fuse8_populate_with_workspace(big_set, (uint32_t)size, &filter,
+                                                           &workspace);
+      } else if (mode == 2) {
+        constructed = xor8_populate(big_set, (uint32_t)size, &xfilter);
+      } else {
+        constructed = xor8_populate_with_workspace(big_set, (uint32_t)size, &xfilter,
+                                                   &xworkspace);
+      }
+      seconds[mode] += binary_fuse_wall_seconds() - t0;
+      if(!constructed) { return false; }
+    }
+  }
+  printf("binary fuse8 populate                %f seconds, %.1f ns per key\n", seconds[0],
+         seconds[0] * 1e9 / (double)(count * size));
+  printf("binary fuse8 populate_with_workspace %f seconds, %.1f ns per key\n", seconds[1],
+         seconds[1] * 1e9 / (double)(count * size));
+  printf("xor8 populate                        %f seconds, %.1f ns per key\n", seconds[2],
+         seconds[2] * 1e9 / (double)(count * size));
+  printf("xor8 populate_with_workspace         %f seconds, %.1f ns per key\n", seconds[3],
+         seconds[3] * 1e9 / (double)(count * size));
+  binary_fuse_workspace_free(&workspace);
+  xor_workspace_free(&xworkspace);
+  binary_fuse8_free(&filter);
+  xor8_free(&xfilter);
+  free(big_set);
+  return true;
+}
+
+// a 64-bit filter, built once (the largest sizes take minutes)
+bool testbinaryfuse8large(uint64_t size) {
+  printf("testing binary fuse8 large ");
+  printf("size = %llu \n", (unsigned long long)size);
+
+  binary_fuse8_large_t filter;
+  if (!binary_fuse8_large_allocate(size, &filter)) { return false; }
+  uint64_t *big_set = (uint64_t *)malloc(sizeof(uint64_t) * size);
+  if (big_set == NULL) { return false; }
+  for (uint64_t i = 0; i < size; i++) {
+    big_set[i] = i; // we use contiguous values
+  }
+  double t0 = binary_fuse_wall_seconds();
+  bool constructed = binary_fuse8_large_populate(big_set, size, &filter);
+  double seconds = binary_fuse_wall_seconds() - t0;
+  if(!constructed) { return false; }
+  printf("It took %f seconds to build an index over %llu values, %.2f bits per key. \n",
+         seconds, (unsigned long long)size,
+         (double)binary_fuse8_large_size_in_bytes(&filter) * 8.0 / (double)size);
+  binary_fuse8_large_free(&filter);
+  free(big_set);
+  return true;
+}
+
 int main() {
+  printf("key mixer: binary fuse %s, xor %s\n", binary_fuse_mixer_name(), xor_mixer_name());
+  if (!testbinaryfuselowmem(10000000)) { abort(); }
+  printf("\n");
   for (size_t s = 10000000; s <= 10000000; s *= 10) {
     if (!testbinaryfuse8(s)) { abort(); }
     if (!testbufferedxor8(s)) { abort(); }
@@ -182,7 +465,25 @@ int main() {
     if (!testbinaryfuse16(s)) { abort(); }
     if (!testbufferedxor16(s)) { abort(); }
     if (!testxor16(s)) { abort(); }
+    if (!testbinaryfusemulti(s)) { abort(); }
+    if (!testbinaryfuseparallel(s, 16)) { abort(); }
+    if (!testxor16parallel(s, 16)) { abort(); }
+    if (!testbinaryfusesharded(s, 16)) { abort(); }
 
     printf("\n");
   }
+  if (!testworkspace(100000, 1000)) { abort(); }
+  if (!testworkspace(1000, 100000)) { abort(); }
+  printf("\n");
+  // more keys than a 32-bit filter holds, on hosts with the memory: the keys
+  // and the construction take about 45 bytes per key
+  uint64_t large = UINT64_C(6000000000);
+  double memory = (double)sysconf(_SC_PHYS_PAGES) * (double)sysconf(_SC_PAGE_SIZE);
+  if (memory >= 45.0 * (double)large) {
+    if (!testbinaryfuse8large(large)) { abort(); }
+  } else {
+    printf("skipping binary fuse8 large with %llu values: it needs %.0f GB of memory, "
+           "this host has %.0f GB\n",
+           (unsigned long long)large, 45.0 * (double)large / 1e9, memory / 1e9);
+  }
 }
@@ -1,6 +1,8 @@
 #include "binaryfusefilter.h"
 #include "xorfilter.h"
+#include "binary_fuse_parallel.h"
 #include <assert.h>
+#include <string.h>
 #include <time.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -155,10 +157,722 @@ static void run_xor16() {
   free(keys);
 }
 
-int main() {
+// Builds a query set where half of the queries are keys of the set (even
+// numbers below 2 * n) and half are odd numbers, which are not in the set.
+static uint64_t *make_queries(size_t n, size_t q) {
+  uint64_t *queries = (uint64_t *)malloc(sizeof(uint64_t) * q);
+  if (queries == NULL) {
+    return NULL;
+  }
+  uint64_t rng = 1234;
+  for (size_t i = 0; i < q; i++) {
+    uint64_t r = binary_fuse_rng_splitmix64(&rng);
+    queries[i] = (i & 1) ? 2 * (r % n) : 2 * (r % n) + 1;
+  }
+  return queries;
+}
+
+static void report(const char *name, size_t n, size_t bytes, double scalar_secs,
+                   double batch_secs, size_t q, size_t found_scalar, size_t found_batch) {
+  double scalar_ns = (scalar_secs * 1e9) / (double)q;
+  double batch_ns = (batch_secs * 1e9) / (double)q;
+  printf("%-14s %12zu keys %10.1f MB   scalar %7.2f ns/q   batch %7.2f ns/q   speedup %5.2fx%s\n",
+         name, n, (double)bytes / (1024.0 * 1024.0), scalar_ns, batch_ns,
+         scalar_ns / batch_ns, found_scalar == found_batch ? "" : "   MISMATCH");
+}
+
+static void run_batch_binaryfuse8(size_t n, const uint64_t *queries, bool *out, size_t q) {
+  binary_fuse8_t filter;
+  uint64_t *keys = (uint64_t *)malloc(sizeof(uint64_t) * n);
+  if (keys == NULL || !binary_fuse8_allocate((uint32_t)n, &filter)) {
+    fprintf(stderr, "binary_fuse8_allocate failed\n");
+    free(keys);
+    return;
+  }
+  for (size_t i = 0; i < n; i++) keys[i] = (uint64_t)i * 2ULL; // even numbers
+  if (!binary_fuse8_populate(keys, (uint32_t)n, &filter)) {
+    fprintf(stderr, "binary_fuse8_populate failed\n");
+    binary_fuse8_free(&filter);
+    free(keys);
+    return;
+  }
+  free(keys);
+
+  size_t found_scalar = 0;
+  double t0 = time_seconds();
+  for (size_t i = 0; i < q; i++) {
+    if (binary_fuse8_contain(queries[i], &filter)) found_scalar++;
+  }
+  double t1 = time_seconds();
+  binary_fuse8_contain_batch(queries, q, out, &filter);
+  double t2 = time_seconds();
+  size_t found_batch = 0;
+  for (size_t i = 0; i < q; i++) found_batch += out[i];
+  report("binary_fuse8", n, binary_fuse8_size_in_bytes(&filter), t1 - t0, t2 - t1, q,
+         found_scalar, found_batch);
+  binary_fuse8_free(&filter);
+}
+
+static void run_batch_binaryfuse16(size_t n, const uint64_t *queries, bool *out, size_t q) {
+  binary_fuse16_t filter;
+  uint64_t *keys = (uint64_t *)malloc(sizeof(uint64_t) * n);
+  if (keys == NULL || !binary_fuse16_allocate((uint32_t)n, &filter)) {
+    fprintf(stderr, "binary_fuse16_allocate failed\n");
+    free(keys);
+    return;
+  }
+  for (size_t i = 0; i < n; i++) keys[i] = (uint64_t)i * 2ULL; // even numbers
+  if (!binary_fuse16_populate(keys, (uint32_t)n, &filter)) {
+    fprintf(stderr, "binary_fuse16_populate failed\n");
+    binary_fuse16_free(&filter);
+    free(keys);
+    return;
+  }
+  free(keys);
+
+  size_t found_scalar = 0;
+  double t0 = time_seconds();
+  for (size_t i = 0; i < q; i++) {
+    if (binary_fuse16_contain(queries[i], &filter)) found_scalar++;
+  }
+  double t1 = time_seconds();
+  binary_fuse16_contain_batch(queries, q, out, &filter);
+  double t2 = time_seconds();
+  size_t found_batch = 0;
+  for (size_t i = 0; i < q; i++) found_batch += out[i];
+  report("binary_fuse16", n, binary_fuse16_size_in_bytes(&filter), t1 - t0, t2 - t1, q,
+         found_scalar, found_batch);
+  binary_fuse16_free(&filter);
+}
+
+static void run_batch_blocked8(size_t n, const uint64_t *queries, bool *out, size_t q) {
+  binary_fuse8_blocked_t filter;
+  uint64_t *keys = (uint64_t *)malloc(sizeof(uint64_t) * n);
+  if (keys == NULL || !binary_fuse8_blocked_allocate((uint32_t)n, &filter)) {
+    fprintf(stderr, "binary_fuse8_blocked_allocate failed\n");
+    free(keys);
+    return;
+  }
+  for (size_t i = 0; i < n; i++) keys[i] = (uint64_t)i * 2ULL; // even numbers
+  if (!binary_fuse8_blocked_populate(keys, (uint32_t)n, &filter)) {
+    fprintf(stderr, "binary_fuse8_blocked_populate failed\n");
+    binary_fuse8_blocked_free(&filter);
+    free(keys);
+    return;
+  }
+  free(keys);
+
+  size_t found_scalar = 0;
+  double t0 = time_seconds();
+  for (size_t i = 0; i < q; i++) {
+    if (binary_fuse8_blocked_contain(queries[i], &filter)) found_scalar++;
+  }
+  double t1 = time_seconds();
+  binary_fuse8_blocked_contain_batch(queries, q, out, &filter);
+  double t2 = time_seconds();
+  size_t found_batch = 0;
+  for (size_t i = 0; i < q; i++) found_batch += out[i];
+  report("fuse8_blocked", n, binary_fuse8_blocked_size_in_bytes(&filter), t1 - t0, t2 - t1, q,
+         found_scalar, found_batch);
+  binary_fuse8_blocked_free(&filter);
+}
+
+static void run_batch_blocked16(size_t n, const uint64_t *queries, bool *out, size_t q) {
+  binary_fuse16_blocked_t filter;
+  uint64_t *keys = (uint64_t *)malloc(sizeof(uint64_t) * n);
+  if (keys == NULL || !binary_fuse16_blocked_allocate((uint32_t)n, &filter)) {
+    fprintf(stderr, "binary_fuse16_blocked_allocate failed\n");
+    free(keys);
+    return;
+  }
+  for (size_t i = 0; i < n; i++) keys[i] = (uint64_t)i * 2ULL; // even numbers
+  if (!binary_fuse16_blocked_populate(keys, (uint32_t)n, &filter)) {
+    fprintf(stderr, "binary_fuse16_blocked_populate failed\n");
+    binary_fuse16_blocked_free(&filter);
+    free(keys);
+    return;
+  }
+  free(keys);
+
+  size_t found_scalar = 0;
+  double t0 = time_seconds();
+  for (size_t i = 0; i < q; i++) {
+    if (binary_fuse16_blocked_contain(queries[i], &filter)) found_scalar++;
+  }
+  double t1 = time_seconds();
+  binary_fuse16_blocked_contain_batch(queries, q, out, &filter);
+  double t2 = time_seconds();
+  size_t found_batch = 0;
+  for (size_t i = 0; i < q; i++) found_batch += out[i];
+  report("fuse16_blocked", n, binary_fuse16_blocked_size_in_bytes(&filter), t1 - t0, t2 - t1, q,
+         found_scalar, found_batch);
+  binary_fuse16_blocked_free(&filter);
+}
+
+// Compares the blocked filters (two adjacent cache lines per query) with the
+// binary fuse filters (three distant cache lines per query) of the same width.
+static void run_blocked(size_t max_keys) {
+  printf("\nRunning blocked vs binary fuse query benchmark (up to %zu keys)\n", max_keys);
+  const size_t q = 4 * Q;
+  bool *out = (bool *)malloc(sizeof(bool) * q);
+  if (out == NULL) {
+    fprintf(stderr, "allocation failed\n");
+    return;
+  }
+  for (size_t n = (size_t)1 << 18; n <= max_keys; n *= 4) {
+    uint64_t *queries = make_queries(n, q);
+    if (queries == NULL) {
+      fprintf(stderr, "allocation failed\n");
+      break;
+    }
+    run_batch_binaryfuse8(n, queries, out, q);
+    run_batch_blocked8(n, queries, out, q);
+    run_batch_binaryfuse16(n, queries, out, q);
+    run_batch_blocked16(n, queries, out, q);
+    free(queries);
+  }
+  free(out);
+}
+
+// Compares the batched queries against one-at-a-time queries, from filters
+// that fit in L2 up to filters much larger than the last-level cache.
+static void run_batch_vs_scalar(size_t max_keys) {
+  printf("\nRunning batched vs scalar query benchmark (up to %zu keys)\n", max_keys);
+  const size_t q = 4 * Q;
+  bool *out = (bool *)malloc(sizeof(bool) * q);
+  if (out == NULL) {
+    fprintf(stderr, "allocation failed\n");
+    return;
+  }
+  for (size_t n = (size_t)1 << 18; n <= max_keys; n *= 4) {
+    uint64_t *queries = make_queries(n, q);
+    if (queries == NULL) {
+      fprintf(stderr, "allocation failed\n");
+      break;
+    }
+    run_batch_binaryfuse8(n, queries, out, q);
+    run_batch_binaryfuse16(n, queries, out, q);
+    free(queries);
+  }
+  free(out);
+}
+
+
+typedef void (*fuse8_batch_fn)(const uint64_t *, size_t, bool *, const binary_fuse8_t *);
+typedef void (*fuse16_batch_fn)(const uint64_t *, size_t, bool *, const binary_fuse16_t *);
+typedef void (*fuse8_4wise_batch_fn)(const uint64_t *, size_t, bool *,
+                                     const binary_fuse8_4wise_t *);
+typedef void (*fuse16_4wise_batch_fn)(const uint64_t *, size_t, bool *,
+                                      const binary_fuse16_4wise_t *);
+typedef void (*bitpacked_batch_fn)(const uint64_t *, size_t, bool *,
+                                   const binary_fuse_bitpacked_t *);
+typedef void (*xor8_batch_fn)(const uint64_t *, size_t, bool *, const xor8_t *);
+typedef void (*xor16_batch_fn)(const uint64_t *, size_t, bool *, const xor16_t *);
+
+static void report_kernel(const char *filter, const char *kernel, double secs, size_t q,
+                          const bool *out) {
+  size_t found = 0;
+  for (size_t i = 0; i < q; i++) found += out[i];
+  printf("%-20s %-8s %7.2f ns/q  %8.1f Mq/s  found=%zu\n", filter, kernel,
+         secs * 1e9 / (double)q, (double)q / secs / 1e6, found);
+}
+
+// Compares the batch query kernels supported by this processor on filters
+// with n keys; the kernel marked as selected is the one the library uses.
+static void run_kernels(size_t n) {
+  const size_t q = 4 * Q;
+  printf("selected kernels: binary fuse %s, xor %s\n",
+         binary_fuse_kernel_name(binary_fuse_kernel()), xor_kernel_name(xor_kernel()));
+  uint64_t *keys = (uint64_t *)malloc(sizeof(uint64_t) * n);
+  uint64_t *queries = make_queries(n, q);
+  bool *out = (bool *)malloc(sizeof(bool) * q);
+  if (keys == NULL || queries == NULL || out == NULL) {
+    fprintf(stderr, "allocation failed\n");
+    free(keys);
+    free(queries);
+    free(out);
+    return;
+  }
+  for (size_t i = 0; i < n; i++) keys[i] = (uint64_t)i * 2ULL; // even numbers
+
+  struct { const char *name; fuse8_batch_fn fn; int kernel; } fuse8[] = {
+    {"scalar", binary_fuse8_contain_batch_scalar, BINARY_FUSE_KERNEL_SCALAR},
+#ifdef BINARY_FUSE_X64_SIMD
+    {"avx2", binary_fuse8_contain_batch_avx2, BINARY_FUSE_KERNEL_AVX2},
+    {"avx512", binary_fuse8_contain_batch_avx512, BINARY_FUSE_KERNEL_AVX512},
+#endif
+  };
+  struct { const char *name; fuse16_batch_fn fn; int kernel; } fuse16[] = {
+    {"scalar", binary_fuse16_contain_batch_scalar, BINARY_FUSE_KERNEL_SCALAR},
+#ifdef BINARY_FUSE_X64_SIMD
+    {"avx2", binary_fuse16_contain_batch_avx2, BINARY_FUSE_KERNEL_AVX2},
+    {"avx512", binary_fuse16_contain_batch_avx512, BINARY_FUSE_KERNEL_AVX512},
+#endif
+  };
+  struct { const char *name; fuse8_4wise_batch_fn fn; int kernel; } fuse8w[] = {
+    {"scalar", binary_fuse8_4wise_contain_batch_scalar, BINARY_FUSE_KERNEL_SCALAR},
+#ifdef BINARY_FUSE_X64_SIMD
+    {"avx2", binary_fuse8_4wise_contain_batch_avx2, BINARY_FUSE_KERNEL_AVX2},
+    {"avx512", binary_fuse8_4wise_contain_batch_avx512, BINARY_FUSE_KERNEL_AVX512},
+#endif
+  };
+  struct { const char *name; fuse16_4wise_batch_fn fn; int kernel; } fuse16w[] = {
+    {"scalar", binary_fuse16_4wise_contain_batch_scalar, BINARY_FUSE_KERNEL_SCALAR},
+#ifdef BINARY_FUSE_X64_SIMD
+    {"avx2", binary_fuse16_4wise_contain_batch_avx2, BINARY_FUSE_KERNEL_AVX2},
+    {"avx512", binary_fuse16_4wise_contain_batch_avx512, BINARY_FUSE_KERNEL_AVX512},
+#endif
+  };
+  struct { const char *name; bitpacked_batch_fn fn; int kernel; } packed[] = {
+    {"scalar", binary_fuse_bitpacked_contain_batch_scalar, BINARY_FUSE_KERNEL_SCALAR},
+#ifdef BINARY_FUSE_X64_SIMD
+    {"avx2", binary_fuse_bitpacked_contain_batch_avx2, BINARY_FUSE_KERNEL_AVX2},
+    {"avx512", binary_fuse_bitpacked_contain_batch_avx512, BINARY_FUSE_KERNEL_AVX512},
+#endif
+  };
+  struct { const char *name; xor8_batch_fn fn; int kernel; } x8[] = {
+    {"scalar", xor8_contain_batch_scalar, XOR_KERNEL_SCALAR},
+#ifdef XOR_X64_SIMD
+    {"avx2", xor8_contain_batch_avx2, XOR_KERNEL_AVX2},
+    {"avx512", xor8_contain_batch_avx512, XOR_KERNEL_AVX512},
+#endif
+  };
+  struct { const char *name; xor16_batch_fn fn; int kernel; } x16[] = {
+    {"scalar", xor16_contain_batch_scalar, XOR_KERNEL_SCALAR},
+#ifdef XOR_X64_SIMD
+    {"avx2", xor16_contain_batch_avx2, XOR_KERNEL_AVX2},
+    {"avx512", xor16_contain_batch_avx512, XOR_KERNEL_AVX512},
+#endif
+  };
+
+  binary_fuse8_t f8;
+  if (binary_fuse8_allocate((uint32_t)n, &f8) && binary_fuse8_populate(keys, (uint32_t)n, &f8)) {
+    for (size_t k = 0; k < sizeof(fuse8) / sizeof(fuse8[0]); k++) {
+      if (fuse8[k].kernel > binary_fuse_detect_kernel()) continue;
+      double t0 = time_seconds();
+      fuse8[k].fn(queries, q, out, &f8);
+      report_kernel("binary_fuse8", fuse8[k].name, time_seconds() - t0, q, out);
+    }
+  }
+  binary_fuse8_free(&f8);
+  binary_fuse16_t f16;
+  if (binary_fuse16_allocate((uint32_t)n, &f16) && binary_fuse16_populate(keys, (uint32_t)n, &f16)) {
+    for (size_t k = 0; k < sizeof(fuse16) / sizeof(fuse16[0]); k++) {
+      if (fuse16[k].kernel > binary_fuse_detect_kernel()) continue;
+      double t0 = time_seconds();
+      fuse16[k].fn(queries, q, out, &f16);
+      report_kernel("binary_fuse16", fuse16[k].name, time_seconds() - t0, q, out);
+    }
+  }
+  binary_fuse16_free(&f16);
+  binary_fuse8_4wise_t w8;
+  if (binary_fuse8_4wise_allocate((uint32_t)n, &w8) &&
+      binary_fuse8_4wise_populate(keys, (uint32_t)n, &w8)) {
+    for (size_t k = 0; k < sizeof(fuse8w) / sizeof(fuse8w[0]); k++) {
+      if (fuse8w[k].kernel > binary_fuse_detect_kernel()) continue;
+      double t0 = time_seconds();
+      fuse8w[k].fn(queries, q, out, &w8);
+      report_kernel("binary_fuse8_4wise", fuse8w[k].name, time_seconds() - t0, q, out);
+    }
+  }
+  binary_fuse8_4wise_free(&w8);
+  binary_fuse16_4wise_t w16;
+  if (binary_fuse16_4wise_allocate((uint32_t)n, &w16) &&
+      binary_fuse16_4wise_populate(keys, (uint32_t)n, &w16)) {
+    for (size_t k = 0; k < sizeof(fuse16w) / sizeof(fuse16w[0]); k++) {
+      if (fuse16w[k].kernel > binary_fuse_detect_kernel()) continue;
+      double t0 = time_seconds();
+      fuse16w[k].fn(queries, q, out, &w16);
+      report_kernel("binary_fuse16_4wise", fuse16w[k].name, time_seconds() - t0, q, out);
+    }
+  }
+  binary_fuse16_4wise_free(&w16);
+  binary_fuse_bitpacked_t p12;
+  if (binary_fuse_bitpacked_allocate((uint32_t)n, 12, &p12) &&
+      binary_fuse_bitpacked_populate(keys, (uint32_t)n, &p12)) {
+    for (size_t k = 0; k < sizeof(packed) / sizeof(packed[0]); k++) {
+      if (packed[k].kernel > binary_fuse_detect_kernel()) continue;
+      double t0 = time_seconds();
+      packed[k].fn(queries, q, out, &p12);
+      report_kernel("binary_fuse12_bits", packed[k].name, time_seconds() - t0, q, out);
+    }
+  }
+  binary_fuse_bitpacked_free(&p12);
+  xor8_t xf8;
+  if (xor8_allocate((uint32_t)n, &xf8) && xor8_populate(keys, (uint32_t)n, &xf8)) {
+    for (size_t k = 0; k < sizeof(x8) / sizeof(x8[0]); k++) {
+      if (x8[k].kernel > xor_detect_kernel()) continue;
+      double t0 = time_seconds();
+      x8[k].fn(queries, q, out, &xf8);
+      report_kernel("xor8", x8[k].name, time_seconds() - t0, q, out);
+    }
+  }
+  xor8_free(&xf8);
+  xor16_t xf16;
+  if (xor16_allocate((uint32_t)n, &xf16) && xor16_populate(keys, (uint32_t)n, &xf16)) {
+    for (size_t k = 0; k < sizeof(x16) / sizeof(x16[0]); k++) {
+      if (x16[k].kernel > xor_detect_kernel()) continue;
+      double t0 = time_seconds();
+      x16[k].fn(queries, q, out, &xf16);
+      report_kernel("xor16", x16[k].name, time_seconds() - t0, q, out);
+    }
+  }
+  xor16_free(&xf16);
+  free(keys);
+  free(queries);
+  free(out);
+}
+
+// One key checked against a stack of 'levels' filters of n keys each, as in
+// an LSM tree: a loop over binary_fuse8_contain on filters with distinct seeds
+// against binary_fuse8_contain_multi on a family of filters sharing their seed.
+static void run_multi(size_t levels, size_t n) {
+  const size_t q = Q;
+  printf("%zu filters of %zu keys, %zu queries\n", levels, n, q);
+  binary_fuse8_t *solo = (binary_fuse8_t *)malloc(sizeof(binary_fuse8_t) * levels);
+  binary_fuse8_t *family = (binary_fuse8_t *)malloc(sizeof(binary_fuse8_t) * levels);
+  const binary_fuse8_t **stack = (const binary_fuse8_t **)malloc(sizeof(binary_fuse8_t *) * levels);
+  uint64_t *keys = (uint64_t *)malloc(sizeof(uint64_t) * n);
+  uint64_t *bitmap = (uint64_t *)malloc(sizeof(uint64_t) * ((levels + 63) / 64));
+  if (solo == NULL || family == NULL || stack == NULL || keys == NULL || bitmap == NULL) {
+    fprintf(stderr, "allocation failed\n");
+    free(solo);
+    free(family);
+    free(stack);
+    free(keys);
+    free(bitmap);
+    return;
+  }
+  for (size_t l = 0; l < levels; l++) {
+    for (size_t i = 0; i < n; i++) keys[i] = (uint64_t)(i * levels + l) * 2ULL;
+    binary_fuse8_allocate((uint32_t)n, &solo[l]);
+    binary_fuse8_allocate((uint32_t)n, &family[l]);
+    binary_fuse8_populate_family(keys, (uint32_t)n, (uint64_t)l, &solo[l]);
+    binary_fuse8_populate_family(keys, (uint32_t)n, 42, &family[l]);
+    stack[l] = &family[l];
+  }
+  uint64_t rng = 1234;
+  size_t found_loop = 0, found_multi = 0;
+  double t0 = time_seconds();
+  for (size_t i = 0; i < q; i++) {
+    uint64_t key = 2 * (binary_fuse_rng_splitmix64(&rng) % (n * levels));
+    for (size_t l = 0; l < levels; l++) {
+      found_loop += binary_fuse8_contain(key, &solo[l]);
+    }
+  }
+  double t1 = time_seconds();
+  rng = 1234;
+  for (size_t i = 0; i < q; i++) {
+    uint64_t key = 2 * (binary_fuse_rng_splitmix64(&rng) % (n * levels));
+    binary_fuse8_contain_multi(key, stack, levels, bitmap);
+    for (size_t w = 0; w < (levels + 63) / 64; w++) {
+      found_multi += (size_t)__builtin_popcountll(bitmap[w]);
+    }
+  }
+  double t2 = time_seconds();
+  printf("contain loop   %7.2f ns/key  found=%zu\n", (t1 - t0) * 1e9 / (double)q, found_loop);
+  printf("contain_multi  %7.2f ns/key  found=%zu\n", (t2 - t1) * 1e9 / (double)q, found_multi);
+  for (size_t l = 0; l < levels; l++) {
+    binary_fuse8_free(&solo[l]);
+    binary_fuse8_free(&family[l]);
+  }
+  free(solo);
+  free(family);
+  free(stack);
+  free(keys);
+  free(bitmap);
+}
+
+// Selection vector of the matching positions, with about half of the queries
+// found: a loop with a branch on binary_fuse8_contain against
+// binary_fuse8_contain_select, and the bitmap variant.
+static void run_select(size_t n) {
+  const size_t q = 4 * Q;
+  uint64_t *keys = (uint64_t *)malloc(sizeof(uint64_t) * n);
+  uint64_t *queries = make_queries(n, q);
+  uint32_t *sel = (uint32_t *)malloc(sizeof(uint32_t) * (q + 64));
+  uint64_t *bitmap = (uint64_t *)malloc(sizeof(uint64_t) * ((q + 63) / 64));
+  binary_fuse8_t filter;
+  if (keys == NULL || queries == NULL || sel == NULL || bitmap == NULL ||
+      !binary_fuse8_allocate((uint32_t)n, &filter)) {
+    fprintf(stderr, "allocation failed\n");
+    free(keys);
+    free(queries);
+    free(sel);
+    free(bitmap);
+    return;
+  }
+  for (size_t i = 0; i < n; i++) keys[i] = (uint64_t)i * 2ULL; // even numbers
+  if (binary_fuse8_populate(keys, (uint32_t)n, &filter)) {
+    double t0 = time_seconds();
+    size_t found_loop = 0;
+    for (size_t i = 0; i < q; i++) {
+      if (binary_fuse8_contain(queries[i], &filter)) {
+        sel[found_loop++] = (uint32_t)i;
+      }
+    }
+    double t1 = time_seconds();
+    size_t found_select = binary_fuse8_contain_select(queries, q, sel, &filter);
+    double t2 = time_seconds();
+    size_t found_bitmap = binary_fuse8_contain_bitmap(queries, q, bitmap, &filter);
+    double t3 = time_seconds();
+    printf("binary_fuse8 %zu keys, %s kernel\n", n,
+           binary_fuse_kernel_name(binary_fuse_kernel()));
+    printf("branchy loop %7.2f ns/q  found=%zu\n", (t1 - t0) * 1e9 / (double)q, found_loop);
+    printf("select       %7.2f ns/q  found=%zu\n", (t2 - t1) * 1e9 / (double)q, found_select);
+    printf("bitmap       %7.2f ns/q  found=%zu\n", (t3 - t2) * 1e9 / (double)q, found_bitmap);
+  }
+  binary_fuse8_free(&filter);
+  free(keys);
+  free(queries);
+  free(sel);
+  free(bitmap);
+}
+
+// Thread scaling of the batch queries on one large binary_fuse16_t: the
+// throughput stops growing when the random fingerprint accesses (three cache
+// lines per query) saturate the memory system.
+static void run_threads(size_t n, size_t max_threads) {
+  const size_t q = (size_t)1 << 25;
+  uint64_t *keys = (uint64_t *)malloc(sizeof(uint64_t) * n);
+  uint64_t *queries = make_queries(n, q);
+  binary_fuse16_t filter;
+  if (keys == NULL || queries == NULL || !binary_fuse16_allocate((uint32_t)n, &filter)) {
+    fprintf(stderr, "allocation failed\n");
+    free(keys);
+    free(queries);
+    return;
+  }
+  for (size_t i = 0; i < n; i++) keys[i] = (uint64_t)i * 2ULL; // even numbers
+  bool ok = binary_fuse16_populate(keys, (uint32_t)n, &filter);
+  free(keys);
+  if (!ok) {
+    fprintf(stderr, "binary_fuse16_populate failed\n");
+    binary_fuse16_free(&filter);
+    free(queries);
+    return;
+  }
+  printf("binary_fuse16, %zu keys (%.1f MB), %zu queries, %s kernel\n", n,
+         (double)binary_fuse16_size_in_bytes(&filter) / (1024.0 * 1024.0), q,
+         binary_fuse_kernel_name(binary_fuse_kernel()));
+  binary_fuse_parallel_stats_t *stats =
+      (binary_fuse_parallel_stats_t *)malloc(sizeof(binary_fuse_parallel_stats_t));
+  for (size_t t = 1; t <= max_threads && stats != NULL; t *= 2) {
+    binary_fuse_pool_t pool;
+    if (!binary_fuse_pool_create(&pool, t)) {
+      break;
+    }
+    binary_fuse16_contain_parallel(&pool, queries, q, NULL, &filter, stats);
+    size_t min_keys = q, max_keys = 0;
+    for (size_t i = 0; i < stats->nthreads; i++) {
+      if (stats->thread_keys[i] < min_keys) min_keys = stats->thread_keys[i];
+      if (stats->thread_keys[i] > max_keys) max_keys = stats->thread_keys[i];
+    }
+    printf("%3zu threads %8.1f Mq/s %7.2f GB/s of cache lines  keys per thread %zu-%zu  found=%zu\n",
+           stats->nthreads, stats->keys_per_second / 1e6,
+           stats->keys_per_second * 3 * 64 / 1e9, min_keys, max_keys, stats->hits);
+    binary_fuse_pool_destroy(&pool);
+  }
+  free(stats);
+  binary_fuse16_free(&filter);
+  free(queries);
+}
+
+// A binary fuse map from n keys to 'bits'-bit values (as shard ids):
+// construction time, size, lookups one by one against the batched lookups, and
+// the rebuild with new values from the construction plan.
+static void run_map(size_t n, uint32_t bits) {
+  const size_t q = 4 * Q;
+  uint64_t *keys = (uint64_t *)malloc(sizeof(uint64_t) * n);
+  uint32_t *values = (uint32_t *)malloc(sizeof(uint32_t) * n);
+  uint64_t *queries = (uint64_t *)malloc(sizeof(uint64_t) * q);
+  uint32_t *out = (uint32_t *)malloc(sizeof(uint32_t) * q);
+  binary_fuse_map_t map;
+  if (keys == NULL || values == NULL || queries == NULL || out == NULL ||
+      !binary_fuse_map_allocate((uint32_t)n, bits, &map)) {
+    fprintf(stderr, "allocation failed\n");
+    free(keys);
+    free(values);
+    free(queries);
+    free(out);
+    return;
+  }
+  uint64_t rng = 1;
+  for (size_t i = 0; i < n; i++) {
+    keys[i] = binary_fuse_rng_splitmix64(&rng);
+    values[i] = (uint32_t)i;
+  }
+  for (size_t i = 0; i < q; i++) {
+    queries[i] = keys[binary_fuse_rng_splitmix64(&rng) % n];
+  }
+  binary_fuse_map_plan_t plan;
+  double t0 = time_seconds();
+  if (binary_fuse_map_populate_plan(keys, values, (uint32_t)n, &map, &plan)) {
+    double t1 = time_seconds();
+    uint32_t sum = 0;
+    for (size_t i = 0; i < q; i++) {
+      sum += binary_fuse_map_get(queries[i], &map);
+    }
+    double t2 = time_seconds();
+    binary_fuse_map_get_batch(queries, q, out, &map);
+    double t3 = time_seconds();
+    uint32_t batch_sum = 0;
+    for (size_t i = 0; i < q; i++) {
+      batch_sum += out[i];
+    }
+    printf("binary_fuse_map %zu keys, %u-bit values, %.2f bits per key, built in %.2f s\n", n,
+           bits, (double)binary_fuse_map_size_in_bytes(&map) * 8.0 / (double)n, t1 - t0);
+    printf("get       %7.2f ns/q  checksum=%u\n", (t2 - t1) * 1e9 / (double)q, sum);
+    printf("get_batch %7.2f ns/q  checksum=%u\n", (t3 - t2) * 1e9 / (double)q, batch_sum);
+    // new values for the same keys, from the construction plan
+    for (size_t i = 0; i < n; i++) {
+      values[i] = (uint32_t)(n - i);
+    }
+    double t4 = time_seconds();
+    binary_fuse_map_replay(&plan, keys, values, &map);
+    double t5 = time_seconds();
+    printf("replay    %7.2f s, plan of %.2f bytes per key\n", t5 - t4,
+           (double)binary_fuse_map_plan_size_in_bytes(&plan) / (double)n);
+    binary_fuse_map_plan_free(&plan);
+  }
+  binary_fuse_map_free(&map);
+  free(keys);
+  free(values);
+  free(queries);
+  free(out);
+}
+
+// A minimal perfect hash function over n keys: construction time, size, and
+// evaluations one by one against the batched evaluations.
+static void run_mphf(size_t n) {
+  const size_t q = 4 * Q;
+  uint64_t *keys = (uint64_t *)malloc(sizeof(uint64_t) * n);
+  uint64_t *queries = (uint64_t *)malloc(sizeof(uint64_t) * q);
+  uint32_t *out = (uint32_t *)malloc(sizeof(uint32_t) * q);
+  binary_fuse_mphf_t mphf;
+  if (keys == NULL || queries == NULL || out == NULL ||
+      !binary_fuse_mphf_allocate((uint32_t)n, &mphf)) {
+    fprintf(stderr, "allocation failed\n");
+    free(keys);
+    free(queries);
+    free(out);
+    return;
+  }
+  uint64_t rng = 1;
+  for (size_t i = 0; i < n; i++) {
+    keys[i] = binary_fuse_rng_splitmix64(&rng);
+  }
+  for (size_t i = 0; i < q; i++) {
+    queries[i] = keys[binary_fuse_rng_splitmix64(&rng) % n];
+  }
+  double t0 = time_seconds();
+  if (binary_fuse_mphf_populate(keys, (uint32_t)n, &mphf)) {
+    double t1 = time_seconds();
+    uint32_t sum = 0;
+    for (size_t i = 0; i < q; i++) {
+      sum += binary_fuse_mphf_get(queries[i], &mphf);
+    }
+    double t2 = time_seconds();
+    binary_fuse_mphf_get_batch(queries, q, out, &mphf);
+    double t3 = time_seconds();
+    uint32_t batch_sum = 0;
+    for (size_t i = 0; i < q; i++) {
+      batch_sum += out[i];
+    }
+    printf("binary_fuse_mphf %zu keys, %.2f bits per key, built in %.2f s\n", n,
+           (double)binary_fuse_mphf_size_in_bytes(&mphf) * 8.0 / (double)n, t1 - t0);
+    printf("get       %7.2f ns/q  checksum=%u\n", (t2 - t1) * 1e9 / (double)q, sum);
+    printf("get_batch %7.2f ns/q  checksum=%u\n", (t3 - t2) * 1e9 / (double)q, batch_sum);
+  }
+  binary_fuse_mphf_free(&mphf);
+  free(keys);
+  free(queries);
+  free(out);
+}
+
+// usage: ./query [max_keys]
+//        ./query kernel [n]
+//        ./query multi [levels]
+//        ./query select [n]
+//        ./query threads [n] [max_threads]
+//        ./query blocked [max_keys]
+//        ./query map [n] [bits]
+//        ./query mphf [n]
+// max_keys bounds the largest filter of the batched benchmark; use e.g.
+// 2000000000 to reach filters of several GB on a machine with enough memory.
+// The kernel mode only compares the batch query kernels, on filters with n
+// keys (default 4194304). The multi mode checks keys against a stack of
+// cache-resident filters (default 8 levels). The select mode compares the
+// selection vector queries with a branchy loop (default n is 1000000).
+// The threads mode reports the throughput of a 16-bit filter with n keys
+// (default 100000000) for 1, 2, 4... up to max_threads (default 16) threads.
+// The blocked mode compares the size and the query time of the blocked
+// filters with the binary fuse filters, up to max_keys keys (default 2^26).
+// The map mode builds a binary fuse map from n keys (default 10000000) to
+// values of 'bits' bits (default 12) and times its lookups and the replay of
+// its construction plan with new values. The mphf mode
+// does the same with a minimal perfect hash function over n keys.
+int main(int argc, char **argv) {
+  size_t max_keys = (size_t)1 << 26;
+  printf("key mixer: binary fuse %s, xor %s\n", binary_fuse_mixer_name(), xor_mixer_name());
+  if (argc > 1 && strcmp(argv[1], "kernel") == 0) {
+    size_t n = (size_t)1 << 22;
+    if (argc > 2) {
+      n = (size_t)strtoull(argv[2], NULL, 10);
+      if (n > UINT32_MAX) {
+        n = UINT32_MAX;
+      }
+    }
+    run_kernels(n);
+    return 0;
+  }
+  if (argc > 1 && strcmp(argv[1], "threads") == 0) {
+    size_t n = argc > 2 ? (size_t)strtoull(argv[2], NULL, 10) : 100000000;
+    size_t max_threads = argc > 3 ? (size_t)strtoull(argv[3], NULL, 10) : 16;
+    run_threads(n < UINT32_MAX ? n : UINT32_MAX, max_threads);
+    return 0;
+  }
+  if (argc > 1 && strcmp(argv[1], "select") == 0) {
+    size_t n = argc > 2 ? (size_t)strtoull(argv[2], NULL, 10) : 1000000;
+    run_select(n < UINT32_MAX ? n : UINT32_MAX);
+    return 0;
+  }
+  if (argc > 1 && strcmp(argv[1], "blocked") == 0) {
+    if (argc > 2) {
+      max_keys = (size_t)strtoull(argv[2], NULL, 10);
+      if (max_keys > UINT32_MAX) {
+        max_keys = UINT32_MAX;
+      }
+    }
+    run_blocked(max_keys);
+    return 0;
+  }
+  if (argc > 1 && strcmp(argv[1], "map") == 0) {
+    size_t n = argc > 2 ? (size_t)strtoull(argv[2], NULL, 10) : 10000000;
+    uint32_t bits = argc > 3 ? (uint32_t)strtoul(argv[3], NULL, 10) : 12;
+    run_map(n < UINT32_MAX ? n : UINT32_MAX, bits);
+    return 0;
+  }
+  if (argc > 1 && strcmp(argv[1], "mphf") == 0) {
+    size_t n = argc > 2 ? (size_t)strtoull(argv[2], NULL, 10) : 10000000;
+    run_mphf(n < UINT32_MAX ? n : UINT32_MAX);
+    return 0;
+  }
+  if (argc > 1 && strcmp(argv[1], "multi") == 0) {
+    size_t levels = argc > 2 ? (size_t)strtoull(argv[2], NULL, 10) : 8;
+    run_multi(levels, 10000);
+    return 0;
+  }
+  if (argc > 1) {
+    max_keys = (size_t)strtoull(argv[1], NULL, 10);
+    if (max_keys > UINT32_MAX) {
+      max_keys = UINT32_MAX;
+    }
+  }
   run_binaryfuse8();
   run_xor8();
   run_binaryfuse16();
   run_xor16();
+  run_batch_vs_scalar(max_keys);
   return 0;
 }
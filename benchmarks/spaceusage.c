@@ -8,6 +8,52 @@ typedef struct {
   size_t pack;
 } sizes;
 
+sizes fuse32(size_t n) {
+  binary_fuse32_t filter = {0};
+  if (! binary_fuse32_allocate(n, &filter)) {
+    printf("allocation failed\n");
+    return (sizes) {0, 0};
+  }
+  uint64_t* big_set = malloc(n * sizeof(uint64_t));
+  for(size_t i = 0; i < n; i++) {
+    big_set[i] = i;
+  }
+  bool is_ok = binary_fuse32_populate(big_set, n, &filter);
+  if(! is_ok ) {
+    printf("populating failed\n");
+  }
+  free(big_set);
+  sizes s = {
+    .standard = binary_fuse32_serialization_bytes(&filter),
+    .pack = binary_fuse32_pack_bytes(&filter)
+  };
+  binary_fuse32_free(&filter);
+  return s;
+}
+
+sizes xor32(size_t n) {
+  xor32_t filter = {0};
+  if (! xor32_allocate(n, &filter)) {
+    printf("allocation failed\n");
+    return (sizes) {0, 0};
+  }
+  uint64_t* big_set = malloc(n * sizeof(uint64_t));
+  for(size_t i = 0; i < n; i++) {
+    big_set[i] = i;
+  }
+  bool is_ok = xor32_populate(big_set, n, &filter);
+  if(! is_ok ) {
+    printf("populating failed\n");
+  }
+  free(big_set);
+  sizes s = {
+    .standard = xor32_serialization_bytes(&filter),
+    .pack = xor32_pack_bytes(&filter)
+  };
+  xor32_free(&filter);
+  return s;
+}
+
 sizes fuse16(size_t n) {
   binary_fuse16_t filter = {0};
   if (! binary_fuse16_allocate(n, &filter)) {
@@ -101,18 +147,136 @@ sizes xor8(size_t n) {
   return s;
 }
 
+// the blocked filters are not serialized, we report their in-memory size
+size_t fuse16_blocked(size_t n) {
+  binary_fuse16_blocked_t filter;
+  if (! binary_fuse16_blocked_allocate(n, &filter)) {
+    printf("allocation failed\n");
+    return 0;
+  }
+  uint64_t* big_set = malloc(n * sizeof(uint64_t));
+  for(size_t i = 0; i < n; i++) {
+    big_set[i] = i;
+  }
+  bool is_ok = binary_fuse16_blocked_populate(big_set, n, &filter);
+  if(! is_ok ) {
+    printf("populating failed\n");
+  }
+  free(big_set);
+  size_t s = binary_fuse16_blocked_size_in_bytes(&filter);
+  binary_fuse16_blocked_free(&filter);
+  return s;
+}
+
+size_t fuse8_blocked(size_t n) {
+  binary_fuse8_blocked_t filter;
+  if (! binary_fuse8_blocked_allocate(n, &filter)) {
+    printf("allocation failed\n");
+    return 0;
+  }
+  uint64_t* big_set = malloc(n * sizeof(uint64_t));
+  for(size_t i = 0; i < n; i++) {
+    big_set[i] = i;
+  }
+  bool is_ok = binary_fuse8_blocked_populate(big_set, n, &filter);
+  if(! is_ok ) {
+    printf("populating failed\n");
+  }
+  free(big_set);
+  size_t s = binary_fuse8_blocked_size_in_bytes(&filter);
+  binary_fuse8_blocked_free(&filter);
+  return s;
+}
+
+// the 4-wise filters are not serialized, we report their in-memory size
+size_t fuse16_4wise(size_t n) {
+  binary_fuse16_4wise_t filter;
+  if (! binary_fuse16_4wise_allocate(n, &filter)) {
+    printf("allocation failed\n");
+    return 0;
+  }
+  uint64_t* big_set = malloc(n * sizeof(uint64_t));
+  for(size_t i = 0; i < n; i++) {
+    big_set[i] = i;
+  }
+  bool is_ok = binary_fuse16_4wise_populate(big_set, n, &filter);
+  if(! is_ok ) {
+    printf("populating failed\n");
+  }
+  free(big_set);
+  size_t s = binary_fuse16_4wise_size_in_bytes(&filter);
+  binary_fuse16_4wise_free(&filter);
+  return s;
+}
+
+size_t fuse8_4wise(size_t n) {
+  binary_fuse8_4wise_t filter;
+  if (! binary_fuse8_4wise_allocate(n, &filter)) {
+    printf("allocation failed\n");
+    return 0;
+  }
+  uint64_t* big_set = malloc(n * sizeof(uint64_t));
+  for(size_t i = 0; i < n; i++) {
+    big_set[i] = i;
+  }
+  bool is_ok = binary_fuse8_4wise_populate(big_set, n, &filter);
+  if(! is_ok ) {
+    printf("populating failed\n");
+  }
+  free(big_set);
+  size_t s = binary_fuse8_4wise_size_in_bytes(&filter);
+  binary_fuse8_4wise_free(&filter);
+  return s;
+}
+
+// in-memory size of a filter with 12-bit fingerprints, the serialized one
+// differs only by the header
+size_t fuse12_bitpacked(size_t n) {
+  binary_fuse_bitpacked_t filter;
+  if (! binary_fuse_bitpacked_allocate(n, 12, &filter)) {
+    printf("allocation failed\n");
+    return 0;
+  }
+  uint64_t* big_set = malloc(n * sizeof(uint64_t));
+  for(size_t i = 0; i < n; i++) {
+    big_set[i] = i;
+  }
+  bool is_ok = binary_fuse_bitpacked_populate(big_set, n, &filter);
+  if(! is_ok ) {
+    printf("populating failed\n");
+  }
+  free(big_set);
+  size_t s = binary_fuse_bitpacked_size_in_bytes(&filter);
+  binary_fuse_bitpacked_free(&filter);
+  return s;
+}
+
 int main() {
     for (size_t n = 10; n <= 10000000; n *= 2) {
         printf("%-10zu ", n);  // Align number to 10 characters wide
+        sizes f32 = fuse32(n);
+        sizes x32 = xor32(n);
         sizes f16 = fuse16(n);
         sizes f8 = fuse8(n);
         sizes x16 = xor16(n);
         sizes x8 = xor8(n);
+        size_t b16 = fuse16_blocked(n);
+        size_t b8 = fuse8_blocked(n);
+        size_t w16 = fuse16_4wise(n);
+        size_t w8 = fuse8_4wise(n);
+        size_t p12 = fuse12_bitpacked(n);
         
+        printf("fuse32: %5.2f %5.2f   ", (double)f32.standard * 8.0 / n, (double)f32.pack * 8.0 / n);
+        printf("xor32: %5.2f %5.2f   ", (double)x32.standard * 8.0 / n, (double)x32.pack * 8.0 / n);
         printf("fuse16: %5.2f %5.2f   ", (double)f16.standard * 8.0 / n, (double)f16.pack * 8.0 / n);
         printf("fuse8: %5.2f %5.2f   ", (double)f8.standard  * 8.0 / n, (double)f8.pack  * 8.0 / n);
         printf("xor16: %5.2f %5.2f   ", (double)x16.standard  * 8.0 / n, (double)x16.pack  * 8.0 / n);
         printf("xor8: %5.2f %5.2f   ", (double)x8.standard  * 8.0 / n, (double)x8.pack  * 8.0 / n);
+        printf("fuse16 blocked: %5.2f   ", (double)b16 * 8.0 / n);
+        printf("fuse8 blocked: %5.2f   ", (double)b8 * 8.0 / n);
+        printf("fuse16 4-wise: %5.2f   ", (double)w16 * 8.0 / n);
+        printf("fuse8 4-wise: %5.2f   ", (double)w8 * 8.0 / n);
+        printf("fuse12 bit-packed: %5.2f   ", (double)p12 * 8.0 / n);
         printf("\n");
     }
     return EXIT_SUCCESS;
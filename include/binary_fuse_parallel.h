@@ -0,0 +1,1542 @@
+#ifndef BINARY_FUSE_PARALLEL_H
+#define BINARY_FUSE_PARALLEL_H
+#include "binaryfusefilter.h"
+#include "xorfilter.h"
+#include <pthread.h>
+#include <sys/time.h>
+#include <time.h>
+
+/**
+ * Optional companion to binaryfusefilter.h and xorfilter.h: a small pool of
+ * POSIX threads, multithreaded versions of the batch queries, for very large
+ * key batches, multithreaded constructions, and sets split into shards built
+ * by different threads.
+ * Link with -pthread.
+ */
+
+#ifndef BINARY_FUSE_MAX_THREADS
+#define BINARY_FUSE_MAX_THREADS 256
+#endif
+
+#ifndef BINARY_FUSE_PARALLEL_CHUNK
+// number of keys per unit of work: the workers claim chunks in order until the
+// batch is exhausted. A multiple of 4096 so that the keys and the answers of a
+// chunk span whole pages, which each worker then touches alone.
+#define BINARY_FUSE_PARALLEL_CHUNK 65536
+#endif
+
+// A task runs once on every thread of the pool, 'thread' is in [0, nthreads).
+typedef void (*binary_fuse_task_t)(void *arg, size_t thread);
+
+struct binary_fuse_pool_s;
+
+typedef struct binary_fuse_worker_s {
+  struct binary_fuse_pool_s *pool;
+  size_t index;
+} binary_fuse_worker_t;
+
+typedef struct binary_fuse_pool_s {
+  size_t nthreads; // including the thread calling binary_fuse_pool_run
+  pthread_t *threads;
+  binary_fuse_worker_t *workers;
+  pthread_mutex_t lock;
+  pthread_cond_t start; // a task was posted, or the pool is shutting down
+  pthread_cond_t done;  // the last worker finished the task
+  binary_fuse_task_t task;
+  void *arg;
+  uint64_t generation; // incremented for each task
+  size_t running;      // workers still busy with the current task
+  bool stop;
+} binary_fuse_pool_t;
+
+static inline void *binary_fuse_pool_main(void *arg) {
+  binary_fuse_worker_t *worker = (binary_fuse_worker_t *)arg;
+  binary_fuse_pool_t *pool = worker->pool;
+  // the generation is 0 when the pool starts: a task may be posted before
+  // this thread gets to run
+  uint64_t seen = 0;
+  pthread_mutex_lock(&pool->lock);
+  for (;;) {
+    while (!pool->stop && pool->generation == seen) {
+      pthread_cond_wait(&pool->start, &pool->lock);
+    }
+    if (pool->stop) {
+      break;
+    }
+    seen = pool->generation;
+    binary_fuse_task_t task = pool->task;
+    void *task_arg = pool->arg;
+    pthread_mutex_unlock(&pool->lock);
+    task(task_arg, worker->index);
+    pthread_mutex_lock(&pool->lock);
+    if (--pool->running == 0) {
+      pthread_cond_signal(&pool->done);
+    }
+  }
+  pthread_mutex_unlock(&pool->lock);
+  return NULL;
+}
+
+// Start a pool of 'nthreads' threads (at most BINARY_FUSE_MAX_THREADS), the
+// calling thread counting as one of them. Returns false on failure.
+// The caller is responsible for calling binary_fuse_pool_destroy(pool).
+static inline bool binary_fuse_pool_create(binary_fuse_pool_t *pool, size_t nthreads) {
+  if (nthreads == 0) {
+    nthreads = 1;
+  }
+  if (nthreads > BINARY_FUSE_MAX_THREADS) {
+    nthreads = BINARY_FUSE_MAX_THREADS;
+  }
+  memset(pool, 0, sizeof(*pool));
+  pool->nthreads = nthreads;
+  pool->threads = (pthread_t *)malloc(nthreads * sizeof(pthread_t));
+  pool->workers = (binary_fuse_worker_t *)malloc(nthreads * sizeof(binary_fuse_worker_t));
+  if (pool->threads == NULL || pool->workers == NULL) {
+    free(pool->threads);
+    free(pool->workers);
+    return false;
+  }
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_cond_init(&pool->start, NULL);
+  pthread_cond_init(&pool->done, NULL);
+  for (size_t i = 1; i < nthreads; i++) {
+    pool->workers[i].pool = pool;
+    pool->workers[i].index = i;
+    if (pthread_create(&pool->threads[i], NULL, binary_fuse_pool_main, &pool->workers[i]) != 0) {
+      // run with the threads we have
+      pool->nthreads = i;
+      break;
+    }
+  }
+  return true;
+}
+
+// Stop the threads and release the memory.
+static inline void binary_fuse_pool_destroy(binary_fuse_pool_t *pool) {
+  pthread_mutex_lock(&pool->lock);
+  pool->stop = true;
+  pthread_cond_broadcast(&pool->start);
+  pthread_mutex_unlock(&pool->lock);
+  for (size_t i = 1; i < pool->nthreads; i++) {
+    pthread_join(pool->threads[i], NULL);
+  }
+  pthread_cond_destroy(&pool->done);
+  pthread_cond_destroy(&pool->start);
+  pthread_mutex_destroy(&pool->lock);
+  free(pool->threads);
+  free(pool->workers);
+  pool->threads = NULL;
+  pool->workers = NULL;
+  pool->nthreads = 0;
+}
+
+// Run task(arg, thread) on every thread of the pool and wait for all of them.
+static inline void binary_fuse_pool_run(binary_fuse_pool_t *pool, binary_fuse_task_t task,
+                                        void *arg) {
+  if (pool->nthreads <= 1) {
+    task(arg, 0);
+    return;
+  }
+  pthread_mutex_lock(&pool->lock);
+  pool->task = task;
+  pool->arg = arg;
+  pool->running = pool->nthreads - 1;
+  pool->generation++;
+  pthread_cond_broadcast(&pool->start);
+  pthread_mutex_unlock(&pool->lock);
+  task(arg, 0);
+  pthread_mutex_lock(&pool->lock);
+  while (pool->running > 0) {
+    pthread_cond_wait(&pool->done, &pool->lock);
+  }
+  pthread_mutex_unlock(&pool->lock);
+}
+
+// Atomically add 'step' to *counter and return its previous value.
+static inline size_t binary_fuse_pool_claim(binary_fuse_pool_t *pool, size_t *counter,
+                                            size_t step) {
+#if defined(__GNUC__) || defined(__clang__)
+  (void)pool;
+  return __atomic_fetch_add(counter, step, __ATOMIC_RELAXED);
+#else
+  pthread_mutex_lock(&pool->lock);
+  size_t claimed = *counter;
+  *counter += step;
+  pthread_mutex_unlock(&pool->lock);
+  return claimed;
+#endif
+}
+
+static inline double binary_fuse_wall_seconds(void) {
+#if defined(CLOCK_MONOTONIC)
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+#else
+  // CLOCK_MONOTONIC needs POSIX features that -std=c99 hides, clock() would
+  // add up the time of all the threads
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return (double)tv.tv_sec + (double)tv.tv_usec * 1e-6;
+#endif
+}
+
+// Statistics of a multithreaded query.
+typedef struct binary_fuse_parallel_stats_s {
+  size_t nthreads;
+  size_t hits; // keys found
+  size_t thread_hits[BINARY_FUSE_MAX_THREADS];
+  size_t thread_keys[BINARY_FUSE_MAX_THREADS]; // keys queried by each thread
+  double seconds;                               // wall-clock time
+  double keys_per_second;
+} binary_fuse_parallel_stats_t;
+
+typedef struct binary_fuse_parallel_job_s {
+  binary_fuse_pool_t *pool;
+  const uint64_t *keys;
+  size_t count;
+  bool *out;
+  const void *filter;
+  size_t next; // first key of the next unclaimed chunk
+  size_t thread_hits[BINARY_FUSE_MAX_THREADS];
+  size_t thread_keys[BINARY_FUSE_MAX_THREADS];
+} binary_fuse_parallel_job_t;
+
+static inline void binary_fuse8_contain_parallel_task(void *arg, size_t thread) {
+  binary_fuse_parallel_job_t *job = (binary_fuse_parallel_job_t *)arg;
+  const binary_fuse8_t *filter = (const binary_fuse8_t *)job->filter;
+  uint64_t bitmap[BINARY_FUSE_PARALLEL_CHUNK / 64];
+  size_t hits = 0, keys = 0;
+  for (;;) {
+    size_t start = binary_fuse_pool_claim(job->pool, &job->next, BINARY_FUSE_PARALLEL_CHUNK);
+    if (start >= job->count) {
+      break;
+    }
+    size_t m = job->count - start < BINARY_FUSE_PARALLEL_CHUNK ? job->count - start
+                                                             : BINARY_FUSE_PARALLEL_CHUNK;
+    if (job->out == NULL) {
+      hits += binary_fuse8_contain_bitmap(job->keys + start, m, bitmap, filter);
+    } else {
+      binary_fuse8_contain_batch(job->keys + start, m, job->out + start, filter);
+      for (size_t i = 0; i < m; i++) {
+        hits += job->out[start + i];
+      }
+    }
+    keys += m;
+  }
+  job->thread_hits[thread] = hits;
+  job->thread_keys[thread] = keys;
+}
+
+static inline void binary_fuse16_contain_parallel_task(void *arg, size_t thread) {
+  binary_fuse_parallel_job_t *job = (binary_fuse_parallel_job_t *)arg;
+  const binary_fuse16_t *filter = (const binary_fuse16_t *)job->filter;
+  uint64_t bitmap[BINARY_FUSE_PARALLEL_CHUNK / 64];
+  size_t hits = 0, keys = 0;
+  for (;;) {
+    size_t start = binary_fuse_pool_claim(job->pool, &job->next, BINARY_FUSE_PARALLEL_CHUNK);
+    if (start >= job->count) {
+      break;
+    }
+    size_t m = job->count - start < BINARY_FUSE_PARALLEL_CHUNK ? job->count - start
+                                                             : BINARY_FUSE_PARALLEL_CHUNK;
+    if (job->out == NULL) {
+      hits += binary_fuse16_contain_bitmap(job->keys + start, m, bitmap, filter);
+    } else {
+      binary_fuse16_contain_batch(job->keys + start, m, job->out + start, filter);
+      for (size_t i = 0; i < m; i++) {
+        hits += job->out[start + i];
+      }
+    }
+    keys += m;
+  }
+  job->thread_hits[thread] = hits;
+  job->thread_keys[thread] = keys;
+}
+
+// Run the job on the pool and fill the optional statistics.
+static inline size_t binary_fuse_parallel_run(binary_fuse_pool_t *pool, binary_fuse_task_t task,
+                                              binary_fuse_parallel_job_t *job,
+                                              binary_fuse_parallel_stats_t *stats) {
+  double t0 = binary_fuse_wall_seconds();
+  binary_fuse_pool_run(pool, task, job);
+  double seconds = binary_fuse_wall_seconds() - t0;
+  size_t hits = 0;
+  for (size_t i = 0; i < pool->nthreads; i++) {
+    hits += job->thread_hits[i];
+  }
+  if (stats != NULL) {
+    memset(stats, 0, sizeof(*stats));
+    stats->nthreads = pool->nthreads;
+    stats->hits = hits;
+    memcpy(stats->thread_hits, job->thread_hits, pool->nthreads * sizeof(size_t));
+    memcpy(stats->thread_keys, job->thread_keys, pool->nthreads * sizeof(size_t));
+    stats->seconds = seconds;
+    stats->keys_per_second = seconds > 0 ? (double)job->count / seconds : 0;
+  }
+  return hits;
+}
+
+// Report, for each of the 'count' keys, if it is in the set, with false
+// positive rate, using all the threads of the pool. The answer for keys[i] is
+// written to out[i]; when out is NULL, the keys are only counted. Returns the
+// number of keys found. When stats is not NULL, it receives the hits and the
+// number of keys of each thread, and the throughput.
+static inline size_t binary_fuse8_contain_parallel(binary_fuse_pool_t *pool, const uint64_t *keys,
+                                                   size_t count, bool *out,
+                                                   const binary_fuse8_t *filter,
+                                                   binary_fuse_parallel_stats_t *stats) {
+  binary_fuse_parallel_job_t job;
+  memset(&job, 0, sizeof(job));
+  job.pool = pool;
+  job.keys = keys;
+  job.count = count;
+  job.out = out;
+  job.filter = filter;
+  return binary_fuse_parallel_run(pool, binary_fuse8_contain_parallel_task, &job, stats);
+}
+
+// See binary_fuse8_contain_parallel.
+static inline size_t binary_fuse16_contain_parallel(binary_fuse_pool_t *pool, const uint64_t *keys,
+                                                    size_t count, bool *out,
+                                                    const binary_fuse16_t *filter,
+                                                    binary_fuse_parallel_stats_t *stats) {
+  binary_fuse_parallel_job_t job;
+  memset(&job, 0, sizeof(job));
+  job.pool = pool;
+  job.keys = keys;
+  job.count = count;
+  job.out = out;
+  job.filter = filter;
+  return binary_fuse_parallel_run(pool, binary_fuse16_contain_parallel_task, &job, stats);
+}
+
+//////////////////
+// multithreaded construction
+//////////////////
+
+// State of binary_fuse8_populate_parallel and binary_fuse16_populate_parallel.
+// The hashes are sorted by the segment of their first location, so that keys
+// whose segments are at least two apart touch distinct cells and can be added
+// by different threads. The peeling then starts from both ends of the array at
+// once, each half on its own thread, and a serial pass peels what is left near
+// the middle.
+typedef struct binary_fuse_build_s {
+  binary_fuse_pool_t *pool;
+  const uint64_t *keys;
+  uint32_t size;
+  binary_fuse32_t geometry; // the fingerprints are not used
+  uint32_t middle;          // the right half starts there, a segment boundary
+  uint32_t *counts;         // hashes per (thread, segment), then their offsets
+  uint32_t *segment_start;  // first hash of each segment in reverseOrder
+  uint64_t *reverseOrder;
+  uint8_t *reverseH;
+  uint8_t *t2count;
+  uint64_t *t2hash;
+  uint32_t *alone;
+  uint32_t stripe;  // segments added by one thread at a time
+  uint32_t stripes;
+  uint32_t parity;  // the current step adds the stripes parity, parity + 2...
+  size_t next;      // next unclaimed stripe
+  uint32_t side_size[2]; // keys peeled from the left end and from the right end
+  uint32_t singletons[BINARY_FUSE_MAX_THREADS]; // in each part of the array
+  int error[BINARY_FUSE_MAX_THREADS];
+  void *filter;
+} binary_fuse_build_t;
+
+// [*begin, *end) is the share of [0, n) of the given thread.
+static inline void binary_fuse_build_range(uint32_t n, size_t thread, size_t nthreads,
+                                           uint32_t *begin, uint32_t *end) {
+  *begin = (uint32_t)((uint64_t)n * thread / nthreads);
+  *end = (uint32_t)((uint64_t)n * (thread + 1) / nthreads);
+}
+
+static inline uint32_t binary_fuse_build_segment(const binary_fuse_build_t *b, uint64_t hash) {
+  return (uint32_t)binary_fuse_mulhi(hash, b->geometry.SegmentCount);
+}
+
+// Count the hashes of each segment, over a contiguous range of keys.
+static inline void binary_fuse_build_count_task(void *arg, size_t thread) {
+  binary_fuse_build_t *b = (binary_fuse_build_t *)arg;
+  uint32_t begin, end;
+  binary_fuse_build_range(b->size, thread, b->pool->nthreads, &begin, &end);
+  uint32_t *counts = b->counts + thread * b->geometry.SegmentCount;
+  uint64_t hashes[BINARY_FUSE_HASH_BLOCK];
+  for (uint32_t start = begin; start < end; start += BINARY_FUSE_HASH_BLOCK) {
+    uint32_t n = end - start < BINARY_FUSE_HASH_BLOCK ? end - start : BINARY_FUSE_HASH_BLOCK;
+    binary_fuse_hash_keys(b->keys + start, n, b->geometry.Seed, hashes);
+    for (uint32_t i = 0; i < n; i++) {
+      counts[binary_fuse_build_segment(b, hashes[i])]++;
+    }
+  }
+}
+
+// Hash the same keys again and write them at their offsets: within a segment,
+// the hashes keep the order of the keys whatever the number of threads.
+static inline void binary_fuse_build_scatter_task(void *arg, size_t thread) {
+  binary_fuse_build_t *b = (binary_fuse_build_t *)arg;
+  uint32_t begin, end;
+  binary_fuse_build_range(b->size, thread, b->pool->nthreads, &begin, &end);
+  uint32_t *offsets = b->counts + thread * b->geometry.SegmentCount;
+  uint64_t hashes[BINARY_FUSE_HASH_BLOCK];
+  for (uint32_t start = begin; start < end; start += BINARY_FUSE_HASH_BLOCK) {
+    uint32_t n = end - start < BINARY_FUSE_HASH_BLOCK ? end - start : BINARY_FUSE_HASH_BLOCK;
+    binary_fuse_hash_keys(b->keys + start, n, b->geometry.Seed, hashes);
+    for (uint32_t i = 0; i < n; i++) {
+      b->reverseOrder[offsets[binary_fuse_build_segment(b, hashes[i])]++] = hashes[i];
+    }
+  }
+}
+
+// Add the hashes of every other stripe to t2count and t2hash. A key of the
+// segment s touches the segments s, s + 1 and s + 2, so two stripes of at
+// least two segments with a stripe between them share no cell. The sums do
+// not depend on the order of the additions.
+static inline void binary_fuse_build_add_task(void *arg, size_t thread) {
+  binary_fuse_build_t *b = (binary_fuse_build_t *)arg;
+  const binary_fuse32_t *geometry = &b->geometry;
+  uint8_t *t2count = b->t2count;
+  uint64_t *t2hash = b->t2hash;
+  int error = 0;
+  for (;;) {
+    size_t stripe = 2 * binary_fuse_pool_claim(b->pool, &b->next, 1) + b->parity;
+    if (stripe >= b->stripes) {
+      break;
+    }
+    uint32_t first = (uint32_t)stripe * b->stripe;
+    uint32_t last = first + b->stripe < geometry->SegmentCount ? first + b->stripe
+                                                               : geometry->SegmentCount;
+    for (uint32_t i = b->segment_start[first]; i < b->segment_start[last]; i++) {
+      uint64_t hash = b->reverseOrder[i];
+      uint32_t h0 = binary_fuse32_hash(0, hash, geometry);
+      t2count[h0] += 4;
+      t2hash[h0] ^= hash;
+      uint32_t h1 = binary_fuse32_hash(1, hash, geometry);
+      t2count[h1] += 4;
+      t2count[h1] ^= 1U;
+      t2hash[h1] ^= hash;
+      uint32_t h2 = binary_fuse32_hash(2, hash, geometry);
+      t2count[h2] += 4;
+      t2hash[h2] ^= hash;
+      t2count[h2] ^= 2U;
+      error = (t2count[h0] < 4) ? 1 : error;
+      error = (t2count[h1] < 4) ? 1 : error;
+      error = (t2count[h2] < 4) ? 1 : error;
+    }
+  }
+  b->error[thread] |= error;
+}
+
+// Peel from the singleton cells alone[0, queued), keeping only the keys whose
+// three cells are in [low, high). The peeled keys go to reverseOrder from
+// 'first' upward, or downward when 'descending'. Returns their number.
+static inline uint32_t binary_fuse_build_peel(binary_fuse_build_t *b, uint32_t *alone,
+                                              uint32_t queued, uint32_t low, uint32_t high,
+                                              uint32_t first, bool descending) {
+  const binary_fuse32_t *geometry = &b->geometry;
+  uint8_t *t2count = b->t2count;
+  uint64_t *t2hash = b->t2hash;
+  uint32_t Qsize = queued;
+  uint32_t stacksize = 0;
+  uint32_t h012[5];
+  while (Qsize > 0) {
+    Qsize--;
+    uint32_t index = alone[Qsize];
+    if ((t2count[index] >> 2U) == 1) {
+      uint64_t hash = t2hash[index];
+      h012[0] = binary_fuse32_hash(0, hash, geometry);
+      h012[2] = binary_fuse32_hash(2, hash, geometry);
+      // the first cell is the lowest, the last one the highest
+      if (h012[0] < low || h012[2] >= high) {
+        continue;
+      }
+      h012[1] = binary_fuse32_hash(1, hash, geometry);
+      h012[3] = h012[0];
+      h012[4] = h012[1];
+      uint8_t found = t2count[index] & 3U;
+      // empty the cell, or the serial pass would find the key there again
+      t2count[index] = 0;
+      t2hash[index] = 0;
+      uint32_t position = descending ? first - stacksize : first + stacksize;
+      b->reverseH[position] = found;
+      b->reverseOrder[position] = hash;
+      stacksize++;
+      uint32_t other_index1 = h012[found + 1];
+      alone[Qsize] = other_index1;
+      Qsize += ((t2count[other_index1] >> 2U) == 2 ? 1U : 0U);
+      t2count[other_index1] -= 4;
+      t2count[other_index1] ^= binary_fuse_mod3(found + 1);
+      t2hash[other_index1] ^= hash;
+
+      uint32_t other_index2 = h012[found + 2];
+      alone[Qsize] = other_index2;
+      Qsize += ((t2count[other_index2] >> 2U) == 2 ? 1U : 0U);
+      t2count[other_index2] -= 4;
+      t2count[other_index2] ^= binary_fuse_mod3(found + 2);
+      t2hash[other_index2] ^= hash;
+    }
+  }
+  return stacksize;
+}
+
+// Thread 0 peels the left half from the start of the array and stacks the keys
+// at the start of reverseOrder, thread 1 the right half from the end of the
+// array, stacking from the end. The halves share no cell: each side skips the
+// keys that reach into the other one, and has its own part of 'alone'.
+static inline void binary_fuse_build_peel_task(void *arg, size_t thread) {
+  binary_fuse_build_t *b = (binary_fuse_build_t *)arg;
+  for (size_t side = thread; side < 2; side += b->pool->nthreads) {
+    uint32_t low = side == 0 ? 0 : b->middle;
+    uint32_t high = side == 0 ? b->middle : b->geometry.ArrayLength;
+    // one more entry than cells: the queue may write one past its end
+    uint32_t *alone = b->alone + (side == 0 ? 0 : b->middle + 1);
+    uint32_t Qsize = 0;
+    for (uint32_t i = low; i < high; i++) {
+      alone[Qsize] = i;
+      Qsize += ((b->t2count[i] >> 2U) == 1) ? 1U : 0U;
+    }
+    b->side_size[side] = side == 0 ? binary_fuse_build_peel(b, alone, Qsize, low, high, 0, false)
+                                   : binary_fuse_build_peel(b, alone, Qsize, low, high,
+                                                            b->size - 1, true);
+  }
+}
+
+// Count, then list, the singleton cells of a range of the array.
+static inline void binary_fuse_build_count_singletons_task(void *arg, size_t thread) {
+  binary_fuse_build_t *b = (binary_fuse_build_t *)arg;
+  uint32_t begin, end, count = 0;
+  binary_fuse_build_range(b->geometry.ArrayLength, thread, b->pool->nthreads, &begin, &end);
+  for (uint32_t i = begin; i < end; i++) {
+    count += ((b->t2count[i] >> 2U) == 1) ? 1U : 0U;
+  }
+  b->singletons[thread] = count;
+}
+
+static inline void binary_fuse_build_list_singletons_task(void *arg, size_t thread) {
+  binary_fuse_build_t *b = (binary_fuse_build_t *)arg;
+  uint32_t begin, end;
+  binary_fuse_build_range(b->geometry.ArrayLength, thread, b->pool->nthreads, &begin, &end);
+  uint32_t *alone = b->alone + b->singletons[thread];
+  uint32_t Qsize = 0;
+  for (uint32_t i = begin; i < end; i++) {
+    if ((b->t2count[i] >> 2U) == 1) {
+      alone[Qsize++] = i;
+    }
+  }
+}
+
+static inline void binary_fuse_build_free(binary_fuse_build_t *b) {
+  free(b->counts);
+  free(b->segment_start);
+  free(b->reverseOrder);
+  free(b->reverseH);
+  free(b->t2count);
+  free(b->t2hash);
+  free(b->alone);
+  free(b);
+}
+
+// Allocate the state for 'size' keys and the geometry of a filter.
+static inline binary_fuse_build_t *binary_fuse_build_create(binary_fuse_pool_t *pool,
+                                                            uint32_t size,
+                                                            const binary_fuse32_t *geometry) {
+  binary_fuse_build_t *b = (binary_fuse_build_t *)calloc(1, sizeof(binary_fuse_build_t));
+  if (b == NULL) {
+    return NULL;
+  }
+  b->pool = pool;
+  b->size = size;
+  b->geometry = *geometry;
+  b->geometry.Fingerprints = NULL;
+  uint32_t capacity = geometry->ArrayLength;
+  uint32_t segments = geometry->SegmentCount;
+  b->middle = (segments + 2) / 2 * geometry->SegmentLength;
+  b->counts = (uint32_t *)malloc(pool->nthreads * segments * sizeof(uint32_t));
+  b->segment_start = (uint32_t *)malloc((segments + 1) * sizeof(uint32_t));
+  b->reverseOrder = (uint64_t *)malloc((size + 1) * sizeof(uint64_t));
+  b->reverseH = (uint8_t *)malloc((size + 1) * sizeof(uint8_t));
+  b->t2count = (uint8_t *)calloc(capacity, sizeof(uint8_t));
+  b->t2hash = (uint64_t *)calloc(capacity, sizeof(uint64_t));
+  b->alone = (uint32_t *)malloc((capacity + 2) * sizeof(uint32_t));
+  if ((b->counts == NULL) || (b->segment_start == NULL) || (b->reverseOrder == NULL) ||
+      (b->reverseH == NULL) || (b->t2count == NULL) || (b->t2hash == NULL) ||
+      (b->alone == NULL)) {
+    binary_fuse_build_free(b);
+    return NULL;
+  }
+  // many stripes for each thread, so that they finish together
+  uint32_t target = (uint32_t)(8 * pool->nthreads);
+  b->stripe = pool->nthreads == 1 ? segments : (segments + target - 1) / target;
+  if (b->stripe < 2) {
+    b->stripe = 2;
+  }
+  b->stripes = (segments + b->stripe - 1) / b->stripe;
+  return b;
+}
+
+// Find a seed for which all the keys peel, leaving the keys in reverseOrder:
+// the left side in [0, side_size[0]), then the keys peeled by the serial pass,
+// then the right side in [size - side_size[1], size). Returns false on failure.
+static inline bool binary_fuse_build_run(binary_fuse_build_t *b, uint64_t *keys) {
+  binary_fuse_pool_t *pool = b->pool;
+  uint32_t segments = b->geometry.SegmentCount;
+  uint32_t capacity = b->geometry.ArrayLength;
+  bool deduplicated = false;
+  uint64_t rng_counter = 0x726b2b9d438b9d4d;
+  b->geometry.Seed = binary_fuse_rng_splitmix64(&rng_counter);
+  for (int loop = 0; true; ++loop) {
+    if (loop + 1 > XOR_MAX_ITERATIONS) {
+      // The probability of this happening is lower than the
+      // the cosmic-ray probability (i.e., a cosmic ray corrupts your system).
+      return false;
+    }
+    b->keys = keys;
+    memset(b->counts, 0, pool->nthreads * segments * sizeof(uint32_t));
+    binary_fuse_pool_run(pool, binary_fuse_build_count_task, b);
+    uint32_t offset = 0;
+    for (uint32_t s = 0; s < segments; s++) {
+      b->segment_start[s] = offset;
+      for (size_t t = 0; t < pool->nthreads; t++) {
+        uint32_t count = b->counts[t * segments + s];
+        b->counts[t * segments + s] = offset;
+        offset += count;
+      }
+    }
+    b->segment_start[segments] = offset;
+    binary_fuse_pool_run(pool, binary_fuse_build_scatter_task, b);
+
+    memset(b->error, 0, sizeof(b->error));
+    for (b->parity = 0; b->parity < 2; b->parity++) {
+      b->next = 0;
+      binary_fuse_pool_run(pool, binary_fuse_build_add_task, b);
+    }
+    int error = 0;
+    for (size_t t = 0; t < pool->nthreads; t++) {
+      error |= b->error[t];
+    }
+    if (!error) {
+      binary_fuse_pool_run(pool, binary_fuse_build_peel_task, b);
+      binary_fuse_pool_run(pool, binary_fuse_build_count_singletons_task, b);
+      uint32_t queued = 0;
+      for (size_t t = 0; t < pool->nthreads; t++) {
+        uint32_t count = b->singletons[t];
+        b->singletons[t] = queued;
+        queued += count;
+      }
+      binary_fuse_pool_run(pool, binary_fuse_build_list_singletons_task, b);
+      uint32_t peeled = binary_fuse_build_peel(b, b->alone, queued, 0, capacity,
+                                               b->side_size[0], false);
+      if (b->side_size[0] + peeled + b->side_size[1] == b->size) {
+        return true;
+      }
+    }
+    // The duplicated keys never peel (and many copies of a key can overflow a
+    // counter): remove them once.
+    if (!deduplicated && b->size > 1) {
+      b->size = (uint32_t)binary_fuse_sort_and_remove_dup(keys, b->size);
+      deduplicated = true;
+    }
+    memset(b->t2count, 0, sizeof(uint8_t) * capacity);
+    memset(b->t2hash, 0, sizeof(uint64_t) * capacity);
+    b->geometry.Seed = binary_fuse_rng_splitmix64(&rng_counter);
+  }
+}
+
+static inline void binary_fuse8_build_assign(const binary_fuse_build_t *b, uint32_t i) {
+  binary_fuse8_t *filter = (binary_fuse8_t *)b->filter;
+  uint64_t hash = b->reverseOrder[i];
+  uint8_t found = b->reverseH[i];
+  uint32_t h012[5];
+  h012[0] = binary_fuse32_hash(0, hash, &b->geometry);
+  h012[1] = binary_fuse32_hash(1, hash, &b->geometry);
+  h012[2] = binary_fuse32_hash(2, hash, &b->geometry);
+  h012[3] = h012[0];
+  h012[4] = h012[1];
+  filter->Fingerprints[h012[found]] = (uint8_t)(
+      (uint32_t)binary_fuse8_fingerprint(hash) ^
+      (uint32_t)filter->Fingerprints[h012[found + 1]] ^
+      (uint32_t)filter->Fingerprints[h012[found + 2]]);
+}
+
+static inline void binary_fuse16_build_assign(const binary_fuse_build_t *b, uint32_t i) {
+  binary_fuse16_t *filter = (binary_fuse16_t *)b->filter;
+  uint64_t hash = b->reverseOrder[i];
+  uint8_t found = b->reverseH[i];
+  uint32_t h012[5];
+  h012[0] = binary_fuse32_hash(0, hash, &b->geometry);
+  h012[1] = binary_fuse32_hash(1, hash, &b->geometry);
+  h012[2] = binary_fuse32_hash(2, hash, &b->geometry);
+  h012[3] = h012[0];
+  h012[4] = h012[1];
+  filter->Fingerprints[h012[found]] = (uint16_t)(
+      (uint32_t)binary_fuse16_fingerprint(hash) ^
+      (uint32_t)filter->Fingerprints[h012[found + 1]] ^
+      (uint32_t)filter->Fingerprints[h012[found + 2]]);
+}
+
+// The two sides are assigned last (they were peeled first), each in the
+// reverse of its peeling order; they share no cell.
+static inline void binary_fuse8_build_assign_task(void *arg, size_t thread) {
+  const binary_fuse_build_t *b = (const binary_fuse_build_t *)arg;
+  for (size_t side = thread; side < 2; side += b->pool->nthreads) {
+    if (side == 0) {
+      for (uint32_t i = b->side_size[0]; i-- > 0;) {
+        binary_fuse8_build_assign(b, i);
+      }
+    } else {
+      for (uint32_t i = b->size - b->side_size[1]; i < b->size; i++) {
+        binary_fuse8_build_assign(b, i);
+      }
+    }
+  }
+}
+
+static inline void binary_fuse16_build_assign_task(void *arg, size_t thread) {
+  const binary_fuse_build_t *b = (const binary_fuse_build_t *)arg;
+  for (size_t side = thread; side < 2; side += b->pool->nthreads) {
+    if (side == 0) {
+      for (uint32_t i = b->side_size[0]; i-- > 0;) {
+        binary_fuse16_build_assign(b, i);
+      }
+    } else {
+      for (uint32_t i = b->size - b->side_size[1]; i < b->size; i++) {
+        binary_fuse16_build_assign(b, i);
+      }
+    }
+  }
+}
+
+// Construct the filter with 'nthreads' threads (at most
+// BINARY_FUSE_MAX_THREADS), returns true on success, false on failure.
+// The caller is responsable for calling binary_fuse8_allocate(size,filter)
+// before. The filter does not depend on the number of threads, but it is not
+// the one built by binary_fuse8_populate: the keys are peeled in another order.
+// Duplicated keys cost a failed attempt and a sort of the keys.
+static inline bool binary_fuse8_populate_parallel(uint64_t *keys, uint32_t size,
+                                                  binary_fuse8_t *filter, size_t nthreads) {
+  if (size != filter->Size) {
+    return false;
+  }
+  binary_fuse32_t geometry = {0};
+  geometry.Size = filter->Size;
+  geometry.SegmentLength = filter->SegmentLength;
+  geometry.SegmentLengthMask = filter->SegmentLengthMask;
+  geometry.SegmentCount = filter->SegmentCount;
+  geometry.SegmentCountLength = filter->SegmentCountLength;
+  geometry.ArrayLength = filter->ArrayLength;
+  binary_fuse_pool_t pool;
+  if (!binary_fuse_pool_create(&pool, nthreads)) {
+    return false;
+  }
+  binary_fuse_build_t *b = binary_fuse_build_create(&pool, size, &geometry);
+  bool ok = b != NULL && binary_fuse_build_run(b, keys);
+  if (ok) {
+    filter->Seed = b->geometry.Seed;
+    b->filter = filter;
+    uint32_t middle_end = b->size - b->side_size[1];
+    for (uint32_t i = middle_end; i-- > b->side_size[0];) {
+      binary_fuse8_build_assign(b, i);
+    }
+    binary_fuse_pool_run(&pool, binary_fuse8_build_assign_task, b);
+  }
+  if (b != NULL) {
+    binary_fuse_build_free(b);
+  }
+  binary_fuse_pool_destroy(&pool);
+  return ok;
+}
+
+// See binary_fuse8_populate_parallel.
+static inline bool binary_fuse16_populate_parallel(uint64_t *keys, uint32_t size,
+                                                   binary_fuse16_t *filter, size_t nthreads) {
+  if (size != filter->Size) {
+    return false;
+  }
+  binary_fuse32_t geometry = {0};
+  geometry.Size = filter->Size;
+  geometry.SegmentLength = filter->SegmentLength;
+  geometry.SegmentLengthMask = filter->SegmentLengthMask;
+  geometry.SegmentCount = filter->SegmentCount;
+  geometry.SegmentCountLength = filter->SegmentCountLength;
+  geometry.ArrayLength = filter->ArrayLength;
+  binary_fuse_pool_t pool;
+  if (!binary_fuse_pool_create(&pool, nthreads)) {
+    return false;
+  }
+  binary_fuse_build_t *b = binary_fuse_build_create(&pool, size, &geometry);
+  bool ok = b != NULL && binary_fuse_build_run(b, keys);
+  if (ok) {
+    filter->Seed = b->geometry.Seed;
+    b->filter = filter;
+    uint32_t middle_end = b->size - b->side_size[1];
+    for (uint32_t i = middle_end; i-- > b->side_size[0];) {
+      binary_fuse16_build_assign(b, i);
+    }
+    binary_fuse_pool_run(&pool, binary_fuse16_build_assign_task, b);
+  }
+  if (b != NULL) {
+    binary_fuse_build_free(b);
+  }
+  binary_fuse_pool_destroy(&pool);
+  return ok;
+}
+
+//////////////////
+// multithreaded xor construction
+//////////////////
+
+// State of xor8_populate_parallel and xor16_populate_parallel. The keys are
+// added by all the threads at once with atomic operations: private copies of
+// the sets, merged afterwards, would take 16 bytes per cell and per thread.
+// The scans for the singletons are split across the threads too, and the
+// peeling is the serial one of xor8_populate, so that the filter is the same.
+typedef struct xor_build_s {
+  binary_fuse_pool_t *pool;
+  const uint64_t *keys;
+  uint32_t size;
+  xor8_t geometry; // the seed and blockLength, the fingerprints are not used
+  xor_xorset_t *sets;
+  xor_keyindex_t *Q;
+  size_t add_threads; // 1 when the compiler has no atomic operations
+  uint32_t singletons[3][BINARY_FUSE_MAX_THREADS]; // in each part of each block
+} xor_build_t;
+
+#if defined(__GNUC__) || defined(__clang__)
+#define XOR_BUILD_ATOMIC 1
+#endif
+
+static inline void xor_build_clear_task(void *arg, size_t thread) {
+  xor_build_t *b = (xor_build_t *)arg;
+  uint32_t begin, end;
+  binary_fuse_build_range((uint32_t)(3 * b->geometry.blockLength), thread, b->pool->nthreads,
+                          &begin, &end);
+  memset(b->sets + begin, 0, sizeof(xor_xorset_t) * (end - begin));
+}
+
+static inline void xor_build_add_task(void *arg, size_t thread) {
+  xor_build_t *b = (xor_build_t *)arg;
+  if (thread >= b->add_threads) {
+    return;
+  }
+  size_t blockLength = (size_t)(b->geometry.blockLength);
+  xor_xorset_t *sets0 = b->sets;
+  xor_xorset_t *sets1 = b->sets + blockLength;
+  xor_xorset_t *sets2 = b->sets + 2 * blockLength;
+  uint32_t begin, end;
+  binary_fuse_build_range(b->size, thread, b->add_threads, &begin, &end);
+  if (b->add_threads == 1) {
+    for (uint32_t i = begin; i < end; i++) {
+      xor_hashes_t hs = xor8_get_h0_h1_h2(b->keys[i], &b->geometry);
+      sets0[hs.h0].xormask ^= hs.h;
+      sets0[hs.h0].count++;
+      sets1[hs.h1].xormask ^= hs.h;
+      sets1[hs.h1].count++;
+      sets2[hs.h2].xormask ^= hs.h;
+      sets2[hs.h2].count++;
+    }
+    return;
+  }
+#ifdef XOR_BUILD_ATOMIC
+  // the cells are random, two threads rarely meet on one
+  for (uint32_t i = begin; i < end; i++) {
+    xor_hashes_t hs = xor8_get_h0_h1_h2(b->keys[i], &b->geometry);
+    __atomic_fetch_xor(&sets0[hs.h0].xormask, hs.h, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&sets0[hs.h0].count, 1U, __ATOMIC_RELAXED);
+    __atomic_fetch_xor(&sets1[hs.h1].xormask, hs.h, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&sets1[hs.h1].count, 1U, __ATOMIC_RELAXED);
+    __atomic_fetch_xor(&sets2[hs.h2].xormask, hs.h, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&sets2[hs.h2].count, 1U, __ATOMIC_RELAXED);
+  }
+#endif
+}
+
+// Count, then list, the cells with a count of one in a part of each block.
+static inline void xor_build_count_singletons_task(void *arg, size_t thread) {
+  xor_build_t *b = (xor_build_t *)arg;
+  uint32_t blockLength = (uint32_t)b->geometry.blockLength;
+  uint32_t begin, end;
+  binary_fuse_build_range(blockLength, thread, b->pool->nthreads, &begin, &end);
+  for (uint32_t block = 0; block < 3; block++) {
+    const xor_xorset_t *sets = b->sets + (size_t)block * blockLength;
+    uint32_t count = 0;
+    for (uint32_t i = begin; i < end; i++) {
+      count += sets[i].count == 1 ? 1U : 0U;
+    }
+    b->singletons[block][thread] = count;
+  }
+}
+
+static inline void xor_build_list_singletons_task(void *arg, size_t thread) {
+  xor_build_t *b = (xor_build_t *)arg;
+  uint32_t blockLength = (uint32_t)b->geometry.blockLength;
+  uint32_t begin, end;
+  binary_fuse_build_range(blockLength, thread, b->pool->nthreads, &begin, &end);
+  for (uint32_t block = 0; block < 3; block++) {
+    const xor_xorset_t *sets = b->sets + (size_t)block * blockLength;
+    xor_keyindex_t *Q = b->Q + (size_t)block * blockLength + b->singletons[block][thread];
+    size_t Qsize = 0;
+    for (uint32_t i = begin; i < end; i++) {
+      if (sets[i].count == 1) {
+        Q[Qsize].index = i;
+        Q[Qsize].hash = sets[i].xormask;
+        Qsize++;
+      }
+    }
+  }
+}
+
+// The peeling of xor8_populate, from the queues Q0, Q1 and Q2 of the given
+// sizes. Returns the number of keys in the stack.
+static inline size_t xor_build_peel(xor_build_t *b, xor_keyindex_t *stack, size_t Q0size,
+                                    size_t Q1size, size_t Q2size) {
+  const xor8_t *filter = &b->geometry;
+  size_t blockLength = (size_t)(filter->blockLength);
+  xor_xorset_t *sets0 = b->sets;
+  xor_xorset_t *sets1 = b->sets + blockLength;
+  xor_xorset_t *sets2 = b->sets + 2 * blockLength;
+  xor_keyindex_t *Q0 = b->Q;
+  xor_keyindex_t *Q1 = b->Q + blockLength;
+  xor_keyindex_t *Q2 = b->Q + 2 * blockLength;
+  size_t stack_size = 0;
+  while (Q0size + Q1size + Q2size > 0) {
+    while (Q0size > 0) {
+      xor_keyindex_t keyindex = Q0[--Q0size];
+      size_t index = keyindex.index;
+      if (sets0[index].count == 0)
+        continue; // not actually possible after the initial scan.
+      uint64_t hash = keyindex.hash;
+      uint32_t h1 = xor8_get_h1(hash, filter);
+      uint32_t h2 = xor8_get_h2(hash, filter);
+
+      stack[stack_size] = keyindex;
+      stack_size++;
+      sets1[h1].xormask ^= hash;
+      sets1[h1].count--;
+      if (sets1[h1].count == 1) {
+        Q1[Q1size].index = h1;
+        Q1[Q1size].hash = sets1[h1].xormask;
+        Q1size++;
+      }
+      sets2[h2].xormask ^= hash;
+      sets2[h2].count--;
+      if (sets2[h2].count == 1) {
+        Q2[Q2size].index = h2;
+        Q2[Q2size].hash = sets2[h2].xormask;
+        Q2size++;
+      }
+    }
+    while (Q1size > 0) {
+      xor_keyindex_t keyindex = Q1[--Q1size];
+      size_t index = keyindex.index;
+      if (sets1[index].count == 0)
+        continue;
+      uint64_t hash = keyindex.hash;
+      uint32_t h0 = xor8_get_h0(hash, filter);
+      uint32_t h2 = xor8_get_h2(hash, filter);
+      keyindex.index += (uint32_t)blockLength;
+      stack[stack_size] = keyindex;
+      stack_size++;
+      sets0[h0].xormask ^= hash;
+      sets0[h0].count--;
+      if (sets0[h0].count == 1) {
+        Q0[Q0size].index = h0;
+        Q0[Q0size].hash = sets0[h0].xormask;
+        Q0size++;
+      }
+      sets2[h2].xormask ^= hash;
+      sets2[h2].count--;
+      if (sets2[h2].count == 1) {
+        Q2[Q2size].index = h2;
+        Q2[Q2size].hash = sets2[h2].xormask;
+        Q2size++;
+      }
+    }
+    while (Q2size > 0) {
+      xor_keyindex_t keyindex = Q2[--Q2size];
+      size_t index = keyindex.index;
+      if (sets2[index].count == 0)
+        continue;
+      uint64_t hash = keyindex.hash;
+      uint32_t h0 = xor8_get_h0(hash, filter);
+      uint32_t h1 = xor8_get_h1(hash, filter);
+      keyindex.index += 2 * (uint32_t)blockLength;
+
+      stack[stack_size] = keyindex;
+      stack_size++;
+      sets0[h0].xormask ^= hash;
+      sets0[h0].count--;
+      if (sets0[h0].count == 1) {
+        Q0[Q0size].index = h0;
+        Q0[Q0size].hash = sets0[h0].xormask;
+        Q0size++;
+      }
+      sets1[h1].xormask ^= hash;
+      sets1[h1].count--;
+      if (sets1[h1].count == 1) {
+        Q1[Q1size].index = h1;
+        Q1[Q1size].hash = sets1[h1].xormask;
+        Q1size++;
+      }
+    }
+  }
+  return stack_size;
+}
+
+// Find a seed for which all the keys peel, like xor8_populate, and leave them
+// in the stack. Returns the number of keys (after removing the duplicates),
+// 0 on failure.
+static inline uint32_t xor_build_run(binary_fuse_pool_t *pool, uint64_t *keys, uint32_t size,
+                                     xor8_t *geometry, xor_keyindex_t *stack) {
+  size_t arrayLength = (size_t)(geometry->blockLength) * 3;
+  xor_build_t *b = (xor_build_t *)calloc(1, sizeof(xor_build_t));
+  if (b == NULL) {
+    return 0;
+  }
+  b->sets = (xor_xorset_t *)malloc(arrayLength * sizeof(xor_xorset_t));
+  b->Q = (xor_keyindex_t *)malloc(arrayLength * sizeof(xor_keyindex_t));
+  if ((b->sets == NULL) || (b->Q == NULL)) {
+    free(b->sets);
+    free(b->Q);
+    free(b);
+    return 0;
+  }
+  b->pool = pool;
+  b->keys = keys;
+  b->add_threads = 1;
+#ifdef XOR_BUILD_ATOMIC
+  b->add_threads = pool->nthreads;
+#endif
+  uint64_t rng_counter = 1;
+  geometry->seed = xor_rng_splitmix64(&rng_counter);
+  int iterations = 0;
+  while (true) {
+    iterations ++;
+    if(iterations == XOR_SORT_ITERATIONS) {
+      size = (uint32_t)xor_sort_and_remove_dup(keys, size);
+    }
+    if(iterations > XOR_MAX_ITERATIONS) {
+      // The probability of this happening is lower than the
+      // the cosmic-ray probability (i.e., a cosmic ray corrupts your system).
+      size = 0;
+      break;
+    }
+    b->size = size;
+    b->geometry = *geometry;
+    binary_fuse_pool_run(pool, xor_build_clear_task, b);
+    binary_fuse_pool_run(pool, xor_build_add_task, b);
+    binary_fuse_pool_run(pool, xor_build_count_singletons_task, b);
+    size_t Qsize[3];
+    for (size_t block = 0; block < 3; block++) {
+      uint32_t queued = 0;
+      for (size_t t = 0; t < pool->nthreads; t++) {
+        uint32_t count = b->singletons[block][t];
+        b->singletons[block][t] = queued;
+        queued += count;
+      }
+      Qsize[block] = queued;
+    }
+    binary_fuse_pool_run(pool, xor_build_list_singletons_task, b);
+    if (xor_build_peel(b, stack, Qsize[0], Qsize[1], Qsize[2]) == size) {
+      // success
+      break;
+    }
+    geometry->seed = xor_rng_splitmix64(&rng_counter);
+  }
+  free(b->sets);
+  free(b->Q);
+  free(b);
+  return size;
+}
+
+// Construct the filter with 'nthreads' threads (at most
+// BINARY_FUSE_MAX_THREADS), returns true on success, false on failure.
+// The caller is responsable for calling xor8_allocate(size,filter) before.
+// The keys are added and the singletons found in parallel, the peeling and the
+// assignment run on one thread: the filter is the one of xor8_populate.
+static inline bool xor8_populate_parallel(uint64_t *keys, uint32_t size, xor8_t *filter,
+                                          size_t nthreads) {
+  if(size == 0) { return false; }
+  size_t blockLength = (size_t)(filter->blockLength);
+  xor_keyindex_t *stack = (xor_keyindex_t *)malloc(size * sizeof(xor_keyindex_t));
+  binary_fuse_pool_t pool;
+  if (stack == NULL) {
+    return false;
+  }
+  if (!binary_fuse_pool_create(&pool, nthreads)) {
+    free(stack);
+    return false;
+  }
+  xor8_t geometry = *filter;
+  size = xor_build_run(&pool, keys, size, &geometry, stack);
+  binary_fuse_pool_destroy(&pool);
+  if (size == 0) {
+    free(stack);
+    return false;
+  }
+  filter->seed = geometry.seed;
+  uint8_t * fingerprints0 = filter->fingerprints;
+  uint8_t * fingerprints1 = filter->fingerprints + blockLength;
+  uint8_t * fingerprints2 = filter->fingerprints + 2 * blockLength;
+
+  size_t stack_size = size;
+  while (stack_size > 0) {
+    xor_keyindex_t ki = stack[--stack_size];
+    uint64_t val = xor_fingerprint(ki.hash);
+    if(ki.index < blockLength) {
+      val ^= (uint32_t)fingerprints1[xor8_get_h1(ki.hash,filter)] ^ fingerprints2[xor8_get_h2(ki.hash,filter)];
+    } else if(ki.index < 2 * blockLength) {
+      val ^= (uint32_t)fingerprints0[xor8_get_h0(ki.hash,filter)] ^ fingerprints2[xor8_get_h2(ki.hash,filter)];
+    } else {
+      val ^= (uint32_t)fingerprints0[xor8_get_h0(ki.hash,filter)] ^ fingerprints1[xor8_get_h1(ki.hash,filter)];
+    }
+    filter->fingerprints[ki.index] = (uint8_t)val;
+  }
+  free(stack);
+  return true;
+}
+
+// See xor8_populate_parallel.
+static inline bool xor16_populate_parallel(uint64_t *keys, uint32_t size, xor16_t *filter,
+                                           size_t nthreads) {
+  if(size == 0) { return false; }
+  size_t blockLength = (size_t)(filter->blockLength);
+  xor_keyindex_t *stack = (xor_keyindex_t *)malloc(size * sizeof(xor_keyindex_t));
+  binary_fuse_pool_t pool;
+  if (stack == NULL) {
+    return false;
+  }
+  if (!binary_fuse_pool_create(&pool, nthreads)) {
+    free(stack);
+    return false;
+  }
+  xor8_t geometry = {0};
+  geometry.blockLength = filter->blockLength;
+  size = xor_build_run(&pool, keys, size, &geometry, stack);
+  binary_fuse_pool_destroy(&pool);
+  if (size == 0) {
+    free(stack);
+    return false;
+  }
+  filter->seed = geometry.seed;
+  uint16_t * fingerprints0 = filter->fingerprints;
+  uint16_t * fingerprints1 = filter->fingerprints + blockLength;
+  uint16_t * fingerprints2 = filter->fingerprints + 2 * blockLength;
+
+  size_t stack_size = size;
+  while (stack_size > 0) {
+    xor_keyindex_t ki = stack[--stack_size];
+    uint64_t val = xor_fingerprint(ki.hash);
+    if(ki.index < blockLength) {
+      val ^= (uint32_t)fingerprints1[xor16_get_h1(ki.hash,filter)] ^ fingerprints2[xor16_get_h2(ki.hash,filter)];
+    } else if(ki.index < 2 * blockLength) {
+      val ^= (uint32_t)fingerprints0[xor16_get_h0(ki.hash,filter)] ^ fingerprints2[xor16_get_h2(ki.hash,filter)];
+    } else {
+      val ^= (uint32_t)fingerprints0[xor16_get_h0(ki.hash,filter)] ^ fingerprints1[xor16_get_h1(ki.hash,filter)];
+    }
+    filter->fingerprints[ki.index] = (uint16_t)val;
+  }
+  free(stack);
+  return true;
+}
+
+//////////////////
+// sharded filters
+//////////////////
+
+#ifndef BINARY_FUSE_SHARD_KEYS
+// expected number of keys per shard when binary_fuse_sharded_allocate picks
+// the number of shards
+#define BINARY_FUSE_SHARD_KEYS (UINT32_C(1) << 24)
+#endif
+
+// A set split by hash into ShardCount independent binary_fuse8_t filters, so
+// that the shards can be built at once on different threads (or machines),
+// rebuilt one at a time, and loaded or evicted one at a time. It also holds
+// more than 2^32 keys. A key is hashed once with Seed: the hash selects the
+// shard, and the shard is probed with the same hash when it was built with
+// that seed (its construction retries with another seed on rare occasions).
+// An evicted shard (Fingerprints == NULL) reports every key as present.
+typedef struct binary_fuse_sharded_s {
+  uint64_t Seed;
+  uint64_t Size;
+  uint32_t ShardCount;
+  binary_fuse8_t *Shards;
+} binary_fuse_sharded_t;
+
+// The seed from which the shards derive theirs, see
+// binary_fuse8_populate_family.
+#define BINARY_FUSE_SHARD_FAMILY_SEED UINT64_C(0x726b2b9d438b9d4d)
+
+// The shard of a hash. The shards use every bit of the hash, so the shard is
+// taken from the top bits of a multiple of the hash: the keys of a shard keep
+// uniform hashes.
+static inline uint32_t binary_fuse_sharded_route(uint64_t hash, const binary_fuse_sharded_t *s) {
+  return (uint32_t)binary_fuse_mulhi(hash * UINT64_C(0x9e3779b97f4a7c15), s->ShardCount);
+}
+
+// The shard that holds the key, see binary_fuse_sharded_populate_shard.
+static inline uint32_t binary_fuse_sharded_shard_of(uint64_t key, const binary_fuse_sharded_t *s) {
+  return binary_fuse_sharded_route(binary_fuse_mix_split(key, s->Seed), s);
+}
+
+// Allocate the table of 'shard_count' shards for a set of 'size' keys, or of
+// about one shard per BINARY_FUSE_SHARD_KEYS keys when shard_count is 0. The
+// shards themselves are allocated when they are built, and are evicted until
+// then. The caller is responsible for calling binary_fuse_sharded_free(s).
+static inline bool binary_fuse_sharded_allocate(uint64_t size, uint32_t shard_count,
+                                                binary_fuse_sharded_t *s) {
+  uint64_t rng_counter = BINARY_FUSE_SHARD_FAMILY_SEED;
+  s->Seed = binary_fuse_rng_splitmix64(&rng_counter);
+  s->Size = size;
+  if (shard_count == 0) {
+    uint64_t count = (size + BINARY_FUSE_SHARD_KEYS - 1) / BINARY_FUSE_SHARD_KEYS;
+    shard_count = count == 0 ? 1 : count > UINT32_MAX ? UINT32_MAX : (uint32_t)count;
+  }
+  s->ShardCount = shard_count;
+  s->Shards = (binary_fuse8_t *)calloc(shard_count, sizeof(binary_fuse8_t));
+  return s->Shards != NULL;
+}
+
+// release memory
+static inline void binary_fuse_sharded_free(binary_fuse_sharded_t *s) {
+  if (s->Shards != NULL) {
+    for (uint32_t i = 0; i < s->ShardCount; i++) {
+      binary_fuse8_free(&s->Shards[i]);
+    }
+  }
+  free(s->Shards);
+  s->Shards = NULL;
+  s->Seed = 0;
+  s->Size = 0;
+  s->ShardCount = 0;
+}
+
+// report memory usage of the loaded shards
+static inline size_t binary_fuse_sharded_size_in_bytes(const binary_fuse_sharded_t *s) {
+  size_t bytes = sizeof(binary_fuse_sharded_t) + s->ShardCount * sizeof(binary_fuse8_t);
+  for (uint32_t i = 0; i < s->ShardCount; i++) {
+    if (s->Shards[i].Fingerprints != NULL) {
+      bytes += s->Shards[i].ArrayLength * sizeof(uint8_t);
+    }
+  }
+  return bytes;
+}
+
+// Release the fingerprints of a shard, keeping its geometry, so that
+// binary_fuse_sharded_load_shard can bring it back.
+static inline void binary_fuse_sharded_evict_shard(uint32_t index, binary_fuse_sharded_t *s) {
+  free(s->Shards[index].Fingerprints);
+  s->Shards[index].Fingerprints = NULL;
+}
+
+// Replace the content of a shard with the 'size' keys.
+static inline bool binary_fuse_sharded_build_shard(uint64_t *keys, uint32_t size,
+                                                   binary_fuse8_t *shard) {
+  binary_fuse8_free(shard);
+  if (!binary_fuse8_allocate(size, shard)) {
+    binary_fuse8_free(shard);
+    return false;
+  }
+  return binary_fuse8_populate_family(keys, size, BINARY_FUSE_SHARD_FAMILY_SEED, shard);
+}
+
+// Build the shard 'index' from its 'size' keys, all the keys of the set for
+// which binary_fuse_sharded_shard_of returns 'index', replacing its previous
+// content. Returns true on success, false on failure.
+static inline bool binary_fuse_sharded_populate_shard(uint64_t *keys, uint32_t size,
+                                                      uint32_t index,
+                                                      binary_fuse_sharded_t *s) {
+  s->Size = s->Size - s->Shards[index].Size + size;
+  return binary_fuse_sharded_build_shard(keys, size, &s->Shards[index]);
+}
+
+// Report if the key is in the set, with false positive rate.
+static inline bool binary_fuse_sharded_contain(uint64_t key, const binary_fuse_sharded_t *s) {
+  uint64_t hash = binary_fuse_mix_split(key, s->Seed);
+  const binary_fuse8_t *shard = &s->Shards[binary_fuse_sharded_route(hash, s)];
+  if (shard->Fingerprints == NULL) {
+    return true;
+  }
+  if (shard->Seed != s->Seed) {
+    hash = binary_fuse_mix_split(key, shard->Seed);
+  }
+  uint8_t f = binary_fuse8_fingerprint(hash);
+  binary_hashes_t hashes = binary_fuse8_hash_batch(hash, shard);
+  f ^= (uint32_t)shard->Fingerprints[hashes.h0] ^ shard->Fingerprints[hashes.h1] ^
+       shard->Fingerprints[hashes.h2];
+  return f == 0;
+}
+
+// First phase of a query, see binary_fuse8_probe_prepare. Returns the shard
+// to give to binary_fuse8_probe_finish, or NULL when the shard is evicted.
+static inline const binary_fuse8_t *binary_fuse_sharded_probe_prepare(uint64_t key,
+                                                                      const binary_fuse_sharded_t *s,
+                                                                      binary_fuse8_probe_t *probe) {
+  uint64_t hash = binary_fuse_mix_split(key, s->Seed);
+  const binary_fuse8_t *shard = &s->Shards[binary_fuse_sharded_route(hash, s)];
+  if (shard->Fingerprints == NULL) {
+    return NULL;
+  }
+  if (shard->Seed != s->Seed) {
+    hash = binary_fuse_mix_split(key, shard->Seed);
+  }
+  binary_fuse8_probe_prepare_hash(hash, shard, probe);
+  return shard;
+}
+
+// Report, for each of the 'count' keys, if it is in the set, with false
+// positive rate. The answer for keys[i] is written to out[i]. As in
+// binary_fuse8_contain_batch_scalar, the keys are hashed and their locations
+// prefetched BINARY_FUSE_BATCH_WINDOW positions ahead, whatever their shards.
+static inline void binary_fuse_sharded_contain_batch(const uint64_t *keys, size_t count,
+                                                     bool *out,
+                                                     const binary_fuse_sharded_t *s) {
+  binary_fuse8_probe_t probes[BINARY_FUSE_BATCH_WINDOW];
+  const binary_fuse8_t *shards[BINARY_FUSE_BATCH_WINDOW];
+  const size_t mask = BINARY_FUSE_BATCH_WINDOW - 1;
+  size_t ahead = count < BINARY_FUSE_BATCH_WINDOW ? count : BINARY_FUSE_BATCH_WINDOW;
+  for (size_t i = 0; i < ahead; i++) {
+    shards[i] = binary_fuse_sharded_probe_prepare(keys[i], s, &probes[i]);
+  }
+  for (size_t i = 0; i < count; i++) {
+    size_t slot = i & mask;
+    out[i] = shards[slot] == NULL || binary_fuse8_probe_finish(&probes[slot], shards[slot]);
+    if (i + BINARY_FUSE_BATCH_WINDOW < count) {
+      shards[slot] =
+          binary_fuse_sharded_probe_prepare(keys[i + BINARY_FUSE_BATCH_WINDOW], s, &probes[slot]);
+    }
+  }
+}
+
+// State of binary_fuse_sharded_populate_parallel.
+typedef struct binary_fuse_sharded_build_s {
+  binary_fuse_pool_t *pool;
+  binary_fuse_sharded_t *sharded;
+  const uint64_t *keys;
+  uint64_t size;
+  uint64_t *routed; // the keys, grouped by shard
+  uint64_t *counts; // [thread][shard]: keys, then offsets in 'routed'
+  uint64_t *starts; // [shard]: first key of the shard in 'routed'
+  bool *failed;     // [shard]
+  size_t next;      // next unclaimed shard
+} binary_fuse_sharded_build_t;
+
+static inline void binary_fuse_sharded_range(uint64_t n, size_t thread, size_t nthreads,
+                                             uint64_t *begin, uint64_t *end) {
+  *begin = n / nthreads * thread + (thread < n % nthreads ? thread : n % nthreads);
+  *end = *begin + n / nthreads + (thread < n % nthreads ? 1 : 0);
+}
+
+// Count the keys of each shard, over a contiguous range of keys.
+static inline void binary_fuse_sharded_count_task(void *arg, size_t thread) {
+  binary_fuse_sharded_build_t *b = (binary_fuse_sharded_build_t *)arg;
+  uint64_t *counts = b->counts + thread * b->sharded->ShardCount;
+  uint64_t begin, end;
+  binary_fuse_sharded_range(b->size, thread, b->pool->nthreads, &begin, &end);
+  for (uint64_t i = begin; i < end; i++) {
+    counts[binary_fuse_sharded_shard_of(b->keys[i], b->sharded)]++;
+  }
+}
+
+// Write the same keys at their offsets: within a shard, the keys keep their
+// order whatever the number of threads.
+static inline void binary_fuse_sharded_scatter_task(void *arg, size_t thread) {
+  binary_fuse_sharded_build_t *b = (binary_fuse_sharded_build_t *)arg;
+  uint64_t *offsets = b->counts + thread * b->sharded->ShardCount;
+  uint64_t begin, end;
+  binary_fuse_sharded_range(b->size, thread, b->pool->nthreads, &begin, &end);
+  for (uint64_t i = begin; i < end; i++) {
+    b->routed[offsets[binary_fuse_sharded_shard_of(b->keys[i], b->sharded)]++] = b->keys[i];
+  }
+}
+
+// Each thread builds whole shards, one at a time.
+static inline void binary_fuse_sharded_build_task(void *arg, size_t thread) {
+  binary_fuse_sharded_build_t *b = (binary_fuse_sharded_build_t *)arg;
+  (void)thread;
+  for (;;) {
+    size_t index = binary_fuse_pool_claim(b->pool, &b->next, 1);
+    if (index >= b->sharded->ShardCount) {
+      break;
+    }
+    uint64_t size = b->starts[index + 1] - b->starts[index];
+    b->failed[index] =
+        size >= UINT32_MAX ||
+        !binary_fuse_sharded_build_shard(b->routed + b->starts[index], (uint32_t)size,
+                                         &b->sharded->Shards[index]);
+  }
+}
+
+// Construct the shards with 'nthreads' threads (at most
+// BINARY_FUSE_MAX_THREADS), returns true on success, false on failure.
+// The caller is responsable for calling binary_fuse_sharded_allocate(size,
+// shard_count, s) before. The keys are first copied and grouped by shard, then
+// each thread builds whole shards with binary_fuse8_populate_family: there
+// should be at least as many shards as threads. The keys are not modified.
+static inline bool binary_fuse_sharded_populate_parallel(const uint64_t *keys, uint64_t size,
+                                                         binary_fuse_sharded_t *s,
+                                                         size_t nthreads) {
+  if (size != s->Size) {
+    return false;
+  }
+  binary_fuse_pool_t pool;
+  if (!binary_fuse_pool_create(&pool, nthreads)) {
+    return false;
+  }
+  uint32_t shard_count = s->ShardCount;
+  binary_fuse_sharded_build_t b;
+  memset(&b, 0, sizeof(b));
+  b.pool = &pool;
+  b.sharded = s;
+  b.keys = keys;
+  b.size = size;
+  b.routed = (uint64_t *)malloc((size_t)(size == 0 ? 1 : size) * sizeof(uint64_t));
+  b.counts = (uint64_t *)calloc(pool.nthreads * shard_count, sizeof(uint64_t));
+  b.starts = (uint64_t *)malloc(((size_t)shard_count + 1) * sizeof(uint64_t));
+  b.failed = (bool *)calloc(shard_count, sizeof(bool));
+  bool ok = b.routed != NULL && b.counts != NULL && b.starts != NULL && b.failed != NULL;
+  if (ok) {
+    binary_fuse_pool_run(&pool, binary_fuse_sharded_count_task, &b);
+    uint64_t offset = 0;
+    for (uint32_t shard = 0; shard < shard_count; shard++) {
+      b.starts[shard] = offset;
+      for (size_t t = 0; t < pool.nthreads; t++) {
+        uint64_t count = b.counts[t * shard_count + shard];
+        b.counts[t * shard_count + shard] = offset;
+        offset += count;
+      }
+    }
+    b.starts[shard_count] = offset;
+    binary_fuse_pool_run(&pool, binary_fuse_sharded_scatter_task, &b);
+    binary_fuse_pool_run(&pool, binary_fuse_sharded_build_task, &b);
+    for (uint32_t shard = 0; shard < shard_count; shard++) {
+      ok = ok && !b.failed[shard];
+    }
+  }
+  free(b.routed);
+  free(b.counts);
+  free(b.starts);
+  free(b.failed);
+  binary_fuse_pool_destroy(&pool);
+  return ok;
+}
+
+// The serialized form holds Seed, Size and ShardCount, then a table of
+// ShardCount + 1 offsets from the start of the buffer, where each shard starts
+// (the last one is the total number of bytes), then the shards, each as
+// written by binary_fuse8_serialize.
+static inline size_t binary_fuse_sharded_header_bytes(uint32_t shard_count) {
+  return sizeof(uint64_t) + sizeof(uint64_t) + sizeof(uint32_t) +
+         ((size_t)shard_count + 1) * sizeof(uint64_t);
+}
+
+static inline size_t binary_fuse_sharded_serialization_bytes(const binary_fuse_sharded_t *s) {
+  size_t bytes = binary_fuse_sharded_header_bytes(s->ShardCount);
+  for (uint32_t i = 0; i < s->ShardCount; i++) {
+    bytes += binary_fuse8_serialization_bytes(&s->Shards[i]);
+  }
+  return bytes;
+}
+
+// where the shard 'index' starts in a buffer written by
+// binary_fuse_sharded_serialize
+static inline uint64_t binary_fuse_sharded_offset(const char *buffer, uint32_t index) {
+  uint64_t offset;
+  memcpy(&offset, buffer + binary_fuse_sharded_header_bytes(index) - sizeof(uint64_t),
+         sizeof(offset));
+  return offset;
+}
+
+// serialize the shards to a buffer, the buffer should have a capacity of at
+// least binary_fuse_sharded_serialization_bytes(s) bytes. Every shard must be
+// loaded. Native endianess only.
+static inline void binary_fuse_sharded_serialize(const binary_fuse_sharded_t *s, char *buffer) {
+  char *start = buffer;
+  memcpy(buffer, &s->Seed, sizeof(s->Seed));
+  buffer += sizeof(s->Seed);
+  memcpy(buffer, &s->Size, sizeof(s->Size));
+  buffer += sizeof(s->Size);
+  memcpy(buffer, &s->ShardCount, sizeof(s->ShardCount));
+  buffer += sizeof(s->ShardCount);
+  uint64_t offset = binary_fuse_sharded_header_bytes(s->ShardCount);
+  for (uint32_t i = 0; i < s->ShardCount; i++) {
+    memcpy(buffer, &offset, sizeof(offset));
+    buffer += sizeof(offset);
+    binary_fuse8_serialize(&s->Shards[i], start + offset);
+    offset += binary_fuse8_serialization_bytes(&s->Shards[i]);
+  }
+  memcpy(buffer, &offset, sizeof(offset));
+}
+
+// deserialize the table of shards and the geometry of every shard from a
+// buffer written by binary_fuse_sharded_serialize, returns true on success,
+// false on failure. The shards are left evicted: load the ones needed with
+// binary_fuse_sharded_load_shard, from the same buffer. The output will be
+// reallocated, so the caller should call binary_fuse_sharded_free(s) before if
+// it was already allocated, and needs to call binary_fuse_sharded_free(s)
+// after. Native endianess only.
+static inline bool binary_fuse_sharded_deserialize_header(binary_fuse_sharded_t *s,
+                                                          const char *buffer) {
+  const char *start = buffer;
+  memcpy(&s->Seed, buffer, sizeof(s->Seed));
+  buffer += sizeof(s->Seed);
+  memcpy(&s->Size, buffer, sizeof(s->Size));
+  buffer += sizeof(s->Size);
+  memcpy(&s->ShardCount, buffer, sizeof(s->ShardCount));
+  s->Shards = (binary_fuse8_t *)calloc(s->ShardCount, sizeof(binary_fuse8_t));
+  if (s->Shards == NULL) {
+    return false;
+  }
+  for (uint32_t i = 0; i < s->ShardCount; i++) {
+    if (binary_fuse8_deserialize_header(&s->Shards[i],
+                                        start + binary_fuse_sharded_offset(start, i)) == NULL) {
+      binary_fuse_sharded_free(s);
+      return false;
+    }
+    s->Shards[i].Fingerprints = NULL;
+  }
+  return true;
+}
+
+// Load the fingerprints of the shard 'index' from the buffer given to
+// binary_fuse_sharded_deserialize_header, returns true on success, false on
+// failure. A loaded shard is left as it is.
+static inline bool binary_fuse_sharded_load_shard(uint32_t index, binary_fuse_sharded_t *s,
+                                                  const char *buffer) {
+  binary_fuse8_t *shard = &s->Shards[index];
+  if (shard->Fingerprints != NULL) {
+    return true;
+  }
+  binary_fuse8_t loaded;
+  const char *fingerprints =
+      binary_fuse8_deserialize_header(&loaded, buffer + binary_fuse_sharded_offset(buffer, index));
+  if (fingerprints == NULL) {
+    return false;
+  }
+  shard->Fingerprints = (uint8_t *)malloc(shard->ArrayLength * sizeof(uint8_t));
+  if (shard->Fingerprints == NULL) {
+    return false;
+  }
+  memcpy(shard->Fingerprints, fingerprints, shard->ArrayLength * sizeof(uint8_t));
+  return true;
+}
+
+// deserialize every shard from a buffer, returns true on success, false on
+// failure. The output will be reallocated, so the caller should call
+// binary_fuse_sharded_free(s) before if it was already allocated. The caller
+// needs to call binary_fuse_sharded_free(s) after. The number of bytes read is
+// binary_fuse_sharded_serialization_bytes(s). Native endianess only.
+static inline bool binary_fuse_sharded_deserialize(binary_fuse_sharded_t *s, const char *buffer) {
+  if (!binary_fuse_sharded_deserialize_header(s, buffer)) {
+    return false;
+  }
+  for (uint32_t i = 0; i < s->ShardCount; i++) {
+    if (!binary_fuse_sharded_load_shard(i, s, buffer)) {
+      binary_fuse_sharded_free(s);
+      return false;
+    }
+  }
+  return true;
+}
+
+#endif
@@ -7,13 +7,49 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <xmmintrin.h>
+#endif
+// The key mixer: binary_fuse_mix_split(key, seed) turns a key into the 64-bit hash
+// that gives its fingerprint and locations. Define BINARY_FUSE_MIXER before including
+// this header to select another one; a serialized filter records it.
+#define BINARY_FUSE_MIXER_MURMUR64 0 // murmur64 finalizer of key + seed (default)
+#define BINARY_FUSE_MIXER_MULXOR 1   // one 64x64->128-bit multiplication and a fold
+#define BINARY_FUSE_MIXER_CRC32C 2   // two CRC32C instructions, x64 with SSE4.2
+#define BINARY_FUSE_MIXER_AES 3      // two AES rounds, x64 with AES-NI
+#ifndef BINARY_FUSE_MIXER
+#define BINARY_FUSE_MIXER BINARY_FUSE_MIXER_MURMUR64
+#endif
+#if BINARY_FUSE_MIXER == BINARY_FUSE_MIXER_CRC32C
+#ifndef __SSE4_2__
+#error "BINARY_FUSE_MIXER_CRC32C requires SSE4.2 (e.g., -msse4.2)"
+#endif
+#include <nmmintrin.h>
+#elif BINARY_FUSE_MIXER == BINARY_FUSE_MIXER_AES
+#ifndef __AES__
+#error "BINARY_FUSE_MIXER_AES requires AES-NI (e.g., -maes)"
+#endif
+#include <wmmintrin.h>
+#elif BINARY_FUSE_MIXER != BINARY_FUSE_MIXER_MURMUR64 && BINARY_FUSE_MIXER != BINARY_FUSE_MIXER_MULXOR
+#error "unknown BINARY_FUSE_MIXER"
+#endif
+#if !defined(BINARY_FUSE_DISABLE_SIMD) && (defined(__GNUC__) || defined(__clang__)) && \
+    defined(__x86_64__) &&                                                       \
+    BINARY_FUSE_MIXER == BINARY_FUSE_MIXER_MURMUR64
+// AVX2 and AVX-512 query kernels, selected at runtime; they implement the
+// default mixer only
+#define BINARY_FUSE_X64_SIMD 1
+#include <immintrin.h>
+#endif
 #ifndef XOR_MAX_ITERATIONS
 // probability of success should always be > 0.5 so 100 iterations is highly unlikely
 #define XOR_MAX_ITERATIONS 100 
 #endif
 
 static int binary_fuse_cmpfunc(const void * a, const void * b) {
-  return (int)( *(const uint64_t*)a - *(const uint64_t*)b );
+  uint64_t x = *(const uint64_t*)a;
+  uint64_t y = *(const uint64_t*)b;
+  return (x > y) - (x < y);
 }
 
 static size_t binary_fuse_sort_and_remove_dup(uint64_t* keys, size_t length) {
@@ -39,9 +75,6 @@ static inline uint64_t binary_fuse_murmur64(uint64_t h) {
   h ^= h >> 33U;
   return h;
 }
-static inline uint64_t binary_fuse_mix_split(uint64_t key, uint64_t seed) {
-  return binary_fuse_murmur64(key + seed);
-}
 static inline uint64_t binary_fuse_rotl64(uint64_t n, unsigned int c) {
   return (n << (c & 63U)) | (n >> ((-c) & 63U));
 }
@@ -53,6 +86,33 @@ static inline uint8_t binary_fuse8_fingerprint(uint64_t hash) {
   return (uint8_t)(hash ^ (hash >> 32U));
 }
 
+#ifndef BINARY_FUSE_BATCH_WINDOW
+// number of keys hashed ahead of the one being resolved in the batch queries,
+// must be a power of two
+#define BINARY_FUSE_BATCH_WINDOW 16
+#endif
+
+// hint that the cache line holding 'addr' will soon be read
+static inline void binary_fuse_prefetch(const void *addr) {
+#if defined(__GNUC__) || defined(__clang__)
+  __builtin_prefetch(addr, 0, 3);
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+  _mm_prefetch((const char *)addr, _MM_HINT_T0);
+#else
+  (void)addr;
+#endif
+}
+
+#ifndef BINARY_FUSE_HASH_BLOCK
+// number of keys hashed at once by the constructions, see binary_fuse_hash_keys
+#define BINARY_FUSE_HASH_BLOCK 256
+#endif
+
+// out[i] = binary_fuse_mix_split(keys[i], seed) for i < n, with the SIMD kernel
+// of binary_fuse_kernel(). Defined with the batch queries.
+static inline void binary_fuse_hash_keys(const uint64_t *keys, size_t n, uint64_t seed,
+                                         uint64_t *out);
+
 /**
  * We need a decent random number generator.
  **/
@@ -145,6 +205,110 @@ static inline uint64_t binary_fuse_mulhi(uint64_t a, uint64_t b) {
 }
 #endif
 
+/**
+ * Byte-string keys (binary_fuse8_populate_bytes, binary_fuse8_contain_bytes...)
+ * are first hashed to 64 bits by binary_fuse_hash_bytes, which reads eight bytes
+ * at a time and folds them with one 64x64->128-bit multiplication per sixteen
+ * bytes. The result then goes through binary_fuse_mix_split like any key.
+ ***/
+
+// fold of the 128-bit product of a and b
+static inline uint64_t binary_fuse_mum(uint64_t a, uint64_t b) {
+  return (a * b) ^ binary_fuse_mulhi(a, b);
+}
+
+static inline uint64_t binary_fuse_mix_split(uint64_t key, uint64_t seed) {
+#if BINARY_FUSE_MIXER == BINARY_FUSE_MIXER_MULXOR
+  // the key times itself, each side perturbed, folded: one 64x64->128-bit
+  // multiplication
+  return binary_fuse_mum(key ^ seed, key ^ UINT64_C(0x9e3779b97f4a7c15));
+#elif BINARY_FUSE_MIXER == BINARY_FUSE_MIXER_CRC32C
+  // each half is the CRC32C of the key, rotated for the high half, from one
+  // half of the seed; the CRC is linear, so a multiplication finishes it
+  uint64_t lo = _mm_crc32_u64(seed & UINT32_MAX, key);
+  uint64_t hi = _mm_crc32_u64(seed >> 32U, (key << 32U) | (key >> 32U));
+  return binary_fuse_mum((hi << 32U) | lo, UINT64_C(0x9e3779b97f4a7c15));
+#elif BINARY_FUSE_MIXER == BINARY_FUSE_MIXER_AES
+  // two rounds diffuse every byte of the key and of the seed to the result
+  __m128i x = _mm_set_epi64x((long long)seed, (long long)key);
+  x = _mm_aesenc_si128(x, _mm_set_epi64x((long long)UINT64_C(0x243f6a8885a308d3),
+                                         (long long)UINT64_C(0x13198a2e03707344)));
+  x = _mm_aesenc_si128(x, _mm_set_epi64x((long long)UINT64_C(0xa4093822299f31d0),
+                                         (long long)UINT64_C(0x082efa98ec4e6c89)));
+  return (uint64_t)_mm_cvtsi128_si64(x);
+#else
+  return binary_fuse_murmur64(key + seed);
+#endif
+}
+
+// name of the key mixer, see BINARY_FUSE_MIXER
+static inline const char *binary_fuse_mixer_name(void) {
+#if BINARY_FUSE_MIXER == BINARY_FUSE_MIXER_MULXOR
+  return "mulxor";
+#elif BINARY_FUSE_MIXER == BINARY_FUSE_MIXER_CRC32C
+  return "crc32c";
+#elif BINARY_FUSE_MIXER == BINARY_FUSE_MIXER_AES
+  return "aes";
+#else
+  return "murmur64";
+#endif
+}
+
+// The serialized filters, maps and functions record the mixer in the top byte
+// of SegmentLength, which is at most 2^18: a buffer written with another mixer
+// is rejected. The default mixer is 0, so older buffers stay readable.
+static inline uint32_t binary_fuse_tag_mixer(uint32_t segment_length) {
+  return segment_length | ((uint32_t)BINARY_FUSE_MIXER << 24U);
+}
+
+// clear the mixer byte of a serialized SegmentLength, returns false if it
+// is not the mixer of this build
+static inline bool binary_fuse_untag_mixer(uint32_t *segment_length) {
+  uint32_t mixer = *segment_length >> 24U;
+  *segment_length &= UINT32_C(0xFFFFFF);
+  return mixer == BINARY_FUSE_MIXER;
+}
+
+static inline uint64_t binary_fuse_read64(const uint8_t *p) {
+  uint64_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static inline uint64_t binary_fuse_read32(const uint8_t *p) {
+  uint32_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+// 64-bit hash of 'length' bytes, native endianness
+static inline uint64_t binary_fuse_hash_bytes(const void *data, size_t length) {
+  const uint64_t k0 = UINT64_C(0xa0761d6478bd642f);
+  const uint64_t k1 = UINT64_C(0xe7037ed1a0b428db);
+  const uint8_t *p = (const uint8_t *)data;
+  uint64_t h = k0 ^ (uint64_t)length;
+  size_t n = length;
+  while (n > 16) {
+    h = binary_fuse_mum(binary_fuse_read64(p) ^ k1, binary_fuse_read64(p + 8) ^ h);
+    p += 16;
+    n -= 16;
+  }
+  // the last 1 to 16 bytes, the two words may overlap
+  uint64_t a = 0;
+  uint64_t b = 0;
+  if (n >= 8) {
+    a = binary_fuse_read64(p);
+    b = binary_fuse_read64(p + n - 8);
+  } else if (n >= 4) {
+    a = binary_fuse_read32(p);
+    b = binary_fuse_read32(p + n - 4);
+  } else if (n > 0) {
+    a = ((uint64_t)p[0] << 16) | ((uint64_t)p[n / 2] << 8) | p[n - 1];
+  }
+  h = binary_fuse_mum(a ^ k1, b ^ h);
+  return binary_fuse_mum(h ^ k1, (uint64_t)length ^ k0);
+}
+
 typedef struct binary_hashes_s {
   uint32_t h0;
   uint32_t h1;
@@ -186,6 +350,99 @@ static inline bool binary_fuse8_contain(uint64_t key,
   return f == 0;
 }
 
+// A query split in two phases, see binary_fuse8_probe_prepare.
+typedef struct binary_fuse8_probe_s {
+  binary_hashes_t hashes;
+  uint8_t fingerprint;
+} binary_fuse8_probe_t;
+
+// binary_fuse8_probe_prepare from the hash of the key,
+// binary_fuse_mix_split(key, filter->Seed)
+static inline void binary_fuse8_probe_prepare_hash(uint64_t hash, const binary_fuse8_t *filter,
+                                                   binary_fuse8_probe_t *probe) {
+  probe->fingerprint = binary_fuse8_fingerprint(hash);
+  probe->hashes = binary_fuse8_hash_batch(hash, filter);
+  binary_fuse_prefetch(filter->Fingerprints + probe->hashes.h0);
+  binary_fuse_prefetch(filter->Fingerprints + probe->hashes.h1);
+  binary_fuse_prefetch(filter->Fingerprints + probe->hashes.h2);
+}
+
+// First phase of a query: hash the key, compute its fingerprint and its three
+// locations, and prefetch them. Do some other work, then call
+// binary_fuse8_probe_finish, by which time the fingerprints should be in cache.
+// The hash is computed only once: binary_fuse8_probe_finish(&probe, filter)
+// is equivalent to binary_fuse8_contain(key, filter).
+static inline void binary_fuse8_probe_prepare(uint64_t key, const binary_fuse8_t *filter,
+                                              binary_fuse8_probe_t *probe) {
+  binary_fuse8_probe_prepare_hash(binary_fuse_mix_split(key, filter->Seed), filter, probe);
+}
+
+// Second phase of a query: report if the key given to
+// binary_fuse8_probe_prepare is in the set, with false positive rate.
+static inline bool binary_fuse8_probe_finish(const binary_fuse8_probe_t *probe,
+                                             const binary_fuse8_t *filter) {
+  return ((uint32_t)probe->fingerprint ^ filter->Fingerprints[probe->hashes.h0] ^
+          filter->Fingerprints[probe->hashes.h1] ^
+          filter->Fingerprints[probe->hashes.h2]) == 0;
+}
+
+// Report, for each of the 'n' filters, if the key may be in it: bit i % 64 of
+// out_bitmap[i / 64] is set when binary_fuse8_contain(key, filters[i]) is true
+// (out_bitmap must hold (n + 63) / 64 words). The key is hashed again only when
+// the seed differs from the one of the previous filter, so it is hashed once
+// for filters built with binary_fuse8_populate_family and a common family seed.
+// All the locations are prefetched before the first one is read.
+static inline void binary_fuse8_contain_multi(uint64_t key, const binary_fuse8_t *const *filters,
+                                              size_t n, uint64_t *out_bitmap) {
+  binary_fuse8_probe_t probes[64];
+  if (n == 0) {
+    return;
+  }
+  uint64_t seed = filters[0]->Seed;
+  uint64_t hash = binary_fuse_mix_split(key, seed);
+  for (size_t start = 0; start < n; start += 64) {
+    size_t m = n - start < 64 ? n - start : 64;
+    for (size_t i = 0; i < m; i++) {
+      const binary_fuse8_t *filter = filters[start + i];
+      if (filter->Seed != seed) {
+        seed = filter->Seed;
+        hash = binary_fuse_mix_split(key, seed);
+      }
+      binary_fuse8_probe_prepare_hash(hash, filter, &probes[i]);
+    }
+    uint64_t bits = 0;
+    for (size_t i = 0; i < m; i++) {
+      bits |= (uint64_t)binary_fuse8_probe_finish(&probes[i], filters[start + i]) << i;
+    }
+    out_bitmap[start / 64] = bits;
+  }
+}
+
+// Report, for each of the 'count' keys, if it is in the set, with false
+// positive rate. The answer for keys[i] is written to out[i].
+// The keys are hashed BINARY_FUSE_BATCH_WINDOW positions ahead of the one being
+// resolved and their fingerprint locations are prefetched, so that several
+// cache misses are in flight at once. When the filter does not fit in cache,
+// this is much faster than calling binary_fuse8_contain in a loop.
+// Portable version of binary_fuse8_contain_batch.
+static inline void binary_fuse8_contain_batch_scalar(const uint64_t *keys, size_t count,
+                                                     bool *out,
+                                                     const binary_fuse8_t *filter) {
+  binary_fuse8_probe_t probes[BINARY_FUSE_BATCH_WINDOW];
+  const size_t mask = BINARY_FUSE_BATCH_WINDOW - 1;
+  size_t ahead = count < BINARY_FUSE_BATCH_WINDOW ? count : BINARY_FUSE_BATCH_WINDOW;
+  for (size_t i = 0; i < ahead; i++) {
+    binary_fuse8_probe_prepare(keys[i], filter, &probes[i]);
+  }
+  for (size_t i = 0; i < count; i++) {
+    size_t slot = i & mask;
+    out[i] = binary_fuse8_probe_finish(&probes[slot], filter);
+    if (i + BINARY_FUSE_BATCH_WINDOW < count) {
+      binary_fuse8_probe_prepare(keys[i + BINARY_FUSE_BATCH_WINDOW], filter, &probes[slot]);
+    }
+  }
+}
+
 static inline uint32_t binary_fuse_calculate_segment_length(uint32_t arity,
                                                              uint32_t size) {
   // These parameters are very sensitive. Replacing 'floor' by 'round' can
@@ -272,74 +529,158 @@ static inline uint8_t binary_fuse_mod3(uint8_t x) {
     return x > 2 ? x - 3 : x;
 }
 
-// Construct the filter, returns true on success, false on failure.
-// The algorithm fails when there is insufficient memory.
-// The caller is responsable for calling binary_fuse8_allocate(size,filter)
-// before. For best performance, the caller should ensure that there are not too
-// many duplicated keys.
-static inline bool binary_fuse8_populate(uint64_t *keys, uint32_t size,
-                           binary_fuse8_t *filter) {
+// Scratch memory of binary_fuse8_populate, binary_fuse16_populate and
+// binary_fuse32_populate, which the caller can keep from one construction to
+// the next with binary_fuse8_populate_with_workspace: the arrays are
+// allocated once, and a construction leaves reverseOrder, t2count and t2hash
+// cleared by undoing its own writes instead of clearing whole arrays again.
+typedef struct binary_fuse_workspace_s {
+  uint32_t KeyCapacity;   // entries of reverseH, reverseOrder has one more
+  uint32_t CellCapacity;  // entries of alone, t2count and t2hash
+  uint32_t BlockCapacity; // entries of startPos
+  uint64_t *reverseOrder; // all zero between constructions
+  uint8_t *reverseH;
+  uint32_t *alone;
+  uint8_t *t2count;       // all zero between constructions
+  uint64_t *t2hash;       // all zero between constructions
+  uint32_t *startPos;
+} binary_fuse_workspace_t;
+
+// release memory
+static inline void binary_fuse_workspace_free(binary_fuse_workspace_t *workspace) {
+  free(workspace->reverseOrder);
+  free(workspace->reverseH);
+  free(workspace->alone);
+  free(workspace->t2count);
+  free(workspace->t2hash);
+  free(workspace->startPos);
+  memset(workspace, 0, sizeof(binary_fuse_workspace_t));
+}
+
+// grow the workspace to 'size' keys, 'capacity' cells and 'block' blocks if
+// needed
+static inline bool binary_fuse_workspace_reserve(binary_fuse_workspace_t *workspace,
+                                                 uint32_t size, uint32_t capacity,
+                                                 uint32_t block) {
+  if (workspace->reverseOrder == NULL || workspace->reverseH == NULL ||
+      size > workspace->KeyCapacity) {
+    free(workspace->reverseOrder);
+    free(workspace->reverseH);
+    workspace->KeyCapacity = size;
+    workspace->reverseOrder = (uint64_t *)calloc((size_t)size + 1, sizeof(uint64_t));
+    workspace->reverseH = (uint8_t *)malloc(((size_t)size + 1) * sizeof(uint8_t));
+  }
+  if (workspace->alone == NULL || workspace->t2count == NULL || workspace->t2hash == NULL ||
+      capacity > workspace->CellCapacity) {
+    free(workspace->alone);
+    free(workspace->t2count);
+    free(workspace->t2hash);
+    workspace->CellCapacity = capacity;
+    workspace->alone = (uint32_t *)malloc(capacity * sizeof(uint32_t));
+    workspace->t2count = (uint8_t *)calloc(capacity, sizeof(uint8_t));
+    workspace->t2hash = (uint64_t *)calloc(capacity, sizeof(uint64_t));
+  }
+  if (workspace->startPos == NULL || block > workspace->BlockCapacity) {
+    free(workspace->startPos);
+    workspace->BlockCapacity = block;
+    workspace->startPos = (uint32_t *)malloc(block * sizeof(uint32_t));
+  }
+  if ((workspace->alone == NULL) || (workspace->t2count == NULL) ||
+      (workspace->reverseH == NULL) || (workspace->t2hash == NULL) ||
+      (workspace->reverseOrder == NULL) || (workspace->startPos == NULL)) {
+    binary_fuse_workspace_free(workspace);
+    return false;
+  }
+  return true;
+}
+
+// number of blocks by which the constructions sort the hashes
+static inline uint32_t binary_fuse_block_count(uint32_t segment_count) {
+  uint32_t blockBits = 1;
+  while (((uint32_t)1 << blockBits) < segment_count) {
+    blockBits += 1;
+  }
+  return (uint32_t)1 << blockBits;
+}
+
+// allocate a workspace for the filters of up to 'size' elements, it grows
+// when it is given a larger filter.
+// caller is responsible to call binary_fuse_workspace_free(workspace)
+static inline bool binary_fuse_workspace_allocate(uint32_t size,
+                                                  binary_fuse_workspace_t *workspace) {
+  memset(workspace, 0, sizeof(binary_fuse_workspace_t));
+  // the geometry of a filter of 'size' elements
+  binary_fuse8_t filter;
+  if (!binary_fuse8_allocate(size, &filter)) {
+    return false;
+  }
+  uint32_t capacity = filter.ArrayLength;
+  uint32_t block = binary_fuse_block_count(filter.SegmentCount);
+  binary_fuse8_free(&filter);
+  return binary_fuse_workspace_reserve(workspace, size, capacity, block);
+}
+
+// binary_fuse8_populate_family with the scratch memory of 'workspace', see
+// binary_fuse8_populate_with_workspace.
+static inline bool binary_fuse8_populate_family_with_workspace(uint64_t *keys, uint32_t size,
+                                                               uint64_t family_seed,
+                                                               binary_fuse8_t *filter,
+                                                               binary_fuse_workspace_t *workspace) {
   if (size != filter->Size) {
     return false;
   }
 
-  uint64_t rng_counter = 0x726b2b9d438b9d4d;
+  uint64_t rng_counter = family_seed;
   filter->Seed = binary_fuse_rng_splitmix64(&rng_counter);
-  uint64_t *reverseOrder = (uint64_t *)calloc((size + 1), sizeof(uint64_t));
   uint32_t capacity = filter->ArrayLength;
-  uint32_t *alone = (uint32_t *)malloc(capacity * sizeof(uint32_t));
-  uint8_t *t2count = (uint8_t *)calloc(capacity, sizeof(uint8_t));
-  uint8_t *reverseH = (uint8_t *)malloc(size * sizeof(uint8_t));
-  uint64_t *t2hash = (uint64_t *)calloc(capacity, sizeof(uint64_t));
-
   uint32_t blockBits = 1;
   while (((uint32_t)1 << blockBits) < filter->SegmentCount) {
     blockBits += 1;
   }
   uint32_t block = ((uint32_t)1 << blockBits);
-  uint32_t *startPos = (uint32_t *)malloc((1U << blockBits) * sizeof(uint32_t));
-  uint32_t h012[5];
-
-  if ((alone == NULL) || (t2count == NULL) || (reverseH == NULL) ||
-      (t2hash == NULL) || (reverseOrder == NULL) || (startPos == NULL)) {
-    free(alone);
-    free(t2count);
-    free(reverseH);
-    free(t2hash);
-    free(reverseOrder);
-    free(startPos);
+  if (!binary_fuse_workspace_reserve(workspace, size, capacity, block)) {
     return false;
   }
+  uint64_t *reverseOrder = workspace->reverseOrder;
+  uint32_t *alone = workspace->alone;
+  uint8_t *t2count = workspace->t2count;
+  uint8_t *reverseH = workspace->reverseH;
+  uint64_t *t2hash = workspace->t2hash;
+  uint32_t *startPos = workspace->startPos;
+  // removing duplicates shrinks 'size', not the part of reverseOrder to clear
+  uint32_t touched = size + 1;
+  uint32_t h012[5];
+  uint64_t hashes[BINARY_FUSE_HASH_BLOCK];
+
   reverseOrder[size] = 1;
   for (int loop = 0; true; ++loop) {
     if (loop + 1 > XOR_MAX_ITERATIONS) {
       // The probability of this happening is lower than the
       // the cosmic-ray probability (i.e., a cosmic ray corrupts your system)
-      free(alone);
-      free(t2count);
-      free(reverseH);
-      free(t2hash);
-      free(reverseOrder);
-      free(startPos);
+      memset(reverseOrder, 0, sizeof(uint64_t) * touched);
       return false;
     }
 
     for (uint32_t i = 0; i < block; i++) {
       // important : i * size would overflow as a 32-bit number in some
       // cases.
-      startPos[i] = (uint32_t)((uint64_t)i * size) >> blockBits;
+      startPos[i] = (uint32_t)(((uint64_t)i * size) >> blockBits);
     }
 
     uint64_t maskblock = block - 1;
-    for (uint32_t i = 0; i < size; i++) {
-      uint64_t hash = binary_fuse_murmur64(keys[i] + filter->Seed);
-      uint64_t segment_index = hash >> (64 - blockBits);
-      while (reverseOrder[startPos[segment_index]] != 0) {
-        segment_index++;
-        segment_index &= maskblock;
+    for (uint32_t start = 0; start < size; start += BINARY_FUSE_HASH_BLOCK) {
+      uint32_t n = size - start < BINARY_FUSE_HASH_BLOCK ? size - start : BINARY_FUSE_HASH_BLOCK;
+      binary_fuse_hash_keys(keys + start, n, filter->Seed, hashes);
+      for (uint32_t i = 0; i < n; i++) {
+        uint64_t hash = hashes[i];
+        uint64_t segment_index = hash >> (64 - blockBits);
+        while (reverseOrder[startPos[segment_index]] != 0) {
+          segment_index++;
+          segment_index &= maskblock;
+        }
+        reverseOrder[startPos[segment_index]] = hash;
+        startPos[segment_index]++;
       }
-      reverseOrder[startPos[segment_index]] = hash;
-      startPos[segment_index]++;
     }
     int error = 0;
     uint32_t duplicates = 0;
@@ -376,6 +717,10 @@ static inline bool binary_fuse8_populate(uint64_t *keys, uint32_t size,
       error = (t2count[h2] < 4) ? 1 : error;
     }
     if(error) {
+      if(duplicates > 0) {
+        // many copies of a key can overflow a counter before they are detected
+        size = (uint32_t)binary_fuse_sort_and_remove_dup(keys, size);
+      }
       memset(reverseOrder, 0, sizeof(uint64_t) * size);
       memset(t2count, 0, sizeof(uint8_t) * capacity);
       memset(t2hash, 0, sizeof(uint64_t) * capacity);
@@ -449,16 +794,289 @@ static inline bool binary_fuse8_populate(uint64_t *keys, uint32_t size,
     filter->Fingerprints[h012[found]] = (uint8_t)((uint32_t)xor2 ^
                                                   filter->Fingerprints[h012[found + 1]] ^
                                                   filter->Fingerprints[h012[found + 2]]);
+    // the cell the key was peeled from is the only one left with a key
+    t2count[h012[found]] = 0;
+    t2hash[h012[found]] = 0;
+  }
+  memset(reverseOrder, 0, sizeof(uint64_t) * touched);
+  return true;
+}
+
+// Construct the filter like binary_fuse8_populate, but derive the seeds
+// from 'family_seed'. Filters built with the same family_seed almost always
+// end up with the same Seed (they differ only when the construction needs to
+// retry with another seed), so that binary_fuse8_contain_multi hashes a key
+// once for all of them. Returns true on success, false on failure.
+static inline bool binary_fuse8_populate_family(uint64_t *keys, uint32_t size,
+                                                uint64_t family_seed,
+                                                binary_fuse8_t *filter) {
+  binary_fuse_workspace_t workspace;
+  memset(&workspace, 0, sizeof(workspace));
+  bool ok = binary_fuse8_populate_family_with_workspace(keys, size, family_seed, filter,
+                                                        &workspace);
+  binary_fuse_workspace_free(&workspace);
+  return ok;
+}
+
+// Construct the filter, returns true on success, false on failure.
+// The algorithm fails when there is insufficient memory.
+// The caller is responsable for calling binary_fuse8_allocate(size,filter)
+// before. For best performance, the caller should ensure that there are not too
+// many duplicated keys.
+static inline bool binary_fuse8_populate(uint64_t *keys, uint32_t size,
+                           binary_fuse8_t *filter) {
+  return binary_fuse8_populate_family(keys, size, 0x726b2b9d438b9d4d, filter);
+}
+
+// Construct the filter like binary_fuse8_populate, with the scratch memory of
+// 'workspace', returns true on success, false on failure. The workspace grows
+// if the filter is larger than the ones it was allocated for, and can be
+// reused as soon as the function returns: rebuilding many filters then
+// allocates and clears no memory.
+// The caller is responsable for calling binary_fuse8_allocate(size,filter)
+// and binary_fuse_workspace_allocate before.
+static inline bool binary_fuse8_populate_with_workspace(uint64_t *keys, uint32_t size,
+                                                        binary_fuse8_t *filter,
+                                                        binary_fuse_workspace_t *workspace) {
+  return binary_fuse8_populate_family_with_workspace(keys, size, 0x726b2b9d438b9d4d, filter,
+                                                     workspace);
+}
+
+// Reorder the keys in place by the block of their hash under 'seed', blocks
+// of 2^block_bits, with an American flag sort: the keys of a block then reach
+// neighbouring cells. 'next' and 'end' hold 2^block_bits entries each.
+static inline void binary_fuse_partition_keys(uint64_t *keys, uint32_t size, uint64_t seed,
+                                              uint32_t block_bits, uint32_t *next,
+                                              uint32_t *end) {
+  uint32_t block = (uint32_t)1 << block_bits;
+  memset(end, 0, block * sizeof(uint32_t));
+  for (uint32_t i = 0; i < size; i++) {
+    end[binary_fuse_mix_split(keys[i], seed) >> (64 - block_bits)]++;
+  }
+  uint32_t offset = 0;
+  for (uint32_t b = 0; b < block; b++) {
+    next[b] = offset;
+    offset += end[b];
+    end[b] = offset;
+  }
+  for (uint32_t b = 0; b < block; b++) {
+    while (next[b] < end[b]) {
+      uint64_t key = keys[next[b]];
+      uint32_t d = (uint32_t)(binary_fuse_mix_split(key, seed) >> (64 - block_bits));
+      while (d != b) {
+        uint64_t displaced = keys[next[d]];
+        keys[next[d]++] = key;
+        key = displaced;
+        d = (uint32_t)(binary_fuse_mix_split(key, seed) >> (64 - block_bits));
+      }
+      keys[next[b]++] = key;
+    }
+  }
+}
+
+// Construct the filter like binary_fuse8_populate, with about 9 bytes of
+// temporary memory per key instead of about 24. The cells count their keys in
+// the Fingerprints array itself, and hold the xor of the indexes of their keys
+// in 'keys' (4 bytes) instead of the xor of their hashes (8 bytes): a key is
+// hashed again when it is peeled and when it is assigned. Instead of a sorted
+// copy of the hashes, the keys themselves are reordered by segment, and the
+// array of the cells with a single key also records the peeling order. The
+// construction is about 1.8 times slower, and the filter is not the one
+// binary_fuse8_populate builds. Duplicated keys cost a failed attempt and a
+// sort of the keys. Returns true on success, false on failure.
+// The caller is responsable for calling binary_fuse8_allocate(size,filter)
+// before. The keys are reordered.
+static inline bool binary_fuse8_populate_lowmem(uint64_t *keys, uint32_t size,
+                                                binary_fuse8_t *filter) {
+  if (size != filter->Size) {
+    return false;
+  }
+  uint64_t rng_counter = 0x726b2b9d438b9d4d;
+  filter->Seed = binary_fuse_rng_splitmix64(&rng_counter);
+  uint32_t capacity = filter->ArrayLength;
+  // count << 2 | xor of the positions (0, 1 or 2) of the keys in the cell
+  uint8_t *t2count = filter->Fingerprints;
+  uint32_t *t2index = (uint32_t *)calloc(capacity, sizeof(uint32_t));
+  // the peeling order, and the cells with a single key to visit
+  uint32_t *alone = (uint32_t *)malloc(((size_t)capacity + 1) * sizeof(uint32_t));
+  uint32_t blockBits = 1;
+  while (((uint32_t)1 << blockBits) < filter->SegmentCount) {
+    blockBits += 1;
+  }
+  uint32_t *next = (uint32_t *)malloc(((size_t)2 << blockBits) * sizeof(uint32_t));
+  uint32_t h012[5];
+  uint64_t hashes[BINARY_FUSE_HASH_BLOCK];
+  if ((t2index == NULL) || (alone == NULL) || (next == NULL)) {
+    free(t2index);
+    free(alone);
+    free(next);
+    return false;
+  }
+  memset(t2count, 0, capacity * sizeof(uint8_t));
+  bool deduplicated = false;
+  uint32_t stacksize = 0;
+  for (int loop = 0; true; ++loop) {
+    if (loop + 1 > XOR_MAX_ITERATIONS) {
+      free(t2index);
+      free(alone);
+      free(next);
+      memset(filter->Fingerprints, 0, capacity * sizeof(uint8_t));
+      return false;
+    }
+    binary_fuse_partition_keys(keys, size, filter->Seed, blockBits, next,
+                               next + ((size_t)1 << blockBits));
+    int error = 0;
+    for (uint32_t start = 0; start < size; start += BINARY_FUSE_HASH_BLOCK) {
+      uint32_t n = size - start < BINARY_FUSE_HASH_BLOCK ? size - start : BINARY_FUSE_HASH_BLOCK;
+      binary_fuse_hash_keys(keys + start, n, filter->Seed, hashes);
+      for (uint32_t i = 0; i < n; i++) {
+        uint64_t hash = hashes[i];
+        uint32_t h0 = binary_fuse8_hash(0, hash, filter);
+        t2count[h0] += 4;
+        t2index[h0] ^= start + i;
+        uint32_t h1 = binary_fuse8_hash(1, hash, filter);
+        t2count[h1] += 4;
+        t2count[h1] ^= 1U;
+        t2index[h1] ^= start + i;
+        uint32_t h2 = binary_fuse8_hash(2, hash, filter);
+        t2count[h2] += 4;
+        t2count[h2] ^= 2U;
+        t2index[h2] ^= start + i;
+        // many copies of a key overflow a counter
+        error = (t2count[h0] < 4) ? 1 : error;
+        error = (t2count[h1] < 4) ? 1 : error;
+        error = (t2count[h2] < 4) ? 1 : error;
+      }
+    }
+    stacksize = 0;
+    if (!error) {
+      // the cells to visit are stacked down from the end of 'alone', the
+      // peeled cells up from its start: a cell is stacked at most once, so
+      // the two never meet
+      uint32_t top = capacity + 1;
+      for (uint32_t i = 0; i < capacity; i++) {
+        alone[top - 1] = i;
+        top -= ((t2count[i] >> 2U) == 1) ? 1U : 0U;
+      }
+      while (top <= capacity) {
+        uint32_t index = alone[top++];
+        if ((t2count[index] >> 2U) == 1) {
+          // the cell keeps the count and the index of its key, for the
+          // assignment: no other key reaches it
+          uint32_t key_index = t2index[index];
+          uint64_t hash = binary_fuse_mix_split(keys[key_index], filter->Seed);
+          h012[1] = binary_fuse8_hash(1, hash, filter);
+          h012[2] = binary_fuse8_hash(2, hash, filter);
+          h012[3] = binary_fuse8_hash(0, hash, filter);
+          h012[4] = h012[1];
+          uint8_t found = t2count[index] & 3U;
+          alone[stacksize++] = index;
+          uint32_t other_index1 = h012[found + 1];
+          alone[top - 1] = other_index1;
+          top -= ((t2count[other_index1] >> 2U) == 2 ? 1U : 0U);
+          t2count[other_index1] -= 4;
+          t2count[other_index1] ^= binary_fuse_mod3(found + 1);
+          t2index[other_index1] ^= key_index;
+
+          uint32_t other_index2 = h012[found + 2];
+          alone[top - 1] = other_index2;
+          top -= ((t2count[other_index2] >> 2U) == 2 ? 1U : 0U);
+          t2count[other_index2] -= 4;
+          t2count[other_index2] ^= binary_fuse_mod3(found + 2);
+          t2index[other_index2] ^= key_index;
+        }
+      }
+      if (stacksize == size) {
+        break;
+      }
+    }
+    if (!deduplicated) {
+      // copies of a key share their three cells and never peel
+      deduplicated = true;
+      size = (uint32_t)binary_fuse_sort_and_remove_dup(keys, size);
+    }
+    memset(t2count, 0, capacity * sizeof(uint8_t));
+    memset(t2index, 0, capacity * sizeof(uint32_t));
+    filter->Seed = binary_fuse_rng_splitmix64(&rng_counter);
   }
+
+  // The cells that were not peeled are back to 0. A key is assigned after
+  // the keys peeled after it, which hold its two other cells.
+  for (uint32_t i = stacksize - 1; i < stacksize; i--) {
+    uint32_t index = alone[i];
+    uint64_t hash = binary_fuse_mix_split(keys[t2index[index]], filter->Seed);
+    uint8_t found = t2count[index] & 3U;
+    h012[0] = binary_fuse8_hash(0, hash, filter);
+    h012[1] = binary_fuse8_hash(1, hash, filter);
+    h012[2] = binary_fuse8_hash(2, hash, filter);
+    h012[3] = h012[0];
+    h012[4] = h012[1];
+    filter->Fingerprints[index] = (uint8_t)((uint32_t)binary_fuse8_fingerprint(hash) ^
+                                            filter->Fingerprints[h012[found + 1]] ^
+                                            filter->Fingerprints[h012[found + 2]]);
+  }
+  free(t2index);
   free(alone);
-  free(t2count);
-  free(reverseH);
-  free(t2hash);
-  free(reverseOrder);
-  free(startPos);
+  free(next);
   return true;
 }
 
+// Construct the filter from 'size' byte strings: ptrs[i] points to the
+// lens[i] bytes of the i-th key. Each string is hashed with
+// binary_fuse_hash_bytes; the filter then holds the hashes, so that
+// binary_fuse8_contain_bytes(ptrs[i], lens[i], filter) is true. Repeated
+// strings are fine. The hashes are kept in a temporary array of 8 bytes per
+// key, which the construction needs for its retries and duplicate removal.
+// The caller is responsable for calling binary_fuse8_allocate(size,filter)
+// before. Returns true on success, false on failure.
+static inline bool binary_fuse8_populate_bytes(const void *const *ptrs, const size_t *lens,
+                                               uint32_t size, binary_fuse8_t *filter) {
+  uint64_t *hashes = (uint64_t *)malloc(((size_t)size + 1) * sizeof(uint64_t));
+  if (hashes == NULL) {
+    return false;
+  }
+  for (uint32_t i = 0; i < size; i++) {
+    hashes[i] = binary_fuse_hash_bytes(ptrs[i], lens[i]);
+  }
+  bool ok = binary_fuse8_populate(hashes, size, filter);
+  free(hashes);
+  return ok;
+}
+
+// Report if the 'length' bytes at 'data' are in the set built by
+// binary_fuse8_populate_bytes, with false positive rate.
+static inline bool binary_fuse8_contain_bytes(const void *data, size_t length,
+                                              const binary_fuse8_t *filter) {
+  return binary_fuse8_contain(binary_fuse_hash_bytes(data, length), filter);
+}
+
+// Report, for each of the 'count' byte strings, if it is in the set built by
+// binary_fuse8_populate_bytes: out[i] is
+// binary_fuse8_contain_bytes(ptrs[i], lens[i], filter). As in
+// binary_fuse8_contain_batch_scalar, the strings are hashed a few positions
+// ahead and their locations prefetched.
+static inline void binary_fuse8_contain_bytes_batch(const void *const *ptrs, const size_t *lens,
+                                                    size_t count, bool *out,
+                                                    const binary_fuse8_t *filter) {
+  binary_fuse8_probe_t probes[BINARY_FUSE_BATCH_WINDOW];
+  const size_t mask = BINARY_FUSE_BATCH_WINDOW - 1;
+  size_t ahead = count < BINARY_FUSE_BATCH_WINDOW ? count : BINARY_FUSE_BATCH_WINDOW;
+  for (size_t i = 0; i < ahead; i++) {
+    uint64_t hash = binary_fuse_mix_split(binary_fuse_hash_bytes(ptrs[i], lens[i]), filter->Seed);
+    binary_fuse8_probe_prepare_hash(hash, filter, &probes[i]);
+  }
+  for (size_t i = 0; i < count; i++) {
+    size_t slot = i & mask;
+    out[i] = binary_fuse8_probe_finish(&probes[slot], filter);
+    size_t next = i + BINARY_FUSE_BATCH_WINDOW;
+    if (next < count) {
+      uint64_t hash =
+          binary_fuse_mix_split(binary_fuse_hash_bytes(ptrs[next], lens[next]), filter->Seed);
+      binary_fuse8_probe_prepare_hash(hash, filter, &probes[slot]);
+    }
+  }
+}
+
 //////////////////
 // fuse16
 //////////////////
@@ -512,6 +1130,92 @@ static inline bool binary_fuse16_contain(uint64_t key,
   return f == 0;
 }
 
+// A query split in two phases, see binary_fuse8_probe_prepare.
+typedef struct binary_fuse16_probe_s {
+  binary_hashes_t hashes;
+  uint16_t fingerprint;
+} binary_fuse16_probe_t;
+
+// binary_fuse16_probe_prepare from the hash of the key,
+// binary_fuse_mix_split(key, filter->Seed)
+static inline void binary_fuse16_probe_prepare_hash(uint64_t hash, const binary_fuse16_t *filter,
+                                                    binary_fuse16_probe_t *probe) {
+  probe->fingerprint = binary_fuse16_fingerprint(hash);
+  probe->hashes = binary_fuse16_hash_batch(hash, filter);
+  binary_fuse_prefetch(filter->Fingerprints + probe->hashes.h0);
+  binary_fuse_prefetch(filter->Fingerprints + probe->hashes.h1);
+  binary_fuse_prefetch(filter->Fingerprints + probe->hashes.h2);
+}
+
+// First phase of a query: hash the key, compute its fingerprint and its three
+// locations, and prefetch them. See binary_fuse8_probe_prepare.
+static inline void binary_fuse16_probe_prepare(uint64_t key, const binary_fuse16_t *filter,
+                                               binary_fuse16_probe_t *probe) {
+  binary_fuse16_probe_prepare_hash(binary_fuse_mix_split(key, filter->Seed), filter, probe);
+}
+
+// Second phase of a query: report if the key given to
+// binary_fuse16_probe_prepare is in the set, with false positive rate.
+static inline bool binary_fuse16_probe_finish(const binary_fuse16_probe_t *probe,
+                                              const binary_fuse16_t *filter) {
+  return ((uint32_t)probe->fingerprint ^ filter->Fingerprints[probe->hashes.h0] ^
+          filter->Fingerprints[probe->hashes.h1] ^
+          filter->Fingerprints[probe->hashes.h2]) == 0;
+}
+
+// Report, for each of the 'n' filters, if the key may be in it: bit i % 64 of
+// out_bitmap[i / 64] is set when binary_fuse16_contain(key, filters[i]) is true
+// (out_bitmap must hold (n + 63) / 64 words). The key is hashed again only when
+// the seed differs from the one of the previous filter, so it is hashed once
+// for filters built with binary_fuse16_populate_family and a common family seed.
+// All the locations are prefetched before the first one is read.
+static inline void binary_fuse16_contain_multi(uint64_t key, const binary_fuse16_t *const *filters,
+                                              size_t n, uint64_t *out_bitmap) {
+  binary_fuse16_probe_t probes[64];
+  if (n == 0) {
+    return;
+  }
+  uint64_t seed = filters[0]->Seed;
+  uint64_t hash = binary_fuse_mix_split(key, seed);
+  for (size_t start = 0; start < n; start += 64) {
+    size_t m = n - start < 64 ? n - start : 64;
+    for (size_t i = 0; i < m; i++) {
+      const binary_fuse16_t *filter = filters[start + i];
+      if (filter->Seed != seed) {
+        seed = filter->Seed;
+        hash = binary_fuse_mix_split(key, seed);
+      }
+      binary_fuse16_probe_prepare_hash(hash, filter, &probes[i]);
+    }
+    uint64_t bits = 0;
+    for (size_t i = 0; i < m; i++) {
+      bits |= (uint64_t)binary_fuse16_probe_finish(&probes[i], filters[start + i]) << i;
+    }
+    out_bitmap[start / 64] = bits;
+  }
+}
+
+// Report, for each of the 'count' keys, if it is in the set, with false
+// positive rate. The answer for keys[i] is written to out[i].
+// Portable version of binary_fuse16_contain_batch, see binary_fuse8_contain_batch_scalar.
+static inline void binary_fuse16_contain_batch_scalar(const uint64_t *keys, size_t count,
+                                                      bool *out,
+                                                      const binary_fuse16_t *filter) {
+  binary_fuse16_probe_t probes[BINARY_FUSE_BATCH_WINDOW];
+  const size_t mask = BINARY_FUSE_BATCH_WINDOW - 1;
+  size_t ahead = count < BINARY_FUSE_BATCH_WINDOW ? count : BINARY_FUSE_BATCH_WINDOW;
+  for (size_t i = 0; i < ahead; i++) {
+    binary_fuse16_probe_prepare(keys[i], filter, &probes[i]);
+  }
+  for (size_t i = 0; i < count; i++) {
+    size_t slot = i & mask;
+    out[i] = binary_fuse16_probe_finish(&probes[slot], filter);
+    if (i + BINARY_FUSE_BATCH_WINDOW < count) {
+      binary_fuse16_probe_prepare(keys[i + BINARY_FUSE_BATCH_WINDOW], filter, &probes[slot]);
+    }
+  }
+}
+
 
 // allocate enough capacity for a set containing up to 'size' elements
 // caller is responsible to call binary_fuse16_free(filter)
@@ -565,55 +1269,44 @@ static inline void binary_fuse16_free(binary_fuse16_t *filter) {
 }
 
 
-// Construct the filter, returns true on success, false on failure.
-// The algorithm fails when there is insufficient memory.
-// The caller is responsable for calling binary_fuse8_allocate(size,filter)
-// before. For best performance, the caller should ensure that there are not too
-// many duplicated keys.
-static inline bool binary_fuse16_populate(uint64_t *keys, uint32_t size,
-                           binary_fuse16_t *filter) {
+// binary_fuse16_populate_family with the scratch memory of 'workspace', see
+// binary_fuse16_populate_with_workspace.
+static inline bool binary_fuse16_populate_family_with_workspace(uint64_t *keys, uint32_t size,
+                                                                uint64_t family_seed,
+                                                                binary_fuse16_t *filter,
+                                                                binary_fuse_workspace_t *workspace) {
   if (size != filter->Size) {
     return false;
   }
 
-  uint64_t rng_counter = 0x726b2b9d438b9d4d;
+  uint64_t rng_counter = family_seed;
   filter->Seed = binary_fuse_rng_splitmix64(&rng_counter);
-  uint64_t *reverseOrder = (uint64_t *)calloc((size + 1), sizeof(uint64_t));
   uint32_t capacity = filter->ArrayLength;
-  uint32_t *alone = (uint32_t *)malloc(capacity * sizeof(uint32_t));
-  uint8_t *t2count = (uint8_t *)calloc(capacity, sizeof(uint8_t));
-  uint8_t *reverseH = (uint8_t *)malloc(size * sizeof(uint8_t));
-  uint64_t *t2hash = (uint64_t *)calloc(capacity, sizeof(uint64_t));
-
   uint32_t blockBits = 1;
   while (((uint32_t)1 << blockBits) < filter->SegmentCount) {
     blockBits += 1;
   }
   uint32_t block = ((uint32_t)1 << blockBits);
-  uint32_t *startPos = (uint32_t *)malloc((1U << blockBits) * sizeof(uint32_t));
-  uint32_t h012[5];
-
-  if ((alone == NULL) || (t2count == NULL) || (reverseH == NULL) ||
-      (t2hash == NULL) || (reverseOrder == NULL) || (startPos == NULL)) {
-    free(alone);
-    free(t2count);
-    free(reverseH);
-    free(t2hash);
-    free(reverseOrder);
-    free(startPos);
+  if (!binary_fuse_workspace_reserve(workspace, size, capacity, block)) {
     return false;
   }
+  uint64_t *reverseOrder = workspace->reverseOrder;
+  uint32_t *alone = workspace->alone;
+  uint8_t *t2count = workspace->t2count;
+  uint8_t *reverseH = workspace->reverseH;
+  uint64_t *t2hash = workspace->t2hash;
+  uint32_t *startPos = workspace->startPos;
+  // removing duplicates shrinks 'size', not the part of reverseOrder to clear
+  uint32_t touched = size + 1;
+  uint32_t h012[5];
+  uint64_t hashes[BINARY_FUSE_HASH_BLOCK];
+
   reverseOrder[size] = 1;
   for (int loop = 0; true; ++loop) {
     if (loop + 1 > XOR_MAX_ITERATIONS) {
       // The probability of this happening is lower than the
       // the cosmic-ray probability (i.e., a cosmic ray corrupts your system).
-      free(alone);
-      free(t2count);
-      free(reverseH);
-      free(t2hash);
-      free(reverseOrder);
-      free(startPos);
+      memset(reverseOrder, 0, sizeof(uint64_t) * touched);
       return false;
     }
 
@@ -624,15 +1317,19 @@ static inline bool binary_fuse16_populate(uint64_t *keys, uint32_t size,
     }
 
     uint64_t maskblock = block - 1;
-    for (uint32_t i = 0; i < size; i++) {
-      uint64_t hash = binary_fuse_murmur64(keys[i] + filter->Seed);
-      uint64_t segment_index = hash >> (64 - blockBits);
-      while (reverseOrder[startPos[segment_index]] != 0) {
-        segment_index++;
-        segment_index &= maskblock;
+    for (uint32_t start = 0; start < size; start += BINARY_FUSE_HASH_BLOCK) {
+      uint32_t n = size - start < BINARY_FUSE_HASH_BLOCK ? size - start : BINARY_FUSE_HASH_BLOCK;
+      binary_fuse_hash_keys(keys + start, n, filter->Seed, hashes);
+      for (uint32_t i = 0; i < n; i++) {
+        uint64_t hash = hashes[i];
+        uint64_t segment_index = hash >> (64 - blockBits);
+        while (reverseOrder[startPos[segment_index]] != 0) {
+          segment_index++;
+          segment_index &= maskblock;
+        }
+        reverseOrder[startPos[segment_index]] = hash;
+        startPos[segment_index]++;
       }
-      reverseOrder[startPos[segment_index]] = hash;
-      startPos[segment_index]++;
     }
     int error = 0;
     uint32_t duplicates = 0;
@@ -669,6 +1366,10 @@ static inline bool binary_fuse16_populate(uint64_t *keys, uint32_t size,
       error = (t2count[h2] < 4) ? 1 : error;
     }
     if(error) {
+      if(duplicates > 0) {
+        // many copies of a key can overflow a counter before they are detected
+        size = (uint32_t)binary_fuse_sort_and_remove_dup(keys, size);
+      }
       memset(reverseOrder, 0, sizeof(uint64_t) * size);
       memset(t2count, 0, sizeof(uint8_t) * capacity);
       memset(t2hash, 0, sizeof(uint64_t) * capacity);
@@ -743,7 +1444,5480 @@ static inline bool binary_fuse16_populate(uint64_t *keys, uint32_t size,
         (uint32_t)xor2 ^
         (uint32_t)filter->Fingerprints[h012[found + 1]] ^
         (uint32_t)filter->Fingerprints[h012[found + 2]]);
+    // the cell the key was peeled from is the only one left with a key
+    t2count[h012[found]] = 0;
+    t2hash[h012[found]] = 0;
   }
+  memset(reverseOrder, 0, sizeof(uint64_t) * touched);
+  return true;
+}
+
+// Construct the filter like binary_fuse16_populate, but derive the seeds
+// from 'family_seed'. Filters built with the same family_seed almost always
+// end up with the same Seed (they differ only when the construction needs to
+// retry with another seed), so that binary_fuse16_contain_multi hashes a key
+// once for all of them. Returns true on success, false on failure.
+static inline bool binary_fuse16_populate_family(uint64_t *keys, uint32_t size,
+                                                 uint64_t family_seed,
+                                                 binary_fuse16_t *filter) {
+  binary_fuse_workspace_t workspace;
+  memset(&workspace, 0, sizeof(workspace));
+  bool ok = binary_fuse16_populate_family_with_workspace(keys, size, family_seed, filter,
+                                                         &workspace);
+  binary_fuse_workspace_free(&workspace);
+  return ok;
+}
+
+// Construct the filter, returns true on success, false on failure.
+// The algorithm fails when there is insufficient memory.
+// The caller is responsable for calling binary_fuse8_allocate(size,filter)
+// before. For best performance, the caller should ensure that there are not too
+// many duplicated keys.
+static inline bool binary_fuse16_populate(uint64_t *keys, uint32_t size,
+                           binary_fuse16_t *filter) {
+  return binary_fuse16_populate_family(keys, size, 0x726b2b9d438b9d4d, filter);
+}
+
+// Construct the filter like binary_fuse16_populate, with the scratch memory of
+// 'workspace', returns true on success, false on failure. The workspace grows
+// if the filter is larger than the ones it was allocated for, and can be
+// reused as soon as the function returns: rebuilding many filters then
+// allocates and clears no memory.
+// The caller is responsable for calling binary_fuse16_allocate(size,filter)
+// and binary_fuse_workspace_allocate before.
+static inline bool binary_fuse16_populate_with_workspace(uint64_t *keys, uint32_t size,
+                                                         binary_fuse16_t *filter,
+                                                         binary_fuse_workspace_t *workspace) {
+  return binary_fuse16_populate_family_with_workspace(keys, size, 0x726b2b9d438b9d4d, filter,
+                                                      workspace);
+}
+
+// Construct the filter like binary_fuse16_populate, with about 9 bytes of
+// temporary memory per key instead of about 24, see
+// binary_fuse8_populate_lowmem. Returns true on success, false on failure.
+// The caller is responsable for calling binary_fuse16_allocate(size,filter)
+// before. The keys are reordered.
+static inline bool binary_fuse16_populate_lowmem(uint64_t *keys, uint32_t size,
+                                                 binary_fuse16_t *filter) {
+  if (size != filter->Size) {
+    return false;
+  }
+  uint64_t rng_counter = 0x726b2b9d438b9d4d;
+  filter->Seed = binary_fuse_rng_splitmix64(&rng_counter);
+  uint32_t capacity = filter->ArrayLength;
+  // count << 2 | xor of the positions (0, 1 or 2) of the keys in the cell
+  uint16_t *t2count = filter->Fingerprints;
+  uint32_t *t2index = (uint32_t *)calloc(capacity, sizeof(uint32_t));
+  // the peeling order, and the cells with a single key to visit
+  uint32_t *alone = (uint32_t *)malloc(((size_t)capacity + 1) * sizeof(uint32_t));
+  uint32_t blockBits = 1;
+  while (((uint32_t)1 << blockBits) < filter->SegmentCount) {
+    blockBits += 1;
+  }
+  uint32_t *next = (uint32_t *)malloc(((size_t)2 << blockBits) * sizeof(uint32_t));
+  uint32_t h012[5];
+  uint64_t hashes[BINARY_FUSE_HASH_BLOCK];
+  if ((t2index == NULL) || (alone == NULL) || (next == NULL)) {
+    free(t2index);
+    free(alone);
+    free(next);
+    return false;
+  }
+  memset(t2count, 0, capacity * sizeof(uint16_t));
+  bool deduplicated = false;
+  uint32_t stacksize = 0;
+  for (int loop = 0; true; ++loop) {
+    if (loop + 1 > XOR_MAX_ITERATIONS) {
+      free(t2index);
+      free(alone);
+      free(next);
+      memset(filter->Fingerprints, 0, capacity * sizeof(uint16_t));
+      return false;
+    }
+    binary_fuse_partition_keys(keys, size, filter->Seed, blockBits, next,
+                               next + ((size_t)1 << blockBits));
+    int error = 0;
+    for (uint32_t start = 0; start < size; start += BINARY_FUSE_HASH_BLOCK) {
+      uint32_t n = size - start < BINARY_FUSE_HASH_BLOCK ? size - start : BINARY_FUSE_HASH_BLOCK;
+      binary_fuse_hash_keys(keys + start, n, filter->Seed, hashes);
+      for (uint32_t i = 0; i < n; i++) {
+        uint64_t hash = hashes[i];
+        uint32_t h0 = binary_fuse16_hash(0, hash, filter);
+        t2count[h0] += 4;
+        t2index[h0] ^= start + i;
+        uint32_t h1 = binary_fuse16_hash(1, hash, filter);
+        t2count[h1] += 4;
+        t2count[h1] ^= 1U;
+        t2index[h1] ^= start + i;
+        uint32_t h2 = binary_fuse16_hash(2, hash, filter);
+        t2count[h2] += 4;
+        t2count[h2] ^= 2U;
+        t2index[h2] ^= start + i;
+        // many copies of a key overflow a counter
+        error = (t2count[h0] < 4) ? 1 : error;
+        error = (t2count[h1] < 4) ? 1 : error;
+        error = (t2count[h2] < 4) ? 1 : error;
+      }
+    }
+    stacksize = 0;
+    if (!error) {
+      // the cells to visit are stacked down from the end of 'alone', the
+      // peeled cells up from its start: a cell is stacked at most once, so
+      // the two never meet
+      uint32_t top = capacity + 1;
+      for (uint32_t i = 0; i < capacity; i++) {
+        alone[top - 1] = i;
+        top -= ((t2count[i] >> 2U) == 1) ? 1U : 0U;
+      }
+      while (top <= capacity) {
+        uint32_t index = alone[top++];
+        if ((t2count[index] >> 2U) == 1) {
+          // the cell keeps the count and the index of its key, for the
+          // assignment: no other key reaches it
+          uint32_t key_index = t2index[index];
+          uint64_t hash = binary_fuse_mix_split(keys[key_index], filter->Seed);
+          h012[1] = binary_fuse16_hash(1, hash, filter);
+          h012[2] = binary_fuse16_hash(2, hash, filter);
+          h012[3] = binary_fuse16_hash(0, hash, filter);
+          h012[4] = h012[1];
+          uint8_t found = t2count[index] & 3U;
+          alone[stacksize++] = index;
+          uint32_t other_index1 = h012[found + 1];
+          alone[top - 1] = other_index1;
+          top -= ((t2count[other_index1] >> 2U) == 2 ? 1U : 0U);
+          t2count[other_index1] -= 4;
+          t2count[other_index1] ^= binary_fuse_mod3(found + 1);
+          t2index[other_index1] ^= key_index;
+
+          uint32_t other_index2 = h012[found + 2];
+          alone[top - 1] = other_index2;
+          top -= ((t2count[other_index2] >> 2U) == 2 ? 1U : 0U);
+          t2count[other_index2] -= 4;
+          t2count[other_index2] ^= binary_fuse_mod3(found + 2);
+          t2index[other_index2] ^= key_index;
+        }
+      }
+      if (stacksize == size) {
+        break;
+      }
+    }
+    if (!deduplicated) {
+      // copies of a key share their three cells and never peel
+      deduplicated = true;
+      size = (uint32_t)binary_fuse_sort_and_remove_dup(keys, size);
+    }
+    memset(t2count, 0, capacity * sizeof(uint16_t));
+    memset(t2index, 0, capacity * sizeof(uint32_t));
+    filter->Seed = binary_fuse_rng_splitmix64(&rng_counter);
+  }
+
+  // The cells that were not peeled are back to 0. A key is assigned after
+  // the keys peeled after it, which hold its two other cells.
+  for (uint32_t i = stacksize - 1; i < stacksize; i--) {
+    uint32_t index = alone[i];
+    uint64_t hash = binary_fuse_mix_split(keys[t2index[index]], filter->Seed);
+    uint8_t found = t2count[index] & 3U;
+    h012[0] = binary_fuse16_hash(0, hash, filter);
+    h012[1] = binary_fuse16_hash(1, hash, filter);
+    h012[2] = binary_fuse16_hash(2, hash, filter);
+    h012[3] = h012[0];
+    h012[4] = h012[1];
+    filter->Fingerprints[index] = (uint16_t)((uint32_t)binary_fuse16_fingerprint(hash) ^
+                                             filter->Fingerprints[h012[found + 1]] ^
+                                             filter->Fingerprints[h012[found + 2]]);
+  }
+  free(t2index);
+  free(alone);
+  free(next);
+  return true;
+}
+
+// Construct the filter from 'size' byte strings: ptrs[i] points to the
+// lens[i] bytes of the i-th key. Each string is hashed with
+// binary_fuse_hash_bytes; the filter then holds the hashes, so that
+// binary_fuse16_contain_bytes(ptrs[i], lens[i], filter) is true. Repeated
+// strings are fine. The hashes are kept in a temporary array of 8 bytes per
+// key, which the construction needs for its retries and duplicate removal.
+// The caller is responsable for calling binary_fuse16_allocate(size,filter)
+// before. Returns true on success, false on failure.
+static inline bool binary_fuse16_populate_bytes(const void *const *ptrs, const size_t *lens,
+                                               uint32_t size, binary_fuse16_t *filter) {
+  uint64_t *hashes = (uint64_t *)malloc(((size_t)size + 1) * sizeof(uint64_t));
+  if (hashes == NULL) {
+    return false;
+  }
+  for (uint32_t i = 0; i < size; i++) {
+    hashes[i] = binary_fuse_hash_bytes(ptrs[i], lens[i]);
+  }
+  bool ok = binary_fuse16_populate(hashes, size, filter);
+  free(hashes);
+  return ok;
+}
+
+// Report if the 'length' bytes at 'data' are in the set built by
+// binary_fuse16_populate_bytes, with false positive rate.
+static inline bool binary_fuse16_contain_bytes(const void *data, size_t length,
+                                              const binary_fuse16_t *filter) {
+  return binary_fuse16_contain(binary_fuse_hash_bytes(data, length), filter);
+}
+
+// Report, for each of the 'count' byte strings, if it is in the set built by
+// binary_fuse16_populate_bytes: out[i] is
+// binary_fuse16_contain_bytes(ptrs[i], lens[i], filter). As in
+// binary_fuse8_contain_batch_scalar, the strings are hashed a few positions
+// ahead and their locations prefetched.
+static inline void binary_fuse16_contain_bytes_batch(const void *const *ptrs, const size_t *lens,
+                                                    size_t count, bool *out,
+                                                    const binary_fuse16_t *filter) {
+  binary_fuse16_probe_t probes[BINARY_FUSE_BATCH_WINDOW];
+  const size_t mask = BINARY_FUSE_BATCH_WINDOW - 1;
+  size_t ahead = count < BINARY_FUSE_BATCH_WINDOW ? count : BINARY_FUSE_BATCH_WINDOW;
+  for (size_t i = 0; i < ahead; i++) {
+    uint64_t hash = binary_fuse_mix_split(binary_fuse_hash_bytes(ptrs[i], lens[i]), filter->Seed);
+    binary_fuse16_probe_prepare_hash(hash, filter, &probes[i]);
+  }
+  for (size_t i = 0; i < count; i++) {
+    size_t slot = i & mask;
+    out[i] = binary_fuse16_probe_finish(&probes[slot], filter);
+    size_t next = i + BINARY_FUSE_BATCH_WINDOW;
+    if (next < count) {
+      uint64_t hash =
+          binary_fuse_mix_split(binary_fuse_hash_bytes(ptrs[next], lens[next]), filter->Seed);
+      binary_fuse16_probe_prepare_hash(hash, filter, &probes[slot]);
+    }
+  }
+}
+
+//////////////////
+// fuse32
+//////////////////
+
+/**
+ * 32-bit fingerprints: a false positive rate of about 1 in 4 billion, for
+ * applications where each false positive is costly, at twice the memory of
+ * binary_fuse16_t (about 36 bits per key).
+ ***/
+
+typedef struct binary_fuse32_s {
+  uint64_t Seed;
+  uint32_t Size;
+  uint32_t SegmentLength;
+  uint32_t SegmentLengthMask;
+  uint32_t SegmentCount;
+  uint32_t SegmentCountLength;
+  uint32_t ArrayLength;
+  uint32_t *Fingerprints;
+} binary_fuse32_t;
+
+static inline uint32_t binary_fuse32_fingerprint(uint64_t hash) {
+  return (uint32_t)(hash ^ (hash >> 32U));
+}
+
+static inline binary_hashes_t binary_fuse32_hash_batch(uint64_t hash,
+                                        const binary_fuse32_t *filter) {
+  uint64_t hi = binary_fuse_mulhi(hash, filter->SegmentCountLength);
+  binary_hashes_t ans;
+  ans.h0 = (uint32_t)hi;
+  ans.h1 = ans.h0 + filter->SegmentLength;
+  ans.h2 = ans.h1 + filter->SegmentLength;
+  ans.h1 ^= (uint32_t)(hash >> 18U) & filter->SegmentLengthMask;
+  ans.h2 ^= (uint32_t)(hash)&filter->SegmentLengthMask;
+  return ans;
+}
+static inline uint32_t binary_fuse32_hash(uint64_t index, uint64_t hash,
+                                        const binary_fuse32_t *filter) {
+    uint64_t h = binary_fuse_mulhi(hash, filter->SegmentCountLength);
+    h += index * filter->SegmentLength;
+    // keep the lower 36 bits
+    uint64_t hh = hash & ((1ULL << 36U) - 1);
+    // index 0: right shift by 36; index 1: right shift by 18; index 2: no shift
+    h ^= (size_t)((hh >> (36 - 18 * index)) & filter->SegmentLengthMask);
+    return (uint32_t)h;
+}
+
+// Report if the key is in the set, with false positive rate.
+static inline bool binary_fuse32_contain(uint64_t key,
+                                        const binary_fuse32_t *filter) {
+  uint64_t hash = binary_fuse_mix_split(key, filter->Seed);
+  uint32_t f = binary_fuse32_fingerprint(hash);
+  binary_hashes_t hashes = binary_fuse32_hash_batch(hash, filter);
+  f ^= (uint32_t)filter->Fingerprints[hashes.h0] ^
+       filter->Fingerprints[hashes.h1] ^
+       filter->Fingerprints[hashes.h2];
+  return f == 0;
+}
+
+// A query split in two phases, see binary_fuse8_probe_prepare.
+typedef struct binary_fuse32_probe_s {
+  binary_hashes_t hashes;
+  uint32_t fingerprint;
+} binary_fuse32_probe_t;
+
+// binary_fuse32_probe_prepare from the hash of the key,
+// binary_fuse_mix_split(key, filter->Seed)
+static inline void binary_fuse32_probe_prepare_hash(uint64_t hash, const binary_fuse32_t *filter,
+                                                    binary_fuse32_probe_t *probe) {
+  probe->fingerprint = binary_fuse32_fingerprint(hash);
+  probe->hashes = binary_fuse32_hash_batch(hash, filter);
+  binary_fuse_prefetch(filter->Fingerprints + probe->hashes.h0);
+  binary_fuse_prefetch(filter->Fingerprints + probe->hashes.h1);
+  binary_fuse_prefetch(filter->Fingerprints + probe->hashes.h2);
+}
+
+// First phase of a query: hash the key, compute its fingerprint and its three
+// locations, and prefetch them. See binary_fuse8_probe_prepare.
+static inline void binary_fuse32_probe_prepare(uint64_t key, const binary_fuse32_t *filter,
+                                               binary_fuse32_probe_t *probe) {
+  binary_fuse32_probe_prepare_hash(binary_fuse_mix_split(key, filter->Seed), filter, probe);
+}
+
+// Second phase of a query: report if the key given to
+// binary_fuse32_probe_prepare is in the set, with false positive rate.
+static inline bool binary_fuse32_probe_finish(const binary_fuse32_probe_t *probe,
+                                              const binary_fuse32_t *filter) {
+  return ((uint32_t)probe->fingerprint ^ filter->Fingerprints[probe->hashes.h0] ^
+          filter->Fingerprints[probe->hashes.h1] ^
+          filter->Fingerprints[probe->hashes.h2]) == 0;
+}
+
+// Report, for each of the 'n' filters, if the key may be in it: bit i % 64 of
+// out_bitmap[i / 64] is set when binary_fuse32_contain(key, filters[i]) is true
+// (out_bitmap must hold (n + 63) / 64 words). The key is hashed again only when
+// the seed differs from the one of the previous filter, so it is hashed once
+// for filters built with binary_fuse32_populate_family and a common family seed.
+// All the locations are prefetched before the first one is read.
+static inline void binary_fuse32_contain_multi(uint64_t key, const binary_fuse32_t *const *filters,
+                                              size_t n, uint64_t *out_bitmap) {
+  binary_fuse32_probe_t probes[64];
+  if (n == 0) {
+    return;
+  }
+  uint64_t seed = filters[0]->Seed;
+  uint64_t hash = binary_fuse_mix_split(key, seed);
+  for (size_t start = 0; start < n; start += 64) {
+    size_t m = n - start < 64 ? n - start : 64;
+    for (size_t i = 0; i < m; i++) {
+      const binary_fuse32_t *filter = filters[start + i];
+      if (filter->Seed != seed) {
+        seed = filter->Seed;
+        hash = binary_fuse_mix_split(key, seed);
+      }
+      binary_fuse32_probe_prepare_hash(hash, filter, &probes[i]);
+    }
+    uint64_t bits = 0;
+    for (size_t i = 0; i < m; i++) {
+      bits |= (uint64_t)binary_fuse32_probe_finish(&probes[i], filters[start + i]) << i;
+    }
+    out_bitmap[start / 64] = bits;
+  }
+}
+
+// Report, for each of the 'count' keys, if it is in the set, with false
+// positive rate. The answer for keys[i] is written to out[i].
+// Portable version of binary_fuse32_contain_batch, see binary_fuse8_contain_batch_scalar.
+static inline void binary_fuse32_contain_batch_scalar(const uint64_t *keys, size_t count,
+                                                      bool *out,
+                                                      const binary_fuse32_t *filter) {
+  binary_fuse32_probe_t probes[BINARY_FUSE_BATCH_WINDOW];
+  const size_t mask = BINARY_FUSE_BATCH_WINDOW - 1;
+  size_t ahead = count < BINARY_FUSE_BATCH_WINDOW ? count : BINARY_FUSE_BATCH_WINDOW;
+  for (size_t i = 0; i < ahead; i++) {
+    binary_fuse32_probe_prepare(keys[i], filter, &probes[i]);
+  }
+  for (size_t i = 0; i < count; i++) {
+    size_t slot = i & mask;
+    out[i] = binary_fuse32_probe_finish(&probes[slot], filter);
+    if (i + BINARY_FUSE_BATCH_WINDOW < count) {
+      binary_fuse32_probe_prepare(keys[i + BINARY_FUSE_BATCH_WINDOW], filter, &probes[slot]);
+    }
+  }
+}
+
+// Report, for each of the 'count' keys, if it is in the set, with false
+// positive rate. The answer for keys[i] is written to out[i]. There are no
+// SIMD kernels for 32-bit fingerprints: this is binary_fuse32_contain_batch_scalar.
+static inline void binary_fuse32_contain_batch(const uint64_t *keys, size_t count, bool *out,
+                                               const binary_fuse32_t *filter) {
+  binary_fuse32_contain_batch_scalar(keys, count, out, filter);
+}
+
+
+// allocate enough capacity for a set containing up to 'size' elements
+// caller is responsible to call binary_fuse32_free(filter)
+// size should be at least 2.
+static inline bool binary_fuse32_allocate(uint32_t size,
+                                         binary_fuse32_t *filter) {
+  uint32_t arity = 3;
+  filter->Size = size;
+  filter->SegmentLength = size == 0 ? 4 : binary_fuse_calculate_segment_length(arity, size);
+  if (filter->SegmentLength > 262144) {
+    filter->SegmentLength = 262144;
+  }
+  filter->SegmentLengthMask = filter->SegmentLength - 1;
+  double sizeFactor = size <= 1 ? 0 : binary_fuse_calculate_size_factor(arity, size);
+  uint32_t capacity = size <= 1 ? 0 : (uint32_t)(round((double)size * sizeFactor));
+  uint32_t initSegmentCount =
+      (capacity + filter->SegmentLength - 1) / filter->SegmentLength -
+      (arity - 1);
+  filter->ArrayLength = (initSegmentCount + arity - 1) * filter->SegmentLength;
+  filter->SegmentCount =
+      (filter->ArrayLength + filter->SegmentLength - 1) / filter->SegmentLength;
+  if (filter->SegmentCount <= arity - 1) {
+    filter->SegmentCount = 1;
+  } else {
+    filter->SegmentCount = filter->SegmentCount - (arity - 1);
+  }
+  filter->ArrayLength =
+      (filter->SegmentCount + arity - 1) * filter->SegmentLength;
+  filter->SegmentCountLength = filter->SegmentCount * filter->SegmentLength;
+  filter->Fingerprints =
+      (uint32_t *)calloc(filter->ArrayLength, sizeof(uint32_t));
+  return filter->Fingerprints != NULL;
+}
+
+// report memory usage
+static inline size_t binary_fuse32_size_in_bytes(const binary_fuse32_t *filter) {
+  return filter->ArrayLength * sizeof(uint32_t) + sizeof(binary_fuse32_t);
+}
+
+// release memory
+static inline void binary_fuse32_free(binary_fuse32_t *filter) {
+  free(filter->Fingerprints);
+  filter->Fingerprints = NULL;
+  filter->Seed = 0;
+  filter->Size = 0;
+  filter->SegmentLength = 0;
+  filter->SegmentLengthMask = 0;
+  filter->SegmentCount = 0;
+  filter->SegmentCountLength = 0;
+  filter->ArrayLength = 0;
+}
+
+
+// binary_fuse32_populate_family with the scratch memory of 'workspace', see
+// binary_fuse32_populate_with_workspace.
+static inline bool binary_fuse32_populate_family_with_workspace(uint64_t *keys, uint32_t size,
+                                                                uint64_t family_seed,
+                                                                binary_fuse32_t *filter,
+                                                                binary_fuse_workspace_t *workspace) {
+  if (size != filter->Size) {
+    return false;
+  }
+
+  uint64_t rng_counter = family_seed;
+  filter->Seed = binary_fuse_rng_splitmix64(&rng_counter);
+  uint32_t capacity = filter->ArrayLength;
+  uint32_t blockBits = 1;
+  while (((uint32_t)1 << blockBits) < filter->SegmentCount) {
+    blockBits += 1;
+  }
+  uint32_t block = ((uint32_t)1 << blockBits);
+  if (!binary_fuse_workspace_reserve(workspace, size, capacity, block)) {
+    return false;
+  }
+  uint64_t *reverseOrder = workspace->reverseOrder;
+  uint32_t *alone = workspace->alone;
+  uint8_t *t2count = workspace->t2count;
+  uint8_t *reverseH = workspace->reverseH;
+  uint64_t *t2hash = workspace->t2hash;
+  uint32_t *startPos = workspace->startPos;
+  // removing duplicates shrinks 'size', not the part of reverseOrder to clear
+  uint32_t touched = size + 1;
+  uint32_t h012[5];
+  uint64_t hashes[BINARY_FUSE_HASH_BLOCK];
+
+  reverseOrder[size] = 1;
+  for (int loop = 0; true; ++loop) {
+    if (loop + 1 > XOR_MAX_ITERATIONS) {
+      // The probability of this happening is lower than the
+      // the cosmic-ray probability (i.e., a cosmic ray corrupts your system).
+      memset(reverseOrder, 0, sizeof(uint64_t) * touched);
+      return false;
+    }
+
+    for (uint32_t i = 0; i < block; i++) {
+      // important : i * size would overflow as a 32-bit number in some
+      // cases.
+      startPos[i] = (uint32_t)(((uint64_t)i * size) >> blockBits);
+    }
+
+    uint64_t maskblock = block - 1;
+    for (uint32_t start = 0; start < size; start += BINARY_FUSE_HASH_BLOCK) {
+      uint32_t n = size - start < BINARY_FUSE_HASH_BLOCK ? size - start : BINARY_FUSE_HASH_BLOCK;
+      binary_fuse_hash_keys(keys + start, n, filter->Seed, hashes);
+      for (uint32_t i = 0; i < n; i++) {
+        uint64_t hash = hashes[i];
+        uint64_t segment_index = hash >> (64 - blockBits);
+        while (reverseOrder[startPos[segment_index]] != 0) {
+          segment_index++;
+          segment_index &= maskblock;
+        }
+        reverseOrder[startPos[segment_index]] = hash;
+        startPos[segment_index]++;
+      }
+    }
+    int error = 0;
+    uint32_t duplicates = 0;
+    for (uint32_t i = 0; i < size; i++) {
+      uint64_t hash = reverseOrder[i];
+      uint32_t h0 = binary_fuse32_hash(0, hash, filter);
+      t2count[h0] += 4;
+      t2hash[h0] ^= hash;
+      uint32_t h1= binary_fuse32_hash(1, hash, filter);
+      t2count[h1] += 4;
+      t2count[h1] ^= 1U;
+      t2hash[h1] ^= hash;
+      uint32_t h2 = binary_fuse32_hash(2, hash, filter);
+      t2count[h2] += 4;
+      t2hash[h2] ^= hash;
+      t2count[h2] ^= 2U;
+      if ((t2hash[h0] & t2hash[h1] & t2hash[h2]) == 0) {
+        if   (((t2hash[h0] == 0) && (t2count[h0] == 8))
+          ||  ((t2hash[h1] == 0) && (t2count[h1] == 8))
+          ||  ((t2hash[h2] == 0) && (t2count[h2] == 8))) {
+					duplicates += 1;
+ 					t2count[h0] -= 4;
+ 					t2hash[h0] ^= hash;
+ 					t2count[h1] -= 4;
+ 					t2count[h1] ^= 1U;
+ 					t2hash[h1] ^= hash;
+ 					t2count[h2] -= 4;
+ 					t2count[h2] ^= 2U;
+ 					t2hash[h2] ^= hash;
+        }
+      }
+      error = (t2count[h0] < 4) ? 1 : error;
+      error = (t2count[h1] < 4) ? 1 : error;
+      error = (t2count[h2] < 4) ? 1 : error;
+    }
+    if(error) {
+      if(duplicates > 0) {
+        // many copies of a key can overflow a counter before they are detected
+        size = (uint32_t)binary_fuse_sort_and_remove_dup(keys, size);
+      }
+      memset(reverseOrder, 0, sizeof(uint64_t) * size);
+      memset(t2count, 0, sizeof(uint8_t) * capacity);
+      memset(t2hash, 0, sizeof(uint64_t) * capacity);
+      filter->Seed = binary_fuse_rng_splitmix64(&rng_counter);
+      continue;
+    }
+
+    // End of key addition
+    uint32_t Qsize = 0;
+    // Add sets with one key to the queue.
+    for (uint32_t i = 0; i < capacity; i++) {
+      alone[Qsize] = i;
+      Qsize += ((t2count[i] >> 2U) == 1) ? 1U : 0U;
+    }
+    uint32_t stacksize = 0;
+    while (Qsize > 0) {
+      Qsize--;
+      uint32_t index = alone[Qsize];
+      if ((t2count[index] >> 2U) == 1) {
+        uint64_t hash = t2hash[index];
+
+        //h012[0] = binary_fuse32_hash(0, hash, filter);
+        h012[1] = binary_fuse32_hash(1, hash, filter);
+        h012[2] = binary_fuse32_hash(2, hash, filter);
+        h012[3] = binary_fuse32_hash(0, hash, filter); // == h012[0];
+        h012[4] = h012[1];
+        uint8_t found = t2count[index] & 3U;
+        reverseH[stacksize] = found;
+        reverseOrder[stacksize] = hash;
+        stacksize++;
+        uint32_t other_index1 = h012[found + 1];
+        alone[Qsize] = other_index1;
+        Qsize += ((t2count[other_index1] >> 2U) == 2 ? 1U : 0U);
+
+        t2count[other_index1] -= 4;
+        t2count[other_index1] ^= binary_fuse_mod3(found + 1);
+        t2hash[other_index1] ^= hash;
+
+        uint32_t other_index2 = h012[found + 2];
+        alone[Qsize] = other_index2;
+        Qsize += ((t2count[other_index2] >> 2U) == 2 ? 1U : 0U);
+        t2count[other_index2] -= 4;
+        t2count[other_index2] ^= binary_fuse_mod3(found + 2);
+        t2hash[other_index2] ^= hash;
+      }
+    }
+    if (stacksize + duplicates == size) {
+      // success
+      size = stacksize;
+      break;
+    }
+    if(duplicates > 0) {
+      size = (uint32_t)binary_fuse_sort_and_remove_dup(keys, size);
+    }
+    memset(reverseOrder, 0, sizeof(uint64_t) * size);
+    memset(t2count, 0, sizeof(uint8_t) * capacity);
+    memset(t2hash, 0, sizeof(uint64_t) * capacity);
+    filter->Seed = binary_fuse_rng_splitmix64(&rng_counter);
+  }
+
+  for (uint32_t i = size - 1; i < size; i--) {
+    // the hash of the key we insert next
+    uint64_t hash = reverseOrder[i];
+    uint32_t xor2 = binary_fuse32_fingerprint(hash);
+    uint8_t found = reverseH[i];
+    h012[0] = binary_fuse32_hash(0, hash, filter);
+    h012[1] = binary_fuse32_hash(1, hash, filter);
+    h012[2] = binary_fuse32_hash(2, hash, filter);
+    h012[3] = h012[0];
+    h012[4] = h012[1];
+    filter->Fingerprints[h012[found]] = (uint32_t)(
+        (uint32_t)xor2 ^
+        (uint32_t)filter->Fingerprints[h012[found + 1]] ^
+        (uint32_t)filter->Fingerprints[h012[found + 2]]);
+    // the cell the key was peeled from is the only one left with a key
+    t2count[h012[found]] = 0;
+    t2hash[h012[found]] = 0;
+  }
+  memset(reverseOrder, 0, sizeof(uint64_t) * touched);
+  return true;
+}
+
+// Construct the filter like binary_fuse32_populate, but derive the seeds
+// from 'family_seed'. Filters built with the same family_seed almost always
+// end up with the same Seed (they differ only when the construction needs to
+// retry with another seed), so that binary_fuse32_contain_multi hashes a key
+// once for all of them. Returns true on success, false on failure.
+static inline bool binary_fuse32_populate_family(uint64_t *keys, uint32_t size,
+                                                 uint64_t family_seed,
+                                                 binary_fuse32_t *filter) {
+  binary_fuse_workspace_t workspace;
+  memset(&workspace, 0, sizeof(workspace));
+  bool ok = binary_fuse32_populate_family_with_workspace(keys, size, family_seed, filter,
+                                                         &workspace);
+  binary_fuse_workspace_free(&workspace);
+  return ok;
+}
+
+// Construct the filter, returns true on success, false on failure.
+// The algorithm fails when there is insufficient memory.
+// The caller is responsable for calling binary_fuse8_allocate(size,filter)
+// before. For best performance, the caller should ensure that there are not too
+// many duplicated keys.
+static inline bool binary_fuse32_populate(uint64_t *keys, uint32_t size,
+                           binary_fuse32_t *filter) {
+  return binary_fuse32_populate_family(keys, size, 0x726b2b9d438b9d4d, filter);
+}
+
+// Construct the filter like binary_fuse32_populate, with the scratch memory of
+// 'workspace', returns true on success, false on failure. The workspace grows
+// if the filter is larger than the ones it was allocated for, and can be
+// reused as soon as the function returns: rebuilding many filters then
+// allocates and clears no memory.
+// The caller is responsable for calling binary_fuse32_allocate(size,filter)
+// and binary_fuse_workspace_allocate before.
+static inline bool binary_fuse32_populate_with_workspace(uint64_t *keys, uint32_t size,
+                                                         binary_fuse32_t *filter,
+                                                         binary_fuse_workspace_t *workspace) {
+  return binary_fuse32_populate_family_with_workspace(keys, size, 0x726b2b9d438b9d4d, filter,
+                                                      workspace);
+}
+
+//////////////////
+// several widths from one construction
+//////////////////
+
+// Construct filters of several fingerprint widths over the same keys. The
+// peeling order depends only on the hashes and on the geometry, so the keys
+// are hashed and peeled once and each fingerprint array is filled by its own
+// back-substitution. Any of filter8, filter16 and filter32 may be NULL; the
+// others must have been allocated for the same size. Each filter is then
+// identical to the one built by its own populate function (same Seed, same
+// fingerprints). Returns true on success, false on failure.
+static inline bool binary_fuse_populate_multi(uint64_t *keys, uint32_t size,
+                                              binary_fuse8_t *filter8,
+                                              binary_fuse16_t *filter16,
+                                              binary_fuse32_t *filter32) {
+  // the geometry depends only on the size, all filters must share it
+  binary_fuse32_t header = {0};
+  binary_fuse32_t *geometry = &header;
+  if (filter8 != NULL) {
+    header.Size = filter8->Size;
+    header.SegmentLength = filter8->SegmentLength;
+    header.SegmentLengthMask = filter8->SegmentLengthMask;
+    header.SegmentCount = filter8->SegmentCount;
+    header.SegmentCountLength = filter8->SegmentCountLength;
+    header.ArrayLength = filter8->ArrayLength;
+  } else if (filter16 != NULL) {
+    header.Size = filter16->Size;
+    header.SegmentLength = filter16->SegmentLength;
+    header.SegmentLengthMask = filter16->SegmentLengthMask;
+    header.SegmentCount = filter16->SegmentCount;
+    header.SegmentCountLength = filter16->SegmentCountLength;
+    header.ArrayLength = filter16->ArrayLength;
+  } else if (filter32 != NULL) {
+    header = *filter32;
+    header.Fingerprints = NULL;
+  } else {
+    return false;
+  }
+  if (size != header.Size ||
+      (filter8 != NULL &&
+       (filter8->Size != size || filter8->ArrayLength != header.ArrayLength)) ||
+      (filter16 != NULL &&
+       (filter16->Size != size || filter16->ArrayLength != header.ArrayLength)) ||
+      (filter32 != NULL &&
+       (filter32->Size != size || filter32->ArrayLength != header.ArrayLength))) {
+    return false;
+  }
+
+  uint64_t rng_counter = 0x726b2b9d438b9d4d;
+  geometry->Seed = binary_fuse_rng_splitmix64(&rng_counter);
+  uint64_t *reverseOrder = (uint64_t *)calloc((size + 1), sizeof(uint64_t));
+  uint32_t capacity = geometry->ArrayLength;
+  uint32_t *alone = (uint32_t *)malloc(capacity * sizeof(uint32_t));
+  uint8_t *t2count = (uint8_t *)calloc(capacity, sizeof(uint8_t));
+  uint8_t *reverseH = (uint8_t *)malloc(size * sizeof(uint8_t));
+  uint64_t *t2hash = (uint64_t *)calloc(capacity, sizeof(uint64_t));
+
+  uint32_t blockBits = 1;
+  while (((uint32_t)1 << blockBits) < geometry->SegmentCount) {
+    blockBits += 1;
+  }
+  uint32_t block = ((uint32_t)1 << blockBits);
+  uint32_t *startPos = (uint32_t *)malloc((1U << blockBits) * sizeof(uint32_t));
+  uint32_t h012[5];
+  uint64_t hashes[BINARY_FUSE_HASH_BLOCK];
+
+  if ((alone == NULL) || (t2count == NULL) || (reverseH == NULL) ||
+      (t2hash == NULL) || (reverseOrder == NULL) || (startPos == NULL)) {
+    free(alone);
+    free(t2count);
+    free(reverseH);
+    free(t2hash);
+    free(reverseOrder);
+    free(startPos);
+    return false;
+  }
+  reverseOrder[size] = 1;
+  for (int loop = 0; true; ++loop) {
+    if (loop + 1 > XOR_MAX_ITERATIONS) {
+      // The probability of this happening is lower than the
+      // the cosmic-ray probability (i.e., a cosmic ray corrupts your system).
+      free(alone);
+      free(t2count);
+      free(reverseH);
+      free(t2hash);
+      free(reverseOrder);
+      free(startPos);
+      return false;
+    }
+
+    for (uint32_t i = 0; i < block; i++) {
+      // important : i * size would overflow as a 32-bit number in some
+      // cases.
+      startPos[i] = (uint32_t)(((uint64_t)i * size) >> blockBits);
+    }
+
+    uint64_t maskblock = block - 1;
+    for (uint32_t start = 0; start < size; start += BINARY_FUSE_HASH_BLOCK) {
+      uint32_t n = size - start < BINARY_FUSE_HASH_BLOCK ? size - start : BINARY_FUSE_HASH_BLOCK;
+      binary_fuse_hash_keys(keys + start, n, geometry->Seed, hashes);
+      for (uint32_t i = 0; i < n; i++) {
+        uint64_t hash = hashes[i];
+        uint64_t segment_index = hash >> (64 - blockBits);
+        while (reverseOrder[startPos[segment_index]] != 0) {
+          segment_index++;
+          segment_index &= maskblock;
+        }
+        reverseOrder[startPos[segment_index]] = hash;
+        startPos[segment_index]++;
+      }
+    }
+    int error = 0;
+    uint32_t duplicates = 0;
+    for (uint32_t i = 0; i < size; i++) {
+      uint64_t hash = reverseOrder[i];
+      uint32_t h0 = binary_fuse32_hash(0, hash, geometry);
+      t2count[h0] += 4;
+      t2hash[h0] ^= hash;
+      uint32_t h1= binary_fuse32_hash(1, hash, geometry);
+      t2count[h1] += 4;
+      t2count[h1] ^= 1U;
+      t2hash[h1] ^= hash;
+      uint32_t h2 = binary_fuse32_hash(2, hash, geometry);
+      t2count[h2] += 4;
+      t2hash[h2] ^= hash;
+      t2count[h2] ^= 2U;
+      if ((t2hash[h0] & t2hash[h1] & t2hash[h2]) == 0) {
+        if   (((t2hash[h0] == 0) && (t2count[h0] == 8))
+          ||  ((t2hash[h1] == 0) && (t2count[h1] == 8))
+          ||  ((t2hash[h2] == 0) && (t2count[h2] == 8))) {
+					duplicates += 1;
+ 					t2count[h0] -= 4;
+ 					t2hash[h0] ^= hash;
+ 					t2count[h1] -= 4;
+ 					t2count[h1] ^= 1U;
+ 					t2hash[h1] ^= hash;
+ 					t2count[h2] -= 4;
+ 					t2count[h2] ^= 2U;
+ 					t2hash[h2] ^= hash;
+        }
+      }
+      error = (t2count[h0] < 4) ? 1 : error;
+      error = (t2count[h1] < 4) ? 1 : error;
+      error = (t2count[h2] < 4) ? 1 : error;
+    }
+    if(error) {
+      if(duplicates > 0) {
+        // many copies of a key can overflow a counter before they are detected
+        size = (uint32_t)binary_fuse_sort_and_remove_dup(keys, size);
+      }
+      memset(reverseOrder, 0, sizeof(uint64_t) * size);
+      memset(t2count, 0, sizeof(uint8_t) * capacity);
+      memset(t2hash, 0, sizeof(uint64_t) * capacity);
+      geometry->Seed = binary_fuse_rng_splitmix64(&rng_counter);
+      continue;
+    }
+
+    // End of key addition
+    uint32_t Qsize = 0;
+    // Add sets with one key to the queue.
+    for (uint32_t i = 0; i < capacity; i++) {
+      alone[Qsize] = i;
+      Qsize += ((t2count[i] >> 2U) == 1) ? 1U : 0U;
+    }
+    uint32_t stacksize = 0;
+    while (Qsize > 0) {
+      Qsize--;
+      uint32_t index = alone[Qsize];
+      if ((t2count[index] >> 2U) == 1) {
+        uint64_t hash = t2hash[index];
+
+        //h012[0] = binary_fuse32_hash(0, hash, geometry);
+        h012[1] = binary_fuse32_hash(1, hash, geometry);
+        h012[2] = binary_fuse32_hash(2, hash, geometry);
+        h012[3] = binary_fuse32_hash(0, hash, geometry); // == h012[0];
+        h012[4] = h012[1];
+        uint8_t found = t2count[index] & 3U;
+        reverseH[stacksize] = found;
+        reverseOrder[stacksize] = hash;
+        stacksize++;
+        uint32_t other_index1 = h012[found + 1];
+        alone[Qsize] = other_index1;
+        Qsize += ((t2count[other_index1] >> 2U) == 2 ? 1U : 0U);
+
+        t2count[other_index1] -= 4;
+        t2count[other_index1] ^= binary_fuse_mod3(found + 1);
+        t2hash[other_index1] ^= hash;
+
+        uint32_t other_index2 = h012[found + 2];
+        alone[Qsize] = other_index2;
+        Qsize += ((t2count[other_index2] >> 2U) == 2 ? 1U : 0U);
+        t2count[other_index2] -= 4;
+        t2count[other_index2] ^= binary_fuse_mod3(found + 2);
+        t2hash[other_index2] ^= hash;
+      }
+    }
+    if (stacksize + duplicates == size) {
+      // success
+      size = stacksize;
+      break;
+    }
+    if(duplicates > 0) {
+      size = (uint32_t)binary_fuse_sort_and_remove_dup(keys, size);
+    }
+    memset(reverseOrder, 0, sizeof(uint64_t) * size);
+    memset(t2count, 0, sizeof(uint8_t) * capacity);
+    memset(t2hash, 0, sizeof(uint64_t) * capacity);
+    geometry->Seed = binary_fuse_rng_splitmix64(&rng_counter);
+  }
+
+  if (filter8 != NULL) {
+    filter8->Seed = geometry->Seed;
+  }
+  if (filter16 != NULL) {
+    filter16->Seed = geometry->Seed;
+  }
+  if (filter32 != NULL) {
+    filter32->Seed = geometry->Seed;
+  }
+  for (uint32_t i = size - 1; i < size; i--) {
+    // the hash of the key we insert next
+    uint64_t hash = reverseOrder[i];
+    uint8_t found = reverseH[i];
+    h012[0] = binary_fuse32_hash(0, hash, geometry);
+    h012[1] = binary_fuse32_hash(1, hash, geometry);
+    h012[2] = binary_fuse32_hash(2, hash, geometry);
+    h012[3] = h012[0];
+    h012[4] = h012[1];
+    if (filter8 != NULL) {
+      filter8->Fingerprints[h012[found]] = (uint8_t)(
+          (uint32_t)binary_fuse8_fingerprint(hash) ^
+          (uint32_t)filter8->Fingerprints[h012[found + 1]] ^
+          (uint32_t)filter8->Fingerprints[h012[found + 2]]);
+    }
+    if (filter16 != NULL) {
+      filter16->Fingerprints[h012[found]] = (uint16_t)(
+          (uint32_t)binary_fuse16_fingerprint(hash) ^
+          (uint32_t)filter16->Fingerprints[h012[found + 1]] ^
+          (uint32_t)filter16->Fingerprints[h012[found + 2]]);
+    }
+    if (filter32 != NULL) {
+      filter32->Fingerprints[h012[found]] =
+          binary_fuse32_fingerprint(hash) ^
+          filter32->Fingerprints[h012[found + 1]] ^
+          filter32->Fingerprints[h012[found + 2]];
+    }
+  }
+  free(alone);
+  free(t2count);
+  free(reverseH);
+  free(t2hash);
+  free(reverseOrder);
+  free(startPos);
+  return true;
+}
+
+//////////////////
+// batch queries with SIMD kernels
+//////////////////
+
+// Kernels for the batch queries, see binary_fuse_kernel().
+#define BINARY_FUSE_KERNEL_SCALAR 0
+#define BINARY_FUSE_KERNEL_AVX2 1
+#define BINARY_FUSE_KERNEL_AVX512 2
+
+#ifdef BINARY_FUSE_X64_SIMD
+#define BINARY_FUSE_TARGET_AVX2 __attribute__((target("avx2")))
+#define BINARY_FUSE_TARGET_AVX512 __attribute__((target("avx2,avx512f,avx512dq")))
+
+/**
+ * AVX2 kernels: eight keys per iteration.
+ ***/
+
+// low 64 bits of the lane-wise product, AVX2 lacks a 64-bit multiplication
+BINARY_FUSE_TARGET_AVX2
+static inline __m256i binary_fuse_avx2_mullo64(__m256i a, __m256i b) {
+  __m256i lo = _mm256_mul_epu32(a, b);
+  __m256i cross = _mm256_add_epi64(_mm256_mul_epu32(_mm256_srli_epi64(a, 32), b),
+                                   _mm256_mul_epu32(a, _mm256_srli_epi64(b, 32)));
+  return _mm256_add_epi64(lo, _mm256_slli_epi64(cross, 32));
+}
+
+BINARY_FUSE_TARGET_AVX2
+static inline __m256i binary_fuse_avx2_murmur64(__m256i h) {
+  h = _mm256_xor_si256(h, _mm256_srli_epi64(h, 33));
+  h = binary_fuse_avx2_mullo64(h, _mm256_set1_epi64x((long long)UINT64_C(0xff51afd7ed558ccd)));
+  h = _mm256_xor_si256(h, _mm256_srli_epi64(h, 33));
+  h = binary_fuse_avx2_mullo64(h, _mm256_set1_epi64x((long long)UINT64_C(0xc4ceb9fe1a85ec53)));
+  h = _mm256_xor_si256(h, _mm256_srli_epi64(h, 33));
+  return h;
+}
+
+// binary_fuse_mulhi(a, n) in each lane, for a 32-bit n: (a_hi * n + (a_lo * n >> 32)) >> 32
+BINARY_FUSE_TARGET_AVX2
+static inline __m256i binary_fuse_avx2_mulhi32(__m256i a, __m256i n) {
+  __m256i lo = _mm256_mul_epu32(a, n);
+  __m256i hi = _mm256_mul_epu32(_mm256_srli_epi64(a, 32), n);
+  return _mm256_srli_epi64(_mm256_add_epi64(hi, _mm256_srli_epi64(lo, 32)), 32);
+}
+
+// Split the 64-bit lanes of a (lanes 0-3) and b (lanes 4-7) into their low
+// and high 32-bit halves.
+BINARY_FUSE_TARGET_AVX2
+static inline void binary_fuse_avx2_split32(__m256i a, __m256i b, __m256i *lo,
+                                            __m256i *hi) {
+  const __m256i perm = _mm256_setr_epi32(0, 2, 4, 6, 1, 3, 5, 7);
+  __m256i pa = _mm256_permutevar8x32_epi32(a, perm);
+  __m256i pb = _mm256_permutevar8x32_epi32(b, perm);
+  *lo = _mm256_permute2x128_si256(pa, pb, 0x20);
+  *hi = _mm256_permute2x128_si256(pa, pb, 0x31);
+}
+
+// Hash eight keys and compute their fingerprints and locations (32-bit lanes),
+// following binary_fuse8_hash_batch.
+BINARY_FUSE_TARGET_AVX2
+static inline void binary_fuse_avx2_hash8(const uint64_t *keys, uint64_t seed,
+                                          uint32_t segmentLength,
+                                          uint32_t segmentLengthMask,
+                                          uint32_t segmentCountLength,
+                                          __m256i *f, __m256i *h0, __m256i *h1,
+                                          __m256i *h2) {
+  const __m256i vseed = _mm256_set1_epi64x((long long)seed);
+  const __m256i vscl = _mm256_set1_epi64x((long long)segmentCountLength);
+  __m256i ha = binary_fuse_avx2_murmur64(
+      _mm256_add_epi64(_mm256_loadu_si256((const __m256i *)(const void *)keys), vseed));
+  __m256i hb = binary_fuse_avx2_murmur64(
+      _mm256_add_epi64(_mm256_loadu_si256((const __m256i *)(const void *)(keys + 4)), vseed));
+  __m256i lo, hi, h0_lo, h0_hi;
+  binary_fuse_avx2_split32(ha, hb, &lo, &hi);
+  binary_fuse_avx2_split32(binary_fuse_avx2_mulhi32(ha, vscl),
+                           binary_fuse_avx2_mulhi32(hb, vscl), &h0_lo, &h0_hi);
+  (void)h0_hi;
+  const __m256i vsl = _mm256_set1_epi32((int)segmentLength);
+  const __m256i vmask = _mm256_set1_epi32((int)segmentLengthMask);
+  // low 32 bits of (hash >> 18)
+  __m256i shifted = _mm256_or_si256(_mm256_srli_epi32(lo, 18), _mm256_slli_epi32(hi, 14));
+  *f = _mm256_xor_si256(lo, hi);
+  *h0 = h0_lo;
+  *h1 = _mm256_xor_si256(_mm256_add_epi32(h0_lo, vsl), _mm256_and_si256(shifted, vmask));
+  *h2 = _mm256_xor_si256(_mm256_add_epi32(h0_lo, _mm256_add_epi32(vsl, vsl)),
+                         _mm256_and_si256(lo, vmask));
+}
+
+// Returns a nonzero value when all eight lanes of idx are no larger than limit.
+BINARY_FUSE_TARGET_AVX2
+static inline int binary_fuse_avx2_all_le(__m256i idx, uint32_t limit) {
+  const __m256i vlimit = _mm256_set1_epi32((int)limit);
+  __m256i ok = _mm256_cmpeq_epi32(_mm256_max_epu32(idx, vlimit), vlimit);
+  return _mm256_movemask_epi8(ok) == -1;
+}
+
+// Report, for each of the 'count' keys, if it is in the set, with false
+// positive rate, using AVX2 gathers eight keys at a time. The answer for
+// keys[i] is written to out[i] and is identical to binary_fuse8_contain.
+// The processor must support AVX2, binary_fuse8_contain_batch checks it for you.
+BINARY_FUSE_TARGET_AVX2
+static inline void binary_fuse8_contain_batch_avx2(const uint64_t *keys, size_t count,
+                                                   bool *out,
+                                                   const binary_fuse8_t *filter) {
+  size_t i = 0;
+  // The gathers load 32 bits at each byte location, and use signed indexes.
+  if (filter->ArrayLength >= 4 && filter->ArrayLength <= INT32_MAX) {
+    const int *base = (const int *)(const void *)filter->Fingerprints;
+    const __m256i fmask = _mm256_set1_epi32(0xFF);
+    for (; i + 8 <= count; i += 8) {
+      __m256i f, h0, h1, h2;
+      binary_fuse_avx2_hash8(keys + i, filter->Seed, filter->SegmentLength,
+                             filter->SegmentLengthMask, filter->SegmentCountLength,
+                             &f, &h0, &h1, &h2);
+      // h2 is the largest location: at the end of the array, we fall back
+      // on the scalar code rather than reading past the fingerprints
+      if (!binary_fuse_avx2_all_le(h2, filter->ArrayLength - 4)) {
+        for (size_t j = 0; j < 8; j++) {
+          out[i + j] = binary_fuse8_contain(keys[i + j], filter);
+        }
+        continue;
+      }
+      __m256i x = _mm256_xor_si256(f, _mm256_i32gather_epi32(base, h0, 1));
+      x = _mm256_xor_si256(x, _mm256_i32gather_epi32(base, h1, 1));
+      x = _mm256_xor_si256(x, _mm256_i32gather_epi32(base, h2, 1));
+      __m256i hit = _mm256_cmpeq_epi32(_mm256_and_si256(x, fmask), _mm256_setzero_si256());
+      unsigned bits = (unsigned)_mm256_movemask_ps(_mm256_castsi256_ps(hit));
+      for (size_t j = 0; j < 8; j++) {
+        out[i + j] = (bits >> j) & 1;
+      }
+    }
+  }
+  for (; i < count; i++) {
+    out[i] = binary_fuse8_contain(keys[i], filter);
+  }
+}
+
+// Report, for each of the 'count' keys, if it is in the set, with false
+// positive rate, using AVX2 gathers eight keys at a time. The answer for
+// keys[i] is written to out[i] and is identical to binary_fuse16_contain.
+// The processor must support AVX2, binary_fuse16_contain_batch checks it for you.
+BINARY_FUSE_TARGET_AVX2
+static inline void binary_fuse16_contain_batch_avx2(const uint64_t *keys, size_t count,
+                                                    bool *out,
+                                                    const binary_fuse16_t *filter) {
+  size_t i = 0;
+  // The gathers load 32 bits at each 16-bit location, and use signed indexes.
+  if (filter->ArrayLength >= 2 && filter->ArrayLength <= INT32_MAX) {
+    const int *base = (const int *)(const void *)filter->Fingerprints;
+    const __m256i fmask = _mm256_set1_epi32(0xFFFF);
+    for (; i + 8 <= count; i += 8) {
+      __m256i f, h0, h1, h2;
+      binary_fuse_avx2_hash8(keys + i, filter->Seed, filter->SegmentLength,
+                             filter->SegmentLengthMask, filter->SegmentCountLength,
+                             &f, &h0, &h1, &h2);
+      if (!binary_fuse_avx2_all_le(h2, filter->ArrayLength - 2)) {
+        for (size_t j = 0; j < 8; j++) {
+          out[i + j] = binary_fuse16_contain(keys[i + j], filter);
+        }
+        continue;
+      }
+      __m256i x = _mm256_xor_si256(f, _mm256_i32gather_epi32(base, h0, 2));
+      x = _mm256_xor_si256(x, _mm256_i32gather_epi32(base, h1, 2));
+      x = _mm256_xor_si256(x, _mm256_i32gather_epi32(base, h2, 2));
+      __m256i hit = _mm256_cmpeq_epi32(_mm256_and_si256(x, fmask), _mm256_setzero_si256());
+      unsigned bits = (unsigned)_mm256_movemask_ps(_mm256_castsi256_ps(hit));
+      for (size_t j = 0; j < 8; j++) {
+        out[i + j] = (bits >> j) & 1;
+      }
+    }
+  }
+  for (; i < count; i++) {
+    out[i] = binary_fuse16_contain(keys[i], filter);
+  }
+}
+
+/**
+ * AVX-512 kernels: sixteen keys per iteration. The keys are hashed with the
+ * native 64-bit multiplication (vpmullq) in two halves of eight, and the
+ * locations, narrowed to 32 bits, feed 16-lane masked gathers. The remaining
+ * keys of a batch are processed with masked loads and stores.
+ ***/
+
+BINARY_FUSE_TARGET_AVX512
+static inline __m512i binary_fuse_avx512_murmur64(__m512i h) {
+  h = _mm512_xor_si512(h, _mm512_srli_epi64(h, 33));
+  h = _mm512_mullo_epi64(h, _mm512_set1_epi64((long long)UINT64_C(0xff51afd7ed558ccd)));
+  h = _mm512_xor_si512(h, _mm512_srli_epi64(h, 33));
+  h = _mm512_mullo_epi64(h, _mm512_set1_epi64((long long)UINT64_C(0xc4ceb9fe1a85ec53)));
+  h = _mm512_xor_si512(h, _mm512_srli_epi64(h, 33));
+  return h;
+}
+
+// Concatenate the low 32 bits of the lanes of a (lanes 0-7) and b (lanes 8-15).
+BINARY_FUSE_TARGET_AVX512
+static inline __m512i binary_fuse_avx512_narrow(__m512i a, __m512i b) {
+  return _mm512_inserti64x4(_mm512_castsi256_si512(_mm512_cvtepi64_epi32(a)),
+                            _mm512_cvtepi64_epi32(b), 1);
+}
+
+// 32-bit gathers at the byte offsets (gather8) or the 16-bit offsets (gather16)
+// of 'index', zero in the lanes outside 'mask'. Without optimization, GCC
+// expands _mm512_mask_i32gather_epi32 to a macro that converts the mask to the
+// signed type of its builtin, which -Wsign-conversion reports.
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wsign-conversion"
+#endif
+BINARY_FUSE_TARGET_AVX512
+static inline __m512i binary_fuse_avx512_gather8(__mmask16 mask, __m512i index, const void *base) {
+  return _mm512_mask_i32gather_epi32(_mm512_setzero_si512(), mask, index, base, 1);
+}
+
+BINARY_FUSE_TARGET_AVX512
+static inline __m512i binary_fuse_avx512_gather16(__mmask16 mask, __m512i index, const void *base) {
+  return _mm512_mask_i32gather_epi32(_mm512_setzero_si512(), mask, index, base, 2);
+}
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+// Hash the keys selected by 'valid' and compute their fingerprints and
+// locations (32-bit lanes), following binary_fuse8_hash_batch.
+BINARY_FUSE_TARGET_AVX512
+static inline void binary_fuse_avx512_hash16(const uint64_t *keys, __mmask16 valid,
+                                             uint64_t seed, uint32_t segmentLength,
+                                             uint32_t segmentLengthMask,
+                                             uint32_t segmentCountLength,
+                                             __m512i *f, __m512i *h0, __m512i *h1,
+                                             __m512i *h2) {
+  const __m512i vseed = _mm512_set1_epi64((long long)seed);
+  const __m512i vscl = _mm512_set1_epi64((long long)segmentCountLength);
+  __m512i ha = binary_fuse_avx512_murmur64(
+      _mm512_add_epi64(_mm512_maskz_loadu_epi64((__mmask8)valid, keys), vseed));
+  __m512i hb = binary_fuse_avx512_murmur64(
+      _mm512_add_epi64(_mm512_maskz_loadu_epi64((__mmask8)(valid >> 8), keys + 8), vseed));
+  // binary_fuse_mulhi(hash, segmentCountLength)
+  __m512i ma = _mm512_srli_epi64(
+      _mm512_add_epi64(_mm512_mul_epu32(_mm512_srli_epi64(ha, 32), vscl),
+                       _mm512_srli_epi64(_mm512_mul_epu32(ha, vscl), 32)), 32);
+  __m512i mb = _mm512_srli_epi64(
+      _mm512_add_epi64(_mm512_mul_epu32(_mm512_srli_epi64(hb, 32), vscl),
+                       _mm512_srli_epi64(_mm512_mul_epu32(hb, vscl), 32)), 32);
+  __m512i hash = binary_fuse_avx512_narrow(ha, hb);
+  __m512i shifted = binary_fuse_avx512_narrow(_mm512_srli_epi64(ha, 18),
+                                              _mm512_srli_epi64(hb, 18));
+  const __m512i vsl = _mm512_set1_epi32((int)segmentLength);
+  const __m512i vmask = _mm512_set1_epi32((int)segmentLengthMask);
+  *f = _mm512_xor_si512(hash, binary_fuse_avx512_narrow(_mm512_srli_epi64(ha, 32),
+                                                        _mm512_srli_epi64(hb, 32)));
+  *h0 = binary_fuse_avx512_narrow(ma, mb);
+  *h1 = _mm512_xor_si512(_mm512_add_epi32(*h0, vsl), _mm512_and_si512(shifted, vmask));
+  *h2 = _mm512_xor_si512(_mm512_add_epi32(*h0, _mm512_add_epi32(vsl, vsl)),
+                         _mm512_and_si512(hash, vmask));
+}
+
+// Write the answers of the lanes in 'valid' to out, one bool per lane.
+BINARY_FUSE_TARGET_AVX512
+static inline void binary_fuse_avx512_store16(bool *out, __mmask16 valid, __mmask16 hits) {
+  _mm512_mask_cvtepi32_storeu_epi8(out, valid, _mm512_maskz_set1_epi32(hits, 1));
+}
+
+// Report, for each of the 'count' keys, if it is in the set, with false
+// positive rate, using AVX-512 sixteen keys at a time. The answer for keys[i]
+// is written to out[i] and is identical to binary_fuse8_contain.
+// The processor must support AVX-512 F and DQ, binary_fuse8_contain_batch
+// checks it for you.
+BINARY_FUSE_TARGET_AVX512
+static inline void binary_fuse8_contain_batch_avx512(const uint64_t *keys, size_t count,
+                                                     bool *out,
+                                                     const binary_fuse8_t *filter) {
+  // The gathers load 32 bits at each byte location, and use signed indexes.
+  if (filter->ArrayLength < 4 || filter->ArrayLength > INT32_MAX) {
+    binary_fuse8_contain_batch_scalar(keys, count, out, filter);
+    return;
+  }
+  // The lanes too close to the end of the array are left out of the gathers
+  // and computed one by one.
+  const __m512i vlimit = _mm512_set1_epi32((int)(filter->ArrayLength - 4));
+  const __m512i fmask = _mm512_set1_epi32(0xFF);
+  for (size_t i = 0; i < count; i += 16) {
+    size_t n = count - i < 16 ? count - i : 16;
+    __mmask16 valid = (__mmask16)((1U << n) - 1);
+    __m512i f, h0, h1, h2;
+    binary_fuse_avx512_hash16(keys + i, valid, filter->Seed, filter->SegmentLength,
+                              filter->SegmentLengthMask, filter->SegmentCountLength,
+                              &f, &h0, &h1, &h2);
+    __mmask16 safe = _mm512_mask_cmple_epu32_mask(valid, h2, vlimit);
+    __m512i x = _mm512_xor_si512(f, binary_fuse_avx512_gather8(safe, h0, filter->Fingerprints));
+    x = _mm512_xor_si512(x, binary_fuse_avx512_gather8(safe, h1, filter->Fingerprints));
+    x = _mm512_xor_si512(x, binary_fuse_avx512_gather8(safe, h2, filter->Fingerprints));
+    __mmask16 hits = _mm512_mask_testn_epi32_mask(safe, x, fmask);
+    binary_fuse_avx512_store16(out + i, valid, hits);
+    for (unsigned rest = (unsigned)(valid & ~safe); rest != 0; rest &= rest - 1) {
+      size_t j = (size_t)__builtin_ctz(rest);
+      out[i + j] = binary_fuse8_contain(keys[i + j], filter);
+    }
+  }
+}
+
+// Report, for each of the 'count' keys, if it is in the set, with false
+// positive rate, using AVX-512 sixteen keys at a time. The answer for keys[i]
+// is written to out[i] and is identical to binary_fuse16_contain.
+// The processor must support AVX-512 F and DQ, binary_fuse16_contain_batch
+// checks it for you.
+BINARY_FUSE_TARGET_AVX512
+static inline void binary_fuse16_contain_batch_avx512(const uint64_t *keys, size_t count,
+                                                      bool *out,
+                                                      const binary_fuse16_t *filter) {
+  // The gathers load 32 bits at each 16-bit location, and use signed indexes.
+  if (filter->ArrayLength < 2 || filter->ArrayLength > INT32_MAX) {
+    binary_fuse16_contain_batch_scalar(keys, count, out, filter);
+    return;
+  }
+  const __m512i vlimit = _mm512_set1_epi32((int)(filter->ArrayLength - 2));
+  const __m512i fmask = _mm512_set1_epi32(0xFFFF);
+  for (size_t i = 0; i < count; i += 16) {
+    size_t n = count - i < 16 ? count - i : 16;
+    __mmask16 valid = (__mmask16)((1U << n) - 1);
+    __m512i f, h0, h1, h2;
+    binary_fuse_avx512_hash16(keys + i, valid, filter->Seed, filter->SegmentLength,
+                              filter->SegmentLengthMask, filter->SegmentCountLength,
+                              &f, &h0, &h1, &h2);
+    __mmask16 safe = _mm512_mask_cmple_epu32_mask(valid, h2, vlimit);
+    __m512i x = _mm512_xor_si512(f, binary_fuse_avx512_gather16(safe, h0, filter->Fingerprints));
+    x = _mm512_xor_si512(x, binary_fuse_avx512_gather16(safe, h1, filter->Fingerprints));
+    x = _mm512_xor_si512(x, binary_fuse_avx512_gather16(safe, h2, filter->Fingerprints));
+    __mmask16 hits = _mm512_mask_testn_epi32_mask(safe, x, fmask);
+    binary_fuse_avx512_store16(out + i, valid, hits);
+    for (unsigned rest = (unsigned)(valid & ~safe); rest != 0; rest &= rest - 1) {
+      size_t j = (size_t)__builtin_ctz(rest);
+      out[i + j] = binary_fuse16_contain(keys[i + j], filter);
+    }
+  }
+}
+#endif // BINARY_FUSE_X64_SIMD
+
+// Returns the fastest kernel supported by both the compiler and the processor.
+static inline int binary_fuse_detect_kernel(void) {
+#ifdef BINARY_FUSE_X64_SIMD
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512dq")) {
+    return BINARY_FUSE_KERNEL_AVX512;
+  }
+  if (__builtin_cpu_supports("avx2")) {
+    return BINARY_FUSE_KERNEL_AVX2;
+  }
+#endif
+  return BINARY_FUSE_KERNEL_SCALAR;
+}
+
+// Returns the kernel used by the batch queries. It is detected on first use,
+// and then remains the same for the life of the program.
+static inline int binary_fuse_kernel(void) {
+  static int kernel = -1;
+#if defined(__GNUC__) || defined(__clang__)
+  // the batch queries may run on several threads at once (see
+  // binary_fuse_parallel.h), they all detect the same kernel
+  int detected = __atomic_load_n(&kernel, __ATOMIC_RELAXED);
+  if (detected < 0) {
+    detected = binary_fuse_detect_kernel();
+    __atomic_store_n(&kernel, detected, __ATOMIC_RELAXED);
+  }
+  return detected;
+#else
+  if (kernel < 0) {
+    kernel = binary_fuse_detect_kernel();
+  }
+  return kernel;
+#endif
+}
+
+#ifdef BINARY_FUSE_X64_SIMD
+BINARY_FUSE_TARGET_AVX2
+static inline void binary_fuse_hash_keys_avx2(const uint64_t *keys, size_t n, uint64_t seed,
+                                              uint64_t *out) {
+  const __m256i vseed = _mm256_set1_epi64x((long long)seed);
+  size_t vector_end = n - n % 4;
+  for (size_t i = 0; i < vector_end; i += 4) {
+    __m256i h = _mm256_loadu_si256((const __m256i *)(const void *)(keys + i));
+    h = binary_fuse_avx2_murmur64(_mm256_add_epi64(h, vseed));
+    _mm256_storeu_si256((__m256i *)(void *)(out + i), h);
+  }
+  for (size_t i = vector_end; i < n; i++) {
+    out[i] = binary_fuse_mix_split(keys[i], seed);
+  }
+}
+
+BINARY_FUSE_TARGET_AVX512
+static inline void binary_fuse_hash_keys_avx512(const uint64_t *keys, size_t n, uint64_t seed,
+                                                uint64_t *out) {
+  const __m512i vseed = _mm512_set1_epi64((long long)seed);
+  for (size_t i = 0; i < n; i += 8) {
+    __mmask8 valid = n - i >= 8 ? (__mmask8)0xFF : (__mmask8)((1U << (n - i)) - 1);
+    __m512i h = _mm512_maskz_loadu_epi64(valid, keys + i);
+    h = binary_fuse_avx512_murmur64(_mm512_add_epi64(h, vseed));
+    _mm512_mask_storeu_epi64(out + i, valid, h);
+  }
+}
+#endif // BINARY_FUSE_X64_SIMD
+
+// The constructions hash their keys BINARY_FUSE_HASH_BLOCK at a time with this
+// function, the results are identical whatever the kernel.
+static inline void binary_fuse_hash_keys(const uint64_t *keys, size_t n, uint64_t seed,
+                                         uint64_t *out) {
+#ifdef BINARY_FUSE_X64_SIMD
+  switch (binary_fuse_kernel()) {
+  case BINARY_FUSE_KERNEL_AVX512:
+    binary_fuse_hash_keys_avx512(keys, n, seed, out);
+    return;
+  case BINARY_FUSE_KERNEL_AVX2:
+    binary_fuse_hash_keys_avx2(keys, n, seed, out);
+    return;
+  default:
+    break;
+  }
+#endif
+  for (size_t i = 0; i < n; i++) {
+    out[i] = binary_fuse_mix_split(keys[i], seed);
+  }
+}
+
+static inline const char *binary_fuse_kernel_name(int kernel) {
+  switch (kernel) {
+  case BINARY_FUSE_KERNEL_AVX2:
+    return "avx2";
+  case BINARY_FUSE_KERNEL_AVX512:
+    return "avx512";
+  default:
+    return "scalar";
+  }
+}
+
+// Report, for each of the 'count' keys, if it is in the set, with false
+// positive rate. The answer for keys[i] is written to out[i].
+// This is much faster than calling binary_fuse8_contain in a loop: depending
+// on the processor, it uses AVX-512 or AVX2 gathers, or scalar code with
+// software prefetching (see binary_fuse_kernel()).
+static inline void binary_fuse8_contain_batch(const uint64_t *keys, size_t count,
+                                              bool *out,
+                                              const binary_fuse8_t *filter) {
+#ifdef BINARY_FUSE_X64_SIMD
+  switch (binary_fuse_kernel()) {
+  case BINARY_FUSE_KERNEL_AVX512:
+    binary_fuse8_contain_batch_avx512(keys, count, out, filter);
+    return;
+  case BINARY_FUSE_KERNEL_AVX2:
+    binary_fuse8_contain_batch_avx2(keys, count, out, filter);
+    return;
+  default:
+    break;
+  }
+#endif
+  binary_fuse8_contain_batch_scalar(keys, count, out, filter);
+}
+
+// Report, for each of the 'count' keys, if it is in the set, with false
+// positive rate. The answer for keys[i] is written to out[i].
+// See binary_fuse8_contain_batch.
+static inline void binary_fuse16_contain_batch(const uint64_t *keys, size_t count,
+                                               bool *out,
+                                               const binary_fuse16_t *filter) {
+#ifdef BINARY_FUSE_X64_SIMD
+  switch (binary_fuse_kernel()) {
+  case BINARY_FUSE_KERNEL_AVX512:
+    binary_fuse16_contain_batch_avx512(keys, count, out, filter);
+    return;
+  case BINARY_FUSE_KERNEL_AVX2:
+    binary_fuse16_contain_batch_avx2(keys, count, out, filter);
+    return;
+  default:
+    break;
+  }
+#endif
+  binary_fuse16_contain_batch_scalar(keys, count, out, filter);
+}
+
+//////////////////
+// bitmap and selection vector queries
+//////////////////
+
+// number of keys queried at once by the bitmap and selection vector queries,
+// a multiple of 64
+#define BINARY_FUSE_SELECT_BLOCK 256
+
+static inline uint64_t binary_fuse_popcount64(uint64_t x) {
+#if defined(__GNUC__) || defined(__clang__)
+  return (uint64_t)__builtin_popcountll(x);
+#else
+  x = x - ((x >> 1) & UINT64_C(0x5555555555555555));
+  x = (x & UINT64_C(0x3333333333333333)) + ((x >> 2) & UINT64_C(0x3333333333333333));
+  x = (x + (x >> 4)) & UINT64_C(0x0f0f0f0f0f0f0f0f);
+  return (x * UINT64_C(0x0101010101010101)) >> 56;
+#endif
+}
+
+// Pack the 'n' (at most 64) answers of a batch query into the low bits of a
+// word: bit j is set when answers[j] is true.
+static inline uint64_t binary_fuse_pack_answers(const bool *answers, size_t n) {
+  uint64_t bits = 0;
+  size_t j = 0;
+  for (; j + 8 <= n; j += 8) {
+    uint64_t bytes;
+    memcpy(&bytes, answers + j, sizeof(bytes));
+    // each byte is 0 or 1: the multiplication moves byte k to bit 56 + k
+    bits |= ((bytes * UINT64_C(0x0102040810204080)) >> 56) << j;
+  }
+  for (; j < n; j++) {
+    bits |= (uint64_t)answers[j] << j;
+  }
+  return bits;
+}
+
+#ifdef BINARY_FUSE_X64_SIMD
+// binary_fuse_select_bits with the AVX-512 compress instruction
+BINARY_FUSE_TARGET_AVX512
+static inline size_t binary_fuse_select_bits_avx512(uint64_t bits, uint32_t base,
+                                                    uint32_t *sel) {
+  __m512i idx = _mm512_add_epi32(_mm512_set1_epi32((int)base),
+                                 _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10,
+                                                   11, 12, 13, 14, 15));
+  const __m512i sixteen = _mm512_set1_epi32(16);
+  size_t n = 0;
+  for (int k = 0; k < 4; k++) {
+    __mmask16 m = (__mmask16)(bits >> (16 * k));
+    _mm512_mask_compressstoreu_epi32(sel + n, m, idx);
+    n += (size_t)binary_fuse_popcount64(m);
+    idx = _mm512_add_epi32(idx, sixteen);
+  }
+  return n;
+}
+#endif
+
+// Append base + j to sel for each bit j set in 'bits', and return how many
+// positions were appended. There is no branch per bit, but up to 64 entries
+// of sel may be written.
+static inline size_t binary_fuse_select_bits(uint64_t bits, uint32_t base, uint32_t *sel) {
+#ifdef BINARY_FUSE_X64_SIMD
+  if (binary_fuse_kernel() == BINARY_FUSE_KERNEL_AVX512) {
+    return binary_fuse_select_bits_avx512(bits, base, sel);
+  }
+#endif
+  size_t n = 0;
+  for (uint32_t j = 0; j < 64; j++) {
+    sel[n] = base + j;
+    n += (bits >> j) & 1;
+  }
+  return n;
+}
+
+// Query the 'count' keys and set bit i % 64 of bitmap[i / 64] when keys[i] is in
+// the set (with false positive rate), clearing it otherwise. The bitmap must hold
+// (count + 63) / 64 words; the unused bits of the last word are cleared.
+// Returns the number of keys found.
+static inline size_t binary_fuse8_contain_bitmap(const uint64_t *keys, size_t count,
+                                                 uint64_t *bitmap,
+                                                 const binary_fuse8_t *filter) {
+  bool answers[BINARY_FUSE_SELECT_BLOCK];
+  size_t hits = 0;
+  for (size_t start = 0; start < count; start += BINARY_FUSE_SELECT_BLOCK) {
+    size_t m = count - start < BINARY_FUSE_SELECT_BLOCK ? count - start : BINARY_FUSE_SELECT_BLOCK;
+    binary_fuse8_contain_batch(keys + start, m, answers, filter);
+    for (size_t j = 0; j < m; j += 64) {
+      uint64_t bits = binary_fuse_pack_answers(answers + j, m - j < 64 ? m - j : 64);
+      bitmap[(start + j) / 64] = bits;
+      hits += (size_t)binary_fuse_popcount64(bits);
+    }
+  }
+  return hits;
+}
+
+// Query the 'count' keys and write the positions i of the keys found in the set
+// (with false positive rate) to sel, in increasing order. Returns the number of
+// positions written. The count must be less than 2^32 and sel must have room
+// for 'count' positions, rounded up to a multiple of 64.
+static inline size_t binary_fuse8_contain_select(const uint64_t *keys, size_t count,
+                                                 uint32_t *sel,
+                                                 const binary_fuse8_t *filter) {
+  bool answers[BINARY_FUSE_SELECT_BLOCK];
+  size_t hits = 0;
+  for (size_t start = 0; start < count; start += BINARY_FUSE_SELECT_BLOCK) {
+    size_t m = count - start < BINARY_FUSE_SELECT_BLOCK ? count - start : BINARY_FUSE_SELECT_BLOCK;
+    binary_fuse8_contain_batch(keys + start, m, answers, filter);
+    for (size_t j = 0; j < m; j += 64) {
+      uint64_t bits = binary_fuse_pack_answers(answers + j, m - j < 64 ? m - j : 64);
+      hits += binary_fuse_select_bits(bits, (uint32_t)(start + j), sel + hits);
+    }
+  }
+  return hits;
+}
+
+// See binary_fuse8_contain_bitmap.
+static inline size_t binary_fuse16_contain_bitmap(const uint64_t *keys, size_t count,
+                                                  uint64_t *bitmap,
+                                                  const binary_fuse16_t *filter) {
+  bool answers[BINARY_FUSE_SELECT_BLOCK];
+  size_t hits = 0;
+  for (size_t start = 0; start < count; start += BINARY_FUSE_SELECT_BLOCK) {
+    size_t m = count - start < BINARY_FUSE_SELECT_BLOCK ? count - start : BINARY_FUSE_SELECT_BLOCK;
+    binary_fuse16_contain_batch(keys + start, m, answers, filter);
+    for (size_t j = 0; j < m; j += 64) {
+      uint64_t bits = binary_fuse_pack_answers(answers + j, m - j < 64 ? m - j : 64);
+      bitmap[(start + j) / 64] = bits;
+      hits += (size_t)binary_fuse_popcount64(bits);
+    }
+  }
+  return hits;
+}
+
+// See binary_fuse8_contain_select.
+static inline size_t binary_fuse16_contain_select(const uint64_t *keys, size_t count,
+                                                  uint32_t *sel,
+                                                  const binary_fuse16_t *filter) {
+  bool answers[BINARY_FUSE_SELECT_BLOCK];
+  size_t hits = 0;
+  for (size_t start = 0; start < count; start += BINARY_FUSE_SELECT_BLOCK) {
+    size_t m = count - start < BINARY_FUSE_SELECT_BLOCK ? count - start : BINARY_FUSE_SELECT_BLOCK;
+    binary_fuse16_contain_batch(keys + start, m, answers, filter);
+    for (size_t j = 0; j < m; j += 64) {
+      uint64_t bits = binary_fuse_pack_answers(answers + j, m - j < 64 ? m - j : 64);
+      hits += binary_fuse_select_bits(bits, (uint32_t)(start + j), sel + hits);
+    }
+  }
+  return hits;
+}
+
+//////////////////
+// cache-line-local (blocked) filters
+//////////////////
+
+/**
+ * In binary_fuse8_t, the three locations of a key are in three consecutive
+ * segments of up to 262144 entries: a query on a large filter costs three
+ * cache misses. The locations cannot simply be brought closer: with segments of
+ * a few dozen entries, the peeling fails even with 30% of extra space.
+ *
+ * The blocked filters instead store, for each key, the equation
+ *     parity(coefficients & window) == fingerprint
+ * on a window of 64 consecutive slots (a banded linear system, solved by
+ * Gaussian elimination as in ribbon filters). The slots are stored bit-sliced:
+ * 64 slots of 8 bits, or 32 slots of 16 bits, per 64-byte line, so that a query
+ * reads exactly two adjacent cache lines. They use a few percent more space
+ * than binary_fuse8_t (binary_fuse16_blocked_t: about 15% more than
+ * binary_fuse16_t), see benchmarks/spaceusage.c.
+ ***/
+
+#define BINARY_FUSE_CACHE_LINE 64
+
+static inline uint64_t binary_fuse_parity64(uint64_t x) {
+#if defined(__GNUC__) || defined(__clang__)
+  return (uint64_t)__builtin_parityll(x);
+#else
+  x ^= x >> 32;
+  x ^= x >> 16;
+  x ^= x >> 8;
+  x ^= x >> 4;
+  return (0x6996U >> (x & 0xF)) & 1;
+#endif
+}
+
+static inline unsigned binary_fuse_trailing_zeroes64(uint64_t x) {
+#if defined(__GNUC__) || defined(__clang__)
+  return (unsigned)__builtin_ctzll(x);
+#else
+  unsigned z = 0;
+  while ((x & 1) == 0) {
+    x >>= 1;
+    z++;
+  }
+  return z;
+#endif
+}
+
+// The coefficients of the equation of a key: bit j selects the slot start + j.
+// The lowest bit is always set.
+static inline uint64_t binary_fuse_blocked_coefficients(uint64_t hash) {
+  uint64_t c = (hash ^ (hash >> 31U)) * UINT64_C(0xbf58476d1ce4e5b9);
+  return (c ^ (c >> 29U)) | 1U;
+}
+
+// Allocate 'bytes' bytes of zeroed memory aligned on a cache line, *memory
+// receives the pointer to free.
+static inline void *binary_fuse_blocked_calloc(size_t bytes, void **memory) {
+  *memory = calloc(bytes + BINARY_FUSE_CACHE_LINE, 1);
+  if (*memory == NULL) {
+    return NULL;
+  }
+  uintptr_t p = (uintptr_t)*memory;
+  return (void *)((p + BINARY_FUSE_CACHE_LINE - 1) & ~(uintptr_t)(BINARY_FUSE_CACHE_LINE - 1));
+}
+
+typedef struct binary_fuse8_blocked_s {
+  uint64_t Seed;
+  uint32_t Size;
+  uint32_t ArrayLength; // number of slots, a multiple of 64
+  uint32_t StartCount;  // number of possible windows
+  uint64_t *Blocks;     // eight words per block of 64 slots, bit j of slot i
+                        // is bit i % 64 of Blocks[(i / 64) * 8 + j]
+  void *Memory;
+} binary_fuse8_blocked_t;
+
+// The product of the coefficients with the window of 64 slots starting at
+// 'start', which spans two cache lines.
+static inline uint8_t binary_fuse8_blocked_product(const uint64_t *blocks, uint32_t start,
+                                                   uint64_t coefficients) {
+  const uint64_t *lo = blocks + (start / 64) * 8;
+  const uint64_t *hi = lo + 8;
+  unsigned shift = start % 64;
+  // the coefficients are shifted instead of the window: bit j is the
+  // coefficient of bit j of lo[] (clo) or hi[] (chi)
+  uint64_t clo = coefficients << shift;
+  uint64_t chi = (coefficients >> 1U) >> (63 - shift);
+  uint64_t t[8];
+  for (unsigned j = 0; j < 8; j++) {
+    t[j] = (lo[j] & clo) ^ (hi[j] & chi);
+  }
+  // Fold the eight words at once, halving the width each time while keeping
+  // the parity of every column: in the end, byte j holds the column j.
+  uint64_t u[4];
+  for (unsigned k = 0; k < 4; k++) {
+    u[k] = ((t[k] ^ (t[k] >> 32U)) & UINT64_C(0x00000000FFFFFFFF)) |
+           ((t[k + 4] ^ (t[k + 4] << 32U)) & UINT64_C(0xFFFFFFFF00000000));
+  }
+  uint64_t v[2];
+  for (unsigned k = 0; k < 2; k++) {
+    v[k] = ((u[k] ^ (u[k] >> 16U)) & UINT64_C(0x0000FFFF0000FFFF)) |
+           ((u[k + 2] ^ (u[k + 2] << 16U)) & UINT64_C(0xFFFF0000FFFF0000));
+  }
+  uint64_t x = ((v[0] ^ (v[0] >> 8U)) & UINT64_C(0x00FF00FF00FF00FF)) |
+               ((v[1] ^ (v[1] << 8U)) & UINT64_C(0xFF00FF00FF00FF00));
+  x ^= x >> 4U;
+  x ^= x >> 2U;
+  x ^= x >> 1U;
+  // bit 8 * j is the parity of the column j: move it to bit j
+  return (uint8_t)(((x & UINT64_C(0x0101010101010101)) * UINT64_C(0x0102040810204080)) >> 56U);
+}
+
+
+// Report, for each of the 'count' keys, if it is in the set, with false
+// positive rate. The answer for keys[i] is written to out[i]. As in
+// binary_fuse8_contain_batch_scalar, the two cache lines of a key are
+// prefetched BINARY_FUSE_BATCH_WINDOW keys ahead.
+// Portable version of binary_fuse8_blocked_contain_batch.
+static inline void binary_fuse8_blocked_contain_batch_scalar(const uint64_t *keys, size_t count,
+                                                             bool *out,
+                                                             const binary_fuse8_blocked_t *filter) {
+  uint64_t hashes[BINARY_FUSE_BATCH_WINDOW];
+  uint32_t starts[BINARY_FUSE_BATCH_WINDOW];
+  const size_t mask = BINARY_FUSE_BATCH_WINDOW - 1;
+  for (size_t i = 0; i < count + BINARY_FUSE_BATCH_WINDOW; i++) {
+    size_t slot = i & mask;
+    if (i >= BINARY_FUSE_BATCH_WINDOW) {
+      uint64_t hash = hashes[slot];
+      out[i - BINARY_FUSE_BATCH_WINDOW] =
+          binary_fuse8_blocked_product(filter->Blocks, starts[slot],
+                                       binary_fuse_blocked_coefficients(hash)) ==
+          binary_fuse8_fingerprint(hash);
+    }
+    if (i < count) {
+      uint64_t hash = binary_fuse_mix_split(keys[i], filter->Seed);
+      uint32_t start = (uint32_t)binary_fuse_mulhi(hash, filter->StartCount);
+      const uint64_t *block = filter->Blocks + (start / 64) * 8;
+      binary_fuse_prefetch(block);
+      binary_fuse_prefetch(block + 8);
+      hashes[slot] = hash;
+      starts[slot] = start;
+    }
+  }
+}
+
+#ifdef BINARY_FUSE_X64_SIMD
+/**
+ * Without the popcnt instruction, the parities dominate the cost of a query
+ * and limit the number of cache misses in flight: the AVX2 versions compute
+ * the eight or sixteen parities of a key at once.
+ ***/
+
+// parity of the low nibble of each byte
+BINARY_FUSE_TARGET_AVX2
+static inline __m256i binary_fuse_avx2_nibble_parity(__m256i x) {
+  const __m256i table = _mm256_setr_epi8(0, 1, 1, 0, 1, 0, 0, 1, 1, 0, 0, 1, 0, 1, 1, 0,
+                                         0, 1, 1, 0, 1, 0, 0, 1, 1, 0, 0, 1, 0, 1, 1, 0);
+  return _mm256_shuffle_epi8(table, x);
+}
+
+// binary_fuse8_blocked_product with AVX2
+BINARY_FUSE_TARGET_AVX2
+static inline uint8_t binary_fuse8_blocked_product_avx2(const uint64_t *blocks, uint32_t start,
+                                                        uint64_t coefficients) {
+  const __m256i *lo = (const __m256i *)(blocks + (start / 64) * 8);
+  unsigned shift = start % 64;
+  const __m256i clo = _mm256_set1_epi64x((long long)(coefficients << shift));
+  const __m256i chi = _mm256_set1_epi64x((long long)((coefficients >> 1U) >> (63 - shift)));
+  // columns 0-3 in a, 4-7 in b
+  __m256i a = _mm256_xor_si256(_mm256_and_si256(_mm256_load_si256(lo), clo),
+                               _mm256_and_si256(_mm256_load_si256(lo + 2), chi));
+  __m256i b = _mm256_xor_si256(_mm256_and_si256(_mm256_load_si256(lo + 1), clo),
+                               _mm256_and_si256(_mm256_load_si256(lo + 3), chi));
+  a = _mm256_xor_si256(a, _mm256_srli_epi64(a, 32));
+  b = _mm256_xor_si256(b, _mm256_slli_epi64(b, 32));
+  // the 32-bit word 2k holds the column k, 2k + 1 the column k + 4
+  __m256i x = _mm256_blend_epi32(a, b, 0xAA);
+  x = _mm256_xor_si256(x, _mm256_srli_epi32(x, 16));
+  x = _mm256_xor_si256(x, _mm256_srli_epi32(x, 8));
+  x = _mm256_xor_si256(x, _mm256_srli_epi32(x, 4));
+  x = binary_fuse_avx2_nibble_parity(_mm256_and_si256(x, _mm256_set1_epi32(0xF)));
+  x = _mm256_permutevar8x32_epi32(x, _mm256_setr_epi32(0, 2, 4, 6, 1, 3, 5, 7));
+  return (uint8_t)_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_slli_epi32(x, 31)));
+}
+
+// binary_fuse8_blocked_contain_batch_scalar with binary_fuse8_blocked_product_avx2
+BINARY_FUSE_TARGET_AVX2
+static inline void binary_fuse8_blocked_contain_batch_avx2(const uint64_t *keys, size_t count,
+                                                           bool *out,
+                                                           const binary_fuse8_blocked_t *filter) {
+  uint64_t hashes[BINARY_FUSE_BATCH_WINDOW];
+  uint32_t starts[BINARY_FUSE_BATCH_WINDOW];
+  const size_t mask = BINARY_FUSE_BATCH_WINDOW - 1;
+  for (size_t i = 0; i < count + BINARY_FUSE_BATCH_WINDOW; i++) {
+    size_t slot = i & mask;
+    if (i >= BINARY_FUSE_BATCH_WINDOW) {
+      uint64_t hash = hashes[slot];
+      out[i - BINARY_FUSE_BATCH_WINDOW] =
+          binary_fuse8_blocked_product_avx2(filter->Blocks, starts[slot],
+                                            binary_fuse_blocked_coefficients(hash)) ==
+          binary_fuse8_fingerprint(hash);
+    }
+    if (i < count) {
+      uint64_t hash = binary_fuse_mix_split(keys[i], filter->Seed);
+      uint32_t start = (uint32_t)binary_fuse_mulhi(hash, filter->StartCount);
+      const uint64_t *block = filter->Blocks + (start / 64) * 8;
+      binary_fuse_prefetch(block);
+      binary_fuse_prefetch(block + 8);
+      hashes[slot] = hash;
+      starts[slot] = start;
+    }
+  }
+}
+#endif // BINARY_FUSE_X64_SIMD
+
+// Report, for each of the 'count' keys, if it is in the set, with false
+// positive rate. The answer for keys[i] is written to out[i].
+// On processors supporting AVX2, the parities are computed with AVX2 (see
+// binary_fuse_kernel()).
+static inline void binary_fuse8_blocked_contain_batch(const uint64_t *keys, size_t count,
+                                                      bool *out,
+                                                      const binary_fuse8_blocked_t *filter) {
+#ifdef BINARY_FUSE_X64_SIMD
+  if (binary_fuse_kernel() != BINARY_FUSE_KERNEL_SCALAR) {
+    binary_fuse8_blocked_contain_batch_avx2(keys, count, out, filter);
+    return;
+  }
+#endif
+  binary_fuse8_blocked_contain_batch_scalar(keys, count, out, filter);
+}
+
+// Report if the key is in the set, with false positive rate.
+static inline bool binary_fuse8_blocked_contain(uint64_t key,
+                                                const binary_fuse8_blocked_t *filter) {
+  uint64_t hash = binary_fuse_mix_split(key, filter->Seed);
+  uint32_t start = (uint32_t)binary_fuse_mulhi(hash, filter->StartCount);
+  uint64_t coefficients = binary_fuse_blocked_coefficients(hash);
+#ifdef BINARY_FUSE_X64_SIMD
+  if (binary_fuse_kernel() != BINARY_FUSE_KERNEL_SCALAR) {
+    return binary_fuse8_blocked_product_avx2(filter->Blocks, start, coefficients) ==
+           binary_fuse8_fingerprint(hash);
+  }
+#endif
+  return binary_fuse8_blocked_product(filter->Blocks, start, coefficients) ==
+         binary_fuse8_fingerprint(hash);
+}
+
+// allocate enough capacity for a set containing up to 'size' elements
+// caller is responsible to call binary_fuse8_blocked_free(filter)
+// size should be at least 2.
+static inline bool binary_fuse8_blocked_allocate(uint32_t size,
+                                                 binary_fuse8_blocked_t *filter) {
+  // The elimination fails more often as the set grows: the factor was tuned so
+  // that it succeeds at least 80% of the time, from 1e4 to 5e7 keys.
+  double sizeFactor = size <= 1 ? 0 : 1.04 + 0.017 * log10((double)size);
+  uint64_t capacity = (uint64_t)round((double)size * sizeFactor);
+  uint64_t blocks = (capacity + 63) / 64 + 1;
+  if (blocks < 2) {
+    blocks = 2;
+  }
+  filter->Seed = 0;
+  filter->Size = size;
+  filter->Blocks = NULL;
+  filter->Memory = NULL;
+  if (blocks * 64 > UINT32_MAX) {
+    filter->ArrayLength = 0;
+    filter->StartCount = 0;
+    return false;
+  }
+  filter->ArrayLength = (uint32_t)blocks * 64;
+  // the last window ends in the before-last slot, so that the second line read
+  // by a query is always inside the array
+  filter->StartCount = filter->ArrayLength - 64;
+  filter->Blocks = (uint64_t *)binary_fuse_blocked_calloc(filter->ArrayLength, &filter->Memory);
+  return filter->Blocks != NULL;
+}
+
+// report memory usage
+static inline size_t binary_fuse8_blocked_size_in_bytes(const binary_fuse8_blocked_t *filter) {
+  return filter->ArrayLength * sizeof(uint8_t) + sizeof(binary_fuse8_blocked_t);
+}
+
+// release memory
+static inline void binary_fuse8_blocked_free(binary_fuse8_blocked_t *filter) {
+  free(filter->Memory);
+  filter->Memory = NULL;
+  filter->Blocks = NULL;
+  filter->Seed = 0;
+  filter->Size = 0;
+  filter->ArrayLength = 0;
+  filter->StartCount = 0;
+}
+
+// Construct the filter, returns true on success, false on failure.
+// The algorithm fails when there is insufficient memory.
+// The caller is responsable for calling binary_fuse8_blocked_allocate(size,filter)
+// before. Duplicated keys are allowed.
+static inline bool binary_fuse8_blocked_populate(const uint64_t *keys, uint32_t size,
+                                                 binary_fuse8_blocked_t *filter) {
+  if (size != filter->Size) {
+    return false;
+  }
+  uint64_t rng_counter = 0x726b2b9d438b9d4d;
+  uint32_t capacity = filter->ArrayLength;
+  // row i of the system: the equation whose lowest coefficient is slot i
+  uint64_t *rows = (uint64_t *)malloc(capacity * sizeof(uint64_t));
+  uint8_t *results = (uint8_t *)malloc(capacity * sizeof(uint8_t));
+  if ((rows == NULL) || (results == NULL)) {
+    free(rows);
+    free(results);
+    return false;
+  }
+  for (int loop = 0; true; ++loop) {
+    if (loop + 1 > XOR_MAX_ITERATIONS) {
+      free(rows);
+      free(results);
+      return false;
+    }
+    filter->Seed = binary_fuse_rng_splitmix64(&rng_counter);
+    memset(rows, 0, capacity * sizeof(uint64_t));
+    bool error = false;
+    for (uint32_t i = 0; (i < size) && !error; i++) {
+      uint64_t hash = binary_fuse_mix_split(keys[i], filter->Seed);
+      uint32_t row = (uint32_t)binary_fuse_mulhi(hash, filter->StartCount);
+      uint64_t c = binary_fuse_blocked_coefficients(hash);
+      uint8_t r = binary_fuse8_fingerprint(hash);
+      while (true) {
+        if (rows[row] == 0) {
+          rows[row] = c;
+          results[row] = r;
+          break;
+        }
+        c ^= rows[row];
+        r ^= results[row];
+        if (c == 0) {
+          // a duplicated key when r == 0, otherwise the system has no solution
+          error = (r != 0);
+          break;
+        }
+        unsigned z = binary_fuse_trailing_zeroes64(c);
+        row += z;
+        c >>= z;
+      }
+    }
+    if (!error) {
+      break;
+    }
+  }
+  // Back substitution, from the last row. Bit k of window[j] is bit j of the
+  // slot i + k.
+  uint64_t window[8] = {0};
+  memset(filter->Blocks, 0, capacity * sizeof(uint8_t));
+  for (uint32_t i = capacity - 1; i < capacity; i--) {
+    uint64_t c = rows[i];
+    for (unsigned j = 0; j < 8; j++) {
+      window[j] <<= 1U;
+      if (c != 0) {
+        window[j] |= binary_fuse_parity64(window[j] & c) ^ ((results[i] >> j) & 1U);
+        filter->Blocks[(i / 64) * 8 + j] |= (window[j] & 1U) << (i % 64);
+      }
+    }
+  }
+  free(rows);
+  free(results);
+  return true;
+}
+
+typedef struct binary_fuse16_blocked_s {
+  uint64_t Seed;
+  uint32_t Size;
+  uint32_t ArrayLength; // number of slots, a multiple of 32
+  uint32_t StartCount;  // number of possible windows
+  uint32_t *Blocks;     // sixteen words per block of 32 slots, bit j of slot i
+                        // is bit i % 32 of Blocks[(i / 32) * 16 + j]
+  void *Memory;
+} binary_fuse16_blocked_t;
+
+// The product of the coefficients with the window of 64 slots starting at
+// slot 32 * 'start', which spans two cache lines.
+static inline uint16_t binary_fuse16_blocked_product(const uint32_t *blocks, uint32_t start,
+                                                     uint64_t coefficients) {
+  const uint32_t *lo = blocks + (size_t)start * 16;
+  const uint32_t *hi = lo + 16;
+  uint32_t clo = (uint32_t)coefficients;
+  uint32_t chi = (uint32_t)(coefficients >> 32U);
+  // as in binary_fuse8_blocked_product, but with 32-bit columns: in the end,
+  // nibble j holds the column j
+  uint64_t t[8];
+  for (unsigned k = 0; k < 8; k++) {
+    t[k] = ((lo[k] & clo) ^ (hi[k] & chi)) |
+           ((uint64_t)((lo[k + 8] & clo) ^ (hi[k + 8] & chi)) << 32U);
+  }
+  uint64_t u[4];
+  for (unsigned k = 0; k < 4; k++) {
+    u[k] = ((t[k] ^ (t[k] >> 16U)) & UINT64_C(0x0000FFFF0000FFFF)) |
+           ((t[k + 4] ^ (t[k + 4] << 16U)) & UINT64_C(0xFFFF0000FFFF0000));
+  }
+  uint64_t v[2];
+  for (unsigned k = 0; k < 2; k++) {
+    v[k] = ((u[k] ^ (u[k] >> 8U)) & UINT64_C(0x00FF00FF00FF00FF)) |
+           ((u[k + 2] ^ (u[k + 2] << 8U)) & UINT64_C(0xFF00FF00FF00FF00));
+  }
+  uint64_t x = ((v[0] ^ (v[0] >> 4U)) & UINT64_C(0x0F0F0F0F0F0F0F0F)) |
+               ((v[1] ^ (v[1] << 4U)) & UINT64_C(0xF0F0F0F0F0F0F0F0));
+  x ^= x >> 2U;
+  x ^= x >> 1U;
+  // bit 4 * j is the parity of the column j: move it to bit j
+  x &= UINT64_C(0x1111111111111111);
+  x = (x | (x >> 3U)) & UINT64_C(0x0303030303030303);
+  x = (x | (x >> 6U)) & UINT64_C(0x000F000F000F000F);
+  x = (x | (x >> 12U)) & UINT64_C(0x000000FF000000FF);
+  x = (x | (x >> 24U)) & UINT64_C(0x000000000000FFFF);
+  return (uint16_t)x;
+}
+
+
+// See binary_fuse8_blocked_contain_batch_scalar.
+static inline void binary_fuse16_blocked_contain_batch_scalar(const uint64_t *keys, size_t count,
+                                                              bool *out,
+                                                              const binary_fuse16_blocked_t *filter) {
+  uint64_t hashes[BINARY_FUSE_BATCH_WINDOW];
+  uint32_t starts[BINARY_FUSE_BATCH_WINDOW];
+  const size_t mask = BINARY_FUSE_BATCH_WINDOW - 1;
+  for (size_t i = 0; i < count + BINARY_FUSE_BATCH_WINDOW; i++) {
+    size_t slot = i & mask;
+    if (i >= BINARY_FUSE_BATCH_WINDOW) {
+      uint64_t hash = hashes[slot];
+      out[i - BINARY_FUSE_BATCH_WINDOW] =
+          binary_fuse16_blocked_product(filter->Blocks, starts[slot],
+                                        binary_fuse_blocked_coefficients(hash)) ==
+          binary_fuse16_fingerprint(hash);
+    }
+    if (i < count) {
+      uint64_t hash = binary_fuse_mix_split(keys[i], filter->Seed);
+      uint32_t start = (uint32_t)binary_fuse_mulhi(hash, filter->StartCount);
+      const uint32_t *block = filter->Blocks + (size_t)start * 16;
+      binary_fuse_prefetch(block);
+      binary_fuse_prefetch(block + 16);
+      hashes[slot] = hash;
+      starts[slot] = start;
+    }
+  }
+}
+
+#ifdef BINARY_FUSE_X64_SIMD
+// binary_fuse16_blocked_product with AVX2
+BINARY_FUSE_TARGET_AVX2
+static inline uint16_t binary_fuse16_blocked_product_avx2(const uint32_t *blocks, uint32_t start,
+                                                          uint64_t coefficients) {
+  const __m256i *lo = (const __m256i *)(blocks + (size_t)start * 16);
+  const __m256i clo = _mm256_set1_epi32((int)(uint32_t)coefficients);
+  const __m256i chi = _mm256_set1_epi32((int)(uint32_t)(coefficients >> 32U));
+  const __m256i low16 = _mm256_set1_epi32(0xFFFF);
+  // columns 0-7 in a, 8-15 in b
+  __m256i a = _mm256_xor_si256(_mm256_and_si256(_mm256_load_si256(lo), clo),
+                               _mm256_and_si256(_mm256_load_si256(lo + 2), chi));
+  __m256i b = _mm256_xor_si256(_mm256_and_si256(_mm256_load_si256(lo + 1), clo),
+                               _mm256_and_si256(_mm256_load_si256(lo + 3), chi));
+  a = _mm256_and_si256(_mm256_xor_si256(a, _mm256_srli_epi32(a, 16)), low16);
+  b = _mm256_and_si256(_mm256_xor_si256(b, _mm256_srli_epi32(b, 16)), low16);
+  // 16-bit words, columns 0-3, 8-11, 4-7, 12-15
+  __m256i x = _mm256_packus_epi32(a, b);
+  x = _mm256_xor_si256(x, _mm256_srli_epi16(x, 8));
+  x = _mm256_xor_si256(x, _mm256_srli_epi16(x, 4));
+  x = binary_fuse_avx2_nibble_parity(_mm256_and_si256(x, _mm256_set1_epi16(0xF)));
+  x = _mm256_packus_epi16(x, x);
+  uint32_t m = (uint32_t)_mm256_movemask_epi8(_mm256_slli_epi16(x, 7));
+  return (uint16_t)((m & 0xFU) | ((m >> 12U) & 0xF0U) | ((m << 4U) & 0xF00U) |
+                    ((m >> 8U) & 0xF000U));
+}
+
+// binary_fuse16_blocked_contain_batch_scalar with binary_fuse16_blocked_product_avx2
+BINARY_FUSE_TARGET_AVX2
+static inline void binary_fuse16_blocked_contain_batch_avx2(const uint64_t *keys, size_t count,
+                                                            bool *out,
+                                                            const binary_fuse16_blocked_t *filter) {
+  uint64_t hashes[BINARY_FUSE_BATCH_WINDOW];
+  uint32_t starts[BINARY_FUSE_BATCH_WINDOW];
+  const size_t mask = BINARY_FUSE_BATCH_WINDOW - 1;
+  for (size_t i = 0; i < count + BINARY_FUSE_BATCH_WINDOW; i++) {
+    size_t slot = i & mask;
+    if (i >= BINARY_FUSE_BATCH_WINDOW) {
+      uint64_t hash = hashes[slot];
+      out[i - BINARY_FUSE_BATCH_WINDOW] =
+          binary_fuse16_blocked_product_avx2(filter->Blocks, starts[slot],
+                                             binary_fuse_blocked_coefficients(hash)) ==
+          binary_fuse16_fingerprint(hash);
+    }
+    if (i < count) {
+      uint64_t hash = binary_fuse_mix_split(keys[i], filter->Seed);
+      uint32_t start = (uint32_t)binary_fuse_mulhi(hash, filter->StartCount);
+      const uint32_t *block = filter->Blocks + (size_t)start * 16;
+      binary_fuse_prefetch(block);
+      binary_fuse_prefetch(block + 16);
+      hashes[slot] = hash;
+      starts[slot] = start;
+    }
+  }
+}
+#endif // BINARY_FUSE_X64_SIMD
+
+// Report, for each of the 'count' keys, if it is in the set, with false
+// positive rate. The answer for keys[i] is written to out[i].
+// See binary_fuse8_blocked_contain_batch.
+static inline void binary_fuse16_blocked_contain_batch(const uint64_t *keys, size_t count,
+                                                       bool *out,
+                                                       const binary_fuse16_blocked_t *filter) {
+#ifdef BINARY_FUSE_X64_SIMD
+  if (binary_fuse_kernel() != BINARY_FUSE_KERNEL_SCALAR) {
+    binary_fuse16_blocked_contain_batch_avx2(keys, count, out, filter);
+    return;
+  }
+#endif
+  binary_fuse16_blocked_contain_batch_scalar(keys, count, out, filter);
+}
+
+// Report if the key is in the set, with false positive rate.
+static inline bool binary_fuse16_blocked_contain(uint64_t key,
+                                                 const binary_fuse16_blocked_t *filter) {
+  uint64_t hash = binary_fuse_mix_split(key, filter->Seed);
+  uint32_t start = (uint32_t)binary_fuse_mulhi(hash, filter->StartCount);
+  uint64_t coefficients = binary_fuse_blocked_coefficients(hash);
+#ifdef BINARY_FUSE_X64_SIMD
+  if (binary_fuse_kernel() != BINARY_FUSE_KERNEL_SCALAR) {
+    return binary_fuse16_blocked_product_avx2(filter->Blocks, start, coefficients) ==
+           binary_fuse16_fingerprint(hash);
+  }
+#endif
+  return binary_fuse16_blocked_product(filter->Blocks, start, coefficients) ==
+         binary_fuse16_fingerprint(hash);
+}
+
+// allocate enough capacity for a set containing up to 'size' elements
+// caller is responsible to call binary_fuse16_blocked_free(filter)
+// size should be at least 2.
+static inline bool binary_fuse16_blocked_allocate(uint32_t size,
+                                                  binary_fuse16_blocked_t *filter) {
+  // The windows start on every other line, which requires more space than
+  // binary_fuse8_blocked_t: the factor was tuned so that the elimination
+  // succeeds at least 80% of the time, from 1e4 to 1e7 keys.
+  double sizeFactor = size <= 1 ? 0 : 1.09 + 0.03 * log10((double)size);
+  uint64_t capacity = (uint64_t)round((double)size * sizeFactor);
+  uint64_t blocks = (capacity + 31) / 32 + 1;
+  if (blocks < 2) {
+    blocks = 2;
+  }
+  filter->Seed = 0;
+  filter->Size = size;
+  filter->Blocks = NULL;
+  filter->Memory = NULL;
+  if (blocks * 32 > UINT32_MAX) {
+    filter->ArrayLength = 0;
+    filter->StartCount = 0;
+    return false;
+  }
+  filter->ArrayLength = (uint32_t)blocks * 32;
+  filter->StartCount = (uint32_t)blocks - 1;
+  filter->Blocks = (uint32_t *)binary_fuse_blocked_calloc(
+      filter->ArrayLength * sizeof(uint16_t), &filter->Memory);
+  return filter->Blocks != NULL;
+}
+
+// report memory usage
+static inline size_t binary_fuse16_blocked_size_in_bytes(const binary_fuse16_blocked_t *filter) {
+  return filter->ArrayLength * sizeof(uint16_t) + sizeof(binary_fuse16_blocked_t);
+}
+
+// release memory
+static inline void binary_fuse16_blocked_free(binary_fuse16_blocked_t *filter) {
+  free(filter->Memory);
+  filter->Memory = NULL;
+  filter->Blocks = NULL;
+  filter->Seed = 0;
+  filter->Size = 0;
+  filter->ArrayLength = 0;
+  filter->StartCount = 0;
+}
+
+// Construct the filter, returns true on success, false on failure.
+// The algorithm fails when there is insufficient memory.
+// The caller is responsable for calling binary_fuse16_blocked_allocate(size,filter)
+// before. Duplicated keys are allowed.
+static inline bool binary_fuse16_blocked_populate(const uint64_t *keys, uint32_t size,
+                                                  binary_fuse16_blocked_t *filter) {
+  if (size != filter->Size) {
+    return false;
+  }
+  uint64_t rng_counter = 0x726b2b9d438b9d4d;
+  uint32_t capacity = filter->ArrayLength;
+  // row i of the system: the equation whose lowest coefficient is slot i
+  uint64_t *rows = (uint64_t *)malloc(capacity * sizeof(uint64_t));
+  uint16_t *results = (uint16_t *)malloc(capacity * sizeof(uint16_t));
+  if ((rows == NULL) || (results == NULL)) {
+    free(rows);
+    free(results);
+    return false;
+  }
+  for (int loop = 0; true; ++loop) {
+    if (loop + 1 > XOR_MAX_ITERATIONS) {
+      free(rows);
+      free(results);
+      return false;
+    }
+    filter->Seed = binary_fuse_rng_splitmix64(&rng_counter);
+    memset(rows, 0, capacity * sizeof(uint64_t));
+    bool error = false;
+    for (uint32_t i = 0; (i < size) && !error; i++) {
+      uint64_t hash = binary_fuse_mix_split(keys[i], filter->Seed);
+      uint32_t row = 32 * (uint32_t)binary_fuse_mulhi(hash, filter->StartCount);
+      uint64_t c = binary_fuse_blocked_coefficients(hash);
+      uint16_t r = binary_fuse16_fingerprint(hash);
+      while (true) {
+        if (rows[row] == 0) {
+          rows[row] = c;
+          results[row] = r;
+          break;
+        }
+        c ^= rows[row];
+        r ^= results[row];
+        if (c == 0) {
+          // a duplicated key when r == 0, otherwise the system has no solution
+          error = (r != 0);
+          break;
+        }
+        unsigned z = binary_fuse_trailing_zeroes64(c);
+        row += z;
+        c >>= z;
+      }
+    }
+    if (!error) {
+      break;
+    }
+  }
+  // Back substitution, from the last row. Bit k of window[j] is bit j of the
+  // slot i + k.
+  uint64_t window[16] = {0};
+  memset(filter->Blocks, 0, capacity * sizeof(uint16_t));
+  for (uint32_t i = capacity - 1; i < capacity; i--) {
+    uint64_t c = rows[i];
+    for (unsigned j = 0; j < 16; j++) {
+      window[j] <<= 1U;
+      if (c != 0) {
+        window[j] |= binary_fuse_parity64(window[j] & c) ^ ((uint64_t)(results[i] >> j) & 1U);
+        filter->Blocks[(i / 32) * 16 + j] |= (uint32_t)(window[j] & 1U) << (i % 32);
+      }
+    }
+  }
+  free(rows);
+  free(results);
+  return true;
+}
+
+//////////////////
+// 4-wise binary fuse filters
+//////////////////
+
+/**
+ * With four locations per key instead of three, the peeling succeeds with a
+ * smaller array: about 1.075 times the number of keys for large sets instead
+ * of 1.125, at the cost of a fourth memory access per query.
+ * The fourth location is in the segment following the third one.
+ ***/
+
+typedef struct binary_hashes4_s {
+  uint32_t h0;
+  uint32_t h1;
+  uint32_t h2;
+  uint32_t h3;
+} binary_hashes4_t;
+
+// Compute the geometry of a 4-wise filter for 'size' keys.
+static inline void binary_fuse_4wise_geometry(uint32_t size, uint32_t *segmentLength,
+                                              uint32_t *segmentCount,
+                                              uint32_t *arrayLength) {
+  uint32_t arity = 4;
+  *segmentLength = size <= 1 ? 4 : binary_fuse_calculate_segment_length(arity, size);
+  if (*segmentLength > 262144) {
+    *segmentLength = 262144;
+  }
+  double sizeFactor = size <= 1 ? 0 : binary_fuse_calculate_size_factor(arity, size);
+  uint32_t capacity = size <= 1 ? 0 : (uint32_t)(round((double)size * sizeFactor));
+  uint32_t initSegmentCount =
+      (capacity + *segmentLength - 1) / *segmentLength - (arity - 1);
+  *arrayLength = (initSegmentCount + arity - 1) * *segmentLength;
+  *segmentCount = (*arrayLength + *segmentLength - 1) / *segmentLength;
+  if (*segmentCount <= arity - 1) {
+    *segmentCount = 1;
+  } else {
+    *segmentCount = *segmentCount - (arity - 1);
+  }
+  *arrayLength = (*segmentCount + arity - 1) * *segmentLength;
+}
+
+#ifdef BINARY_FUSE_X64_SIMD
+// Hash eight keys and compute their fingerprints and four locations (32-bit
+// lanes), following binary_fuse8_4wise_hash_batch.
+BINARY_FUSE_TARGET_AVX2
+static inline void binary_fuse_avx2_hash8_4wise(const uint64_t *keys, uint64_t seed,
+                                                uint32_t segmentLength,
+                                                uint32_t segmentLengthMask,
+                                                uint32_t segmentCountLength, __m256i *f,
+                                                __m256i *h) {
+  const __m256i vseed = _mm256_set1_epi64x((long long)seed);
+  const __m256i vscl = _mm256_set1_epi64x((long long)segmentCountLength);
+  __m256i ha = binary_fuse_avx2_murmur64(
+      _mm256_add_epi64(_mm256_loadu_si256((const __m256i *)(const void *)keys), vseed));
+  __m256i hb = binary_fuse_avx2_murmur64(
+      _mm256_add_epi64(_mm256_loadu_si256((const __m256i *)(const void *)(keys + 4)), vseed));
+  __m256i lo, hi, h0_lo, h0_hi;
+  binary_fuse_avx2_split32(ha, hb, &lo, &hi);
+  binary_fuse_avx2_split32(binary_fuse_avx2_mulhi32(ha, vscl),
+                           binary_fuse_avx2_mulhi32(hb, vscl), &h0_lo, &h0_hi);
+  (void)h0_hi;
+  const __m256i vsl = _mm256_set1_epi32((int)segmentLength);
+  const __m256i vmask = _mm256_set1_epi32((int)segmentLengthMask);
+  // bits 32 to 35 of the hash
+  __m256i hi4 = _mm256_and_si256(hi, _mm256_set1_epi32(0xF));
+  __m256i s1 = _mm256_or_si256(_mm256_srli_epi32(lo, 24), _mm256_slli_epi32(hi4, 8));
+  __m256i s2 = _mm256_or_si256(_mm256_srli_epi32(lo, 12), _mm256_slli_epi32(hi4, 20));
+  *f = _mm256_xor_si256(lo, hi);
+  h[0] = h0_lo;
+  h[1] = _mm256_xor_si256(_mm256_add_epi32(h[0], vsl), _mm256_and_si256(s1, vmask));
+  h[2] = _mm256_xor_si256(_mm256_add_epi32(h[0], _mm256_add_epi32(vsl, vsl)),
+                          _mm256_and_si256(s2, vmask));
+  h[3] = _mm256_xor_si256(_mm256_add_epi32(_mm256_add_epi32(h[0], vsl), _mm256_add_epi32(vsl, vsl)),
+                          _mm256_and_si256(lo, vmask));
+}
+
+// Hash the keys selected by 'valid' and compute their fingerprints and four
+// locations (32-bit lanes), following binary_fuse8_4wise_hash_batch.
+BINARY_FUSE_TARGET_AVX512
+static inline void binary_fuse_avx512_hash16_4wise(const uint64_t *keys, __mmask16 valid,
+                                                   uint64_t seed, uint32_t segmentLength,
+                                                   uint32_t segmentLengthMask,
+                                                   uint32_t segmentCountLength,
+                                                   __m512i *f, __m512i *h) {
+  const __m512i vseed = _mm512_set1_epi64((long long)seed);
+  const __m512i vscl = _mm512_set1_epi64((long long)segmentCountLength);
+  __m512i ha = binary_fuse_avx512_murmur64(
+      _mm512_add_epi64(_mm512_maskz_loadu_epi64((__mmask8)valid, keys), vseed));
+  __m512i hb = binary_fuse_avx512_murmur64(
+      _mm512_add_epi64(_mm512_maskz_loadu_epi64((__mmask8)(valid >> 8), keys + 8), vseed));
+  // binary_fuse_mulhi(hash, segmentCountLength)
+  __m512i ma = _mm512_srli_epi64(
+      _mm512_add_epi64(_mm512_mul_epu32(_mm512_srli_epi64(ha, 32), vscl),
+                       _mm512_srli_epi64(_mm512_mul_epu32(ha, vscl), 32)), 32);
+  __m512i mb = _mm512_srli_epi64(
+      _mm512_add_epi64(_mm512_mul_epu32(_mm512_srli_epi64(hb, 32), vscl),
+                       _mm512_srli_epi64(_mm512_mul_epu32(hb, vscl), 32)), 32);
+  // the lower 36 bits of the hash
+  const __m512i low36 = _mm512_set1_epi64((long long)((UINT64_C(1) << 36U) - 1));
+  __m512i hha = _mm512_and_si512(ha, low36);
+  __m512i hhb = _mm512_and_si512(hb, low36);
+  __m512i hash = binary_fuse_avx512_narrow(ha, hb);
+  __m512i s1 = binary_fuse_avx512_narrow(_mm512_srli_epi64(hha, 24), _mm512_srli_epi64(hhb, 24));
+  __m512i s2 = binary_fuse_avx512_narrow(_mm512_srli_epi64(hha, 12), _mm512_srli_epi64(hhb, 12));
+  const __m512i vsl = _mm512_set1_epi32((int)segmentLength);
+  const __m512i vmask = _mm512_set1_epi32((int)segmentLengthMask);
+  *f = _mm512_xor_si512(hash, binary_fuse_avx512_narrow(_mm512_srli_epi64(ha, 32),
+                                                        _mm512_srli_epi64(hb, 32)));
+  h[0] = binary_fuse_avx512_narrow(ma, mb);
+  h[1] = _mm512_xor_si512(_mm512_add_epi32(h[0], vsl), _mm512_and_si512(s1, vmask));
+  h[2] = _mm512_xor_si512(_mm512_add_epi32(h[0], _mm512_add_epi32(vsl, vsl)),
+                          _mm512_and_si512(s2, vmask));
+  h[3] = _mm512_xor_si512(
+      _mm512_add_epi32(_mm512_add_epi32(h[0], vsl), _mm512_add_epi32(vsl, vsl)),
+      _mm512_and_si512(hash, vmask));
+}
+#endif // BINARY_FUSE_X64_SIMD
+
+typedef struct binary_fuse8_4wise_s {
+  uint64_t Seed;
+  uint32_t Size;
+  uint32_t SegmentLength;
+  uint32_t SegmentLengthMask;
+  uint32_t SegmentCount;
+  uint32_t SegmentCountLength;
+  uint32_t ArrayLength;
+  uint8_t *Fingerprints;
+} binary_fuse8_4wise_t;
+
+static inline binary_hashes4_t binary_fuse8_4wise_hash_batch(uint64_t hash,
+                                                          const binary_fuse8_4wise_t *filter) {
+  uint64_t hi = binary_fuse_mulhi(hash, filter->SegmentCountLength);
+  // keep the lower 36 bits
+  uint32_t hh_lo = (uint32_t)hash;
+  uint32_t hh_hi = (uint32_t)(hash >> 32U) & 0xFU;
+  binary_hashes4_t ans;
+  ans.h0 = (uint32_t)hi;
+  ans.h1 = ans.h0 + filter->SegmentLength;
+  ans.h2 = ans.h1 + filter->SegmentLength;
+  ans.h3 = ans.h2 + filter->SegmentLength;
+  ans.h1 ^= ((hh_lo >> 24U) | (hh_hi << 8U)) & filter->SegmentLengthMask;
+  ans.h2 ^= ((hh_lo >> 12U) | (hh_hi << 20U)) & filter->SegmentLengthMask;
+  ans.h3 ^= hh_lo & filter->SegmentLengthMask;
+  return ans;
+}
+
+static inline uint32_t binary_fuse8_4wise_hash(uint64_t index, uint64_t hash,
+                                               const binary_fuse8_4wise_t *filter) {
+  uint64_t h = binary_fuse_mulhi(hash, filter->SegmentCountLength);
+  h += index * filter->SegmentLength;
+  // keep the lower 36 bits
+  uint64_t hh = hash & ((1ULL << 36U) - 1);
+  // index 0: right shift by 36; index 1: by 24; index 2: by 12; index 3: no shift
+  h ^= (size_t)((hh >> (36 - 12 * index)) & filter->SegmentLengthMask);
+  return (uint32_t)h;
+}
+
+// Report if the key is in the set, with false positive rate.
+static inline bool binary_fuse8_4wise_contain(uint64_t key,
+                                              const binary_fuse8_4wise_t *filter) {
+  uint64_t hash = binary_fuse_mix_split(key, filter->Seed);
+  uint8_t f = binary_fuse8_fingerprint(hash);
+  binary_hashes4_t hashes = binary_fuse8_4wise_hash_batch(hash, filter);
+  f ^= (uint32_t)filter->Fingerprints[hashes.h0] ^ filter->Fingerprints[hashes.h1] ^
+       filter->Fingerprints[hashes.h2] ^ filter->Fingerprints[hashes.h3];
+  return f == 0;
+}
+
+// A query split in two phases, see binary_fuse8_probe_prepare.
+typedef struct binary_fuse8_4wise_probe_s {
+  binary_hashes4_t hashes;
+  uint8_t fingerprint;
+} binary_fuse8_4wise_probe_t;
+
+// First phase of a query: hash the key, compute its fingerprint and its four
+// locations, and prefetch them.
+static inline void binary_fuse8_4wise_probe_prepare(uint64_t key,
+                                                    const binary_fuse8_4wise_t *filter,
+                                                    binary_fuse8_4wise_probe_t *probe) {
+  uint64_t hash = binary_fuse_mix_split(key, filter->Seed);
+  probe->fingerprint = binary_fuse8_fingerprint(hash);
+  probe->hashes = binary_fuse8_4wise_hash_batch(hash, filter);
+  binary_fuse_prefetch(filter->Fingerprints + probe->hashes.h0);
+  binary_fuse_prefetch(filter->Fingerprints + probe->hashes.h1);
+  binary_fuse_prefetch(filter->Fingerprints + probe->hashes.h2);
+  binary_fuse_prefetch(filter->Fingerprints + probe->hashes.h3);
+}
+
+// Second phase of a query: report if the key given to
+// binary_fuse8_4wise_probe_prepare is in the set, with false positive rate.
+static inline bool binary_fuse8_4wise_probe_finish(const binary_fuse8_4wise_probe_t *probe,
+                                                   const binary_fuse8_4wise_t *filter) {
+  return ((uint32_t)probe->fingerprint ^ filter->Fingerprints[probe->hashes.h0] ^
+          filter->Fingerprints[probe->hashes.h1] ^ filter->Fingerprints[probe->hashes.h2] ^
+          filter->Fingerprints[probe->hashes.h3]) == 0;
+}
+
+// Report, for each of the 'count' keys, if it is in the set, with false
+// positive rate. The answer for keys[i] is written to out[i]. See
+// binary_fuse8_contain_batch_scalar.
+// Portable version of binary_fuse8_4wise_contain_batch.
+static inline void binary_fuse8_4wise_contain_batch_scalar(const uint64_t *keys, size_t count,
+                                                           bool *out,
+                                                           const binary_fuse8_4wise_t *filter) {
+  binary_fuse8_4wise_probe_t probes[BINARY_FUSE_BATCH_WINDOW];
+  const size_t mask = BINARY_FUSE_BATCH_WINDOW - 1;
+  size_t ahead = count < BINARY_FUSE_BATCH_WINDOW ? count : BINARY_FUSE_BATCH_WINDOW;
+  for (size_t i = 0; i < ahead; i++) {
+    binary_fuse8_4wise_probe_prepare(keys[i], filter, &probes[i]);
+  }
+  for (size_t i = 0; i < count; i++) {
+    size_t slot = i & mask;
+    out[i] = binary_fuse8_4wise_probe_finish(&probes[slot], filter);
+    if (i + BINARY_FUSE_BATCH_WINDOW < count) {
+      binary_fuse8_4wise_probe_prepare(keys[i + BINARY_FUSE_BATCH_WINDOW], filter,
+                                       &probes[slot]);
+    }
+  }
+}
+
+#ifdef BINARY_FUSE_X64_SIMD
+// Report, for each of the 'count' keys, if it is in the set, with false
+// positive rate, using AVX2 gathers eight keys at a time. The answer for
+// keys[i] is written to out[i] and is identical to binary_fuse8_4wise_contain.
+// The processor must support AVX2, binary_fuse8_4wise_contain_batch checks it
+// for you.
+BINARY_FUSE_TARGET_AVX2
+static inline void binary_fuse8_4wise_contain_batch_avx2(const uint64_t *keys, size_t count,
+                                                         bool *out,
+                                                         const binary_fuse8_4wise_t *filter) {
+  size_t i = 0;
+  // The gathers load 32 bits at each byte location, and use signed indexes.
+  if (filter->ArrayLength >= 4 && filter->ArrayLength <= INT32_MAX) {
+    const int *base = (const int *)(const void *)filter->Fingerprints;
+    const __m256i fmask = _mm256_set1_epi32(0xFF);
+    for (; i + 8 <= count; i += 8) {
+      __m256i f, h[4];
+      binary_fuse_avx2_hash8_4wise(keys + i, filter->Seed, filter->SegmentLength,
+                                   filter->SegmentLengthMask, filter->SegmentCountLength,
+                                   &f, h);
+      // h[3] is the largest location
+      if (!binary_fuse_avx2_all_le(h[3], filter->ArrayLength - 4)) {
+        for (size_t j = 0; j < 8; j++) {
+          out[i + j] = binary_fuse8_4wise_contain(keys[i + j], filter);
+        }
+        continue;
+      }
+      __m256i x = _mm256_xor_si256(f, _mm256_i32gather_epi32(base, h[0], 1));
+      x = _mm256_xor_si256(x, _mm256_i32gather_epi32(base, h[1], 1));
+      x = _mm256_xor_si256(x, _mm256_i32gather_epi32(base, h[2], 1));
+      x = _mm256_xor_si256(x, _mm256_i32gather_epi32(base, h[3], 1));
+      __m256i hit = _mm256_cmpeq_epi32(_mm256_and_si256(x, fmask), _mm256_setzero_si256());
+      unsigned bits = (unsigned)_mm256_movemask_ps(_mm256_castsi256_ps(hit));
+      for (size_t j = 0; j < 8; j++) {
+        out[i + j] = (bits >> j) & 1;
+      }
+    }
+  }
+  for (; i < count; i++) {
+    out[i] = binary_fuse8_4wise_contain(keys[i], filter);
+  }
+}
+
+// Report, for each of the 'count' keys, if it is in the set, with false
+// positive rate, using AVX-512 sixteen keys at a time. The answer for keys[i]
+// is written to out[i] and is identical to binary_fuse8_4wise_contain.
+// The processor must support AVX-512 F and DQ, binary_fuse8_4wise_contain_batch
+// checks it for you.
+BINARY_FUSE_TARGET_AVX512
+static inline void binary_fuse8_4wise_contain_batch_avx512(const uint64_t *keys, size_t count,
+                                                           bool *out,
+                                                           const binary_fuse8_4wise_t *filter) {
+  // The gathers load 32 bits at each byte location, and use signed indexes.
+  if (filter->ArrayLength < 4 || filter->ArrayLength > INT32_MAX) {
+    binary_fuse8_4wise_contain_batch_scalar(keys, count, out, filter);
+    return;
+  }
+  // The lanes too close to the end of the array are left out of the gathers
+  // and computed one by one.
+  const __m512i vlimit = _mm512_set1_epi32((int)(filter->ArrayLength - 4));
+  const __m512i fmask = _mm512_set1_epi32(0xFF);
+  for (size_t i = 0; i < count; i += 16) {
+    size_t n = count - i < 16 ? count - i : 16;
+    __mmask16 valid = (__mmask16)((1U << n) - 1);
+    __m512i f, h[4];
+    binary_fuse_avx512_hash16_4wise(keys + i, valid, filter->Seed, filter->SegmentLength,
+                                    filter->SegmentLengthMask, filter->SegmentCountLength,
+                                    &f, h);
+    __mmask16 safe = _mm512_mask_cmple_epu32_mask(valid, h[3], vlimit);
+    __m512i x = f;
+    for (int k = 0; k < 4; k++) {
+      x = _mm512_xor_si512(x, binary_fuse_avx512_gather8(safe, h[k], filter->Fingerprints));
+    }
+    __mmask16 hits = _mm512_mask_testn_epi32_mask(safe, x, fmask);
+    binary_fuse_avx512_store16(out + i, valid, hits);
+    for (unsigned rest = (unsigned)(valid & ~safe); rest != 0; rest &= rest - 1) {
+      size_t j = (size_t)__builtin_ctz(rest);
+      out[i + j] = binary_fuse8_4wise_contain(keys[i + j], filter);
+    }
+  }
+}
+#endif // BINARY_FUSE_X64_SIMD
+
+// Report, for each of the 'count' keys, if it is in the set, with false
+// positive rate. The answer for keys[i] is written to out[i].
+// The kernel is selected as in binary_fuse8_contain_batch.
+static inline void binary_fuse8_4wise_contain_batch(const uint64_t *keys, size_t count,
+                                                    bool *out,
+                                                    const binary_fuse8_4wise_t *filter) {
+#ifdef BINARY_FUSE_X64_SIMD
+  switch (binary_fuse_kernel()) {
+  case BINARY_FUSE_KERNEL_AVX512:
+    binary_fuse8_4wise_contain_batch_avx512(keys, count, out, filter);
+    return;
+  case BINARY_FUSE_KERNEL_AVX2:
+    binary_fuse8_4wise_contain_batch_avx2(keys, count, out, filter);
+    return;
+  default:
+    break;
+  }
+#endif
+  binary_fuse8_4wise_contain_batch_scalar(keys, count, out, filter);
+}
+
+// allocate enough capacity for a set containing up to 'size' elements
+// caller is responsible to call binary_fuse8_4wise_free(filter)
+// size should be at least 2.
+static inline bool binary_fuse8_4wise_allocate(uint32_t size,
+                                               binary_fuse8_4wise_t *filter) {
+  filter->Size = size;
+  binary_fuse_4wise_geometry(size, &filter->SegmentLength, &filter->SegmentCount,
+                             &filter->ArrayLength);
+  filter->SegmentLengthMask = filter->SegmentLength - 1;
+  filter->SegmentCountLength = filter->SegmentCount * filter->SegmentLength;
+  filter->Fingerprints =
+      (uint8_t *)calloc(filter->ArrayLength, sizeof(uint8_t));
+  return filter->Fingerprints != NULL;
+}
+
+// report memory usage
+static inline size_t binary_fuse8_4wise_size_in_bytes(const binary_fuse8_4wise_t *filter) {
+  return filter->ArrayLength * sizeof(uint8_t) + sizeof(binary_fuse8_4wise_t);
+}
+
+// release memory
+static inline void binary_fuse8_4wise_free(binary_fuse8_4wise_t *filter) {
+  free(filter->Fingerprints);
+  filter->Fingerprints = NULL;
+  filter->Seed = 0;
+  filter->Size = 0;
+  filter->SegmentLength = 0;
+  filter->SegmentLengthMask = 0;
+  filter->SegmentCount = 0;
+  filter->SegmentCountLength = 0;
+  filter->ArrayLength = 0;
+}
+
+// Construct the filter, returns true on success, false on failure.
+// The algorithm fails when there is insufficient memory.
+// The caller is responsable for calling binary_fuse8_4wise_allocate(size,filter)
+// before. For best performance, the caller should ensure that there are not too
+// many duplicated keys.
+static inline bool binary_fuse8_4wise_populate(uint64_t *keys, uint32_t size,
+                                               binary_fuse8_4wise_t *filter) {
+  if (size != filter->Size) {
+    return false;
+  }
+
+  uint64_t rng_counter = 0x726b2b9d438b9d4d;
+  filter->Seed = binary_fuse_rng_splitmix64(&rng_counter);
+  uint64_t *reverseOrder = (uint64_t *)calloc((size + 1), sizeof(uint64_t));
+  uint32_t capacity = filter->ArrayLength;
+  uint32_t *alone = (uint32_t *)malloc(capacity * sizeof(uint32_t));
+  // t2count[i] is 4 times the number of keys at location i, plus the xor of
+  // their indexes (0 to 3) among their four locations
+  uint8_t *t2count = (uint8_t *)calloc(capacity, sizeof(uint8_t));
+  uint8_t *reverseH = (uint8_t *)malloc(size * sizeof(uint8_t));
+  uint64_t *t2hash = (uint64_t *)calloc(capacity, sizeof(uint64_t));
+
+  uint32_t blockBits = 1;
+  while (((uint32_t)1 << blockBits) < filter->SegmentCount) {
+    blockBits += 1;
+  }
+  uint32_t block = ((uint32_t)1 << blockBits);
+  uint32_t *startPos = (uint32_t *)malloc((1U << blockBits) * sizeof(uint32_t));
+  uint32_t h0123[4];
+  uint64_t hashes[BINARY_FUSE_HASH_BLOCK];
+
+  if ((alone == NULL) || (t2count == NULL) || (reverseH == NULL) ||
+      (t2hash == NULL) || (reverseOrder == NULL) || (startPos == NULL)) {
+    free(alone);
+    free(t2count);
+    free(reverseH);
+    free(t2hash);
+    free(reverseOrder);
+    free(startPos);
+    return false;
+  }
+  reverseOrder[size] = 1;
+  for (int loop = 0; true; ++loop) {
+    if (loop + 1 > XOR_MAX_ITERATIONS) {
+      free(alone);
+      free(t2count);
+      free(reverseH);
+      free(t2hash);
+      free(reverseOrder);
+      free(startPos);
+      return false;
+    }
+
+    for (uint32_t i = 0; i < block; i++) {
+      // important : i * size would overflow as a 32-bit number in some
+      // cases.
+      startPos[i] = (uint32_t)(((uint64_t)i * size) >> blockBits);
+    }
+
+    uint64_t maskblock = block - 1;
+    for (uint32_t start = 0; start < size; start += BINARY_FUSE_HASH_BLOCK) {
+      uint32_t n = size - start < BINARY_FUSE_HASH_BLOCK ? size - start : BINARY_FUSE_HASH_BLOCK;
+      binary_fuse_hash_keys(keys + start, n, filter->Seed, hashes);
+      for (uint32_t i = 0; i < n; i++) {
+        uint64_t hash = hashes[i];
+        uint64_t segment_index = hash >> (64 - blockBits);
+        while (reverseOrder[startPos[segment_index]] != 0) {
+          segment_index++;
+          segment_index &= maskblock;
+        }
+        reverseOrder[startPos[segment_index]] = hash;
+        startPos[segment_index]++;
+      }
+    }
+    int error = 0;
+    uint32_t duplicates = 0;
+    for (uint32_t i = 0; i < size; i++) {
+      uint64_t hash = reverseOrder[i];
+      for (uint32_t k = 0; k < 4; k++) {
+        h0123[k] = binary_fuse8_4wise_hash(k, hash, filter);
+        t2count[h0123[k]] += 4;
+        t2count[h0123[k]] ^= (uint8_t)k;
+        t2hash[h0123[k]] ^= hash;
+      }
+      if ((t2hash[h0123[0]] & t2hash[h0123[1]] & t2hash[h0123[2]] & t2hash[h0123[3]]) == 0) {
+        bool duplicate = false;
+        for (uint32_t k = 0; k < 4; k++) {
+          duplicate |= (t2hash[h0123[k]] == 0) && (t2count[h0123[k]] == 8);
+        }
+        if (duplicate) {
+          duplicates += 1;
+          for (uint32_t k = 0; k < 4; k++) {
+            t2count[h0123[k]] -= 4;
+            t2count[h0123[k]] ^= (uint8_t)k;
+            t2hash[h0123[k]] ^= hash;
+          }
+        }
+      }
+      for (uint32_t k = 0; k < 4; k++) {
+        error = (t2count[h0123[k]] < 4) ? 1 : error;
+      }
+    }
+    if(error) {
+      if(duplicates > 0) {
+        // many copies of a key can overflow a counter before they are detected
+        size = (uint32_t)binary_fuse_sort_and_remove_dup(keys, size);
+      }
+      memset(reverseOrder, 0, sizeof(uint64_t) * size);
+      memset(t2count, 0, sizeof(uint8_t) * capacity);
+      memset(t2hash, 0, sizeof(uint64_t) * capacity);
+      filter->Seed = binary_fuse_rng_splitmix64(&rng_counter);
+      continue;
+    }
+
+    // End of key addition
+    uint32_t Qsize = 0;
+    // Add sets with one key to the queue.
+    for (uint32_t i = 0; i < capacity; i++) {
+      alone[Qsize] = i;
+      Qsize += ((t2count[i] >> 2U) == 1) ? 1U : 0U;
+    }
+    uint32_t stacksize = 0;
+    while (Qsize > 0) {
+      Qsize--;
+      uint32_t index = alone[Qsize];
+      if ((t2count[index] >> 2U) == 1) {
+        uint64_t hash = t2hash[index];
+        uint8_t found = t2count[index] & 3U;
+        reverseH[stacksize] = found;
+        reverseOrder[stacksize] = hash;
+        stacksize++;
+        for (uint32_t k = 0; k < 4; k++) {
+          if (k == found) {
+            continue;
+          }
+          uint32_t other_index = binary_fuse8_4wise_hash(k, hash, filter);
+          alone[Qsize] = other_index;
+          Qsize += ((t2count[other_index] >> 2U) == 2 ? 1U : 0U);
+          t2count[other_index] -= 4;
+          t2count[other_index] ^= (uint8_t)k;
+          t2hash[other_index] ^= hash;
+        }
+      }
+    }
+    if (stacksize + duplicates == size) {
+      // success
+      size = stacksize;
+      break;
+    }
+    if(duplicates > 0) {
+      size = (uint32_t)binary_fuse_sort_and_remove_dup(keys, size);
+    }
+    memset(reverseOrder, 0, sizeof(uint64_t) * size);
+    memset(t2count, 0, sizeof(uint8_t) * capacity);
+    memset(t2hash, 0, sizeof(uint64_t) * capacity);
+    filter->Seed = binary_fuse_rng_splitmix64(&rng_counter);
+  }
+
+  for (uint32_t i = size - 1; i < size; i--) {
+    // the hash of the key we insert next
+    uint64_t hash = reverseOrder[i];
+    uint32_t xor2 = binary_fuse8_fingerprint(hash);
+    uint8_t found = reverseH[i];
+    for (uint32_t k = 0; k < 4; k++) {
+      h0123[k] = binary_fuse8_4wise_hash(k, hash, filter);
+      if (k != found) {
+        xor2 ^= filter->Fingerprints[h0123[k]];
+      }
+    }
+    filter->Fingerprints[h0123[found]] = (uint8_t)xor2;
+  }
+  free(alone);
+  free(t2count);
+  free(reverseH);
+  free(t2hash);
+  free(reverseOrder);
+  free(startPos);
+  return true;
+}
+
+typedef struct binary_fuse16_4wise_s {
+  uint64_t Seed;
+  uint32_t Size;
+  uint32_t SegmentLength;
+  uint32_t SegmentLengthMask;
+  uint32_t SegmentCount;
+  uint32_t SegmentCountLength;
+  uint32_t ArrayLength;
+  uint16_t *Fingerprints;
+} binary_fuse16_4wise_t;
+
+static inline binary_hashes4_t binary_fuse16_4wise_hash_batch(uint64_t hash,
+                                                           const binary_fuse16_4wise_t *filter) {
+  uint64_t hi = binary_fuse_mulhi(hash, filter->SegmentCountLength);
+  // keep the lower 36 bits
+  uint32_t hh_lo = (uint32_t)hash;
+  uint32_t hh_hi = (uint32_t)(hash >> 32U) & 0xFU;
+  binary_hashes4_t ans;
+  ans.h0 = (uint32_t)hi;
+  ans.h1 = ans.h0 + filter->SegmentLength;
+  ans.h2 = ans.h1 + filter->SegmentLength;
+  ans.h3 = ans.h2 + filter->SegmentLength;
+  ans.h1 ^= ((hh_lo >> 24U) | (hh_hi << 8U)) & filter->SegmentLengthMask;
+  ans.h2 ^= ((hh_lo >> 12U) | (hh_hi << 20U)) & filter->SegmentLengthMask;
+  ans.h3 ^= hh_lo & filter->SegmentLengthMask;
+  return ans;
+}
+
+static inline uint32_t binary_fuse16_4wise_hash(uint64_t index, uint64_t hash,
+                                                const binary_fuse16_4wise_t *filter) {
+  uint64_t h = binary_fuse_mulhi(hash, filter->SegmentCountLength);
+  h += index * filter->SegmentLength;
+  // keep the lower 36 bits
+  uint64_t hh = hash & ((1ULL << 36U) - 1);
+  // index 0: right shift by 36; index 1: by 24; index 2: by 12; index 3: no shift
+  h ^= (size_t)((hh >> (36 - 12 * index)) & filter->SegmentLengthMask);
+  return (uint32_t)h;
+}
+
+// Report if the key is in the set, with false positive rate.
+static inline bool binary_fuse16_4wise_contain(uint64_t key,
+                                               const binary_fuse16_4wise_t *filter) {
+  uint64_t hash = binary_fuse_mix_split(key, filter->Seed);
+  uint16_t f = binary_fuse16_fingerprint(hash);
+  binary_hashes4_t hashes = binary_fuse16_4wise_hash_batch(hash, filter);
+  f ^= (uint32_t)filter->Fingerprints[hashes.h0] ^ filter->Fingerprints[hashes.h1] ^
+       filter->Fingerprints[hashes.h2] ^ filter->Fingerprints[hashes.h3];
+  return f == 0;
+}
+
+// A query split in two phases, see binary_fuse8_probe_prepare.
+typedef struct binary_fuse16_4wise_probe_s {
+  binary_hashes4_t hashes;
+  uint16_t fingerprint;
+} binary_fuse16_4wise_probe_t;
+
+// First phase of a query: hash the key, compute its fingerprint and its four
+// locations, and prefetch them.
+static inline void binary_fuse16_4wise_probe_prepare(uint64_t key,
+                                                     const binary_fuse16_4wise_t *filter,
+                                                     binary_fuse16_4wise_probe_t *probe) {
+  uint64_t hash = binary_fuse_mix_split(key, filter->Seed);
+  probe->fingerprint = binary_fuse16_fingerprint(hash);
+  probe->hashes = binary_fuse16_4wise_hash_batch(hash, filter);
+  binary_fuse_prefetch(filter->Fingerprints + probe->hashes.h0);
+  binary_fuse_prefetch(filter->Fingerprints + probe->hashes.h1);
+  binary_fuse_prefetch(filter->Fingerprints + probe->hashes.h2);
+  binary_fuse_prefetch(filter->Fingerprints + probe->hashes.h3);
+}
+
+// Second phase of a query: report if the key given to
+// binary_fuse16_4wise_probe_prepare is in the set, with false positive rate.
+static inline bool binary_fuse16_4wise_probe_finish(const binary_fuse16_4wise_probe_t *probe,
+                                                    const binary_fuse16_4wise_t *filter) {
+  return ((uint32_t)probe->fingerprint ^ filter->Fingerprints[probe->hashes.h0] ^
+          filter->Fingerprints[probe->hashes.h1] ^ filter->Fingerprints[probe->hashes.h2] ^
+          filter->Fingerprints[probe->hashes.h3]) == 0;
+}
+
+// Report, for each of the 'count' keys, if it is in the set, with false
+// positive rate. The answer for keys[i] is written to out[i]. See
+// binary_fuse8_contain_batch_scalar.
+// Portable version of binary_fuse16_4wise_contain_batch.
+static inline void binary_fuse16_4wise_contain_batch_scalar(const uint64_t *keys, size_t count,
+                                                            bool *out,
+                                                            const binary_fuse16_4wise_t *filter) {
+  binary_fuse16_4wise_probe_t probes[BINARY_FUSE_BATCH_WINDOW];
+  const size_t mask = BINARY_FUSE_BATCH_WINDOW - 1;
+  size_t ahead = count < BINARY_FUSE_BATCH_WINDOW ? count : BINARY_FUSE_BATCH_WINDOW;
+  for (size_t i = 0; i < ahead; i++) {
+    binary_fuse16_4wise_probe_prepare(keys[i], filter, &probes[i]);
+  }
+  for (size_t i = 0; i < count; i++) {
+    size_t slot = i & mask;
+    out[i] = binary_fuse16_4wise_probe_finish(&probes[slot], filter);
+    if (i + BINARY_FUSE_BATCH_WINDOW < count) {
+      binary_fuse16_4wise_probe_prepare(keys[i + BINARY_FUSE_BATCH_WINDOW], filter,
+                                        &probes[slot]);
+    }
+  }
+}
+
+#ifdef BINARY_FUSE_X64_SIMD
+// Report, for each of the 'count' keys, if it is in the set, with false
+// positive rate, using AVX2 gathers eight keys at a time. The answer for
+// keys[i] is written to out[i] and is identical to binary_fuse16_4wise_contain.
+// The processor must support AVX2, binary_fuse16_4wise_contain_batch checks it
+// for you.
+BINARY_FUSE_TARGET_AVX2
+static inline void binary_fuse16_4wise_contain_batch_avx2(const uint64_t *keys, size_t count,
+                                                          bool *out,
+                                                          const binary_fuse16_4wise_t *filter) {
+  size_t i = 0;
+  // The gathers load 32 bits at each 16-bit location, and use signed indexes.
+  if (filter->ArrayLength >= 2 && filter->ArrayLength <= INT32_MAX) {
+    const int *base = (const int *)(const void *)filter->Fingerprints;
+    const __m256i fmask = _mm256_set1_epi32(0xFFFF);
+    for (; i + 8 <= count; i += 8) {
+      __m256i f, h[4];
+      binary_fuse_avx2_hash8_4wise(keys + i, filter->Seed, filter->SegmentLength,
+                                   filter->SegmentLengthMask, filter->SegmentCountLength,
+                                   &f, h);
+      // h[3] is the largest location
+      if (!binary_fuse_avx2_all_le(h[3], filter->ArrayLength - 2)) {
+        for (size_t j = 0; j < 8; j++) {
+          out[i + j] = binary_fuse16_4wise_contain(keys[i + j], filter);
+        }
+        continue;
+      }
+      __m256i x = _mm256_xor_si256(f, _mm256_i32gather_epi32(base, h[0], 2));
+      x = _mm256_xor_si256(x, _mm256_i32gather_epi32(base, h[1], 2));
+      x = _mm256_xor_si256(x, _mm256_i32gather_epi32(base, h[2], 2));
+      x = _mm256_xor_si256(x, _mm256_i32gather_epi32(base, h[3], 2));
+      __m256i hit = _mm256_cmpeq_epi32(_mm256_and_si256(x, fmask), _mm256_setzero_si256());
+      unsigned bits = (unsigned)_mm256_movemask_ps(_mm256_castsi256_ps(hit));
+      for (size_t j = 0; j < 8; j++) {
+        out[i + j] = (bits >> j) & 1;
+      }
+    }
+  }
+  for (; i < count; i++) {
+    out[i] = binary_fuse16_4wise_contain(keys[i], filter);
+  }
+}
+
+// Report, for each of the 'count' keys, if it is in the set, with false
+// positive rate, using AVX-512 sixteen keys at a time. The answer for keys[i]
+// is written to out[i] and is identical to binary_fuse16_4wise_contain.
+// The processor must support AVX-512 F and DQ, binary_fuse16_4wise_contain_batch
+// checks it for you.
+BINARY_FUSE_TARGET_AVX512
+static inline void binary_fuse16_4wise_contain_batch_avx512(const uint64_t *keys, size_t count,
+                                                            bool *out,
+                                                            const binary_fuse16_4wise_t *filter) {
+  // The gathers load 32 bits at each 16-bit location, and use signed indexes.
+  if (filter->ArrayLength < 2 || filter->ArrayLength > INT32_MAX) {
+    binary_fuse16_4wise_contain_batch_scalar(keys, count, out, filter);
+    return;
+  }
+  // The lanes too close to the end of the array are left out of the gathers
+  // and computed one by one.
+  const __m512i vlimit = _mm512_set1_epi32((int)(filter->ArrayLength - 2));
+  const __m512i fmask = _mm512_set1_epi32(0xFFFF);
+  for (size_t i = 0; i < count; i += 16) {
+    size_t n = count - i < 16 ? count - i : 16;
+    __mmask16 valid = (__mmask16)((1U << n) - 1);
+    __m512i f, h[4];
+    binary_fuse_avx512_hash16_4wise(keys + i, valid, filter->Seed, filter->SegmentLength,
+                                    filter->SegmentLengthMask, filter->SegmentCountLength,
+                                    &f, h);
+    __mmask16 safe = _mm512_mask_cmple_epu32_mask(valid, h[3], vlimit);
+    __m512i x = f;
+    for (int k = 0; k < 4; k++) {
+      x = _mm512_xor_si512(x, binary_fuse_avx512_gather16(safe, h[k], filter->Fingerprints));
+    }
+    __mmask16 hits = _mm512_mask_testn_epi32_mask(safe, x, fmask);
+    binary_fuse_avx512_store16(out + i, valid, hits);
+    for (unsigned rest = (unsigned)(valid & ~safe); rest != 0; rest &= rest - 1) {
+      size_t j = (size_t)__builtin_ctz(rest);
+      out[i + j] = binary_fuse16_4wise_contain(keys[i + j], filter);
+    }
+  }
+}
+#endif // BINARY_FUSE_X64_SIMD
+
+// Report, for each of the 'count' keys, if it is in the set, with false
+// positive rate. The answer for keys[i] is written to out[i].
+// The kernel is selected as in binary_fuse8_contain_batch.
+static inline void binary_fuse16_4wise_contain_batch(const uint64_t *keys, size_t count,
+                                                     bool *out,
+                                                     const binary_fuse16_4wise_t *filter) {
+#ifdef BINARY_FUSE_X64_SIMD
+  switch (binary_fuse_kernel()) {
+  case BINARY_FUSE_KERNEL_AVX512:
+    binary_fuse16_4wise_contain_batch_avx512(keys, count, out, filter);
+    return;
+  case BINARY_FUSE_KERNEL_AVX2:
+    binary_fuse16_4wise_contain_batch_avx2(keys, count, out, filter);
+    return;
+  default:
+    break;
+  }
+#endif
+  binary_fuse16_4wise_contain_batch_scalar(keys, count, out, filter);
+}
+
+// allocate enough capacity for a set containing up to 'size' elements
+// caller is responsible to call binary_fuse16_4wise_free(filter)
+// size should be at least 2.
+static inline bool binary_fuse16_4wise_allocate(uint32_t size,
+                                                binary_fuse16_4wise_t *filter) {
+  filter->Size = size;
+  binary_fuse_4wise_geometry(size, &filter->SegmentLength, &filter->SegmentCount,
+                             &filter->ArrayLength);
+  filter->SegmentLengthMask = filter->SegmentLength - 1;
+  filter->SegmentCountLength = filter->SegmentCount * filter->SegmentLength;
+  filter->Fingerprints =
+      (uint16_t *)calloc(filter->ArrayLength, sizeof(uint16_t));
+  return filter->Fingerprints != NULL;
+}
+
+// report memory usage
+static inline size_t binary_fuse16_4wise_size_in_bytes(const binary_fuse16_4wise_t *filter) {
+  return filter->ArrayLength * sizeof(uint16_t) + sizeof(binary_fuse16_4wise_t);
+}
+
+// release memory
+static inline void binary_fuse16_4wise_free(binary_fuse16_4wise_t *filter) {
+  free(filter->Fingerprints);
+  filter->Fingerprints = NULL;
+  filter->Seed = 0;
+  filter->Size = 0;
+  filter->SegmentLength = 0;
+  filter->SegmentLengthMask = 0;
+  filter->SegmentCount = 0;
+  filter->SegmentCountLength = 0;
+  filter->ArrayLength = 0;
+}
+
+// Construct the filter, returns true on success, false on failure.
+// The algorithm fails when there is insufficient memory.
+// The caller is responsable for calling binary_fuse16_4wise_allocate(size,filter)
+// before. For best performance, the caller should ensure that there are not too
+// many duplicated keys.
+static inline bool binary_fuse16_4wise_populate(uint64_t *keys, uint32_t size,
+                                                binary_fuse16_4wise_t *filter) {
+  if (size != filter->Size) {
+    return false;
+  }
+
+  uint64_t rng_counter = 0x726b2b9d438b9d4d;
+  filter->Seed = binary_fuse_rng_splitmix64(&rng_counter);
+  uint64_t *reverseOrder = (uint64_t *)calloc((size + 1), sizeof(uint64_t));
+  uint32_t capacity = filter->ArrayLength;
+  uint32_t *alone = (uint32_t *)malloc(capacity * sizeof(uint32_t));
+  // t2count[i] is 4 times the number of keys at location i, plus the xor of
+  // their indexes (0 to 3) among their four locations
+  uint8_t *t2count = (uint8_t *)calloc(capacity, sizeof(uint8_t));
+  uint8_t *reverseH = (uint8_t *)malloc(size * sizeof(uint8_t));
+  uint64_t *t2hash = (uint64_t *)calloc(capacity, sizeof(uint64_t));
+
+  uint32_t blockBits = 1;
+  while (((uint32_t)1 << blockBits) < filter->SegmentCount) {
+    blockBits += 1;
+  }
+  uint32_t block = ((uint32_t)1 << blockBits);
+  uint32_t *startPos = (uint32_t *)malloc((1U << blockBits) * sizeof(uint32_t));
+  uint32_t h0123[4];
+  uint64_t hashes[BINARY_FUSE_HASH_BLOCK];
+
+  if ((alone == NULL) || (t2count == NULL) || (reverseH == NULL) ||
+      (t2hash == NULL) || (reverseOrder == NULL) || (startPos == NULL)) {
+    free(alone);
+    free(t2count);
+    free(reverseH);
+    free(t2hash);
+    free(reverseOrder);
+    free(startPos);
+    return false;
+  }
+  reverseOrder[size] = 1;
+  for (int loop = 0; true; ++loop) {
+    if (loop + 1 > XOR_MAX_ITERATIONS) {
+      free(alone);
+      free(t2count);
+      free(reverseH);
+      free(t2hash);
+      free(reverseOrder);
+      free(startPos);
+      return false;
+    }
+
+    for (uint32_t i = 0; i < block; i++) {
+      // important : i * size would overflow as a 32-bit number in some
+      // cases.
+      startPos[i] = (uint32_t)(((uint64_t)i * size) >> blockBits);
+    }
+
+    uint64_t maskblock = block - 1;
+    for (uint32_t start = 0; start < size; start += BINARY_FUSE_HASH_BLOCK) {
+      uint32_t n = size - start < BINARY_FUSE_HASH_BLOCK ? size - start : BINARY_FUSE_HASH_BLOCK;
+      binary_fuse_hash_keys(keys + start, n, filter->Seed, hashes);
+      for (uint32_t i = 0; i < n; i++) {
+        uint64_t hash = hashes[i];
+        uint64_t segment_index = hash >> (64 - blockBits);
+        while (reverseOrder[startPos[segment_index]] != 0) {
+          segment_index++;
+          segment_index &= maskblock;
+        }
+        reverseOrder[startPos[segment_index]] = hash;
+        startPos[segment_index]++;
+      }
+    }
+    int error = 0;
+    uint32_t duplicates = 0;
+    for (uint32_t i = 0; i < size; i++) {
+      uint64_t hash = reverseOrder[i];
+      for (uint32_t k = 0; k < 4; k++) {
+        h0123[k] = binary_fuse16_4wise_hash(k, hash, filter);
+        t2count[h0123[k]] += 4;
+        t2count[h0123[k]] ^= (uint8_t)k;
+        t2hash[h0123[k]] ^= hash;
+      }
+      if ((t2hash[h0123[0]] & t2hash[h0123[1]] & t2hash[h0123[2]] & t2hash[h0123[3]]) == 0) {
+        bool duplicate = false;
+        for (uint32_t k = 0; k < 4; k++) {
+          duplicate |= (t2hash[h0123[k]] == 0) && (t2count[h0123[k]] == 8);
+        }
+        if (duplicate) {
+          duplicates += 1;
+          for (uint32_t k = 0; k < 4; k++) {
+            t2count[h0123[k]] -= 4;
+            t2count[h0123[k]] ^= (uint8_t)k;
+            t2hash[h0123[k]] ^= hash;
+          }
+        }
+      }
+      for (uint32_t k = 0; k < 4; k++) {
+        error = (t2count[h0123[k]] < 4) ? 1 : error;
+      }
+    }
+    if(error) {
+      if(duplicates > 0) {
+        // many copies of a key can overflow a counter before they are detected
+        size = (uint32_t)binary_fuse_sort_and_remove_dup(keys, size);
+      }
+      memset(reverseOrder, 0, sizeof(uint64_t) * size);
+      memset(t2count, 0, sizeof(uint8_t) * capacity);
+      memset(t2hash, 0, sizeof(uint64_t) * capacity);
+      filter->Seed = binary_fuse_rng_splitmix64(&rng_counter);
+      continue;
+    }
+
+    // End of key addition
+    uint32_t Qsize = 0;
+    // Add sets with one key to the queue.
+    for (uint32_t i = 0; i < capacity; i++) {
+      alone[Qsize] = i;
+      Qsize += ((t2count[i] >> 2U) == 1) ? 1U : 0U;
+    }
+    uint32_t stacksize = 0;
+    while (Qsize > 0) {
+      Qsize--;
+      uint32_t index = alone[Qsize];
+      if ((t2count[index] >> 2U) == 1) {
+        uint64_t hash = t2hash[index];
+        uint8_t found = t2count[index] & 3U;
+        reverseH[stacksize] = found;
+        reverseOrder[stacksize] = hash;
+        stacksize++;
+        for (uint32_t k = 0; k < 4; k++) {
+          if (k == found) {
+            continue;
+          }
+          uint32_t other_index = binary_fuse16_4wise_hash(k, hash, filter);
+          alone[Qsize] = other_index;
+          Qsize += ((t2count[other_index] >> 2U) == 2 ? 1U : 0U);
+          t2count[other_index] -= 4;
+          t2count[other_index] ^= (uint8_t)k;
+          t2hash[other_index] ^= hash;
+        }
+      }
+    }
+    if (stacksize + duplicates == size) {
+      // success
+      size = stacksize;
+      break;
+    }
+    if(duplicates > 0) {
+      size = (uint32_t)binary_fuse_sort_and_remove_dup(keys, size);
+    }
+    memset(reverseOrder, 0, sizeof(uint64_t) * size);
+    memset(t2count, 0, sizeof(uint8_t) * capacity);
+    memset(t2hash, 0, sizeof(uint64_t) * capacity);
+    filter->Seed = binary_fuse_rng_splitmix64(&rng_counter);
+  }
+
+  for (uint32_t i = size - 1; i < size; i--) {
+    // the hash of the key we insert next
+    uint64_t hash = reverseOrder[i];
+    uint32_t xor2 = binary_fuse16_fingerprint(hash);
+    uint8_t found = reverseH[i];
+    for (uint32_t k = 0; k < 4; k++) {
+      h0123[k] = binary_fuse16_4wise_hash(k, hash, filter);
+      if (k != found) {
+        xor2 ^= filter->Fingerprints[h0123[k]];
+      }
+    }
+    filter->Fingerprints[h0123[found]] = (uint16_t)xor2;
+  }
+  free(alone);
+  free(t2count);
+  free(reverseH);
+  free(t2hash);
+  free(reverseOrder);
+  free(startPos);
+  return true;
+}
+
+//////////////////
+// bit-packed fingerprints
+//////////////////
+
+/**
+ * Fingerprints of any width from 4 to 20 bits, chosen at allocation time and
+ * stored back to back: slot i occupies bits [i * Bits, (i + 1) * Bits) of the
+ * array. The false positive rate is about 2^-Bits, with about 1.125 * Bits
+ * bits per key for large sets, e.g. 10-bit fingerprints use 37.5% less memory
+ * than binary_fuse16_t for a false positive rate of 0.1%.
+ * A slot is read with a single unaligned 32-bit load, which always covers it
+ * (its first bit is at most 7 bits into the load, and 7 + 20 <= 32); the
+ * array is padded so that the load at the last slot stays in bounds.
+ ***/
+
+#define BINARY_FUSE_BITPACKED_MIN_BITS 4
+#define BINARY_FUSE_BITPACKED_MAX_BITS 20
+// bytes past the last slot, so that the 32-bit loads stay in bounds
+#define BINARY_FUSE_BITPACKED_PADDING 4
+
+typedef struct binary_fuse_bitpacked_s {
+  uint64_t Seed;
+  uint32_t Size;
+  uint32_t SegmentLength;
+  uint32_t SegmentLengthMask;
+  uint32_t SegmentCount;
+  uint32_t SegmentCountLength;
+  uint32_t ArrayLength;
+  uint32_t Bits;
+  uint32_t FingerprintMask; // (1 << Bits) - 1
+  uint8_t *Fingerprints;    // ArrayLength slots of Bits bits, then the padding
+} binary_fuse_bitpacked_t;
+
+// bytes used by the slots of the filter, without the padding
+static inline size_t binary_fuse_bitpacked_array_bytes(const binary_fuse_bitpacked_t *filter) {
+  return ((size_t)filter->ArrayLength * filter->Bits + 7) / 8;
+}
+
+static inline uint32_t binary_fuse_bitpacked_fingerprint(uint64_t hash,
+                                                         const binary_fuse_bitpacked_t *filter) {
+  return (uint32_t)(hash ^ (hash >> 32U)) & filter->FingerprintMask;
+}
+
+// Returns the fingerprint stored in slot 'index'.
+static inline uint32_t binary_fuse_bitpacked_get(const binary_fuse_bitpacked_t *filter,
+                                                 uint32_t index) {
+  uint64_t bit = (uint64_t)index * filter->Bits;
+  uint32_t word;
+  memcpy(&word, filter->Fingerprints + (bit >> 3U), sizeof(word));
+  return (word >> (bit & 7U)) & filter->FingerprintMask;
+}
+
+// Stores 'value' (which must fit in Bits bits) in slot 'index'.
+static inline void binary_fuse_bitpacked_set(binary_fuse_bitpacked_t *filter, uint32_t index,
+                                             uint32_t value) {
+  uint64_t bit = (uint64_t)index * filter->Bits;
+  uint32_t word;
+  memcpy(&word, filter->Fingerprints + (bit >> 3U), sizeof(word));
+  word &= ~(filter->FingerprintMask << (bit & 7U));
+  word |= value << (bit & 7U);
+  memcpy(filter->Fingerprints + (bit >> 3U), &word, sizeof(word));
+}
+
+static inline binary_hashes_t binary_fuse_bitpacked_hash_batch(uint64_t hash,
+                                        const binary_fuse_bitpacked_t *filter) {
+  uint64_t hi = binary_fuse_mulhi(hash, filter->SegmentCountLength);
+  binary_hashes_t ans;
+  ans.h0 = (uint32_t)hi;
+  ans.h1 = ans.h0 + filter->SegmentLength;
+  ans.h2 = ans.h1 + filter->SegmentLength;
+  ans.h1 ^= (uint32_t)(hash >> 18U) & filter->SegmentLengthMask;
+  ans.h2 ^= (uint32_t)(hash)&filter->SegmentLengthMask;
+  return ans;
+}
+
+static inline uint32_t binary_fuse_bitpacked_hash(uint64_t index, uint64_t hash,
+                                        const binary_fuse_bitpacked_t *filter) {
+    uint64_t h = binary_fuse_mulhi(hash, filter->SegmentCountLength);
+    h += index * filter->SegmentLength;
+    // keep the lower 36 bits
+    uint64_t hh = hash & ((1ULL << 36U) - 1);
+    // index 0: right shift by 36; index 1: right shift by 18; index 2: no shift
+    h ^= (size_t)((hh >> (36 - 18 * index)) & filter->SegmentLengthMask);
+    return (uint32_t)h;
+}
+
+// Report if the key is in the set, with false positive rate.
+static inline bool binary_fuse_bitpacked_contain(uint64_t key,
+                                                 const binary_fuse_bitpacked_t *filter) {
+  uint64_t hash = binary_fuse_mix_split(key, filter->Seed);
+  binary_hashes_t hashes = binary_fuse_bitpacked_hash_batch(hash, filter);
+  uint32_t f = binary_fuse_bitpacked_fingerprint(hash, filter) ^
+               binary_fuse_bitpacked_get(filter, hashes.h0) ^
+               binary_fuse_bitpacked_get(filter, hashes.h1) ^
+               binary_fuse_bitpacked_get(filter, hashes.h2);
+  return f == 0;
+}
+
+// A query split in two phases, see binary_fuse8_probe_prepare.
+typedef struct binary_fuse_bitpacked_probe_s {
+  binary_hashes_t hashes;
+  uint32_t fingerprint;
+} binary_fuse_bitpacked_probe_t;
+
+// First phase of a query: hash the key, compute its fingerprint and its three
+// locations, and prefetch them. See binary_fuse8_probe_prepare.
+static inline void binary_fuse_bitpacked_probe_prepare(uint64_t key,
+                                                       const binary_fuse_bitpacked_t *filter,
+                                                       binary_fuse_bitpacked_probe_t *probe) {
+  uint64_t hash = binary_fuse_mix_split(key, filter->Seed);
+  probe->fingerprint = binary_fuse_bitpacked_fingerprint(hash, filter);
+  probe->hashes = binary_fuse_bitpacked_hash_batch(hash, filter);
+  binary_fuse_prefetch(filter->Fingerprints + (((uint64_t)probe->hashes.h0 * filter->Bits) >> 3U));
+  binary_fuse_prefetch(filter->Fingerprints + (((uint64_t)probe->hashes.h1 * filter->Bits) >> 3U));
+  binary_fuse_prefetch(filter->Fingerprints + (((uint64_t)probe->hashes.h2 * filter->Bits) >> 3U));
+}
+
+// Second phase of a query: report if the key given to
+// binary_fuse_bitpacked_probe_prepare is in the set, with false positive rate.
+static inline bool binary_fuse_bitpacked_probe_finish(const binary_fuse_bitpacked_probe_t *probe,
+                                                      const binary_fuse_bitpacked_t *filter) {
+  return (probe->fingerprint ^ binary_fuse_bitpacked_get(filter, probe->hashes.h0) ^
+          binary_fuse_bitpacked_get(filter, probe->hashes.h1) ^
+          binary_fuse_bitpacked_get(filter, probe->hashes.h2)) == 0;
+}
+
+// Report, for each of the 'count' keys, if it is in the set, with false
+// positive rate. The answer for keys[i] is written to out[i].
+// Portable version of binary_fuse_bitpacked_contain_batch, see
+// binary_fuse8_contain_batch_scalar.
+static inline void binary_fuse_bitpacked_contain_batch_scalar(const uint64_t *keys, size_t count,
+                                                              bool *out,
+                                                              const binary_fuse_bitpacked_t *filter) {
+  binary_fuse_bitpacked_probe_t probes[BINARY_FUSE_BATCH_WINDOW];
+  const size_t mask = BINARY_FUSE_BATCH_WINDOW - 1;
+  size_t ahead = count < BINARY_FUSE_BATCH_WINDOW ? count : BINARY_FUSE_BATCH_WINDOW;
+  for (size_t i = 0; i < ahead; i++) {
+    binary_fuse_bitpacked_probe_prepare(keys[i], filter, &probes[i]);
+  }
+  for (size_t i = 0; i < count; i++) {
+    size_t slot = i & mask;
+    out[i] = binary_fuse_bitpacked_probe_finish(&probes[slot], filter);
+    if (i + BINARY_FUSE_BATCH_WINDOW < count) {
+      binary_fuse_bitpacked_probe_prepare(keys[i + BINARY_FUSE_BATCH_WINDOW], filter,
+                                          &probes[slot]);
+    }
+  }
+}
+
+#ifdef BINARY_FUSE_X64_SIMD
+// Report, for each of the 'count' keys, if it is in the set, with false
+// positive rate, using AVX2 gathers eight keys at a time. Each gather loads
+// the 32 bits starting at the byte of the slot, thanks to the padding no
+// location needs the scalar code. The answer for keys[i] is written to out[i]
+// and is identical to binary_fuse_bitpacked_contain.
+// The processor must support AVX2, binary_fuse_bitpacked_contain_batch checks
+// it for you.
+BINARY_FUSE_TARGET_AVX2
+static inline void binary_fuse_bitpacked_contain_batch_avx2(const uint64_t *keys, size_t count,
+                                                            bool *out,
+                                                            const binary_fuse_bitpacked_t *filter) {
+  size_t i = 0;
+  // The bit offsets are 32-bit products, and the gathers use signed indexes.
+  if ((uint64_t)filter->ArrayLength * filter->Bits <= INT32_MAX) {
+    const int *base = (const int *)(const void *)filter->Fingerprints;
+    const __m256i vbits = _mm256_set1_epi32((int)filter->Bits);
+    const __m256i seven = _mm256_set1_epi32(7);
+    const __m256i fmask = _mm256_set1_epi32((int)filter->FingerprintMask);
+    for (; i + 8 <= count; i += 8) {
+      __m256i f, h[3];
+      binary_fuse_avx2_hash8(keys + i, filter->Seed, filter->SegmentLength,
+                             filter->SegmentLengthMask, filter->SegmentCountLength,
+                             &f, &h[0], &h[1], &h[2]);
+      __m256i x = f;
+      for (int k = 0; k < 3; k++) {
+        __m256i bit = _mm256_mullo_epi32(h[k], vbits);
+        __m256i word = _mm256_i32gather_epi32(base, _mm256_srli_epi32(bit, 3), 1);
+        x = _mm256_xor_si256(x, _mm256_srlv_epi32(word, _mm256_and_si256(bit, seven)));
+      }
+      __m256i hit = _mm256_cmpeq_epi32(_mm256_and_si256(x, fmask), _mm256_setzero_si256());
+      unsigned bits = (unsigned)_mm256_movemask_ps(_mm256_castsi256_ps(hit));
+      for (size_t j = 0; j < 8; j++) {
+        out[i + j] = (bits >> j) & 1;
+      }
+    }
+  }
+  for (; i < count; i++) {
+    out[i] = binary_fuse_bitpacked_contain(keys[i], filter);
+  }
+}
+
+// Report, for each of the 'count' keys, if it is in the set, with false
+// positive rate, using AVX-512 sixteen keys at a time, as
+// binary_fuse_bitpacked_contain_batch_avx2. The answer for keys[i] is written
+// to out[i] and is identical to binary_fuse_bitpacked_contain.
+// The processor must support AVX-512 F and DQ,
+// binary_fuse_bitpacked_contain_batch checks it for you.
+BINARY_FUSE_TARGET_AVX512
+static inline void binary_fuse_bitpacked_contain_batch_avx512(const uint64_t *keys, size_t count,
+                                                              bool *out,
+                                                              const binary_fuse_bitpacked_t *filter) {
+  // The bit offsets are 32-bit products, and the gathers use signed indexes.
+  if ((uint64_t)filter->ArrayLength * filter->Bits > INT32_MAX) {
+    binary_fuse_bitpacked_contain_batch_scalar(keys, count, out, filter);
+    return;
+  }
+  const __m512i vbits = _mm512_set1_epi32((int)filter->Bits);
+  const __m512i seven = _mm512_set1_epi32(7);
+  const __m512i fmask = _mm512_set1_epi32((int)filter->FingerprintMask);
+  for (size_t i = 0; i < count; i += 16) {
+    size_t n = count - i < 16 ? count - i : 16;
+    __mmask16 valid = (__mmask16)((1U << n) - 1);
+    __m512i f, h[3];
+    binary_fuse_avx512_hash16(keys + i, valid, filter->Seed, filter->SegmentLength,
+                              filter->SegmentLengthMask, filter->SegmentCountLength,
+                              &f, &h[0], &h[1], &h[2]);
+    __m512i x = f;
+    for (int k = 0; k < 3; k++) {
+      __m512i bit = _mm512_mullo_epi32(h[k], vbits);
+      __m512i word = binary_fuse_avx512_gather8(valid, _mm512_srli_epi32(bit, 3),
+                                                filter->Fingerprints);
+      x = _mm512_xor_si512(x, _mm512_srlv_epi32(word, _mm512_and_si512(bit, seven)));
+    }
+    __mmask16 hits = _mm512_mask_testn_epi32_mask(valid, x, fmask);
+    binary_fuse_avx512_store16(out + i, valid, hits);
+  }
+}
+#endif // BINARY_FUSE_X64_SIMD
+
+// Report, for each of the 'count' keys, if it is in the set, with false
+// positive rate. The answer for keys[i] is written to out[i].
+// The kernel is selected as in binary_fuse8_contain_batch.
+static inline void binary_fuse_bitpacked_contain_batch(const uint64_t *keys, size_t count,
+                                                       bool *out,
+                                                       const binary_fuse_bitpacked_t *filter) {
+#ifdef BINARY_FUSE_X64_SIMD
+  switch (binary_fuse_kernel()) {
+  case BINARY_FUSE_KERNEL_AVX512:
+    binary_fuse_bitpacked_contain_batch_avx512(keys, count, out, filter);
+    return;
+  case BINARY_FUSE_KERNEL_AVX2:
+    binary_fuse_bitpacked_contain_batch_avx2(keys, count, out, filter);
+    return;
+  default:
+    break;
+  }
+#endif
+  binary_fuse_bitpacked_contain_batch_scalar(keys, count, out, filter);
+}
+
+// allocate enough capacity for a set containing up to 'size' elements, with
+// fingerprints of 'bits' bits (BINARY_FUSE_BITPACKED_MIN_BITS to
+// BINARY_FUSE_BITPACKED_MAX_BITS, otherwise the allocation fails)
+// caller is responsible to call binary_fuse_bitpacked_free(filter)
+// size should be at least 2.
+static inline bool binary_fuse_bitpacked_allocate(uint32_t size, uint32_t bits,
+                                                  binary_fuse_bitpacked_t *filter) {
+  filter->Fingerprints = NULL;
+  if (bits < BINARY_FUSE_BITPACKED_MIN_BITS || bits > BINARY_FUSE_BITPACKED_MAX_BITS) {
+    return false;
+  }
+  uint32_t arity = 3;
+  filter->Size = size;
+  filter->Bits = bits;
+  filter->FingerprintMask = (UINT32_C(1) << bits) - 1;
+  filter->SegmentLength = size == 0 ? 4 : binary_fuse_calculate_segment_length(arity, size);
+  if (filter->SegmentLength > 262144) {
+    filter->SegmentLength = 262144;
+  }
+  filter->SegmentLengthMask = filter->SegmentLength - 1;
+  double sizeFactor = size <= 1 ? 0 : binary_fuse_calculate_size_factor(arity, size);
+  uint32_t capacity = size <= 1 ? 0 : (uint32_t)(round((double)size * sizeFactor));
+  uint32_t initSegmentCount =
+      (capacity + filter->SegmentLength - 1) / filter->SegmentLength -
+      (arity - 1);
+  filter->ArrayLength = (initSegmentCount + arity - 1) * filter->SegmentLength;
+  filter->SegmentCount =
+      (filter->ArrayLength + filter->SegmentLength - 1) / filter->SegmentLength;
+  if (filter->SegmentCount <= arity - 1) {
+    filter->SegmentCount = 1;
+  } else {
+    filter->SegmentCount = filter->SegmentCount - (arity - 1);
+  }
+  filter->ArrayLength =
+      (filter->SegmentCount + arity - 1) * filter->SegmentLength;
+  filter->SegmentCountLength = filter->SegmentCount * filter->SegmentLength;
+  filter->Fingerprints = (uint8_t *)calloc(
+      binary_fuse_bitpacked_array_bytes(filter) + BINARY_FUSE_BITPACKED_PADDING, 1);
+  return filter->Fingerprints != NULL;
+}
+
+// report memory usage
+static inline size_t binary_fuse_bitpacked_size_in_bytes(const binary_fuse_bitpacked_t *filter) {
+  return binary_fuse_bitpacked_array_bytes(filter) + BINARY_FUSE_BITPACKED_PADDING +
+         sizeof(binary_fuse_bitpacked_t);
+}
+
+// release memory
+static inline void binary_fuse_bitpacked_free(binary_fuse_bitpacked_t *filter) {
+  free(filter->Fingerprints);
+  filter->Fingerprints = NULL;
+  filter->Seed = 0;
+  filter->Size = 0;
+  filter->SegmentLength = 0;
+  filter->SegmentLengthMask = 0;
+  filter->SegmentCount = 0;
+  filter->SegmentCountLength = 0;
+  filter->ArrayLength = 0;
+  filter->Bits = 0;
+  filter->FingerprintMask = 0;
+}
+
+// Construct the filter, returns true on success, false on failure.
+// The algorithm fails when there is insufficient memory.
+// The caller is responsable for calling binary_fuse_bitpacked_allocate(size,bits,filter)
+// before. For best performance, the caller should ensure that there are not too
+// many duplicated keys.
+static inline bool binary_fuse_bitpacked_populate(uint64_t *keys, uint32_t size,
+                                                  binary_fuse_bitpacked_t *filter) {
+  if (size != filter->Size) {
+    return false;
+  }
+
+  uint64_t rng_counter = 0x726b2b9d438b9d4d;
+  filter->Seed = binary_fuse_rng_splitmix64(&rng_counter);
+  uint64_t *reverseOrder = (uint64_t *)calloc((size + 1), sizeof(uint64_t));
+  uint32_t capacity = filter->ArrayLength;
+  uint32_t *alone = (uint32_t *)malloc(capacity * sizeof(uint32_t));
+  uint8_t *t2count = (uint8_t *)calloc(capacity, sizeof(uint8_t));
+  uint8_t *reverseH = (uint8_t *)malloc(size * sizeof(uint8_t));
+  uint64_t *t2hash = (uint64_t *)calloc(capacity, sizeof(uint64_t));
+
+  uint32_t blockBits = 1;
+  while (((uint32_t)1 << blockBits) < filter->SegmentCount) {
+    blockBits += 1;
+  }
+  uint32_t block = ((uint32_t)1 << blockBits);
+  uint32_t *startPos = (uint32_t *)malloc((1U << blockBits) * sizeof(uint32_t));
+  uint32_t h012[5];
+  uint64_t hashes[BINARY_FUSE_HASH_BLOCK];
+
+  if ((alone == NULL) || (t2count == NULL) || (reverseH == NULL) ||
+      (t2hash == NULL) || (reverseOrder == NULL) || (startPos == NULL)) {
+    free(alone);
+    free(t2count);
+    free(reverseH);
+    free(t2hash);
+    free(reverseOrder);
+    free(startPos);
+    return false;
+  }
+  reverseOrder[size] = 1;
+  for (int loop = 0; true; ++loop) {
+    if (loop + 1 > XOR_MAX_ITERATIONS) {
+      // The probability of this happening is lower than the
+      // the cosmic-ray probability (i.e., a cosmic ray corrupts your system).
+      free(alone);
+      free(t2count);
+      free(reverseH);
+      free(t2hash);
+      free(reverseOrder);
+      free(startPos);
+      return false;
+    }
+
+    for (uint32_t i = 0; i < block; i++) {
+      // important : i * size would overflow as a 32-bit number in some
+      // cases.
+      startPos[i] = (uint32_t)(((uint64_t)i * size) >> blockBits);
+    }
+
+    uint64_t maskblock = block - 1;
+    for (uint32_t start = 0; start < size; start += BINARY_FUSE_HASH_BLOCK) {
+      uint32_t n = size - start < BINARY_FUSE_HASH_BLOCK ? size - start : BINARY_FUSE_HASH_BLOCK;
+      binary_fuse_hash_keys(keys + start, n, filter->Seed, hashes);
+      for (uint32_t i = 0; i < n; i++) {
+        uint64_t hash = hashes[i];
+        uint64_t segment_index = hash >> (64 - blockBits);
+        while (reverseOrder[startPos[segment_index]] != 0) {
+          segment_index++;
+          segment_index &= maskblock;
+        }
+        reverseOrder[startPos[segment_index]] = hash;
+        startPos[segment_index]++;
+      }
+    }
+    int error = 0;
+    uint32_t duplicates = 0;
+    for (uint32_t i = 0; i < size; i++) {
+      uint64_t hash = reverseOrder[i];
+      uint32_t h0 = binary_fuse_bitpacked_hash(0, hash, filter);
+      t2count[h0] += 4;
+      t2hash[h0] ^= hash;
+      uint32_t h1= binary_fuse_bitpacked_hash(1, hash, filter);
+      t2count[h1] += 4;
+      t2count[h1] ^= 1U;
+      t2hash[h1] ^= hash;
+      uint32_t h2 = binary_fuse_bitpacked_hash(2, hash, filter);
+      t2count[h2] += 4;
+      t2hash[h2] ^= hash;
+      t2count[h2] ^= 2U;
+      if ((t2hash[h0] & t2hash[h1] & t2hash[h2]) == 0) {
+        if   (((t2hash[h0] == 0) && (t2count[h0] == 8))
+          ||  ((t2hash[h1] == 0) && (t2count[h1] == 8))
+          ||  ((t2hash[h2] == 0) && (t2count[h2] == 8))) {
+					duplicates += 1;
+ 					t2count[h0] -= 4;
+ 					t2hash[h0] ^= hash;
+ 					t2count[h1] -= 4;
+ 					t2count[h1] ^= 1U;
+ 					t2hash[h1] ^= hash;
+ 					t2count[h2] -= 4;
+ 					t2count[h2] ^= 2U;
+ 					t2hash[h2] ^= hash;
+        }
+      }
+      error = (t2count[h0] < 4) ? 1 : error;
+      error = (t2count[h1] < 4) ? 1 : error;
+      error = (t2count[h2] < 4) ? 1 : error;
+    }
+    if(error) {
+      if(duplicates > 0) {
+        // many copies of a key can overflow a counter before they are detected
+        size = (uint32_t)binary_fuse_sort_and_remove_dup(keys, size);
+      }
+      memset(reverseOrder, 0, sizeof(uint64_t) * size);
+      memset(t2count, 0, sizeof(uint8_t) * capacity);
+      memset(t2hash, 0, sizeof(uint64_t) * capacity);
+      filter->Seed = binary_fuse_rng_splitmix64(&rng_counter);
+      continue;
+    }
+
+    // End of key addition
+    uint32_t Qsize = 0;
+    // Add sets with one key to the queue.
+    for (uint32_t i = 0; i < capacity; i++) {
+      alone[Qsize] = i;
+      Qsize += ((t2count[i] >> 2U) == 1) ? 1U : 0U;
+    }
+    uint32_t stacksize = 0;
+    while (Qsize > 0) {
+      Qsize--;
+      uint32_t index = alone[Qsize];
+      if ((t2count[index] >> 2U) == 1) {
+        uint64_t hash = t2hash[index];
+
+        //h012[0] = binary_fuse_bitpacked_hash(0, hash, filter);
+        h012[1] = binary_fuse_bitpacked_hash(1, hash, filter);
+        h012[2] = binary_fuse_bitpacked_hash(2, hash, filter);
+        h012[3] = binary_fuse_bitpacked_hash(0, hash, filter); // == h012[0];
+        h012[4] = h012[1];
+        uint8_t found = t2count[index] & 3U;
+        reverseH[stacksize] = found;
+        reverseOrder[stacksize] = hash;
+        stacksize++;
+        uint32_t other_index1 = h012[found + 1];
+        alone[Qsize] = other_index1;
+        Qsize += ((t2count[other_index1] >> 2U) == 2 ? 1U : 0U);
+
+        t2count[other_index1] -= 4;
+        t2count[other_index1] ^= binary_fuse_mod3(found + 1);
+        t2hash[other_index1] ^= hash;
+
+        uint32_t other_index2 = h012[found + 2];
+        alone[Qsize] = other_index2;
+        Qsize += ((t2count[other_index2] >> 2U) == 2 ? 1U : 0U);
+        t2count[other_index2] -= 4;
+        t2count[other_index2] ^= binary_fuse_mod3(found + 2);
+        t2hash[other_index2] ^= hash;
+      }
+    }
+    if (stacksize + duplicates == size) {
+      // success
+      size = stacksize;
+      break;
+    }
+    if(duplicates > 0) {
+      size = (uint32_t)binary_fuse_sort_and_remove_dup(keys, size);
+    }
+    memset(reverseOrder, 0, sizeof(uint64_t) * size);
+    memset(t2count, 0, sizeof(uint8_t) * capacity);
+    memset(t2hash, 0, sizeof(uint64_t) * capacity);
+    filter->Seed = binary_fuse_rng_splitmix64(&rng_counter);
+  }
+
+  for (uint32_t i = size - 1; i < size; i--) {
+    // the hash of the key we insert next
+    uint64_t hash = reverseOrder[i];
+    uint32_t xor2 = binary_fuse_bitpacked_fingerprint(hash, filter);
+    uint8_t found = reverseH[i];
+    h012[0] = binary_fuse_bitpacked_hash(0, hash, filter);
+    h012[1] = binary_fuse_bitpacked_hash(1, hash, filter);
+    h012[2] = binary_fuse_bitpacked_hash(2, hash, filter);
+    h012[3] = h012[0];
+    h012[4] = h012[1];
+    binary_fuse_bitpacked_set(filter, h012[found],
+                              xor2 ^ binary_fuse_bitpacked_get(filter, h012[found + 1]) ^
+                                  binary_fuse_bitpacked_get(filter, h012[found + 2]));
+  }
+  free(alone);
+  free(t2count);
+  free(reverseH);
+  free(t2hash);
+  free(reverseOrder);
+  free(startPos);
+  return true;
+}
+
+static inline size_t binary_fuse_bitpacked_serialization_bytes(const binary_fuse_bitpacked_t *filter) {
+  return sizeof(filter->Seed) + sizeof(filter->Size) + sizeof(filter->SegmentLength) +
+        sizeof(filter->SegmentCount) +
+        sizeof(filter->SegmentCountLength) + sizeof(filter->ArrayLength) +
+        sizeof(filter->Bits) + binary_fuse_bitpacked_array_bytes(filter);
+}
+
+// serialize a filter to a buffer, the buffer should have a capacity of at least
+// binary_fuse_bitpacked_serialization_bytes(filter) bytes. The slots are
+// written as they are in memory, without the padding.
+// Native endianess only.
+static inline void binary_fuse_bitpacked_serialize(const binary_fuse_bitpacked_t *filter,
+                                                   char *buffer) {
+  memcpy(buffer, &filter->Seed, sizeof(filter->Seed));
+  buffer += sizeof(filter->Seed);
+  memcpy(buffer, &filter->Size, sizeof(filter->Size));
+  buffer += sizeof(filter->Size);
+  uint32_t segment_length = binary_fuse_tag_mixer(filter->SegmentLength);
+  memcpy(buffer, &segment_length, sizeof(segment_length));
+  buffer += sizeof(filter->SegmentLength);
+  memcpy(buffer, &filter->SegmentCount, sizeof(filter->SegmentCount));
+  buffer += sizeof(filter->SegmentCount);
+  memcpy(buffer, &filter->SegmentCountLength, sizeof(filter->SegmentCountLength));
+  buffer += sizeof(filter->SegmentCountLength);
+  memcpy(buffer, &filter->ArrayLength, sizeof(filter->ArrayLength));
+  buffer += sizeof(filter->ArrayLength);
+  memcpy(buffer, &filter->Bits, sizeof(filter->Bits));
+  buffer += sizeof(filter->Bits);
+  memcpy(buffer, filter->Fingerprints, binary_fuse_bitpacked_array_bytes(filter));
+}
+
+// deserialize a filter from a buffer, returns true on success, false on failure
+// (insufficient memory, or a fingerprint width out of range).
+// The output will be reallocated, so the caller should call binary_fuse_bitpacked_free(filter)
+// before if the filter was already allocated. The caller needs to call
+// binary_fuse_bitpacked_free(filter) after.
+// The number of bytes read is binary_fuse_bitpacked_serialization_bytes(output).
+// Native endianess only.
+static inline bool binary_fuse_bitpacked_deserialize(binary_fuse_bitpacked_t *filter,
+                                                     const char *buffer) {
+  memcpy(&filter->Seed, buffer, sizeof(filter->Seed));
+  buffer += sizeof(filter->Seed);
+  memcpy(&filter->Size, buffer, sizeof(filter->Size));
+  buffer += sizeof(filter->Size);
+  memcpy(&filter->SegmentLength, buffer, sizeof(filter->SegmentLength));
+  buffer += sizeof(filter->SegmentLength);
+  if (!binary_fuse_untag_mixer(&filter->SegmentLength)) {
+    filter->Fingerprints = NULL;
+    return false;
+  }
+  filter->SegmentLengthMask = filter->SegmentLength - 1;
+  memcpy(&filter->SegmentCount, buffer, sizeof(filter->SegmentCount));
+  buffer += sizeof(filter->SegmentCount);
+  memcpy(&filter->SegmentCountLength, buffer, sizeof(filter->SegmentCountLength));
+  buffer += sizeof(filter->SegmentCountLength);
+  memcpy(&filter->ArrayLength, buffer, sizeof(filter->ArrayLength));
+  buffer += sizeof(filter->ArrayLength);
+  memcpy(&filter->Bits, buffer, sizeof(filter->Bits));
+  buffer += sizeof(filter->Bits);
+  filter->Fingerprints = NULL;
+  if (filter->Bits < BINARY_FUSE_BITPACKED_MIN_BITS ||
+      filter->Bits > BINARY_FUSE_BITPACKED_MAX_BITS) {
+    return false;
+  }
+  filter->FingerprintMask = (UINT32_C(1) << filter->Bits) - 1;
+  size_t bytes = binary_fuse_bitpacked_array_bytes(filter);
+  filter->Fingerprints = (uint8_t *)calloc(bytes + BINARY_FUSE_BITPACKED_PADDING, 1);
+  if(filter->Fingerprints == NULL) {
+    return false;
+  }
+  memcpy(filter->Fingerprints, buffer, bytes);
+  return true;
+}
+
+//////////////////
+// 64-bit sizes
+//////////////////
+
+/**
+ * binary_fuse8_large_t and binary_fuse16_large_t hold more than 2^32 keys:
+ * the size, the array length and the index mapping are 64-bit, with the same
+ * operations as the 32-bit filters (one binary_fuse_mulhi over the 64-bit
+ * range, two additions and two xors), so that a query costs the same.
+ * Below 2^32 keys they are identical to binary_fuse8_t and binary_fuse16_t.
+ ***/
+
+typedef struct binary_large_hashes_s {
+  uint64_t h0;
+  uint64_t h1;
+  uint64_t h2;
+} binary_large_hashes_t;
+
+typedef struct binary_fuse8_large_s {
+  uint64_t Seed;
+  uint64_t Size;
+  uint32_t SegmentLength;
+  uint32_t SegmentLengthMask;
+  uint64_t SegmentCount;
+  uint64_t SegmentCountLength;
+  uint64_t ArrayLength;
+  uint8_t *Fingerprints;
+} binary_fuse8_large_t;
+
+typedef struct binary_fuse16_large_s {
+  uint64_t Seed;
+  uint64_t Size;
+  uint32_t SegmentLength;
+  uint32_t SegmentLengthMask;
+  uint64_t SegmentCount;
+  uint64_t SegmentCountLength;
+  uint64_t ArrayLength;
+  uint16_t *Fingerprints;
+} binary_fuse16_large_t;
+
+// report memory usage
+static inline size_t binary_fuse8_large_size_in_bytes(const binary_fuse8_large_t *filter) {
+  return (size_t)filter->ArrayLength * sizeof(uint8_t) + sizeof(binary_fuse8_large_t);
+}
+
+// release memory
+static inline void binary_fuse8_large_free(binary_fuse8_large_t *filter) {
+  free(filter->Fingerprints);
+  filter->Fingerprints = NULL;
+  filter->Seed = 0;
+  filter->Size = 0;
+  filter->SegmentLength = 0;
+  filter->SegmentLengthMask = 0;
+  filter->SegmentCount = 0;
+  filter->SegmentCountLength = 0;
+  filter->ArrayLength = 0;
+}
+
+static inline binary_large_hashes_t binary_fuse8_large_hash_batch(uint64_t hash,
+                                        const binary_fuse8_large_t *filter) {
+  binary_large_hashes_t ans;
+  ans.h0 = binary_fuse_mulhi(hash, filter->SegmentCountLength);
+  ans.h1 = ans.h0 + filter->SegmentLength;
+  ans.h2 = ans.h1 + filter->SegmentLength;
+  ans.h1 ^= (hash >> 18U) & filter->SegmentLengthMask;
+  ans.h2 ^= hash & filter->SegmentLengthMask;
+  return ans;
+}
+
+static inline uint64_t binary_fuse8_large_hash(uint64_t index, uint64_t hash,
+                                        const binary_fuse8_large_t *filter) {
+    uint64_t h = binary_fuse_mulhi(hash, filter->SegmentCountLength);
+    h += index * filter->SegmentLength;
+    // keep the lower 36 bits
+    uint64_t hh = hash & ((1ULL << 36U) - 1);
+    // index 0: right shift by 36; index 1: right shift by 18; index 2: no shift
+    h ^= (hh >> (36 - 18 * index)) & filter->SegmentLengthMask;
+    return h;
+}
+
+// Report if the key is in the set, with false positive rate.
+static inline bool binary_fuse8_large_contain(uint64_t key,
+                                              const binary_fuse8_large_t *filter) {
+  uint64_t hash = binary_fuse_mix_split(key, filter->Seed);
+  uint8_t f = binary_fuse8_fingerprint(hash);
+  binary_large_hashes_t hashes = binary_fuse8_large_hash_batch(hash, filter);
+  f ^= (uint32_t)filter->Fingerprints[hashes.h0] ^
+       filter->Fingerprints[hashes.h1] ^
+       filter->Fingerprints[hashes.h2];
+  return f == 0;
+}
+
+// allocate enough capacity for a set containing up to 'size' elements
+// caller is responsible to call binary_fuse8_large_free(filter)
+static inline bool binary_fuse8_large_allocate(uint64_t size,
+                                               binary_fuse8_large_t *filter) {
+  uint32_t arity = 3;
+  // the segment length and the size factor stop changing well below 2^32 keys
+  uint32_t size32 = size > UINT32_MAX ? UINT32_MAX : (uint32_t)size;
+  filter->Size = size;
+  filter->SegmentLength = size == 0 ? 4 : binary_fuse_calculate_segment_length(arity, size32);
+  if (filter->SegmentLength > 262144) {
+    filter->SegmentLength = 262144;
+  }
+  filter->SegmentLengthMask = filter->SegmentLength - 1;
+  double sizeFactor = size <= 1 ? 0 : binary_fuse_calculate_size_factor(arity, size32);
+  uint64_t capacity = size <= 1 ? 0 : (uint64_t)(round((double)size * sizeFactor));
+  uint64_t initSegmentCount =
+      (capacity + filter->SegmentLength - 1) / filter->SegmentLength -
+      (arity - 1);
+  filter->ArrayLength = (initSegmentCount + arity - 1) * filter->SegmentLength;
+  filter->SegmentCount =
+      (filter->ArrayLength + filter->SegmentLength - 1) / filter->SegmentLength;
+  if (filter->SegmentCount <= arity - 1) {
+    filter->SegmentCount = 1;
+  } else {
+    filter->SegmentCount = filter->SegmentCount - (arity - 1);
+  }
+  filter->ArrayLength =
+      (filter->SegmentCount + arity - 1) * filter->SegmentLength;
+  filter->SegmentCountLength = filter->SegmentCount * filter->SegmentLength;
+  filter->Fingerprints = NULL;
+  if (filter->ArrayLength > SIZE_MAX / sizeof(uint8_t)) {
+    return false;
+  }
+  filter->Fingerprints =
+      (uint8_t *)calloc((size_t)filter->ArrayLength, sizeof(uint8_t));
+  return filter->Fingerprints != NULL;
+}
+
+// Construct the filter, returns true on success, false on failure.
+// The algorithm fails when there is insufficient memory: it needs about 37
+// bytes per key on top of the keys (and the filter).
+// The caller is responsable for calling binary_fuse8_large_allocate(size,filter)
+// before. For best performance, the caller should ensure that there are not too
+// many duplicated keys. Below 2^32 keys, the filter is the one binary_fuse8_populate
+// builds.
+static inline bool binary_fuse8_large_populate(uint64_t *keys, uint64_t size,
+                                               binary_fuse8_large_t *filter) {
+  if (size != filter->Size) {
+    return false;
+  }
+  uint64_t capacity = filter->ArrayLength;
+  if (size >= SIZE_MAX / sizeof(uint64_t) || capacity > SIZE_MAX / sizeof(uint64_t)) {
+    return false;
+  }
+
+  uint64_t rng_counter = 0x726b2b9d438b9d4d;
+  filter->Seed = binary_fuse_rng_splitmix64(&rng_counter);
+  uint64_t *reverseOrder = (uint64_t *)calloc((size_t)(size + 1), sizeof(uint64_t));
+  uint64_t *alone = (uint64_t *)malloc((size_t)capacity * sizeof(uint64_t));
+  uint8_t *t2count = (uint8_t *)calloc((size_t)capacity, sizeof(uint8_t));
+  uint8_t *reverseH = (uint8_t *)malloc((size_t)size * sizeof(uint8_t));
+  uint64_t *t2hash = (uint64_t *)calloc((size_t)capacity, sizeof(uint64_t));
+
+  uint32_t blockBits = 1;
+  while (((uint64_t)1 << blockBits) < filter->SegmentCount) {
+    blockBits += 1;
+  }
+  uint64_t block = ((uint64_t)1 << blockBits);
+  uint64_t *startPos = (uint64_t *)malloc((size_t)block * sizeof(uint64_t));
+  uint64_t h012[5];
+  uint64_t hashes[BINARY_FUSE_HASH_BLOCK];
+
+  if ((alone == NULL) || (t2count == NULL) || (reverseH == NULL) ||
+      (t2hash == NULL) || (reverseOrder == NULL) || (startPos == NULL)) {
+    free(alone);
+    free(t2count);
+    free(reverseH);
+    free(t2hash);
+    free(reverseOrder);
+    free(startPos);
+    return false;
+  }
+  reverseOrder[size] = 1;
+  for (int loop = 0; true; ++loop) {
+    if (loop + 1 > XOR_MAX_ITERATIONS) {
+      // The probability of this happening is lower than the
+      // the cosmic-ray probability (i.e., a cosmic ray corrupts your system).
+      free(alone);
+      free(t2count);
+      free(reverseH);
+      free(t2hash);
+      free(reverseOrder);
+      free(startPos);
+      return false;
+    }
+
+    for (uint64_t i = 0; i < block; i++) {
+      // i < 2^blockBits and size < 2^47 (the memory of the construction), so
+      // that i * size fits
+      startPos[i] = (i * size) >> blockBits;
+    }
+
+    uint64_t maskblock = block - 1;
+    for (uint64_t start = 0; start < size; start += BINARY_FUSE_HASH_BLOCK) {
+      size_t n = size - start < BINARY_FUSE_HASH_BLOCK ? (size_t)(size - start) : BINARY_FUSE_HASH_BLOCK;
+      binary_fuse_hash_keys(keys + start, n, filter->Seed, hashes);
+      for (size_t i = 0; i < n; i++) {
+        uint64_t hash = hashes[i];
+        uint64_t segment_index = hash >> (64 - blockBits);
+        while (reverseOrder[startPos[segment_index]] != 0) {
+          segment_index++;
+          segment_index &= maskblock;
+        }
+        reverseOrder[startPos[segment_index]] = hash;
+        startPos[segment_index]++;
+      }
+    }
+    int error = 0;
+    uint64_t duplicates = 0;
+    for (uint64_t i = 0; i < size; i++) {
+      uint64_t hash = reverseOrder[i];
+      uint64_t h0 = binary_fuse8_large_hash(0, hash, filter);
+      t2count[h0] += 4;
+      t2hash[h0] ^= hash;
+      uint64_t h1= binary_fuse8_large_hash(1, hash, filter);
+      t2count[h1] += 4;
+      t2count[h1] ^= 1U;
+      t2hash[h1] ^= hash;
+      uint64_t h2 = binary_fuse8_large_hash(2, hash, filter);
+      t2count[h2] += 4;
+      t2hash[h2] ^= hash;
+      t2count[h2] ^= 2U;
+      if ((t2hash[h0] & t2hash[h1] & t2hash[h2]) == 0) {
+        if   (((t2hash[h0] == 0) && (t2count[h0] == 8))
+          ||  ((t2hash[h1] == 0) && (t2count[h1] == 8))
+          ||  ((t2hash[h2] == 0) && (t2count[h2] == 8))) {
+          duplicates += 1;
+          t2count[h0] -= 4;
+          t2hash[h0] ^= hash;
+          t2count[h1] -= 4;
+          t2count[h1] ^= 1U;
+          t2hash[h1] ^= hash;
+          t2count[h2] -= 4;
+          t2count[h2] ^= 2U;
+          t2hash[h2] ^= hash;
+        }
+      }
+      error = (t2count[h0] < 4) ? 1 : error;
+      error = (t2count[h1] < 4) ? 1 : error;
+      error = (t2count[h2] < 4) ? 1 : error;
+    }
+    if(error) {
+      if(duplicates > 0) {
+        // many copies of a key can overflow a counter before they are detected
+        size = binary_fuse_sort_and_remove_dup(keys, (size_t)size);
+      }
+      memset(reverseOrder, 0, sizeof(uint64_t) * (size_t)size);
+      memset(t2count, 0, sizeof(uint8_t) * (size_t)capacity);
+      memset(t2hash, 0, sizeof(uint64_t) * (size_t)capacity);
+      filter->Seed = binary_fuse_rng_splitmix64(&rng_counter);
+      continue;
+    }
+
+    // End of key addition
+    uint64_t Qsize = 0;
+    // Add sets with one key to the queue.
+    for (uint64_t i = 0; i < capacity; i++) {
+      alone[Qsize] = i;
+      Qsize += ((t2count[i] >> 2U) == 1) ? 1U : 0U;
+    }
+    uint64_t stacksize = 0;
+    while (Qsize > 0) {
+      Qsize--;
+      uint64_t index = alone[Qsize];
+      if ((t2count[index] >> 2U) == 1) {
+        uint64_t hash = t2hash[index];
+
+        //h012[0] = binary_fuse8_large_hash(0, hash, filter);
+        h012[1] = binary_fuse8_large_hash(1, hash, filter);
+        h012[2] = binary_fuse8_large_hash(2, hash, filter);
+        h012[3] = binary_fuse8_large_hash(0, hash, filter); // == h012[0];
+        h012[4] = h012[1];
+        uint8_t found = t2count[index] & 3U;
+        reverseH[stacksize] = found;
+        reverseOrder[stacksize] = hash;
+        stacksize++;
+        uint64_t other_index1 = h012[found + 1];
+        alone[Qsize] = other_index1;
+        Qsize += ((t2count[other_index1] >> 2U) == 2 ? 1U : 0U);
+
+        t2count[other_index1] -= 4;
+        t2count[other_index1] ^= binary_fuse_mod3(found + 1);
+        t2hash[other_index1] ^= hash;
+
+        uint64_t other_index2 = h012[found + 2];
+        alone[Qsize] = other_index2;
+        Qsize += ((t2count[other_index2] >> 2U) == 2 ? 1U : 0U);
+        t2count[other_index2] -= 4;
+        t2count[other_index2] ^= binary_fuse_mod3(found + 2);
+        t2hash[other_index2] ^= hash;
+      }
+    }
+    if (stacksize + duplicates == size) {
+      // success
+      size = stacksize;
+      break;
+    }
+    if(duplicates > 0) {
+      size = binary_fuse_sort_and_remove_dup(keys, (size_t)size);
+    }
+    memset(reverseOrder, 0, sizeof(uint64_t) * (size_t)size);
+    memset(t2count, 0, sizeof(uint8_t) * (size_t)capacity);
+    memset(t2hash, 0, sizeof(uint64_t) * (size_t)capacity);
+    filter->Seed = binary_fuse_rng_splitmix64(&rng_counter);
+  }
+
+  for (uint64_t i = size - 1; i < size; i--) {
+    // the hash of the key we insert next
+    uint64_t hash = reverseOrder[i];
+    uint8_t xor2 = binary_fuse8_fingerprint(hash);
+    uint8_t found = reverseH[i];
+    h012[0] = binary_fuse8_large_hash(0, hash, filter);
+    h012[1] = binary_fuse8_large_hash(1, hash, filter);
+    h012[2] = binary_fuse8_large_hash(2, hash, filter);
+    h012[3] = h012[0];
+    h012[4] = h012[1];
+    filter->Fingerprints[h012[found]] = (uint8_t)(
+        (uint32_t)xor2 ^
+        (uint32_t)filter->Fingerprints[h012[found + 1]] ^
+        (uint32_t)filter->Fingerprints[h012[found + 2]]);
+  }
+  free(alone);
+  free(t2count);
+  free(reverseH);
+  free(t2hash);
+  free(reverseOrder);
+  free(startPos);
+  return true;
+}
+
+static inline size_t binary_fuse8_large_serialization_bytes(const binary_fuse8_large_t *filter) {
+  return sizeof(filter->Seed) + sizeof(filter->Size) + sizeof(filter->SegmentLength) +
+        sizeof(filter->SegmentCount) +
+        sizeof(filter->SegmentCountLength) + sizeof(filter->ArrayLength) +
+        sizeof(uint8_t) * (size_t)filter->ArrayLength;
+}
+
+// serialize a filter to a buffer, the buffer should have a capacity of at least
+// binary_fuse8_large_serialization_bytes(filter) bytes.
+// Native endianess only.
+static inline void binary_fuse8_large_serialize(const binary_fuse8_large_t *filter,
+                                                char *buffer) {
+  memcpy(buffer, &filter->Seed, sizeof(filter->Seed));
+  buffer += sizeof(filter->Seed);
+  memcpy(buffer, &filter->Size, sizeof(filter->Size));
+  buffer += sizeof(filter->Size);
+  uint32_t segment_length = binary_fuse_tag_mixer(filter->SegmentLength);
+  memcpy(buffer, &segment_length, sizeof(segment_length));
+  buffer += sizeof(filter->SegmentLength);
+  memcpy(buffer, &filter->SegmentCount, sizeof(filter->SegmentCount));
+  buffer += sizeof(filter->SegmentCount);
+  memcpy(buffer, &filter->SegmentCountLength, sizeof(filter->SegmentCountLength));
+  buffer += sizeof(filter->SegmentCountLength);
+  memcpy(buffer, &filter->ArrayLength, sizeof(filter->ArrayLength));
+  buffer += sizeof(filter->ArrayLength);
+  memcpy(buffer, filter->Fingerprints, sizeof(uint8_t) * (size_t)filter->ArrayLength);
+}
+
+// deserialize a filter from a buffer, returns true on success, false on failure.
+// The output will be reallocated, so the caller should call binary_fuse8_large_free(filter)
+// before if the filter was already allocated. The caller needs to call
+// binary_fuse8_large_free(filter) after.
+// The number of bytes read is binary_fuse8_large_serialization_bytes(output).
+// Native endianess only.
+static inline bool binary_fuse8_large_deserialize(binary_fuse8_large_t *filter,
+                                                  const char *buffer) {
+  memcpy(&filter->Seed, buffer, sizeof(filter->Seed));
+  buffer += sizeof(filter->Seed);
+  memcpy(&filter->Size, buffer, sizeof(filter->Size));
+  buffer += sizeof(filter->Size);
+  memcpy(&filter->SegmentLength, buffer, sizeof(filter->SegmentLength));
+  buffer += sizeof(filter->SegmentLength);
+  filter->Fingerprints = NULL;
+  if (!binary_fuse_untag_mixer(&filter->SegmentLength)) {
+    return false;
+  }
+  filter->SegmentLengthMask = filter->SegmentLength - 1;
+  memcpy(&filter->SegmentCount, buffer, sizeof(filter->SegmentCount));
+  buffer += sizeof(filter->SegmentCount);
+  memcpy(&filter->SegmentCountLength, buffer, sizeof(filter->SegmentCountLength));
+  buffer += sizeof(filter->SegmentCountLength);
+  memcpy(&filter->ArrayLength, buffer, sizeof(filter->ArrayLength));
+  buffer += sizeof(filter->ArrayLength);
+  if (filter->ArrayLength > SIZE_MAX / sizeof(uint8_t)) {
+    return false;
+  }
+  filter->Fingerprints = (uint8_t *)malloc(sizeof(uint8_t) * (size_t)filter->ArrayLength);
+  if(filter->Fingerprints == NULL) {
+    return false;
+  }
+  memcpy(filter->Fingerprints, buffer, sizeof(uint8_t) * (size_t)filter->ArrayLength);
+  return true;
+}
+
+// report memory usage
+static inline size_t binary_fuse16_large_size_in_bytes(const binary_fuse16_large_t *filter) {
+  return (size_t)filter->ArrayLength * sizeof(uint16_t) + sizeof(binary_fuse16_large_t);
+}
+
+// release memory
+static inline void binary_fuse16_large_free(binary_fuse16_large_t *filter) {
+  free(filter->Fingerprints);
+  filter->Fingerprints = NULL;
+  filter->Seed = 0;
+  filter->Size = 0;
+  filter->SegmentLength = 0;
+  filter->SegmentLengthMask = 0;
+  filter->SegmentCount = 0;
+  filter->SegmentCountLength = 0;
+  filter->ArrayLength = 0;
+}
+
+static inline binary_large_hashes_t binary_fuse16_large_hash_batch(uint64_t hash,
+                                        const binary_fuse16_large_t *filter) {
+  binary_large_hashes_t ans;
+  ans.h0 = binary_fuse_mulhi(hash, filter->SegmentCountLength);
+  ans.h1 = ans.h0 + filter->SegmentLength;
+  ans.h2 = ans.h1 + filter->SegmentLength;
+  ans.h1 ^= (hash >> 18U) & filter->SegmentLengthMask;
+  ans.h2 ^= hash & filter->SegmentLengthMask;
+  return ans;
+}
+
+static inline uint64_t binary_fuse16_large_hash(uint64_t index, uint64_t hash,
+                                        const binary_fuse16_large_t *filter) {
+    uint64_t h = binary_fuse_mulhi(hash, filter->SegmentCountLength);
+    h += index * filter->SegmentLength;
+    // keep the lower 36 bits
+    uint64_t hh = hash & ((1ULL << 36U) - 1);
+    // index 0: right shift by 36; index 1: right shift by 18; index 2: no shift
+    h ^= (hh >> (36 - 18 * index)) & filter->SegmentLengthMask;
+    return h;
+}
+
+// Report if the key is in the set, with false positive rate.
+static inline bool binary_fuse16_large_contain(uint64_t key,
+                                              const binary_fuse16_large_t *filter) {
+  uint64_t hash = binary_fuse_mix_split(key, filter->Seed);
+  uint16_t f = binary_fuse16_fingerprint(hash);
+  binary_large_hashes_t hashes = binary_fuse16_large_hash_batch(hash, filter);
+  f ^= (uint32_t)filter->Fingerprints[hashes.h0] ^
+       filter->Fingerprints[hashes.h1] ^
+       filter->Fingerprints[hashes.h2];
+  return f == 0;
+}
+
+// allocate enough capacity for a set containing up to 'size' elements
+// caller is responsible to call binary_fuse16_large_free(filter)
+static inline bool binary_fuse16_large_allocate(uint64_t size,
+                                               binary_fuse16_large_t *filter) {
+  uint32_t arity = 3;
+  // the segment length and the size factor stop changing well below 2^32 keys
+  uint32_t size32 = size > UINT32_MAX ? UINT32_MAX : (uint32_t)size;
+  filter->Size = size;
+  filter->SegmentLength = size == 0 ? 4 : binary_fuse_calculate_segment_length(arity, size32);
+  if (filter->SegmentLength > 262144) {
+    filter->SegmentLength = 262144;
+  }
+  filter->SegmentLengthMask = filter->SegmentLength - 1;
+  double sizeFactor = size <= 1 ? 0 : binary_fuse_calculate_size_factor(arity, size32);
+  uint64_t capacity = size <= 1 ? 0 : (uint64_t)(round((double)size * sizeFactor));
+  uint64_t initSegmentCount =
+      (capacity + filter->SegmentLength - 1) / filter->SegmentLength -
+      (arity - 1);
+  filter->ArrayLength = (initSegmentCount + arity - 1) * filter->SegmentLength;
+  filter->SegmentCount =
+      (filter->ArrayLength + filter->SegmentLength - 1) / filter->SegmentLength;
+  if (filter->SegmentCount <= arity - 1) {
+    filter->SegmentCount = 1;
+  } else {
+    filter->SegmentCount = filter->SegmentCount - (arity - 1);
+  }
+  filter->ArrayLength =
+      (filter->SegmentCount + arity - 1) * filter->SegmentLength;
+  filter->SegmentCountLength = filter->SegmentCount * filter->SegmentLength;
+  filter->Fingerprints = NULL;
+  if (filter->ArrayLength > SIZE_MAX / sizeof(uint16_t)) {
+    return false;
+  }
+  filter->Fingerprints =
+      (uint16_t *)calloc((size_t)filter->ArrayLength, sizeof(uint16_t));
+  return filter->Fingerprints != NULL;
+}
+
+// Construct the filter, returns true on success, false on failure.
+// The algorithm fails when there is insufficient memory: it needs about 37
+// bytes per key on top of the keys (and the filter).
+// The caller is responsable for calling binary_fuse16_large_allocate(size,filter)
+// before. For best performance, the caller should ensure that there are not too
+// many duplicated keys. Below 2^32 keys, the filter is the one binary_fuse16_populate
+// builds.
+static inline bool binary_fuse16_large_populate(uint64_t *keys, uint64_t size,
+                                               binary_fuse16_large_t *filter) {
+  if (size != filter->Size) {
+    return false;
+  }
+  uint64_t capacity = filter->ArrayLength;
+  if (size >= SIZE_MAX / sizeof(uint64_t) || capacity > SIZE_MAX / sizeof(uint64_t)) {
+    return false;
+  }
+
+  uint64_t rng_counter = 0x726b2b9d438b9d4d;
+  filter->Seed = binary_fuse_rng_splitmix64(&rng_counter);
+  uint64_t *reverseOrder = (uint64_t *)calloc((size_t)(size + 1), sizeof(uint64_t));
+  uint64_t *alone = (uint64_t *)malloc((size_t)capacity * sizeof(uint64_t));
+  uint8_t *t2count = (uint8_t *)calloc((size_t)capacity, sizeof(uint8_t));
+  uint8_t *reverseH = (uint8_t *)malloc((size_t)size * sizeof(uint8_t));
+  uint64_t *t2hash = (uint64_t *)calloc((size_t)capacity, sizeof(uint64_t));
+
+  uint32_t blockBits = 1;
+  while (((uint64_t)1 << blockBits) < filter->SegmentCount) {
+    blockBits += 1;
+  }
+  uint64_t block = ((uint64_t)1 << blockBits);
+  uint64_t *startPos = (uint64_t *)malloc((size_t)block * sizeof(uint64_t));
+  uint64_t h012[5];
+  uint64_t hashes[BINARY_FUSE_HASH_BLOCK];
+
+  if ((alone == NULL) || (t2count == NULL) || (reverseH == NULL) ||
+      (t2hash == NULL) || (reverseOrder == NULL) || (startPos == NULL)) {
+    free(alone);
+    free(t2count);
+    free(reverseH);
+    free(t2hash);
+    free(reverseOrder);
+    free(startPos);
+    return false;
+  }
+  reverseOrder[size] = 1;
+  for (int loop = 0; true; ++loop) {
+    if (loop + 1 > XOR_MAX_ITERATIONS) {
+      // The probability of this happening is lower than the
+      // the cosmic-ray probability (i.e., a cosmic ray corrupts your system).
+      free(alone);
+      free(t2count);
+      free(reverseH);
+      free(t2hash);
+      free(reverseOrder);
+      free(startPos);
+      return false;
+    }
+
+    for (uint64_t i = 0; i < block; i++) {
+      // i < 2^blockBits and size < 2^47 (the memory of the construction), so
+      // that i * size fits
+      startPos[i] = (i * size) >> blockBits;
+    }
+
+    uint64_t maskblock = block - 1;
+    for (uint64_t start = 0; start < size; start += BINARY_FUSE_HASH_BLOCK) {
+      size_t n = size - start < BINARY_FUSE_HASH_BLOCK ? (size_t)(size - start) : BINARY_FUSE_HASH_BLOCK;
+      binary_fuse_hash_keys(keys + start, n, filter->Seed, hashes);
+      for (size_t i = 0; i < n; i++) {
+        uint64_t hash = hashes[i];
+        uint64_t segment_index = hash >> (64 - blockBits);
+        while (reverseOrder[startPos[segment_index]] != 0) {
+          segment_index++;
+          segment_index &= maskblock;
+        }
+        reverseOrder[startPos[segment_index]] = hash;
+        startPos[segment_index]++;
+      }
+    }
+    int error = 0;
+    uint64_t duplicates = 0;
+    for (uint64_t i = 0; i < size; i++) {
+      uint64_t hash = reverseOrder[i];
+      uint64_t h0 = binary_fuse16_large_hash(0, hash, filter);
+      t2count[h0] += 4;
+      t2hash[h0] ^= hash;
+      uint64_t h1= binary_fuse16_large_hash(1, hash, filter);
+      t2count[h1] += 4;
+      t2count[h1] ^= 1U;
+      t2hash[h1] ^= hash;
+      uint64_t h2 = binary_fuse16_large_hash(2, hash, filter);
+      t2count[h2] += 4;
+      t2hash[h2] ^= hash;
+      t2count[h2] ^= 2U;
+      if ((t2hash[h0] & t2hash[h1] & t2hash[h2]) == 0) {
+        if   (((t2hash[h0] == 0) && (t2count[h0] == 8))
+          ||  ((t2hash[h1] == 0) && (t2count[h1] == 8))
+          ||  ((t2hash[h2] == 0) && (t2count[h2] == 8))) {
+          duplicates += 1;
+          t2count[h0] -= 4;
+          t2hash[h0] ^= hash;
+          t2count[h1] -= 4;
+          t2count[h1] ^= 1U;
+          t2hash[h1] ^= hash;
+          t2count[h2] -= 4;
+          t2count[h2] ^= 2U;
+          t2hash[h2] ^= hash;
+        }
+      }
+      error = (t2count[h0] < 4) ? 1 : error;
+      error = (t2count[h1] < 4) ? 1 : error;
+      error = (t2count[h2] < 4) ? 1 : error;
+    }
+    if(error) {
+      if(duplicates > 0) {
+        // many copies of a key can overflow a counter before they are detected
+        size = binary_fuse_sort_and_remove_dup(keys, (size_t)size);
+      }
+      memset(reverseOrder, 0, sizeof(uint64_t) * (size_t)size);
+      memset(t2count, 0, sizeof(uint8_t) * (size_t)capacity);
+      memset(t2hash, 0, sizeof(uint64_t) * (size_t)capacity);
+      filter->Seed = binary_fuse_rng_splitmix64(&rng_counter);
+      continue;
+    }
+
+    // End of key addition
+    uint64_t Qsize = 0;
+    // Add sets with one key to the queue.
+    for (uint64_t i = 0; i < capacity; i++) {
+      alone[Qsize] = i;
+      Qsize += ((t2count[i] >> 2U) == 1) ? 1U : 0U;
+    }
+    uint64_t stacksize = 0;
+    while (Qsize > 0) {
+      Qsize--;
+      uint64_t index = alone[Qsize];
+      if ((t2count[index] >> 2U) == 1) {
+        uint64_t hash = t2hash[index];
+
+        //h012[0] = binary_fuse16_large_hash(0, hash, filter);
+        h012[1] = binary_fuse16_large_hash(1, hash, filter);
+        h012[2] = binary_fuse16_large_hash(2, hash, filter);
+        h012[3] = binary_fuse16_large_hash(0, hash, filter); // == h012[0];
+        h012[4] = h012[1];
+        uint8_t found = t2count[index] & 3U;
+        reverseH[stacksize] = found;
+        reverseOrder[stacksize] = hash;
+        stacksize++;
+        uint64_t other_index1 = h012[found + 1];
+        alone[Qsize] = other_index1;
+        Qsize += ((t2count[other_index1] >> 2U) == 2 ? 1U : 0U);
+
+        t2count[other_index1] -= 4;
+        t2count[other_index1] ^= binary_fuse_mod3(found + 1);
+        t2hash[other_index1] ^= hash;
+
+        uint64_t other_index2 = h012[found + 2];
+        alone[Qsize] = other_index2;
+        Qsize += ((t2count[other_index2] >> 2U) == 2 ? 1U : 0U);
+        t2count[other_index2] -= 4;
+        t2count[other_index2] ^= binary_fuse_mod3(found + 2);
+        t2hash[other_index2] ^= hash;
+      }
+    }
+    if (stacksize + duplicates == size) {
+      // success
+      size = stacksize;
+      break;
+    }
+    if(duplicates > 0) {
+      size = binary_fuse_sort_and_remove_dup(keys, (size_t)size);
+    }
+    memset(reverseOrder, 0, sizeof(uint64_t) * (size_t)size);
+    memset(t2count, 0, sizeof(uint8_t) * (size_t)capacity);
+    memset(t2hash, 0, sizeof(uint64_t) * (size_t)capacity);
+    filter->Seed = binary_fuse_rng_splitmix64(&rng_counter);
+  }
+
+  for (uint64_t i = size - 1; i < size; i--) {
+    // the hash of the key we insert next
+    uint64_t hash = reverseOrder[i];
+    uint16_t xor2 = binary_fuse16_fingerprint(hash);
+    uint8_t found = reverseH[i];
+    h012[0] = binary_fuse16_large_hash(0, hash, filter);
+    h012[1] = binary_fuse16_large_hash(1, hash, filter);
+    h012[2] = binary_fuse16_large_hash(2, hash, filter);
+    h012[3] = h012[0];
+    h012[4] = h012[1];
+    filter->Fingerprints[h012[found]] = (uint16_t)(
+        (uint32_t)xor2 ^
+        (uint32_t)filter->Fingerprints[h012[found + 1]] ^
+        (uint32_t)filter->Fingerprints[h012[found + 2]]);
+  }
+  free(alone);
+  free(t2count);
+  free(reverseH);
+  free(t2hash);
+  free(reverseOrder);
+  free(startPos);
+  return true;
+}
+
+static inline size_t binary_fuse16_large_serialization_bytes(const binary_fuse16_large_t *filter) {
+  return sizeof(filter->Seed) + sizeof(filter->Size) + sizeof(filter->SegmentLength) +
+        sizeof(filter->SegmentCount) +
+        sizeof(filter->SegmentCountLength) + sizeof(filter->ArrayLength) +
+        sizeof(uint16_t) * (size_t)filter->ArrayLength;
+}
+
+// serialize a filter to a buffer, the buffer should have a capacity of at least
+// binary_fuse16_large_serialization_bytes(filter) bytes.
+// Native endianess only.
+static inline void binary_fuse16_large_serialize(const binary_fuse16_large_t *filter,
+                                                char *buffer) {
+  memcpy(buffer, &filter->Seed, sizeof(filter->Seed));
+  buffer += sizeof(filter->Seed);
+  memcpy(buffer, &filter->Size, sizeof(filter->Size));
+  buffer += sizeof(filter->Size);
+  uint32_t segment_length = binary_fuse_tag_mixer(filter->SegmentLength);
+  memcpy(buffer, &segment_length, sizeof(segment_length));
+  buffer += sizeof(filter->SegmentLength);
+  memcpy(buffer, &filter->SegmentCount, sizeof(filter->SegmentCount));
+  buffer += sizeof(filter->SegmentCount);
+  memcpy(buffer, &filter->SegmentCountLength, sizeof(filter->SegmentCountLength));
+  buffer += sizeof(filter->SegmentCountLength);
+  memcpy(buffer, &filter->ArrayLength, sizeof(filter->ArrayLength));
+  buffer += sizeof(filter->ArrayLength);
+  memcpy(buffer, filter->Fingerprints, sizeof(uint16_t) * (size_t)filter->ArrayLength);
+}
+
+// deserialize a filter from a buffer, returns true on success, false on failure.
+// The output will be reallocated, so the caller should call binary_fuse16_large_free(filter)
+// before if the filter was already allocated. The caller needs to call
+// binary_fuse16_large_free(filter) after.
+// The number of bytes read is binary_fuse16_large_serialization_bytes(output).
+// Native endianess only.
+static inline bool binary_fuse16_large_deserialize(binary_fuse16_large_t *filter,
+                                                  const char *buffer) {
+  memcpy(&filter->Seed, buffer, sizeof(filter->Seed));
+  buffer += sizeof(filter->Seed);
+  memcpy(&filter->Size, buffer, sizeof(filter->Size));
+  buffer += sizeof(filter->Size);
+  memcpy(&filter->SegmentLength, buffer, sizeof(filter->SegmentLength));
+  buffer += sizeof(filter->SegmentLength);
+  filter->Fingerprints = NULL;
+  if (!binary_fuse_untag_mixer(&filter->SegmentLength)) {
+    return false;
+  }
+  filter->SegmentLengthMask = filter->SegmentLength - 1;
+  memcpy(&filter->SegmentCount, buffer, sizeof(filter->SegmentCount));
+  buffer += sizeof(filter->SegmentCount);
+  memcpy(&filter->SegmentCountLength, buffer, sizeof(filter->SegmentCountLength));
+  buffer += sizeof(filter->SegmentCountLength);
+  memcpy(&filter->ArrayLength, buffer, sizeof(filter->ArrayLength));
+  buffer += sizeof(filter->ArrayLength);
+  if (filter->ArrayLength > SIZE_MAX / sizeof(uint16_t)) {
+    return false;
+  }
+  filter->Fingerprints = (uint16_t *)malloc(sizeof(uint16_t) * (size_t)filter->ArrayLength);
+  if(filter->Fingerprints == NULL) {
+    return false;
+  }
+  memcpy(filter->Fingerprints, buffer, sizeof(uint16_t) * (size_t)filter->ArrayLength);
+  return true;
+}
+
+//////////////////
+// binary fuse maps
+//////////////////
+
+/**
+ * A binary fuse map stores a value of 1 to 20 bits for each key of a set
+ * (a static function, or retrieval structure), in about 1.125 times the value
+ * width per key for large sets. binary_fuse_map_get returns the value of a key
+ * of the set with three loads; it returns an arbitrary value for any other key,
+ * the map does not remember which keys it holds. The slots are bit-packed as
+ * in binary_fuse_bitpacked_t.
+ ***/
+
+#define BINARY_FUSE_MAP_MAX_BITS 20
+
+typedef struct binary_fuse_map_s {
+  uint64_t Seed;
+  uint32_t Size;
+  uint32_t SegmentLength;
+  uint32_t SegmentLengthMask;
+  uint32_t SegmentCount;
+  uint32_t SegmentCountLength;
+  uint32_t ArrayLength;
+  uint32_t Bits;
+  uint32_t ValueMask; // (1 << Bits) - 1
+  uint8_t *Values;    // ArrayLength slots of Bits bits, then the padding
+} binary_fuse_map_t;
+
+// bytes used by the slots of the map, without the padding
+static inline size_t binary_fuse_map_array_bytes(const binary_fuse_map_t *map) {
+  return ((size_t)map->ArrayLength * map->Bits + 7) / 8;
+}
+
+// Returns the content of slot 'index'.
+static inline uint32_t binary_fuse_map_slot(const binary_fuse_map_t *map, uint32_t index) {
+  uint64_t bit = (uint64_t)index * map->Bits;
+  uint32_t word;
+  memcpy(&word, map->Values + (bit >> 3U), sizeof(word));
+  return (word >> (bit & 7U)) & map->ValueMask;
+}
+
+// Stores 'value' (which must fit in Bits bits) in slot 'index'.
+static inline void binary_fuse_map_set_slot(binary_fuse_map_t *map, uint32_t index,
+                                            uint32_t value) {
+  uint64_t bit = (uint64_t)index * map->Bits;
+  uint32_t word;
+  memcpy(&word, map->Values + (bit >> 3U), sizeof(word));
+  word &= ~(map->ValueMask << (bit & 7U));
+  word |= value << (bit & 7U);
+  memcpy(map->Values + (bit >> 3U), &word, sizeof(word));
+}
+
+static inline binary_hashes_t binary_fuse_map_hash_batch(uint64_t hash,
+                                        const binary_fuse_map_t *map) {
+  uint64_t hi = binary_fuse_mulhi(hash, map->SegmentCountLength);
+  binary_hashes_t ans;
+  ans.h0 = (uint32_t)hi;
+  ans.h1 = ans.h0 + map->SegmentLength;
+  ans.h2 = ans.h1 + map->SegmentLength;
+  ans.h1 ^= (uint32_t)(hash >> 18U) & map->SegmentLengthMask;
+  ans.h2 ^= (uint32_t)(hash)&map->SegmentLengthMask;
+  return ans;
+}
+
+static inline uint32_t binary_fuse_map_hash(uint64_t index, uint64_t hash,
+                                        const binary_fuse_map_t *map) {
+    uint64_t h = binary_fuse_mulhi(hash, map->SegmentCountLength);
+    h += index * map->SegmentLength;
+    // keep the lower 36 bits
+    uint64_t hh = hash & ((1ULL << 36U) - 1);
+    // index 0: right shift by 36; index 1: right shift by 18; index 2: no shift
+    h ^= (size_t)((hh >> (36 - 18 * index)) & map->SegmentLengthMask);
+    return (uint32_t)h;
+}
+
+// Returns the value of the key, which must be one of the keys given to
+// binary_fuse_map_populate; for any other key, the result is arbitrary.
+static inline uint32_t binary_fuse_map_get(uint64_t key, const binary_fuse_map_t *map) {
+  uint64_t hash = binary_fuse_mix_split(key, map->Seed);
+  binary_hashes_t hashes = binary_fuse_map_hash_batch(hash, map);
+  return binary_fuse_map_slot(map, hashes.h0) ^ binary_fuse_map_slot(map, hashes.h1) ^
+         binary_fuse_map_slot(map, hashes.h2);
+}
+
+// A lookup split in two phases, see binary_fuse8_probe_prepare.
+typedef struct binary_fuse_map_probe_s {
+  binary_hashes_t hashes;
+} binary_fuse_map_probe_t;
+
+// First phase of a lookup: hash the key, compute its three locations, and
+// prefetch them. See binary_fuse8_probe_prepare.
+static inline void binary_fuse_map_probe_prepare(uint64_t key, const binary_fuse_map_t *map,
+                                                 binary_fuse_map_probe_t *probe) {
+  uint64_t hash = binary_fuse_mix_split(key, map->Seed);
+  probe->hashes = binary_fuse_map_hash_batch(hash, map);
+  binary_fuse_prefetch(map->Values + (((uint64_t)probe->hashes.h0 * map->Bits) >> 3U));
+  binary_fuse_prefetch(map->Values + (((uint64_t)probe->hashes.h1 * map->Bits) >> 3U));
+  binary_fuse_prefetch(map->Values + (((uint64_t)probe->hashes.h2 * map->Bits) >> 3U));
+}
+
+// Second phase of a lookup: returns the value of the key given to
+// binary_fuse_map_probe_prepare, as binary_fuse_map_get.
+static inline uint32_t binary_fuse_map_probe_finish(const binary_fuse_map_probe_t *probe,
+                                                    const binary_fuse_map_t *map) {
+  return binary_fuse_map_slot(map, probe->hashes.h0) ^
+         binary_fuse_map_slot(map, probe->hashes.h1) ^
+         binary_fuse_map_slot(map, probe->hashes.h2);
+}
+
+// Write the value of each of the 'count' keys: out[i] is
+// binary_fuse_map_get(keys[i], map). As in binary_fuse8_contain_batch_scalar,
+// the keys are hashed a few positions ahead and their slots prefetched.
+static inline void binary_fuse_map_get_batch(const uint64_t *keys, size_t count, uint32_t *out,
+                                             const binary_fuse_map_t *map) {
+  binary_fuse_map_probe_t probes[BINARY_FUSE_BATCH_WINDOW];
+  const size_t mask = BINARY_FUSE_BATCH_WINDOW - 1;
+  size_t ahead = count < BINARY_FUSE_BATCH_WINDOW ? count : BINARY_FUSE_BATCH_WINDOW;
+  for (size_t i = 0; i < ahead; i++) {
+    binary_fuse_map_probe_prepare(keys[i], map, &probes[i]);
+  }
+  for (size_t i = 0; i < count; i++) {
+    size_t slot = i & mask;
+    out[i] = binary_fuse_map_probe_finish(&probes[slot], map);
+    if (i + BINARY_FUSE_BATCH_WINDOW < count) {
+      binary_fuse_map_probe_prepare(keys[i + BINARY_FUSE_BATCH_WINDOW], map, &probes[slot]);
+    }
+  }
+}
+
+// allocate enough capacity for up to 'size' keys, with values of 'bits' bits
+// (1 to BINARY_FUSE_MAP_MAX_BITS, otherwise the allocation fails)
+// caller is responsible to call binary_fuse_map_free(map)
+// size should be at least 2.
+static inline bool binary_fuse_map_allocate(uint32_t size, uint32_t bits,
+                                            binary_fuse_map_t *map) {
+  map->Values = NULL;
+  if (bits < 1 || bits > BINARY_FUSE_MAP_MAX_BITS) {
+    return false;
+  }
+  uint32_t arity = 3;
+  map->Size = size;
+  map->Bits = bits;
+  map->ValueMask = (UINT32_C(1) << bits) - 1;
+  map->SegmentLength = size == 0 ? 4 : binary_fuse_calculate_segment_length(arity, size);
+  if (map->SegmentLength > 262144) {
+    map->SegmentLength = 262144;
+  }
+  map->SegmentLengthMask = map->SegmentLength - 1;
+  double sizeFactor = size <= 1 ? 0 : binary_fuse_calculate_size_factor(arity, size);
+  uint32_t capacity = size <= 1 ? 0 : (uint32_t)(round((double)size * sizeFactor));
+  uint32_t initSegmentCount =
+      (capacity + map->SegmentLength - 1) / map->SegmentLength -
+      (arity - 1);
+  map->ArrayLength = (initSegmentCount + arity - 1) * map->SegmentLength;
+  map->SegmentCount =
+      (map->ArrayLength + map->SegmentLength - 1) / map->SegmentLength;
+  if (map->SegmentCount <= arity - 1) {
+    map->SegmentCount = 1;
+  } else {
+    map->SegmentCount = map->SegmentCount - (arity - 1);
+  }
+  map->ArrayLength =
+      (map->SegmentCount + arity - 1) * map->SegmentLength;
+  map->SegmentCountLength = map->SegmentCount * map->SegmentLength;
+  map->Values = (uint8_t *)calloc(
+      binary_fuse_map_array_bytes(map) + BINARY_FUSE_BITPACKED_PADDING, 1);
+  return map->Values != NULL;
+}
+
+// report memory usage
+static inline size_t binary_fuse_map_size_in_bytes(const binary_fuse_map_t *map) {
+  return binary_fuse_map_array_bytes(map) + BINARY_FUSE_BITPACKED_PADDING +
+         sizeof(binary_fuse_map_t);
+}
+
+// release memory
+static inline void binary_fuse_map_free(binary_fuse_map_t *map) {
+  free(map->Values);
+  map->Values = NULL;
+  map->Seed = 0;
+  map->Size = 0;
+  map->SegmentLength = 0;
+  map->SegmentLengthMask = 0;
+  map->SegmentCount = 0;
+  map->SegmentCountLength = 0;
+  map->ArrayLength = 0;
+  map->Bits = 0;
+  map->ValueMask = 0;
+}
+
+/**
+ * When the values change but the keys do not, the hashing and the peeling of
+ * binary_fuse_map_populate can be skipped: its construction plan records, in
+ * the order of the assignment, the index of each key and which of its three
+ * locations it was peeled from (4.25 bytes per key), and
+ * binary_fuse_map_replay rebuilds the values from it in one pass.
+ ***/
+
+typedef struct binary_fuse_map_plan_s {
+  uint64_t Seed;        // the Seed of the map
+  uint32_t Size;        // the number of keys given to binary_fuse_map_populate_plan
+  uint32_t ArrayLength; // the ArrayLength of the map
+  uint32_t Length;      // the number of distinct keys, the steps of the assignment
+  uint32_t *Order;      // Order[i] is the index of the key assigned at step i
+  uint8_t *Found;       // 2 bits per step: the location of the key, 0, 1 or 2
+} binary_fuse_map_plan_t;
+
+static inline uint32_t binary_fuse_map_plan_found(const binary_fuse_map_plan_t *plan,
+                                                  uint32_t step) {
+  return (uint32_t)(plan->Found[step / 4] >> (2 * (step % 4))) & 3U;
+}
+
+// report memory usage
+static inline size_t binary_fuse_map_plan_size_in_bytes(const binary_fuse_map_plan_t *plan) {
+  return plan->Length * sizeof(uint32_t) + (plan->Length + 3) / 4 +
+         sizeof(binary_fuse_map_plan_t);
+}
+
+// release memory
+static inline void binary_fuse_map_plan_free(binary_fuse_map_plan_t *plan) {
+  free(plan->Order);
+  free(plan->Found);
+  plan->Order = NULL;
+  plan->Found = NULL;
+  plan->Seed = 0;
+  plan->Size = 0;
+  plan->ArrayLength = 0;
+  plan->Length = 0;
+}
+
+// Construct the map like binary_fuse_map_populate and, when 'plan' is not
+// NULL, record its construction plan for binary_fuse_map_replay. The caller
+// is responsible for calling binary_fuse_map_plan_free(plan) after.
+// Returns true on success, false on failure.
+static inline bool binary_fuse_map_populate_plan(const uint64_t *keys, const uint32_t *values,
+                                                 uint32_t size, binary_fuse_map_t *map,
+                                                 binary_fuse_map_plan_t *plan) {
+  if (plan != NULL) {
+    plan->Order = NULL;
+    plan->Found = NULL;
+    binary_fuse_map_plan_free(plan);
+  }
+  if (size != map->Size) {
+    return false;
+  }
+
+  uint64_t rng_counter = 0x726b2b9d438b9d4d;
+  map->Seed = binary_fuse_rng_splitmix64(&rng_counter);
+  uint64_t *reverseOrder = (uint64_t *)calloc((size + 1), sizeof(uint64_t));
+  // reverseIndex[i] is the index of the key of reverseOrder[i]
+  uint32_t *reverseIndex = (uint32_t *)malloc((size + 1) * sizeof(uint32_t));
+  uint32_t capacity = map->ArrayLength;
+  uint32_t *alone = (uint32_t *)malloc(capacity * sizeof(uint32_t));
+  uint8_t *t2count = (uint8_t *)calloc(capacity, sizeof(uint8_t));
+  uint8_t *reverseH = (uint8_t *)malloc(size * sizeof(uint8_t));
+  uint64_t *t2hash = (uint64_t *)calloc(capacity, sizeof(uint64_t));
+  uint32_t *t2index = (uint32_t *)calloc(capacity, sizeof(uint32_t));
+
+  uint32_t blockBits = 1;
+  while (((uint32_t)1 << blockBits) < map->SegmentCount) {
+    blockBits += 1;
+  }
+  uint32_t block = ((uint32_t)1 << blockBits);
+  uint32_t *startPos = (uint32_t *)malloc((1U << blockBits) * sizeof(uint32_t));
+  uint32_t h012[5];
+  uint64_t hashes[BINARY_FUSE_HASH_BLOCK];
+  bool ok = (alone != NULL) && (t2count != NULL) && (reverseH != NULL) &&
+            (t2hash != NULL) && (t2index != NULL) && (reverseOrder != NULL) &&
+            (reverseIndex != NULL) && (startPos != NULL);
+
+  if (ok) {
+    reverseOrder[size] = 1;
+  }
+  for (int loop = 0; ok; ++loop) {
+    if (loop + 1 > XOR_MAX_ITERATIONS) {
+      ok = false;
+      break;
+    }
+
+    for (uint32_t i = 0; i < block; i++) {
+      // important : i * size would overflow as a 32-bit number in some
+      // cases.
+      startPos[i] = (uint32_t)(((uint64_t)i * size) >> blockBits);
+    }
+
+    uint64_t maskblock = block - 1;
+    for (uint32_t start = 0; start < size; start += BINARY_FUSE_HASH_BLOCK) {
+      uint32_t n = size - start < BINARY_FUSE_HASH_BLOCK ? size - start : BINARY_FUSE_HASH_BLOCK;
+      binary_fuse_hash_keys(keys + start, n, map->Seed, hashes);
+      for (uint32_t i = 0; i < n; i++) {
+        uint64_t hash = hashes[i];
+        uint64_t segment_index = hash >> (64 - blockBits);
+        while (reverseOrder[startPos[segment_index]] != 0) {
+          segment_index++;
+          segment_index &= maskblock;
+        }
+        reverseOrder[startPos[segment_index]] = hash;
+        reverseIndex[startPos[segment_index]] = start + i;
+        startPos[segment_index]++;
+      }
+    }
+    int error = 0;
+    uint32_t duplicates = 0;
+    for (uint32_t i = 0; i < size && ok; i++) {
+      uint64_t hash = reverseOrder[i];
+      uint32_t key_index = reverseIndex[i];
+      for (uint32_t k = 0; k < 3; k++) {
+        h012[k] = binary_fuse_map_hash(k, hash, map);
+        t2count[h012[k]] += 4;
+        t2count[h012[k]] ^= (uint8_t)k;
+        t2hash[h012[k]] ^= hash;
+        t2index[h012[k]] ^= key_index;
+      }
+      if ((t2hash[h012[0]] & t2hash[h012[1]] & t2hash[h012[2]]) == 0) {
+        for (uint32_t k = 0; k < 3; k++) {
+          if ((t2hash[h012[k]] == 0) && (t2count[h012[k]] == 8)) {
+            // the location holds this key twice
+            uint32_t other = t2index[h012[k]] ^ key_index;
+            ok = ((values[other] ^ values[key_index]) & map->ValueMask) == 0;
+            duplicates += 1;
+            for (uint32_t j = 0; j < 3; j++) {
+              t2count[h012[j]] -= 4;
+              t2count[h012[j]] ^= (uint8_t)j;
+              t2hash[h012[j]] ^= hash;
+              t2index[h012[j]] ^= key_index;
+            }
+            break;
+          }
+        }
+      }
+      for (uint32_t k = 0; k < 3; k++) {
+        error = (t2count[h012[k]] < 4) ? 1 : error;
+      }
+    }
+    if (!ok) {
+      break;
+    }
+    if(error) {
+      memset(reverseOrder, 0, sizeof(uint64_t) * size);
+      memset(t2count, 0, sizeof(uint8_t) * capacity);
+      memset(t2hash, 0, sizeof(uint64_t) * capacity);
+      memset(t2index, 0, sizeof(uint32_t) * capacity);
+      map->Seed = binary_fuse_rng_splitmix64(&rng_counter);
+      continue;
+    }
+
+    // End of key addition
+    uint32_t Qsize = 0;
+    // Add sets with one key to the queue.
+    for (uint32_t i = 0; i < capacity; i++) {
+      alone[Qsize] = i;
+      Qsize += ((t2count[i] >> 2U) == 1) ? 1U : 0U;
+    }
+    uint32_t stacksize = 0;
+    while (Qsize > 0) {
+      Qsize--;
+      uint32_t index = alone[Qsize];
+      if ((t2count[index] >> 2U) == 1) {
+        uint64_t hash = t2hash[index];
+        uint32_t key_index = t2index[index];
+        uint8_t found = t2count[index] & 3U;
+        reverseH[stacksize] = found;
+        reverseOrder[stacksize] = hash;
+        reverseIndex[stacksize] = key_index;
+        stacksize++;
+        for (uint32_t k = 0; k < 3; k++) {
+          if (k == found) {
+            continue;
+          }
+          uint32_t other_index = binary_fuse_map_hash(k, hash, map);
+          alone[Qsize] = other_index;
+          Qsize += ((t2count[other_index] >> 2U) == 2 ? 1U : 0U);
+          t2count[other_index] -= 4;
+          t2count[other_index] ^= (uint8_t)k;
+          t2hash[other_index] ^= hash;
+          t2index[other_index] ^= key_index;
+        }
+      }
+    }
+    if (stacksize + duplicates == size) {
+      // success
+      size = stacksize;
+      break;
+    }
+    memset(reverseOrder, 0, sizeof(uint64_t) * size);
+    memset(t2count, 0, sizeof(uint8_t) * capacity);
+    memset(t2hash, 0, sizeof(uint64_t) * capacity);
+    memset(t2index, 0, sizeof(uint32_t) * capacity);
+    map->Seed = binary_fuse_rng_splitmix64(&rng_counter);
+  }
+
+  for (uint32_t i = size - 1; ok && i < size; i--) {
+    // the hash of the key we insert next
+    uint64_t hash = reverseOrder[i];
+    uint8_t found = reverseH[i];
+    h012[0] = binary_fuse_map_hash(0, hash, map);
+    h012[1] = binary_fuse_map_hash(1, hash, map);
+    h012[2] = binary_fuse_map_hash(2, hash, map);
+    h012[3] = h012[0];
+    h012[4] = h012[1];
+    binary_fuse_map_set_slot(map, h012[found],
+                             (values[reverseIndex[i]] & map->ValueMask) ^
+                                 binary_fuse_map_slot(map, h012[found + 1]) ^
+                                 binary_fuse_map_slot(map, h012[found + 2]));
+  }
+  if (ok && plan != NULL) {
+    plan->Seed = map->Seed;
+    plan->Size = map->Size;
+    plan->ArrayLength = map->ArrayLength;
+    plan->Length = size;
+    plan->Order = (uint32_t *)malloc(((size_t)size + 1) * sizeof(uint32_t));
+    plan->Found = (uint8_t *)calloc((size_t)size / 4 + 1, 1);
+    ok = plan->Order != NULL && plan->Found != NULL;
+    for (uint32_t i = 0; ok && i < size; i++) {
+      // the assignment runs backward in the peeling order
+      plan->Order[i] = reverseIndex[size - 1 - i];
+      plan->Found[i / 4] |= (uint8_t)(reverseH[size - 1 - i] << (2 * (i % 4)));
+    }
+    if (!ok) {
+      binary_fuse_map_plan_free(plan);
+    }
+  }
+  free(alone);
+  free(t2count);
+  free(reverseH);
+  free(t2hash);
+  free(t2index);
+  free(reverseOrder);
+  free(reverseIndex);
+  free(startPos);
+  return ok;
+}
+
+// Construct the map so that binary_fuse_map_get(keys[i], map) returns the low
+// Bits bits of values[i], returns true on success, false on failure.
+// The algorithm fails when there is insufficient memory, or when a key is
+// repeated with different values (a repeated key with the same value is fine).
+// The caller is responsable for calling binary_fuse_map_allocate(size,bits,map)
+// before. The peeling is the one of binary_fuse8_populate; each location also
+// accumulates the xor of the indexes of its keys, so that the key of a peeled
+// location, hence its value, is known.
+static inline bool binary_fuse_map_populate(const uint64_t *keys, const uint32_t *values,
+                                            uint32_t size, binary_fuse_map_t *map) {
+  return binary_fuse_map_populate_plan(keys, values, size, map, NULL);
+}
+
+// Rebuild the map with new values for the keys of binary_fuse_map_populate_plan:
+// afterward binary_fuse_map_get(keys[i], map) returns the low Bits bits of
+// values[i]. The keys must be the same, in the same order, and a repeated key
+// must still have a single value; the values may have another width if the map
+// was allocated for the same size. Only the assignment runs: one hash per key
+// and no temporary memory. Returns false when the map does not match the plan.
+static inline bool binary_fuse_map_replay(const binary_fuse_map_plan_t *plan,
+                                          const uint64_t *keys, const uint32_t *values,
+                                          binary_fuse_map_t *map) {
+  if (plan->Size != map->Size || plan->ArrayLength != map->ArrayLength) {
+    return false;
+  }
+  map->Seed = plan->Seed;
+  uint32_t h012[5];
+  for (uint32_t i = 0; i < plan->Length; i++) {
+    // the keys come in the peeling order, fetch them ahead
+    if (i + BINARY_FUSE_BATCH_WINDOW < plan->Length) {
+      binary_fuse_prefetch(keys + plan->Order[i + BINARY_FUSE_BATCH_WINDOW]);
+      binary_fuse_prefetch(values + plan->Order[i + BINARY_FUSE_BATCH_WINDOW]);
+    }
+    uint32_t key_index = plan->Order[i];
+    uint64_t hash = binary_fuse_mix_split(keys[key_index], map->Seed);
+    uint32_t found = binary_fuse_map_plan_found(plan, i);
+    h012[0] = binary_fuse_map_hash(0, hash, map);
+    h012[1] = binary_fuse_map_hash(1, hash, map);
+    h012[2] = binary_fuse_map_hash(2, hash, map);
+    h012[3] = h012[0];
+    h012[4] = h012[1];
+    binary_fuse_map_set_slot(map, h012[found],
+                             (values[key_index] & map->ValueMask) ^
+                                 binary_fuse_map_slot(map, h012[found + 1]) ^
+                                 binary_fuse_map_slot(map, h012[found + 2]));
+  }
+  return true;
+}
+
+static inline size_t binary_fuse_map_serialization_bytes(const binary_fuse_map_t *map) {
+  return sizeof(map->Seed) + sizeof(map->Size) + sizeof(map->SegmentLength) +
+        sizeof(map->SegmentCount) +
+        sizeof(map->SegmentCountLength) + sizeof(map->ArrayLength) +
+        sizeof(map->Bits) + binary_fuse_map_array_bytes(map);
+}
+
+// serialize a map to a buffer, the buffer should have a capacity of at least
+// binary_fuse_map_serialization_bytes(map) bytes.
+// Native endianess only.
+static inline void binary_fuse_map_serialize(const binary_fuse_map_t *map, char *buffer) {
+  memcpy(buffer, &map->Seed, sizeof(map->Seed));
+  buffer += sizeof(map->Seed);
+  memcpy(buffer, &map->Size, sizeof(map->Size));
+  buffer += sizeof(map->Size);
+  uint32_t segment_length = binary_fuse_tag_mixer(map->SegmentLength);
+  memcpy(buffer, &segment_length, sizeof(segment_length));
+  buffer += sizeof(map->SegmentLength);
+  memcpy(buffer, &map->SegmentCount, sizeof(map->SegmentCount));
+  buffer += sizeof(map->SegmentCount);
+  memcpy(buffer, &map->SegmentCountLength, sizeof(map->SegmentCountLength));
+  buffer += sizeof(map->SegmentCountLength);
+  memcpy(buffer, &map->ArrayLength, sizeof(map->ArrayLength));
+  buffer += sizeof(map->ArrayLength);
+  memcpy(buffer, &map->Bits, sizeof(map->Bits));
+  buffer += sizeof(map->Bits);
+  memcpy(buffer, map->Values, binary_fuse_map_array_bytes(map));
+}
+
+// deserialize a map from a buffer, returns true on success, false on failure
+// (insufficient memory, or a value width out of range).
+// The output will be reallocated, so the caller should call binary_fuse_map_free(map) before
+// if the map was already allocated. The caller needs to call binary_fuse_map_free(map) after.
+// The number of bytes read is binary_fuse_map_serialization_bytes(output).
+// Native endianess only.
+static inline bool binary_fuse_map_deserialize(binary_fuse_map_t *map, const char *buffer) {
+  memcpy(&map->Seed, buffer, sizeof(map->Seed));
+  buffer += sizeof(map->Seed);
+  memcpy(&map->Size, buffer, sizeof(map->Size));
+  buffer += sizeof(map->Size);
+  memcpy(&map->SegmentLength, buffer, sizeof(map->SegmentLength));
+  buffer += sizeof(map->SegmentLength);
+  if (!binary_fuse_untag_mixer(&map->SegmentLength)) {
+    map->Values = NULL;
+    return false;
+  }
+  map->SegmentLengthMask = map->SegmentLength - 1;
+  memcpy(&map->SegmentCount, buffer, sizeof(map->SegmentCount));
+  buffer += sizeof(map->SegmentCount);
+  memcpy(&map->SegmentCountLength, buffer, sizeof(map->SegmentCountLength));
+  buffer += sizeof(map->SegmentCountLength);
+  memcpy(&map->ArrayLength, buffer, sizeof(map->ArrayLength));
+  buffer += sizeof(map->ArrayLength);
+  memcpy(&map->Bits, buffer, sizeof(map->Bits));
+  buffer += sizeof(map->Bits);
+  map->Values = NULL;
+  if (map->Bits < 1 || map->Bits > BINARY_FUSE_MAP_MAX_BITS) {
+    return false;
+  }
+  map->ValueMask = (UINT32_C(1) << map->Bits) - 1;
+  size_t bytes = binary_fuse_map_array_bytes(map);
+  map->Values = (uint8_t *)calloc(bytes + BINARY_FUSE_BITPACKED_PADDING, 1);
+  if(map->Values == NULL) {
+    return false;
+  }
+  memcpy(map->Values, buffer, bytes);
+  return true;
+}
+
+//////////////////
+// minimal perfect hash functions
+//////////////////
+
+/**
+ * The peeling assigns each key its own location among its three: a minimal
+ * perfect hash function maps it to the rank of that location among the
+ * locations in use (BDZ). Each location holds two bits: 3 when no key uses it,
+ * otherwise a value g such that (g[h0] + g[h1] + g[h2]) % 3 is the index of
+ * the location of the key. A free location counts as 0 in this sum, as 3 % 3
+ * is 0. binary_fuse_mphf_get(key) is then the number of locations in use
+ * before it, from a count per 256 locations and a few popcounts.
+ * It uses about 2.4 bits per key for large sets.
+ ***/
+
+// locations per rank entry, 8 words of 32 locations: one cache line
+#define BINARY_FUSE_MPHF_RANK_BLOCK 256
+
+typedef struct binary_fuse_mphf_s {
+  uint64_t Seed;
+  uint32_t Size; // the number of distinct keys, the values are in [0, Size)
+  uint32_t SegmentLength;
+  uint32_t SegmentLengthMask;
+  uint32_t SegmentCount;
+  uint32_t SegmentCountLength;
+  uint32_t ArrayLength;
+  uint32_t WordCount; // a multiple of 8
+  uint64_t *Slots;    // 2 bits per location, 32 locations per word
+  uint32_t *Ranks;    // locations in use before location 256 * i
+} binary_fuse_mphf_t;
+
+// Returns the two bits of location 'index', 3 when it is free.
+static inline uint32_t binary_fuse_mphf_slot(const binary_fuse_mphf_t *mphf, uint32_t index) {
+  return (uint32_t)(mphf->Slots[index / 32] >> (2 * (index % 32))) & 3U;
+}
+
+static inline void binary_fuse_mphf_set_slot(binary_fuse_mphf_t *mphf, uint32_t index,
+                                             uint32_t value) {
+  uint64_t *word = &mphf->Slots[index / 32];
+  *word &= ~(UINT64_C(3) << (2 * (index % 32)));
+  *word |= (uint64_t)value << (2 * (index % 32));
+}
+
+// Returns the number of free locations in the 'n' first ones of the word
+// (n at most 32).
+static inline uint32_t binary_fuse_mphf_free_slots(uint64_t word, uint32_t n) {
+  uint64_t free_slots = word & (word >> 1U) & UINT64_C(0x5555555555555555);
+  if (n < 32) {
+    free_slots &= (UINT64_C(1) << (2 * n)) - 1;
+  }
+  return (uint32_t)binary_fuse_popcount64(free_slots);
+}
+
+// Returns the number of locations in use before location 'index'.
+static inline uint32_t binary_fuse_mphf_rank(const binary_fuse_mphf_t *mphf, uint32_t index) {
+  uint32_t block = index / BINARY_FUSE_MPHF_RANK_BLOCK;
+  uint32_t rank = mphf->Ranks[block];
+  uint32_t last = index / 32;
+  for (uint32_t w = block * (BINARY_FUSE_MPHF_RANK_BLOCK / 32); w < last; w++) {
+    rank += 32 - binary_fuse_mphf_free_slots(mphf->Slots[w], 32);
+  }
+  return rank + index % 32 - binary_fuse_mphf_free_slots(mphf->Slots[last], index % 32);
+}
+
+// Fill the rank entries from the slots.
+static inline void binary_fuse_mphf_build_ranks(binary_fuse_mphf_t *mphf) {
+  uint32_t rank = 0;
+  for (uint32_t w = 0; w < mphf->WordCount; w++) {
+    if (w % (BINARY_FUSE_MPHF_RANK_BLOCK / 32) == 0) {
+      mphf->Ranks[w / (BINARY_FUSE_MPHF_RANK_BLOCK / 32)] = rank;
+    }
+    rank += 32 - binary_fuse_mphf_free_slots(mphf->Slots[w], 32);
+  }
+}
+
+static inline binary_hashes_t binary_fuse_mphf_hash_batch(uint64_t hash,
+                                        const binary_fuse_mphf_t *mphf) {
+  uint64_t hi = binary_fuse_mulhi(hash, mphf->SegmentCountLength);
+  binary_hashes_t ans;
+  ans.h0 = (uint32_t)hi;
+  ans.h1 = ans.h0 + mphf->SegmentLength;
+  ans.h2 = ans.h1 + mphf->SegmentLength;
+  ans.h1 ^= (uint32_t)(hash >> 18U) & mphf->SegmentLengthMask;
+  ans.h2 ^= (uint32_t)(hash)&mphf->SegmentLengthMask;
+  return ans;
+}
+
+static inline uint32_t binary_fuse_mphf_hash(uint64_t index, uint64_t hash,
+                                        const binary_fuse_mphf_t *mphf) {
+    uint64_t h = binary_fuse_mulhi(hash, mphf->SegmentCountLength);
+    h += index * mphf->SegmentLength;
+    // keep the lower 36 bits
+    uint64_t hh = hash & ((1ULL << 36U) - 1);
+    // index 0: right shift by 36; index 1: right shift by 18; index 2: no shift
+    h ^= (size_t)((hh >> (36 - 18 * index)) & mphf->SegmentLengthMask);
+    return (uint32_t)h;
+}
+
+// Returns the location of the key from its three locations.
+static inline uint32_t binary_fuse_mphf_location(const binary_fuse_mphf_t *mphf,
+                                                 binary_hashes_t hashes) {
+  uint32_t sum = binary_fuse_mphf_slot(mphf, hashes.h0) + binary_fuse_mphf_slot(mphf, hashes.h1) +
+                 binary_fuse_mphf_slot(mphf, hashes.h2);
+  switch (sum % 3) {
+  case 0:
+    return hashes.h0;
+  case 1:
+    return hashes.h1;
+  default:
+    return hashes.h2;
+  }
+}
+
+// Returns the value of the key in [0, Size): distinct keys of the set given to
+// binary_fuse_mphf_populate have distinct values. For any other key, the
+// result is an arbitrary value in [0, Size].
+static inline uint32_t binary_fuse_mphf_get(uint64_t key, const binary_fuse_mphf_t *mphf) {
+  uint64_t hash = binary_fuse_mix_split(key, mphf->Seed);
+  return binary_fuse_mphf_rank(mphf, binary_fuse_mphf_location(mphf, binary_fuse_mphf_hash_batch(hash, mphf)));
+}
+
+// A lookup split in two phases, see binary_fuse8_probe_prepare.
+typedef struct binary_fuse_mphf_probe_s {
+  binary_hashes_t hashes;
+} binary_fuse_mphf_probe_t;
+
+// First phase of a lookup: hash the key, compute its three locations, and
+// prefetch them. See binary_fuse8_probe_prepare.
+static inline void binary_fuse_mphf_probe_prepare(uint64_t key, const binary_fuse_mphf_t *mphf,
+                                                  binary_fuse_mphf_probe_t *probe) {
+  uint64_t hash = binary_fuse_mix_split(key, mphf->Seed);
+  probe->hashes = binary_fuse_mphf_hash_batch(hash, mphf);
+  binary_fuse_prefetch(mphf->Slots + probe->hashes.h0 / 32);
+  binary_fuse_prefetch(mphf->Slots + probe->hashes.h1 / 32);
+  binary_fuse_prefetch(mphf->Slots + probe->hashes.h2 / 32);
+}
+
+// Second phase of a lookup: returns the value of the key given to
+// binary_fuse_mphf_probe_prepare, as binary_fuse_mphf_get. The words of the
+// rank are in the cache line of the location of the key.
+static inline uint32_t binary_fuse_mphf_probe_finish(const binary_fuse_mphf_probe_t *probe,
+                                                     const binary_fuse_mphf_t *mphf) {
+  return binary_fuse_mphf_rank(mphf, binary_fuse_mphf_location(mphf, probe->hashes));
+}
+
+// Write the value of each of the 'count' keys: out[i] is
+// binary_fuse_mphf_get(keys[i], mphf). As in binary_fuse8_contain_batch_scalar,
+// the keys are hashed a few positions ahead and their locations prefetched.
+static inline void binary_fuse_mphf_get_batch(const uint64_t *keys, size_t count, uint32_t *out,
+                                              const binary_fuse_mphf_t *mphf) {
+  binary_fuse_mphf_probe_t probes[BINARY_FUSE_BATCH_WINDOW];
+  const size_t mask = BINARY_FUSE_BATCH_WINDOW - 1;
+  size_t ahead = count < BINARY_FUSE_BATCH_WINDOW ? count : BINARY_FUSE_BATCH_WINDOW;
+  for (size_t i = 0; i < ahead; i++) {
+    binary_fuse_mphf_probe_prepare(keys[i], mphf, &probes[i]);
+  }
+  for (size_t i = 0; i < count; i++) {
+    size_t slot = i & mask;
+    out[i] = binary_fuse_mphf_probe_finish(&probes[slot], mphf);
+    if (i + BINARY_FUSE_BATCH_WINDOW < count) {
+      binary_fuse_mphf_probe_prepare(keys[i + BINARY_FUSE_BATCH_WINDOW], mphf, &probes[slot]);
+    }
+  }
+}
+
+// Allocate the slots and the rank entries once ArrayLength is set.
+static inline bool binary_fuse_mphf_allocate_slots(binary_fuse_mphf_t *mphf) {
+  uint32_t blocks =
+      (mphf->ArrayLength + BINARY_FUSE_MPHF_RANK_BLOCK - 1) / BINARY_FUSE_MPHF_RANK_BLOCK;
+  mphf->WordCount = blocks * (BINARY_FUSE_MPHF_RANK_BLOCK / 32);
+  mphf->Slots = (uint64_t *)malloc(mphf->WordCount * sizeof(uint64_t));
+  mphf->Ranks = (uint32_t *)malloc(blocks * sizeof(uint32_t));
+  if (mphf->Slots == NULL || mphf->Ranks == NULL) {
+    free(mphf->Slots);
+    free(mphf->Ranks);
+    mphf->Slots = NULL;
+    mphf->Ranks = NULL;
+    return false;
+  }
+  memset(mphf->Slots, 0xFF, mphf->WordCount * sizeof(uint64_t));
+  binary_fuse_mphf_build_ranks(mphf);
+  return true;
+}
+
+// allocate enough capacity for a set containing up to 'size' elements
+// caller is responsible to call binary_fuse_mphf_free(mphf)
+// size should be at least 2.
+static inline bool binary_fuse_mphf_allocate(uint32_t size, binary_fuse_mphf_t *mphf) {
+  uint32_t arity = 3;
+  mphf->Size = size;
+  mphf->SegmentLength = size == 0 ? 4 : binary_fuse_calculate_segment_length(arity, size);
+  if (mphf->SegmentLength > 262144) {
+    mphf->SegmentLength = 262144;
+  }
+  mphf->SegmentLengthMask = mphf->SegmentLength - 1;
+  double sizeFactor = size <= 1 ? 0 : binary_fuse_calculate_size_factor(arity, size);
+  uint32_t capacity = size <= 1 ? 0 : (uint32_t)(round((double)size * sizeFactor));
+  uint32_t initSegmentCount =
+      (capacity + mphf->SegmentLength - 1) / mphf->SegmentLength -
+      (arity - 1);
+  mphf->ArrayLength = (initSegmentCount + arity - 1) * mphf->SegmentLength;
+  mphf->SegmentCount =
+      (mphf->ArrayLength + mphf->SegmentLength - 1) / mphf->SegmentLength;
+  if (mphf->SegmentCount <= arity - 1) {
+    mphf->SegmentCount = 1;
+  } else {
+    mphf->SegmentCount = mphf->SegmentCount - (arity - 1);
+  }
+  mphf->ArrayLength =
+      (mphf->SegmentCount + arity - 1) * mphf->SegmentLength;
+  mphf->SegmentCountLength = mphf->SegmentCount * mphf->SegmentLength;
+  return binary_fuse_mphf_allocate_slots(mphf);
+}
+
+// report memory usage
+static inline size_t binary_fuse_mphf_size_in_bytes(const binary_fuse_mphf_t *mphf) {
+  return mphf->WordCount * sizeof(uint64_t) +
+         mphf->WordCount / (BINARY_FUSE_MPHF_RANK_BLOCK / 32) * sizeof(uint32_t) +
+         sizeof(binary_fuse_mphf_t);
+}
+
+// release memory
+static inline void binary_fuse_mphf_free(binary_fuse_mphf_t *mphf) {
+  free(mphf->Slots);
+  free(mphf->Ranks);
+  mphf->Slots = NULL;
+  mphf->Ranks = NULL;
+  mphf->Seed = 0;
+  mphf->Size = 0;
+  mphf->SegmentLength = 0;
+  mphf->SegmentLengthMask = 0;
+  mphf->SegmentCount = 0;
+  mphf->SegmentCountLength = 0;
+  mphf->ArrayLength = 0;
+  mphf->WordCount = 0;
+}
+
+// Construct the function, returns true on success, false on failure.
+// The algorithm fails when there is insufficient memory.
+// The caller is responsable for calling binary_fuse_mphf_allocate(size,mphf)
+// before. Repeated keys are allowed: they get the same value, and Size becomes
+// the number of distinct keys.
+static inline bool binary_fuse_mphf_populate(uint64_t *keys, uint32_t size,
+                                             binary_fuse_mphf_t *mphf) {
+  if (size != mphf->Size) {
+    return false;
+  }
+
+  uint64_t rng_counter = 0x726b2b9d438b9d4d;
+  mphf->Seed = binary_fuse_rng_splitmix64(&rng_counter);
+  uint64_t *reverseOrder = (uint64_t *)calloc((size + 1), sizeof(uint64_t));
+  uint32_t capacity = mphf->ArrayLength;
+  uint32_t *alone = (uint32_t *)malloc(capacity * sizeof(uint32_t));
+  uint8_t *t2count = (uint8_t *)calloc(capacity, sizeof(uint8_t));
+  uint8_t *reverseH = (uint8_t *)malloc(size * sizeof(uint8_t));
+  uint64_t *t2hash = (uint64_t *)calloc(capacity, sizeof(uint64_t));
+
+  uint32_t blockBits = 1;
+  while (((uint32_t)1 << blockBits) < mphf->SegmentCount) {
+    blockBits += 1;
+  }
+  uint32_t block = ((uint32_t)1 << blockBits);
+  uint32_t *startPos = (uint32_t *)malloc((1U << blockBits) * sizeof(uint32_t));
+  uint32_t h012[5];
+  uint64_t hashes[BINARY_FUSE_HASH_BLOCK];
+
+  if ((alone == NULL) || (t2count == NULL) || (reverseH == NULL) ||
+      (t2hash == NULL) || (reverseOrder == NULL) || (startPos == NULL)) {
+    free(alone);
+    free(t2count);
+    free(reverseH);
+    free(t2hash);
+    free(reverseOrder);
+    free(startPos);
+    return false;
+  }
+  reverseOrder[size] = 1;
+  for (int loop = 0; true; ++loop) {
+    if (loop + 1 > XOR_MAX_ITERATIONS) {
+      // The probability of this happening is lower than the
+      // the cosmic-ray probability (i.e., a cosmic ray corrupts your system).
+      free(alone);
+      free(t2count);
+      free(reverseH);
+      free(t2hash);
+      free(reverseOrder);
+      free(startPos);
+      return false;
+    }
+
+    for (uint32_t i = 0; i < block; i++) {
+      // important : i * size would overflow as a 32-bit number in some
+      // cases.
+      startPos[i] = (uint32_t)(((uint64_t)i * size) >> blockBits);
+    }
+
+    uint64_t maskblock = block - 1;
+    for (uint32_t start = 0; start < size; start += BINARY_FUSE_HASH_BLOCK) {
+      uint32_t n = size - start < BINARY_FUSE_HASH_BLOCK ? size - start : BINARY_FUSE_HASH_BLOCK;
+      binary_fuse_hash_keys(keys + start, n, mphf->Seed, hashes);
+      for (uint32_t i = 0; i < n; i++) {
+        uint64_t hash = hashes[i];
+        uint64_t segment_index = hash >> (64 - blockBits);
+        while (reverseOrder[startPos[segment_index]] != 0) {
+          segment_index++;
+          segment_index &= maskblock;
+        }
+        reverseOrder[startPos[segment_index]] = hash;
+        startPos[segment_index]++;
+      }
+    }
+    int error = 0;
+    uint32_t duplicates = 0;
+    for (uint32_t i = 0; i < size; i++) {
+      uint64_t hash = reverseOrder[i];
+      uint32_t h0 = binary_fuse_mphf_hash(0, hash, mphf);
+      t2count[h0] += 4;
+      t2hash[h0] ^= hash;
+      uint32_t h1= binary_fuse_mphf_hash(1, hash, mphf);
+      t2count[h1] += 4;
+      t2count[h1] ^= 1U;
+      t2hash[h1] ^= hash;
+      uint32_t h2 = binary_fuse_mphf_hash(2, hash, mphf);
+      t2count[h2] += 4;
+      t2hash[h2] ^= hash;
+      t2count[h2] ^= 2U;
+      if ((t2hash[h0] & t2hash[h1] & t2hash[h2]) == 0) {
+        if   (((t2hash[h0] == 0) && (t2count[h0] == 8))
+          ||  ((t2hash[h1] == 0) && (t2count[h1] == 8))
+          ||  ((t2hash[h2] == 0) && (t2count[h2] == 8))) {
+					duplicates += 1;
+ 					t2count[h0] -= 4;
+ 					t2hash[h0] ^= hash;
+ 					t2count[h1] -= 4;
+ 					t2count[h1] ^= 1U;
+ 					t2hash[h1] ^= hash;
+ 					t2count[h2] -= 4;
+ 					t2count[h2] ^= 2U;
+ 					t2hash[h2] ^= hash;
+        }
+      }
+      error = (t2count[h0] < 4) ? 1 : error;
+      error = (t2count[h1] < 4) ? 1 : error;
+      error = (t2count[h2] < 4) ? 1 : error;
+    }
+    if(error) {
+      if(duplicates > 0) {
+        // many copies of a key can overflow a counter before they are detected
+        size = (uint32_t)binary_fuse_sort_and_remove_dup(keys, size);
+      }
+      memset(reverseOrder, 0, sizeof(uint64_t) * size);
+      memset(t2count, 0, sizeof(uint8_t) * capacity);
+      memset(t2hash, 0, sizeof(uint64_t) * capacity);
+      mphf->Seed = binary_fuse_rng_splitmix64(&rng_counter);
+      continue;
+    }
+
+    // End of key addition
+    uint32_t Qsize = 0;
+    // Add sets with one key to the queue.
+    for (uint32_t i = 0; i < capacity; i++) {
+      alone[Qsize] = i;
+      Qsize += ((t2count[i] >> 2U) == 1) ? 1U : 0U;
+    }
+    uint32_t stacksize = 0;
+    while (Qsize > 0) {
+      Qsize--;
+      uint32_t index = alone[Qsize];
+      if ((t2count[index] >> 2U) == 1) {
+        uint64_t hash = t2hash[index];
+
+        //h012[0] = binary_fuse_mphf_hash(0, hash, mphf);
+        h012[1] = binary_fuse_mphf_hash(1, hash, mphf);
+        h012[2] = binary_fuse_mphf_hash(2, hash, mphf);
+        h012[3] = binary_fuse_mphf_hash(0, hash, mphf); // == h012[0];
+        h012[4] = h012[1];
+        uint8_t found = t2count[index] & 3U;
+        reverseH[stacksize] = found;
+        reverseOrder[stacksize] = hash;
+        stacksize++;
+        uint32_t other_index1 = h012[found + 1];
+        alone[Qsize] = other_index1;
+        Qsize += ((t2count[other_index1] >> 2U) == 2 ? 1U : 0U);
+
+        t2count[other_index1] -= 4;
+        t2count[other_index1] ^= binary_fuse_mod3(found + 1);
+        t2hash[other_index1] ^= hash;
+
+        uint32_t other_index2 = h012[found + 2];
+        alone[Qsize] = other_index2;
+        Qsize += ((t2count[other_index2] >> 2U) == 2 ? 1U : 0U);
+        t2count[other_index2] -= 4;
+        t2count[other_index2] ^= binary_fuse_mod3(found + 2);
+        t2hash[other_index2] ^= hash;
+      }
+    }
+    if (stacksize + duplicates == size) {
+      // success
+      size = stacksize;
+      break;
+    }
+    if(duplicates > 0) {
+      size = (uint32_t)binary_fuse_sort_and_remove_dup(keys, size);
+    }
+    memset(reverseOrder, 0, sizeof(uint64_t) * size);
+    memset(t2count, 0, sizeof(uint8_t) * capacity);
+    memset(t2hash, 0, sizeof(uint64_t) * capacity);
+    mphf->Seed = binary_fuse_rng_splitmix64(&rng_counter);
+  }
+
+  // all the slots are free, then each key sets the one it was peeled from
+  memset(mphf->Slots, 0xFF, mphf->WordCount * sizeof(uint64_t));
+  for (uint32_t i = size - 1; i < size; i--) {
+    // the hash of the key we insert next
+    uint64_t hash = reverseOrder[i];
+    uint8_t found = reverseH[i];
+    h012[0] = binary_fuse_mphf_hash(0, hash, mphf);
+    h012[1] = binary_fuse_mphf_hash(1, hash, mphf);
+    h012[2] = binary_fuse_mphf_hash(2, hash, mphf);
+    h012[3] = h012[0];
+    h012[4] = h012[1];
+    // a free slot (3) counts as 0
+    uint32_t others = binary_fuse_mphf_slot(mphf, h012[found + 1]) +
+                      binary_fuse_mphf_slot(mphf, h012[found + 2]);
+    binary_fuse_mphf_set_slot(mphf, h012[found], (found + 6 - others % 3) % 3);
+  }
+  mphf->Size = size;
+  binary_fuse_mphf_build_ranks(mphf);
   free(alone);
   free(t2count);
   free(reverseH);
@@ -753,6 +6927,66 @@ static inline bool binary_fuse16_populate(uint64_t *keys, uint32_t size,
   return true;
 }
 
+// The rank entries are not serialized, binary_fuse_mphf_deserialize rebuilds them.
+static inline size_t binary_fuse_mphf_serialization_bytes(const binary_fuse_mphf_t *mphf) {
+  return sizeof(mphf->Seed) + sizeof(mphf->Size) + sizeof(mphf->SegmentLength) +
+        sizeof(mphf->SegmentCount) +
+        sizeof(mphf->SegmentCountLength) + sizeof(mphf->ArrayLength) +
+        sizeof(uint64_t) * mphf->WordCount;
+}
+
+// serialize a function to a buffer, the buffer should have a capacity of at least
+// binary_fuse_mphf_serialization_bytes(mphf) bytes.
+// Native endianess only.
+static inline void binary_fuse_mphf_serialize(const binary_fuse_mphf_t *mphf, char *buffer) {
+  memcpy(buffer, &mphf->Seed, sizeof(mphf->Seed));
+  buffer += sizeof(mphf->Seed);
+  memcpy(buffer, &mphf->Size, sizeof(mphf->Size));
+  buffer += sizeof(mphf->Size);
+  uint32_t segment_length = binary_fuse_tag_mixer(mphf->SegmentLength);
+  memcpy(buffer, &segment_length, sizeof(segment_length));
+  buffer += sizeof(mphf->SegmentLength);
+  memcpy(buffer, &mphf->SegmentCount, sizeof(mphf->SegmentCount));
+  buffer += sizeof(mphf->SegmentCount);
+  memcpy(buffer, &mphf->SegmentCountLength, sizeof(mphf->SegmentCountLength));
+  buffer += sizeof(mphf->SegmentCountLength);
+  memcpy(buffer, &mphf->ArrayLength, sizeof(mphf->ArrayLength));
+  buffer += sizeof(mphf->ArrayLength);
+  memcpy(buffer, mphf->Slots, mphf->WordCount * sizeof(uint64_t));
+}
+
+// deserialize a function from a buffer, returns true on success, false on failure.
+// The output will be reallocated, so the caller should call binary_fuse_mphf_free(mphf) before
+// if the function was already allocated. The caller needs to call binary_fuse_mphf_free(mphf)
+// after. The number of bytes read is binary_fuse_mphf_serialization_bytes(output).
+// Native endianess only.
+static inline bool binary_fuse_mphf_deserialize(binary_fuse_mphf_t *mphf, const char *buffer) {
+  memcpy(&mphf->Seed, buffer, sizeof(mphf->Seed));
+  buffer += sizeof(mphf->Seed);
+  memcpy(&mphf->Size, buffer, sizeof(mphf->Size));
+  buffer += sizeof(mphf->Size);
+  memcpy(&mphf->SegmentLength, buffer, sizeof(mphf->SegmentLength));
+  buffer += sizeof(mphf->SegmentLength);
+  if (!binary_fuse_untag_mixer(&mphf->SegmentLength)) {
+    mphf->Slots = NULL;
+    mphf->Ranks = NULL;
+    return false;
+  }
+  mphf->SegmentLengthMask = mphf->SegmentLength - 1;
+  memcpy(&mphf->SegmentCount, buffer, sizeof(mphf->SegmentCount));
+  buffer += sizeof(mphf->SegmentCount);
+  memcpy(&mphf->SegmentCountLength, buffer, sizeof(mphf->SegmentCountLength));
+  buffer += sizeof(mphf->SegmentCountLength);
+  memcpy(&mphf->ArrayLength, buffer, sizeof(mphf->ArrayLength));
+  buffer += sizeof(mphf->ArrayLength);
+  if (!binary_fuse_mphf_allocate_slots(mphf)) {
+    return false;
+  }
+  memcpy(mphf->Slots, buffer, mphf->WordCount * sizeof(uint64_t));
+  binary_fuse_mphf_build_ranks(mphf);
+  return true;
+}
+
 static inline size_t binary_fuse16_serialization_bytes(binary_fuse16_t *filter) {
   return sizeof(filter->Seed) + sizeof(filter->Size) + sizeof(filter->SegmentLength) +
         sizeof(filter->SegmentLengthMask) + sizeof(filter->SegmentCount) +
@@ -775,7 +7009,8 @@ static inline void binary_fuse16_serialize(const binary_fuse16_t *filter, char *
   buffer += sizeof(filter->Seed);
   memcpy(buffer, &filter->Size, sizeof(filter->Size));
   buffer += sizeof(filter->Size);
-  memcpy(buffer, &filter->SegmentLength, sizeof(filter->SegmentLength));
+  uint32_t segment_length = binary_fuse_tag_mixer(filter->SegmentLength);
+  memcpy(buffer, &segment_length, sizeof(segment_length));
   buffer += sizeof(filter->SegmentLength);
   memcpy(buffer, &filter->SegmentCount, sizeof(filter->SegmentCount));
   buffer += sizeof(filter->SegmentCount);
@@ -794,7 +7029,8 @@ static inline void binary_fuse8_serialize(const binary_fuse8_t *filter, char *bu
   buffer += sizeof(filter->Seed);
   memcpy(buffer, &filter->Size, sizeof(filter->Size));
   buffer += sizeof(filter->Size);
-  memcpy(buffer, &filter->SegmentLength, sizeof(filter->SegmentLength));
+  uint32_t segment_length = binary_fuse_tag_mixer(filter->SegmentLength);
+  memcpy(buffer, &segment_length, sizeof(segment_length));
   buffer += sizeof(filter->SegmentLength);
   memcpy(buffer, &filter->SegmentCount, sizeof(filter->SegmentCount));
   buffer += sizeof(filter->SegmentCount);
@@ -809,7 +7045,8 @@ static inline void binary_fuse8_serialize(const binary_fuse8_t *filter, char *bu
 // immediately after those fields. If you used binary_fuse16_seriliaze the return value will point at
 // the start of the `Fingerprints` array. Use this option if you want to allocate your own memory or
 // perhaps have the memory `mmap`ed to a file. Nothing is allocated. Do not call binary_fuse16_free
-// on the returned pointer. Native endianess only.
+// on the returned pointer. Returns NULL if the buffer was written with another mixer
+// (see BINARY_FUSE_MIXER). Native endianess only.
 static inline const char* binary_fuse16_deserialize_header(binary_fuse16_t* filter, const char* buffer) {
   memcpy(&filter->Seed, buffer, sizeof(filter->Seed));
   buffer += sizeof(filter->Seed);
@@ -817,6 +7054,9 @@ static inline const char* binary_fuse16_deserialize_header(binary_fuse16_t* filt
   buffer += sizeof(filter->Size);
   memcpy(&filter->SegmentLength, buffer, sizeof(filter->SegmentLength));
   buffer += sizeof(filter->SegmentLength);
+  if (!binary_fuse_untag_mixer(&filter->SegmentLength)) {
+    return NULL;
+  }
   filter->SegmentLengthMask = filter->SegmentLength - 1;
   memcpy(&filter->SegmentCount, buffer, sizeof(filter->SegmentCount));
   buffer += sizeof(filter->SegmentCount);
@@ -834,6 +7074,10 @@ static inline const char* binary_fuse16_deserialize_header(binary_fuse16_t* filt
 // Native endianess only.
 static inline bool binary_fuse16_deserialize(binary_fuse16_t * filter, const char *buffer) {
   const char* fingerprints = binary_fuse16_deserialize_header(filter, buffer);
+  if(fingerprints == NULL) {
+    filter->Fingerprints = NULL;
+    return false;
+  }
   filter->Fingerprints = (uint16_t*)malloc(filter->ArrayLength * sizeof(uint16_t));
   if(filter->Fingerprints == NULL) {
     return false;
@@ -846,7 +7090,8 @@ static inline bool binary_fuse16_deserialize(binary_fuse16_t * filter, const cha
 // immediately after those fields. If you used binary_fuse8_seriliaze the return value will point at
 // the start of the `Fingerprints` array. Use this option if you want to allocate your own memory or
 // perhaps have the memory `mmap`ed to a file. Nothing is allocated. Do not call binary_fuse8_free
-// on the returned pointer. Native endianess only.
+// on the returned pointer. Returns NULL if the buffer was written with another mixer
+// (see BINARY_FUSE_MIXER). Native endianess only.
 static inline const char* binary_fuse8_deserialize_header(binary_fuse8_t* filter, const char* buffer) {
   memcpy(&filter->Seed, buffer, sizeof(filter->Seed));
   buffer += sizeof(filter->Seed);
@@ -854,6 +7099,9 @@ static inline const char* binary_fuse8_deserialize_header(binary_fuse8_t* filter
   buffer += sizeof(filter->Size);
   memcpy(&filter->SegmentLength, buffer, sizeof(filter->SegmentLength));
   buffer += sizeof(filter->SegmentLength);
+  if (!binary_fuse_untag_mixer(&filter->SegmentLength)) {
+    return NULL;
+  }
   filter->SegmentLengthMask = filter->SegmentLength - 1;
   memcpy(&filter->SegmentCount, buffer, sizeof(filter->SegmentCount));
   buffer += sizeof(filter->SegmentCount);
@@ -871,6 +7119,10 @@ static inline const char* binary_fuse8_deserialize_header(binary_fuse8_t* filter
 // Native endianess only.
 static inline bool binary_fuse8_deserialize(binary_fuse8_t * filter, const char *buffer) {
   const char* fingerprints = binary_fuse8_deserialize_header(filter, buffer);
+  if(fingerprints == NULL) {
+    filter->Fingerprints = NULL;
+    return false;
+  }
   filter->Fingerprints = (uint8_t*)malloc(filter->ArrayLength * sizeof(uint8_t));
   if(filter->Fingerprints == NULL) {
     return false;
@@ -879,6 +7131,75 @@ static inline bool binary_fuse8_deserialize(binary_fuse8_t * filter, const char
   return true;
 }
 
+static inline size_t binary_fuse32_serialization_bytes(const binary_fuse32_t *filter) {
+  return sizeof(filter->Seed) + sizeof(filter->Size) + sizeof(filter->SegmentLength) +
+        sizeof(filter->SegmentCount) +
+        sizeof(filter->SegmentCountLength) + sizeof(filter->ArrayLength) +
+        sizeof(uint32_t) * filter->ArrayLength;
+}
+
+// serialize a filter to a buffer, the buffer should have a capacity of at least
+// binary_fuse32_serialization_bytes(filter) bytes.
+// Native endianess only.
+static inline void binary_fuse32_serialize(const binary_fuse32_t *filter, char *buffer) {
+  memcpy(buffer, &filter->Seed, sizeof(filter->Seed));
+  buffer += sizeof(filter->Seed);
+  memcpy(buffer, &filter->Size, sizeof(filter->Size));
+  buffer += sizeof(filter->Size);
+  uint32_t segment_length = binary_fuse_tag_mixer(filter->SegmentLength);
+  memcpy(buffer, &segment_length, sizeof(segment_length));
+  buffer += sizeof(filter->SegmentLength);
+  memcpy(buffer, &filter->SegmentCount, sizeof(filter->SegmentCount));
+  buffer += sizeof(filter->SegmentCount);
+  memcpy(buffer, &filter->SegmentCountLength, sizeof(filter->SegmentCountLength));
+  buffer += sizeof(filter->SegmentCountLength);
+  memcpy(buffer, &filter->ArrayLength, sizeof(filter->ArrayLength));
+  buffer += sizeof(filter->ArrayLength);
+  memcpy(buffer, filter->Fingerprints, filter->ArrayLength * sizeof(uint32_t));
+}
+
+// deserialize the main struct fields of a filter from a buffer, returns the buffer position
+// immediately after those fields, see binary_fuse16_deserialize_header. Nothing is allocated.
+// Do not call binary_fuse32_free on the returned pointer. Native endianess only.
+static inline const char* binary_fuse32_deserialize_header(binary_fuse32_t* filter, const char* buffer) {
+  memcpy(&filter->Seed, buffer, sizeof(filter->Seed));
+  buffer += sizeof(filter->Seed);
+  memcpy(&filter->Size, buffer, sizeof(filter->Size));
+  buffer += sizeof(filter->Size);
+  memcpy(&filter->SegmentLength, buffer, sizeof(filter->SegmentLength));
+  buffer += sizeof(filter->SegmentLength);
+  if (!binary_fuse_untag_mixer(&filter->SegmentLength)) {
+    return NULL;
+  }
+  filter->SegmentLengthMask = filter->SegmentLength - 1;
+  memcpy(&filter->SegmentCount, buffer, sizeof(filter->SegmentCount));
+  buffer += sizeof(filter->SegmentCount);
+  memcpy(&filter->SegmentCountLength, buffer, sizeof(filter->SegmentCountLength));
+  buffer += sizeof(filter->SegmentCountLength);
+  memcpy(&filter->ArrayLength, buffer, sizeof(filter->ArrayLength));
+  buffer += sizeof(filter->ArrayLength);
+  return buffer;
+}
+
+// deserialize a filter from a buffer, returns true on success, false on failure.
+// The output will be reallocated, so the caller should call binary_fuse32_free(filter) before
+// if the filter was already allocated. The caller needs to call binary_fuse32_free(filter) after.
+// The number of bytes read is binary_fuse32_serialization_bytes(output).
+// Native endianess only.
+static inline bool binary_fuse32_deserialize(binary_fuse32_t * filter, const char *buffer) {
+  const char* fingerprints = binary_fuse32_deserialize_header(filter, buffer);
+  if(fingerprints == NULL) {
+    filter->Fingerprints = NULL;
+    return false;
+  }
+  filter->Fingerprints = (uint32_t*)malloc(filter->ArrayLength * sizeof(uint32_t));
+  if(filter->Fingerprints == NULL) {
+    return false;
+  }
+  memcpy(filter->Fingerprints, fingerprints, filter->ArrayLength * sizeof(uint32_t));
+  return true;
+}
+
 // minimal bitfield implementation
 #define XOR_bitf_w (sizeof(uint8_t) * 8)
 #define XOR_bitf_sz(bits) (((bits) + XOR_bitf_w - 1) / XOR_bitf_w)
@@ -899,7 +7220,7 @@ static inline bool binary_fuse8_deserialize(binary_fuse8_t * filter, const char
 	buf += sizeof dst;			\
 } while (0)
 
-// return required space for binary_fuse{8,16}_pack()
+// return required space for binary_fuse{8,16,32}_pack()
 #define XOR_bytesf(fuse) \
 static inline size_t binary_ ## fuse ## _pack_bytes(const binary_ ## fuse ## _t *filter) \
 { \
@@ -915,7 +7236,9 @@ static inline size_t binary_ ## fuse ## _pack_bytes(const binary_ ## fuse ## _t
   return (sz); \
 }
 
-// serialize as packed format, return size used or 0 for insufficient space
+// serialize as packed format, return size used or 0 for insufficient space.
+// Only Seed and Size are stored, so unlike binary_fuse8_serialize the packed
+// format does not record the mixer: unpack with the same BINARY_FUSE_MIXER.
 #define XOR_packf(fuse) \
 static inline size_t binary_ ## fuse ## _pack(const binary_ ## fuse ## _t *filter, char *buffer, size_t space) { \
   uint8_t *s = (uint8_t *)(void *)buffer; \
@@ -973,6 +7296,7 @@ XOR_unpackf(fuse) \
 
 XOR_packers(fuse8)
 XOR_packers(fuse16)
+XOR_packers(fuse32)
 
 #undef XOR_packers
 #undef XOR_bytesf
@@ -6,6 +6,40 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <xmmintrin.h>
+#endif
+// The key mixer: xor_mix_split(key, seed) turns a key into the 64-bit hash
+// that gives its fingerprint and locations. Define XOR_MIXER before including
+// this header to select another one; a serialized filter records it.
+#define XOR_MIXER_MURMUR64 0 // murmur64 finalizer of key + seed (default)
+#define XOR_MIXER_MULXOR 1   // one 64x64->128-bit multiplication and a fold
+#define XOR_MIXER_CRC32C 2   // two CRC32C instructions, x64 with SSE4.2
+#define XOR_MIXER_AES 3      // two AES rounds, x64 with AES-NI
+#ifndef XOR_MIXER
+#define XOR_MIXER XOR_MIXER_MURMUR64
+#endif
+#if XOR_MIXER == XOR_MIXER_CRC32C
+#ifndef __SSE4_2__
+#error "XOR_MIXER_CRC32C requires SSE4.2 (e.g., -msse4.2)"
+#endif
+#include <nmmintrin.h>
+#elif XOR_MIXER == XOR_MIXER_AES
+#ifndef __AES__
+#error "XOR_MIXER_AES requires AES-NI (e.g., -maes)"
+#endif
+#include <wmmintrin.h>
+#elif XOR_MIXER != XOR_MIXER_MURMUR64 && XOR_MIXER != XOR_MIXER_MULXOR
+#error "unknown XOR_MIXER"
+#endif
+#if !defined(XOR_DISABLE_SIMD) && (defined(__GNUC__) || defined(__clang__)) && \
+    defined(__x86_64__) &&                                                       \
+    XOR_MIXER == XOR_MIXER_MURMUR64
+// AVX2 and AVX-512 query kernels, selected at runtime; they implement the
+// default mixer only
+#define XOR_X64_SIMD 1
+#include <immintrin.h>
+#endif
 
 #ifndef XOR_SORT_ITERATIONS
 #define XOR_SORT_ITERATIONS 10 // after 10 iterations, we sort and remove duplicates
@@ -18,7 +52,9 @@
 
 
 static int xor_cmpfunc(const void * a, const void * b) {
-  return (int)( *(const uint64_t*)a - *(const uint64_t*)b );
+  uint64_t x = *(const uint64_t*)a;
+  uint64_t y = *(const uint64_t*)b;
+  return (x > y) - (x < y);
 }
 
 static size_t xor_sort_and_remove_dup(uint64_t* keys, size_t length) {
@@ -52,8 +88,130 @@ static inline uint64_t xor_murmur64(uint64_t h) {
   return h;
 }
 
+// #ifdefs adapted from:
+//  https://stackoverflow.com/a/50958815
+#ifdef __SIZEOF_INT128__  // compilers supporting __uint128, e.g., gcc, clang
+static inline uint64_t xor_mulhi(uint64_t a, uint64_t b) {
+  return (uint64_t)(((__uint128_t)a * b) >> 64U);
+}
+#elif defined(_M_X64) || defined(_MARM64)   // MSVC
+static inline uint64_t xor_mulhi(uint64_t a, uint64_t b) {
+  return __umulh(a, b);
+}
+#elif defined(_M_IA64)  // also MSVC
+static inline uint64_t xor_mulhi(uint64_t a, uint64_t b) {
+  unsigned __int64 hi;
+  (void) _umul128(a, b, &hi);
+  return hi;
+}
+#else  // portable implementation using uint64_t
+static inline uint64_t xor_mulhi(uint64_t a, uint64_t b) {
+  // Adapted from:
+  //  https://stackoverflow.com/a/51587262
+
+  /*
+        This is implementing schoolbook multiplication:
+
+                a1 a0
+        X       b1 b0
+        -------------
+                   00  LOW PART
+        -------------
+                00
+             10 10     MIDDLE PART
+        +       01
+        -------------
+             01
+        + 11 11        HIGH PART
+        -------------
+  */
+
+  const uint64_t a0 = (uint32_t) a;
+  const uint64_t a1 = a >> 32;
+  const uint64_t b0 = (uint32_t) b;
+  const uint64_t b1 = b >> 32;
+  const uint64_t p11 = a1 * b1;
+  const uint64_t p01 = a0 * b1;
+  const uint64_t p10 = a1 * b0;
+  const uint64_t p00 = a0 * b0;
+
+  // 64-bit product + two 32-bit values
+  const uint64_t middle = p10 + (p00 >> 32) + (uint32_t) p01;
+
+  /*
+    Proof that 64-bit products can accumulate two more 32-bit values
+    without overflowing:
+
+    Max 32-bit value is 2^32 - 1.
+    PSum = (2^32-1) * (2^32-1) + (2^32-1) + (2^32-1)
+         = 2^64 - 2^32 - 2^32 + 1 + 2^32 - 1 + 2^32 - 1
+         = 2^64 - 1
+    Therefore the high half below cannot overflow regardless of input.
+  */
+
+  // high half
+  return p11 + (middle >> 32) + (p01 >> 32);
+
+  // low half (which we don't care about, but here it is)
+  // (middle << 32) | (uint32_t) p00;
+}
+#endif
+
+// fold of the 128-bit product of a and b
+static inline uint64_t xor_mum(uint64_t a, uint64_t b) {
+  return (a * b) ^ xor_mulhi(a, b);
+}
+
 static inline uint64_t xor_mix_split(uint64_t key, uint64_t seed) {
+#if XOR_MIXER == XOR_MIXER_MULXOR
+  // the key times itself, each side perturbed, folded: one 64x64->128-bit
+  // multiplication
+  return xor_mum(key ^ seed, key ^ UINT64_C(0x9e3779b97f4a7c15));
+#elif XOR_MIXER == XOR_MIXER_CRC32C
+  // each half is the CRC32C of the key, rotated for the high half, from one
+  // half of the seed; the CRC is linear, so a multiplication finishes it
+  uint64_t lo = _mm_crc32_u64(seed & UINT32_MAX, key);
+  uint64_t hi = _mm_crc32_u64(seed >> 32U, (key << 32U) | (key >> 32U));
+  return xor_mum((hi << 32U) | lo, UINT64_C(0x9e3779b97f4a7c15));
+#elif XOR_MIXER == XOR_MIXER_AES
+  // two rounds diffuse every byte of the key and of the seed to the result
+  __m128i x = _mm_set_epi64x((long long)seed, (long long)key);
+  x = _mm_aesenc_si128(x, _mm_set_epi64x((long long)UINT64_C(0x243f6a8885a308d3),
+                                         (long long)UINT64_C(0x13198a2e03707344)));
+  x = _mm_aesenc_si128(x, _mm_set_epi64x((long long)UINT64_C(0xa4093822299f31d0),
+                                         (long long)UINT64_C(0x082efa98ec4e6c89)));
+  return (uint64_t)_mm_cvtsi128_si64(x);
+#else
   return xor_murmur64(key + seed);
+#endif
+}
+
+// name of the key mixer, see XOR_MIXER
+static inline const char *xor_mixer_name(void) {
+#if XOR_MIXER == XOR_MIXER_MULXOR
+  return "mulxor";
+#elif XOR_MIXER == XOR_MIXER_CRC32C
+  return "crc32c";
+#elif XOR_MIXER == XOR_MIXER_AES
+  return "aes";
+#else
+  return "murmur64";
+#endif
+}
+
+// The serialized filters record the mixer in the top byte of blockLength: a
+// buffer written with another mixer is rejected. The default mixer is 0, so
+// older buffers stay readable.
+static inline uint64_t xor_tag_mixer(uint64_t block_length) {
+  return block_length | ((uint64_t)XOR_MIXER << 56U);
+}
+
+// clear the mixer byte of a serialized blockLength, returns false if it is
+// not the mixer of this build
+static inline bool xor_untag_mixer(uint64_t *block_length) {
+  uint64_t mixer = *block_length >> 56U;
+  *block_length &= UINT64_C(0xFFFFFFFFFFFFFF);
+  return mixer == XOR_MIXER;
 }
 
 static inline uint64_t xor_rotl64(uint64_t n, unsigned int c) {
@@ -69,6 +227,23 @@ static inline uint64_t xor_fingerprint(uint64_t hash) {
   return hash ^ (hash >> 32U);
 }
 
+#ifndef XOR_BATCH_WINDOW
+// number of keys hashed ahead of the one being resolved in the batch queries,
+// must be a power of two
+#define XOR_BATCH_WINDOW 16
+#endif
+
+// hint that the cache line holding 'addr' will soon be read
+static inline void xor_prefetch(const void *addr) {
+#if defined(__GNUC__) || defined(__clang__)
+  __builtin_prefetch(addr, 0, 3);
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+  _mm_prefetch((const char *)addr, _MM_HINT_T0);
+#else
+  (void)addr;
+#endif
+}
+
 /**
  * We need a decent random number generator.
  **/
@@ -129,6 +304,117 @@ static inline bool xor16_contain(uint64_t key, const xor16_t *filter) {
                filter->fingerprints[h2]);
 }
 
+// A query split in two phases, see xor8_probe_prepare.
+typedef struct xor8_probe_s {
+  uint32_t h0;
+  uint32_t h1;
+  uint32_t h2;
+  uint8_t fingerprint;
+} xor8_probe_t;
+
+// First phase of a query: hash the key, compute its fingerprint and its three
+// locations, and prefetch them. Do some other work, then call
+// xor8_probe_finish, by which time the fingerprints should be in cache.
+// The hash is computed only once: xor8_probe_finish(&probe, filter) is
+// equivalent to xor8_contain(key, filter).
+static inline void xor8_probe_prepare(uint64_t key, const xor8_t *filter,
+                                      xor8_probe_t *probe) {
+  uint64_t hash = xor_mix_split(key, filter->seed);
+  probe->fingerprint = (uint8_t)xor_fingerprint(hash);
+  probe->h0 = xor_reduce((uint32_t)hash, (uint32_t)filter->blockLength);
+  probe->h1 = xor_reduce((uint32_t)xor_rotl64(hash, 21), (uint32_t)filter->blockLength) +
+              (uint32_t)filter->blockLength;
+  probe->h2 = xor_reduce((uint32_t)xor_rotl64(hash, 42), (uint32_t)filter->blockLength) +
+              2 * (uint32_t)filter->blockLength;
+  xor_prefetch(filter->fingerprints + probe->h0);
+  xor_prefetch(filter->fingerprints + probe->h1);
+  xor_prefetch(filter->fingerprints + probe->h2);
+}
+
+// Second phase of a query: report if the key given to xor8_probe_prepare is in
+// the set, with false positive rate.
+static inline bool xor8_probe_finish(const xor8_probe_t *probe, const xor8_t *filter) {
+  return probe->fingerprint == ((uint32_t)filter->fingerprints[probe->h0] ^
+                                filter->fingerprints[probe->h1] ^
+                                filter->fingerprints[probe->h2]);
+}
+
+// A query split in two phases, see xor8_probe_prepare.
+typedef struct xor16_probe_s {
+  uint32_t h0;
+  uint32_t h1;
+  uint32_t h2;
+  uint16_t fingerprint;
+} xor16_probe_t;
+
+// First phase of a query: hash the key, compute its fingerprint and its three
+// locations, and prefetch them. See xor8_probe_prepare.
+static inline void xor16_probe_prepare(uint64_t key, const xor16_t *filter,
+                                       xor16_probe_t *probe) {
+  uint64_t hash = xor_mix_split(key, filter->seed);
+  probe->fingerprint = (uint16_t)xor_fingerprint(hash);
+  probe->h0 = xor_reduce((uint32_t)hash, (uint32_t)filter->blockLength);
+  probe->h1 = xor_reduce((uint32_t)xor_rotl64(hash, 21), (uint32_t)filter->blockLength) +
+              (uint32_t)filter->blockLength;
+  probe->h2 = xor_reduce((uint32_t)xor_rotl64(hash, 42), (uint32_t)filter->blockLength) +
+              2 * (uint32_t)filter->blockLength;
+  xor_prefetch(filter->fingerprints + probe->h0);
+  xor_prefetch(filter->fingerprints + probe->h1);
+  xor_prefetch(filter->fingerprints + probe->h2);
+}
+
+// Second phase of a query: report if the key given to xor16_probe_prepare is
+// in the set, with false positive rate.
+static inline bool xor16_probe_finish(const xor16_probe_t *probe, const xor16_t *filter) {
+  return probe->fingerprint == ((uint32_t)filter->fingerprints[probe->h0] ^
+                                filter->fingerprints[probe->h1] ^
+                                filter->fingerprints[probe->h2]);
+}
+
+// Report, for each of the 'count' keys, if it is in the set, with false
+// positive rate. The answer for keys[i] is written to out[i].
+// The keys are hashed XOR_BATCH_WINDOW positions ahead of the one being
+// resolved and their fingerprint locations are prefetched, so that several
+// cache misses are in flight at once. Portable version of xor8_contain_batch.
+static inline void xor8_contain_batch_scalar(const uint64_t *keys, size_t count,
+                                             bool *out, const xor8_t *filter) {
+  xor8_probe_t probes[XOR_BATCH_WINDOW];
+  const size_t mask = XOR_BATCH_WINDOW - 1;
+  size_t ahead = count < XOR_BATCH_WINDOW ? count : XOR_BATCH_WINDOW;
+  for (size_t i = 0; i < ahead; i++) {
+    xor8_probe_prepare(keys[i], filter, &probes[i]);
+  }
+  for (size_t i = 0; i < count; i++) {
+    size_t slot = i & mask;
+    out[i] = xor8_probe_finish(&probes[slot], filter);
+    if (i + XOR_BATCH_WINDOW < count) {
+      xor8_probe_prepare(keys[i + XOR_BATCH_WINDOW], filter, &probes[slot]);
+    }
+  }
+}
+
+// Report, for each of the 'count' keys, if it is in the set, with false
+// positive rate. The answer for keys[i] is written to out[i].
+// The keys are hashed XOR_BATCH_WINDOW positions ahead of the one being
+// resolved and their fingerprint locations are prefetched, so that several
+// cache misses are in flight at once. Portable version of xor16_contain_batch.
+static inline void xor16_contain_batch_scalar(const uint64_t *keys, size_t count,
+                                              bool *out, const xor16_t *filter) {
+  xor16_probe_t probes[XOR_BATCH_WINDOW];
+  const size_t mask = XOR_BATCH_WINDOW - 1;
+  size_t ahead = count < XOR_BATCH_WINDOW ? count : XOR_BATCH_WINDOW;
+  for (size_t i = 0; i < ahead; i++) {
+    xor16_probe_prepare(keys[i], filter, &probes[i]);
+  }
+  for (size_t i = 0; i < count; i++) {
+    size_t slot = i & mask;
+    out[i] = xor16_probe_finish(&probes[slot], filter);
+    if (i + XOR_BATCH_WINDOW < count) {
+      xor16_probe_prepare(keys[i + XOR_BATCH_WINDOW], filter, &probes[slot]);
+    }
+  }
+}
+
 // allocate enough capacity for a set containing up to 'size' elements
 // caller is responsible to call xor8_free(filter)
 static inline bool xor8_allocate(uint32_t size, xor8_t *filter) {
@@ -263,6 +549,68 @@ struct xor_keyindex_s {
 
 typedef struct xor_keyindex_s xor_keyindex_t;
 
+// Scratch memory of xor8_populate, xor16_populate and xor32_populate, which
+// the caller can keep from one construction to the next with
+// xor8_populate_with_workspace: the arrays are allocated once, and a
+// construction leaves 'sets' cleared by undoing its own writes instead of
+// clearing the whole array again.
+typedef struct xor_workspace_s {
+  size_t keyCapacity;  // entries of 'stack'
+  size_t cellCapacity; // entries of 'sets' and 'Q'
+  xor_xorset_t *sets;  // all zero between constructions
+  xor_keyindex_t *Q;
+  xor_keyindex_t *stack;
+} xor_workspace_t;
+
+// release memory
+static inline void xor_workspace_free(xor_workspace_t *workspace) {
+  free(workspace->sets);
+  free(workspace->Q);
+  free(workspace->stack);
+  workspace->sets = NULL;
+  workspace->Q = NULL;
+  workspace->stack = NULL;
+  workspace->keyCapacity = 0;
+  workspace->cellCapacity = 0;
+}
+
+// grow the workspace to 'size' keys and 'arrayLength' cells if needed
+static inline bool xor_workspace_reserve(xor_workspace_t *workspace, size_t size,
+                                         size_t arrayLength) {
+  if (workspace->stack == NULL || size > workspace->keyCapacity) {
+    free(workspace->stack);
+    workspace->keyCapacity = size;
+    workspace->stack = (xor_keyindex_t *)malloc((size + 1) * sizeof(xor_keyindex_t));
+  }
+  if (workspace->sets == NULL || workspace->Q == NULL ||
+      arrayLength > workspace->cellCapacity) {
+    free(workspace->sets);
+    free(workspace->Q);
+    workspace->cellCapacity = arrayLength;
+    workspace->sets = (xor_xorset_t *)calloc(arrayLength, sizeof(xor_xorset_t));
+    workspace->Q = (xor_keyindex_t *)malloc(arrayLength * sizeof(xor_keyindex_t));
+  }
+  if ((workspace->sets == NULL) || (workspace->Q == NULL) || (workspace->stack == NULL)) {
+    xor_workspace_free(workspace);
+    return false;
+  }
+  return true;
+}
+
+// allocate a workspace for the filters of up to 'size' elements (see
+// xor8_allocate), it grows when it is given a larger filter.
+// caller is responsible to call xor_workspace_free(workspace)
+static inline bool xor_workspace_allocate(uint32_t size, xor_workspace_t *workspace) {
+  size_t capacity = (size_t)(32 + 1.23 * size);
+  capacity = capacity / 3 * 3;
+  workspace->sets = NULL;
+  workspace->Q = NULL;
+  workspace->stack = NULL;
+  workspace->keyCapacity = 0;
+  workspace->cellCapacity = 0;
+  return xor_workspace_reserve(workspace, size, capacity);
+}
+
 struct xor_setbuffer_s {
   xor_keyindex_t *buffer;
   uint32_t *counts;
@@ -651,33 +999,26 @@ static inline bool xor8_buffered_populate(uint64_t *keys, uint32_t size, xor8_t
   return true;
 }
 
-// Construct the filter, returns true on success, false on failure.
-// The algorithm fails when there is insufficient memory.
+// Construct the filter like xor8_populate, with the scratch memory of
+// 'workspace', returns true on success, false on failure. The workspace
+// grows if the filter is larger than the ones it was allocated for, and can
+// be reused as soon as the function returns.
 // The caller is responsable for calling xor8_allocate(size,filter)
-// before. For best performance, the caller should ensure that there are not too
-// many duplicated keys.
-static inline bool xor8_populate(uint64_t *keys, uint32_t size, xor8_t *filter) {
+// and xor_workspace_allocate before.
+static inline bool xor8_populate_with_workspace(uint64_t *keys, uint32_t size, xor8_t *filter,
+                                                xor_workspace_t *workspace) {
   if(size == 0) { return false; }
   uint64_t rng_counter = 1;
   filter->seed = xor_rng_splitmix64(&rng_counter);
   size_t arrayLength = (size_t)(filter->blockLength) * 3; // size of the backing array
   size_t blockLength = (size_t)(filter->blockLength);
 
-  xor_xorset_t *sets =
-      (xor_xorset_t *)malloc(arrayLength * sizeof(xor_xorset_t));
-
-  xor_keyindex_t *Q =
-      (xor_keyindex_t *)malloc(arrayLength * sizeof(xor_keyindex_t));
-
-  xor_keyindex_t *stack =
-      (xor_keyindex_t *)malloc(size * sizeof(xor_keyindex_t));
-
-  if ((sets == NULL) || (Q == NULL) || (stack == NULL)) {
-    free(sets);
-    free(Q);
-    free(stack);
+  if (!xor_workspace_reserve(workspace, size, arrayLength)) {
     return false;
   }
+  xor_xorset_t *sets = workspace->sets;
+  xor_keyindex_t *Q = workspace->Q;
+  xor_keyindex_t *stack = workspace->stack;
   xor_xorset_t *sets0 = sets;
   xor_xorset_t *sets1 = sets + blockLength;
   xor_xorset_t *sets2 = sets + 2 * blockLength;
@@ -695,13 +1036,14 @@ static inline bool xor8_populate(uint64_t *keys, uint32_t size, xor8_t *filter)
     if(iterations > XOR_MAX_ITERATIONS) {
       // The probability of this happening is lower than the
       // the cosmic-ray probability (i.e., a cosmic ray corrupts your system).
-      free(sets);
-      free(Q);
-      free(stack);
+      memset(sets, 0, sizeof(xor_xorset_t) * arrayLength);
       return false;
     }
 
-    memset(sets, 0, sizeof(xor_xorset_t) * arrayLength);
+    if (iterations > 1) {
+      // the sets are clear on entry, and after a failed attempt only here
+      memset(sets, 0, sizeof(xor_xorset_t) * arrayLength);
+    }
     for (size_t i = 0; i < size; i++) {
       uint64_t key = keys[i];
       xor_hashes_t hs = xor8_get_h0_h1_h2(key, filter);
@@ -849,14 +1191,25 @@ static inline bool xor8_populate(uint64_t *keys, uint32_t size, xor8_t *filter)
       val ^= (uint32_t)fingerprints0[xor8_get_h0(ki.hash,filter)] ^ fingerprints1[xor8_get_h1(ki.hash,filter)];
     }
     filter->fingerprints[ki.index] = (uint8_t)val;
+    // the set the key was peeled from is the only one left with a key
+    sets[ki.index].xormask = 0;
+    sets[ki.index].count = 0;
   }
-
-  free(sets);
-  free(Q);
-  free(stack);
   return true;
 }
 
+// Construct the filter, returns true on success, false on failure.
+// The algorithm fails when there is insufficient memory.
+// The caller is responsable for calling xor8_allocate(size,filter)
+// before. For best performance, the caller should ensure that there are not too
+// many duplicated keys.
+static inline bool xor8_populate(uint64_t *keys, uint32_t size, xor8_t *filter) {
+  xor_workspace_t workspace = {0, 0, NULL, NULL, NULL};
+  bool ok = xor8_populate_with_workspace(keys, size, filter, &workspace);
+  xor_workspace_free(&workspace);
+  return ok;
+}
+
 
 // Construct the filter, returns true on success, false on failure.
 // The algorithm fails when there is insufficient memory.
@@ -1072,33 +1425,26 @@ static inline bool xor16_buffered_populate(uint64_t *keys, uint32_t size, xor16_
 
 
 
-// Construct the filter, returns true on success, false on failure.
-// The algorithm fails when there is insufficient memory.
+// Construct the filter like xor16_populate, with the scratch memory of
+// 'workspace', returns true on success, false on failure. The workspace
+// grows if the filter is larger than the ones it was allocated for, and can
+// be reused as soon as the function returns.
 // The caller is responsable for calling xor16_allocate(size,filter)
-// before. For best performance, the caller should ensure that there are not too
-// many duplicated keys.
-static inline bool xor16_populate(uint64_t *keys, uint32_t size, xor16_t *filter) {
+// and xor_workspace_allocate before.
+static inline bool xor16_populate_with_workspace(uint64_t *keys, uint32_t size, xor16_t *filter,
+                                                 xor_workspace_t *workspace) {
   if(size == 0) { return false; }
   uint64_t rng_counter = 1;
   filter->seed = xor_rng_splitmix64(&rng_counter);
   size_t arrayLength = (size_t)(filter->blockLength) * 3; // size of the backing array
   size_t blockLength = (size_t)(filter->blockLength);
 
-  xor_xorset_t *sets =
-      (xor_xorset_t *)malloc(arrayLength * sizeof(xor_xorset_t));
-
-  xor_keyindex_t *Q =
-      (xor_keyindex_t *)malloc(arrayLength * sizeof(xor_keyindex_t));
-
-  xor_keyindex_t *stack =
-      (xor_keyindex_t *)malloc(size * sizeof(xor_keyindex_t));
-
-  if ((sets == NULL) || (Q == NULL) || (stack == NULL)) {
-    free(sets);
-    free(Q);
-    free(stack);
+  if (!xor_workspace_reserve(workspace, size, arrayLength)) {
     return false;
   }
+  xor_xorset_t *sets = workspace->sets;
+  xor_keyindex_t *Q = workspace->Q;
+  xor_keyindex_t *stack = workspace->stack;
   xor_xorset_t *sets0 = sets;
   xor_xorset_t *sets1 = sets + blockLength;
   xor_xorset_t *sets2 = sets + 2 * blockLength;
@@ -1117,13 +1463,14 @@ static inline bool xor16_populate(uint64_t *keys, uint32_t size, xor16_t *filter
     if(iterations > XOR_MAX_ITERATIONS) {
       // The probability of this happening is lower than the
       // the cosmic-ray probability (i.e., a cosmic ray corrupts your system).
-      free(sets);
-      free(Q);
-      free(stack);
+      memset(sets, 0, sizeof(xor_xorset_t) * arrayLength);
       return false;
     }
 
-    memset(sets, 0, sizeof(xor_xorset_t) * arrayLength);
+    if (iterations > 1) {
+      // the sets are clear on entry, and after a failed attempt only here
+      memset(sets, 0, sizeof(xor_xorset_t) * arrayLength);
+    }
     for (size_t i = 0; i < size; i++) {
       uint64_t key = keys[i];
       xor_hashes_t hs = xor16_get_h0_h1_h2(key, filter);
@@ -1271,111 +1618,1082 @@ static inline bool xor16_populate(uint64_t *keys, uint32_t size, xor16_t *filter
       val ^= (uint32_t)fingerprints0[xor16_get_h0(ki.hash,filter)] ^ fingerprints1[xor16_get_h1(ki.hash,filter)];
     }
     filter->fingerprints[ki.index] = (uint16_t)val;
+    // the set the key was peeled from is the only one left with a key
+    sets[ki.index].xormask = 0;
+    sets[ki.index].count = 0;
   }
-
-  free(sets);
-  free(Q);
-  free(stack);
   return true;
 }
 
-
-static inline size_t xor16_serialization_bytes(xor16_t *filter) {
-  return sizeof(filter->seed) + sizeof(filter->blockLength) +
-      sizeof(uint16_t) * 3 * (size_t)(filter->blockLength);
+// Construct the filter, returns true on success, false on failure.
+// The algorithm fails when there is insufficient memory.
+// The caller is responsable for calling xor16_allocate(size,filter)
+// before. For best performance, the caller should ensure that there are not too
+// many duplicated keys.
+static inline bool xor16_populate(uint64_t *keys, uint32_t size, xor16_t *filter) {
+  xor_workspace_t workspace = {0, 0, NULL, NULL, NULL};
+  bool ok = xor16_populate_with_workspace(keys, size, filter, &workspace);
+  xor_workspace_free(&workspace);
+  return ok;
 }
 
-static inline size_t xor8_serialization_bytes(const xor8_t *filter) {
-  return sizeof(filter->seed) + sizeof(filter->blockLength) +
-      sizeof(uint8_t) * 3 * (size_t)(filter->blockLength);
+
+//////////////////
+// xor32
+//////////////////
+
+/**
+ * xor32 has a false-positive probability of about 1 in 4 billion, for
+ * applications where each false positive is costly, at twice the memory of
+ * xor16.
+ */
+typedef struct xor32_s {
+  uint64_t seed;
+  uint64_t blockLength;
+  uint32_t
+      *fingerprints; // after xor32_allocate, will point to 3*blockLength values
+} xor32_t;
+
+// Report if the key is in the set, with false positive rate.
+static inline bool xor32_contain(uint64_t key, const xor32_t *filter) {
+  uint64_t hash = xor_mix_split(key, filter->seed);
+  uint32_t f = (uint32_t)xor_fingerprint(hash);
+  uint32_t r0 = (uint32_t)hash;
+  uint32_t r1 = (uint32_t)xor_rotl64(hash, 21);
+  uint32_t r2 = (uint32_t)xor_rotl64(hash, 42);
+  uint32_t h0 = xor_reduce(r0, (uint32_t)filter->blockLength);
+  uint32_t h1 = xor_reduce(r1, (uint32_t)filter->blockLength) + (uint32_t)filter->blockLength;
+  uint32_t h2 = xor_reduce(r2, (uint32_t)filter->blockLength) + 2 * (uint32_t)filter->blockLength;
+  return f == ((uint32_t)filter->fingerprints[h0] ^
+               filter->fingerprints[h1] ^
+               filter->fingerprints[h2]);
 }
 
-// serialize a filter to a buffer, the buffer should have a capacity of at least
-// xor16_serialization_bytes(filter) bytes.
-// Native endianess only.
-static inline void xor16_serialize(const xor16_t *filter, char *buffer) {
-  memcpy(buffer, &filter->seed, sizeof(filter->seed));
-  buffer += sizeof(filter->seed);
-  memcpy(buffer, &filter->blockLength, sizeof(filter->blockLength));
-  buffer += sizeof(filter->blockLength);
-  memcpy(buffer, filter->fingerprints, (size_t)(filter->blockLength) * 3 * sizeof(uint16_t));
+// A query split in two phases, see xor8_probe_prepare.
+typedef struct xor32_probe_s {
+  uint32_t h0;
+  uint32_t h1;
+  uint32_t h2;
+  uint32_t fingerprint;
+} xor32_probe_t;
+
+// First phase of a query: hash the key, compute its fingerprint and its three
+// locations, and prefetch them. See xor8_probe_prepare.
+static inline void xor32_probe_prepare(uint64_t key, const xor32_t *filter,
+                                       xor32_probe_t *probe) {
+  uint64_t hash = xor_mix_split(key, filter->seed);
+  probe->fingerprint = (uint32_t)xor_fingerprint(hash);
+  probe->h0 = xor_reduce((uint32_t)hash, (uint32_t)filter->blockLength);
+  probe->h1 = xor_reduce((uint32_t)xor_rotl64(hash, 21), (uint32_t)filter->blockLength) +
+              (uint32_t)filter->blockLength;
+  probe->h2 = xor_reduce((uint32_t)xor_rotl64(hash, 42), (uint32_t)filter->blockLength) +
+              2 * (uint32_t)filter->blockLength;
+  xor_prefetch(filter->fingerprints + probe->h0);
+  xor_prefetch(filter->fingerprints + probe->h1);
+  xor_prefetch(filter->fingerprints + probe->h2);
 }
 
-// serialize a filter to a buffer, the buffer should have a capacity of at least
-// xor8_serialization_bytes(filter) bytes.
-// Native endianess only.
-static inline void xor8_serialize(const xor8_t *filter, char *buffer) {
-  memcpy(buffer, &filter->seed, sizeof(filter->seed));
-  buffer += sizeof(filter->seed);
-  memcpy(buffer, &filter->blockLength, sizeof(filter->blockLength));
-  buffer += sizeof(filter->blockLength);
-  memcpy(buffer, filter->fingerprints, (size_t)(filter->blockLength) * 3 * sizeof(uint8_t));
+// Second phase of a query: report if the key given to xor32_probe_prepare is
+// in the set, with false positive rate.
+static inline bool xor32_probe_finish(const xor32_probe_t *probe, const xor32_t *filter) {
+  return probe->fingerprint == ((uint32_t)filter->fingerprints[probe->h0] ^
+                                filter->fingerprints[probe->h1] ^
+                                filter->fingerprints[probe->h2]);
 }
 
-// deserialize a filter from a buffer, returns true on success, false on failure.
-// The output will be reallocated, so the caller should call xor16_free(filter) before
-// if the filter was already allocated. The caller needs to call xor16_free(filter) after.
-// The number of bytes read is xor16_serialization_bytes(filter).
-// Native endianess only.
-static inline bool xor16_deserialize(xor16_t * filter, const char *buffer) {
-  memcpy(&filter->seed, buffer, sizeof(filter->seed));
-  buffer += sizeof(filter->seed);
-  memcpy(&filter->blockLength, buffer, sizeof(filter->blockLength));
-  buffer += sizeof(filter->blockLength);
-  filter->fingerprints = (uint16_t*)malloc((size_t)(filter->blockLength) * 3 * sizeof(uint16_t));
-  if(filter->fingerprints == NULL) {
-    return false;
+// Report, for each of the 'count' keys, if it is in the set, with false
+// positive rate. The answer for keys[i] is written to out[i].
+// The keys are hashed XOR_BATCH_WINDOW positions ahead of the one being
+// resolved and their fingerprint locations are prefetched, so that several
+// cache misses are in flight at once. Portable version of xor32_contain_batch.
+static inline void xor32_contain_batch_scalar(const uint64_t *keys, size_t count,
+                                              bool *out, const xor32_t *filter) {
+  xor32_probe_t probes[XOR_BATCH_WINDOW];
+  const size_t mask = XOR_BATCH_WINDOW - 1;
+  size_t ahead = count < XOR_BATCH_WINDOW ? count : XOR_BATCH_WINDOW;
+  for (size_t i = 0; i < ahead; i++) {
+    xor32_probe_prepare(keys[i], filter, &probes[i]);
+  }
+  for (size_t i = 0; i < count; i++) {
+    size_t slot = i & mask;
+    out[i] = xor32_probe_finish(&probes[slot], filter);
+    if (i + XOR_BATCH_WINDOW < count) {
+      xor32_probe_prepare(keys[i + XOR_BATCH_WINDOW], filter, &probes[slot]);
+    }
   }
-  memcpy(filter->fingerprints, buffer, (size_t)(filter->blockLength) * 3 * sizeof(uint16_t));
-  return true;
 }
 
+// Report, for each of the 'count' keys, if it is in the set, with false
+// positive rate. The answer for keys[i] is written to out[i]. There are no
+// SIMD kernels for 32-bit fingerprints: this is xor32_contain_batch_scalar.
+static inline void xor32_contain_batch(const uint64_t *keys, size_t count,
+                                       bool *out, const xor32_t *filter) {
+  xor32_contain_batch_scalar(keys, count, out, filter);
+}
 
-// deserialize a filter from a buffer, returns true on success, false on failure.
-// The output will be reallocated, so the caller should call xor8_free(filter) before
-// if the filter was already allocated. The caller needs to call xor8_free(filter) after.
-// The number of bytes read is xor8_serialization_bytes(filter).
-// Native endianess only.
-static inline bool xor8_deserialize(xor8_t * filter, const char *buffer) {
-  memcpy(&filter->seed, buffer, sizeof(filter->seed));
-  buffer += sizeof(filter->seed);
-  memcpy(&filter->blockLength, buffer, sizeof(filter->blockLength));
-  buffer += sizeof(filter->blockLength);
-  filter->fingerprints = (uint8_t*)malloc((size_t)(filter->blockLength) * 3 * sizeof(uint8_t));
-  if(filter->fingerprints == NULL) {
-    return false;
+// allocate enough capacity for a set containing up to 'size' elements
+// caller is responsible to call xor32_free(filter)
+static inline bool xor32_allocate(uint32_t size, xor32_t *filter) {
+  size_t capacity = (size_t)(32 + 1.23 * size);
+  capacity = capacity / 3 * 3;
+  filter->fingerprints = (uint32_t *)malloc(capacity * sizeof(uint32_t));
+  if (filter->fingerprints != NULL) {
+    filter->blockLength = capacity / 3;
+    return true;
   }
-  memcpy(filter->fingerprints, buffer, (size_t)(filter->blockLength) * 3 * sizeof(uint8_t));
-  return true;
+  return false;
 }
 
-// minimal bitfield implementation
-#define XOR_bitf_w (sizeof(uint8_t) * 8)
-#define XOR_bitf_sz(bits) (((bits) + XOR_bitf_w - 1) / XOR_bitf_w)
-#define XOR_bitf_word(bit) (bit / XOR_bitf_w)
-#define XOR_bitf_bit(bit) ((1U << (bit % XOR_bitf_w)) % 256)
+// report memory usage
+static inline size_t xor32_size_in_bytes(const xor32_t *filter) {
+  return 3 * (size_t)(filter->blockLength) * sizeof(uint32_t) + sizeof(xor32_t);
+}
 
-#define XOR_ser(buf, lim, src) do {			\
-	if ((buf) + sizeof src > (lim))		\
-	  return (0);				\
-	memcpy(buf, &src, sizeof src);		\
-	buf += sizeof src;			\
-} while (0)
+// release memory
+static inline void xor32_free(xor32_t *filter) {
+  free(filter->fingerprints);
+  filter->fingerprints = NULL;
+  filter->blockLength = 0;
+}
 
-#define XOR_deser(dst, buf, lim) do {		\
-	if ((buf) + sizeof dst > (lim))		\
-	  return (false);			\
-	memcpy(&dst, buf, sizeof dst);		\
-	buf += sizeof dst;			\
-} while (0)
+static inline uint32_t xor32_get_h0(uint64_t hash, const xor32_t *filter) {
+  uint32_t r0 = (uint32_t)hash;
+  return xor_reduce(r0, (uint32_t)filter->blockLength);
+}
 
-// return required space for binary_xor{8,16}_pack()
-#define XOR_bytesf(xbits) \
-static inline size_t xor ## xbits ## _pack_bytes(const xor ## xbits ## _t *filter) \
-{ \
-  size_t sz = 0; \
-  size_t capacity = (size_t)(3 * filter->blockLength); \
-  sz += sizeof filter->seed; \
+static inline uint32_t xor32_get_h1(uint64_t hash, const xor32_t *filter) {
+  uint32_t r1 = (uint32_t)xor_rotl64(hash, 21);
+  return xor_reduce(r1, (uint32_t)filter->blockLength);
+}
+
+static inline uint32_t xor32_get_h2(uint64_t hash, const xor32_t *filter) {
+  uint32_t r2 = (uint32_t)xor_rotl64(hash, 42);
+  return xor_reduce(r2, (uint32_t)filter->blockLength);
+}
+
+static inline xor_hashes_t xor32_get_h0_h1_h2(uint64_t k,
+                                              const xor32_t *filter) {
+  uint64_t hash = xor_mix_split(k, filter->seed);
+  xor_hashes_t answer;
+  answer.h = hash;
+  uint32_t r0 = (uint32_t)hash;
+  uint32_t r1 = (uint32_t)xor_rotl64(hash, 21);
+  uint32_t r2 = (uint32_t)xor_rotl64(hash, 42);
+
+  answer.h0 = xor_reduce(r0, (uint32_t)filter->blockLength);
+  answer.h1 = xor_reduce(r1, (uint32_t)filter->blockLength);
+  answer.h2 = xor_reduce(r2, (uint32_t)filter->blockLength);
+  return answer;
+}
+
+// Construct the filter like xor32_populate, with the scratch memory of
+// 'workspace', returns true on success, false on failure. The workspace
+// grows if the filter is larger than the ones it was allocated for, and can
+// be reused as soon as the function returns.
+// The caller is responsable for calling xor32_allocate(size,filter)
+// and xor_workspace_allocate before.
+static inline bool xor32_populate_with_workspace(uint64_t *keys, uint32_t size, xor32_t *filter,
+                                                 xor_workspace_t *workspace) {
+  if(size == 0) { return false; }
+  uint64_t rng_counter = 1;
+  filter->seed = xor_rng_splitmix64(&rng_counter);
+  size_t arrayLength = (size_t)(filter->blockLength) * 3; // size of the backing array
+  size_t blockLength = (size_t)(filter->blockLength);
+
+  if (!xor_workspace_reserve(workspace, size, arrayLength)) {
+    return false;
+  }
+  xor_xorset_t *sets = workspace->sets;
+  xor_keyindex_t *Q = workspace->Q;
+  xor_keyindex_t *stack = workspace->stack;
+  xor_xorset_t *sets0 = sets;
+  xor_xorset_t *sets1 = sets + blockLength;
+  xor_xorset_t *sets2 = sets + 2 * blockLength;
+
+  xor_keyindex_t *Q0 = Q;
+  xor_keyindex_t *Q1 = Q + blockLength;
+  xor_keyindex_t *Q2 = Q + 2 * blockLength;
+
+  int iterations = 0;
+
+  while (true) {
+    iterations ++;
+    if(iterations == XOR_SORT_ITERATIONS) {
+      size = (uint32_t)xor_sort_and_remove_dup(keys, size);
+    }
+    if(iterations > XOR_MAX_ITERATIONS) {
+      // The probability of this happening is lower than the
+      // the cosmic-ray probability (i.e., a cosmic ray corrupts your system).
+      memset(sets, 0, sizeof(xor_xorset_t) * arrayLength);
+      return false;
+    }
+
+    if (iterations > 1) {
+      // the sets are clear on entry, and after a failed attempt only here
+      memset(sets, 0, sizeof(xor_xorset_t) * arrayLength);
+    }
+    for (size_t i = 0; i < size; i++) {
+      uint64_t key = keys[i];
+      xor_hashes_t hs = xor32_get_h0_h1_h2(key, filter);
+      sets0[hs.h0].xormask ^= hs.h;
+      sets0[hs.h0].count++;
+      sets1[hs.h1].xormask ^= hs.h;
+      sets1[hs.h1].count++;
+      sets2[hs.h2].xormask ^= hs.h;
+      sets2[hs.h2].count++;
+    }
+    // todo: the flush should be sync with the detection that follows
+    // scan for values with a count of one
+    size_t Q0size = 0, Q1size = 0, Q2size = 0;
+    for (size_t i = 0; i < filter->blockLength; i++) {
+      if (sets0[i].count == 1) {
+        Q0[Q0size].index = (uint32_t)i;
+        Q0[Q0size].hash = sets0[i].xormask;
+        Q0size++;
+      }
+    }
+
+    for (size_t i = 0; i < filter->blockLength; i++) {
+      if (sets1[i].count == 1) {
+        Q1[Q1size].index = (uint32_t)i;
+        Q1[Q1size].hash = sets1[i].xormask;
+        Q1size++;
+      }
+    }
+    for (size_t i = 0; i < filter->blockLength; i++) {
+      if (sets2[i].count == 1) {
+        Q2[Q2size].index = (uint32_t)i;
+        Q2[Q2size].hash = sets2[i].xormask;
+        Q2size++;
+      }
+    }
+
+    size_t stack_size = 0;
+    while (Q0size + Q1size + Q2size > 0) {
+      while (Q0size > 0) {
+        xor_keyindex_t keyindex = Q0[--Q0size];
+        size_t index = keyindex.index;
+        if (sets0[index].count == 0)
+          continue; // not actually possible after the initial scan.
+        //sets0[index].count = 0;
+        uint64_t hash = keyindex.hash;
+        uint32_t h1 = xor32_get_h1(hash, filter);
+        uint32_t h2 = xor32_get_h2(hash, filter);
+
+        stack[stack_size] = keyindex;
+        stack_size++;
+        sets1[h1].xormask ^= hash;
+        sets1[h1].count--;
+        if (sets1[h1].count == 1) {
+          Q1[Q1size].index = h1;
+          Q1[Q1size].hash = sets1[h1].xormask;
+          Q1size++;
+        }
+        sets2[h2].xormask ^= hash;
+        sets2[h2].count--;
+        if (sets2[h2].count == 1) {
+          Q2[Q2size].index = h2;
+          Q2[Q2size].hash = sets2[h2].xormask;
+          Q2size++;
+        }
+      }
+      while (Q1size > 0) {
+        xor_keyindex_t keyindex = Q1[--Q1size];
+        size_t index = keyindex.index;
+        if (sets1[index].count == 0)
+          continue;
+        //sets1[index].count = 0;
+        uint64_t hash = keyindex.hash;
+        uint32_t h0 = xor32_get_h0(hash, filter);
+        uint32_t h2 = xor32_get_h2(hash, filter);
+        keyindex.index += (uint32_t)blockLength;
+        stack[stack_size] = keyindex;
+        stack_size++;
+        sets0[h0].xormask ^= hash;
+        sets0[h0].count--;
+        if (sets0[h0].count == 1) {
+          Q0[Q0size].index = h0;
+          Q0[Q0size].hash = sets0[h0].xormask;
+          Q0size++;
+        }
+        sets2[h2].xormask ^= hash;
+        sets2[h2].count--;
+        if (sets2[h2].count == 1) {
+          Q2[Q2size].index = h2;
+          Q2[Q2size].hash = sets2[h2].xormask;
+          Q2size++;
+        }
+      }
+      while (Q2size > 0) {
+        xor_keyindex_t keyindex = Q2[--Q2size];
+        size_t index = keyindex.index;
+        if (sets2[index].count == 0)
+          continue;
+
+        //sets2[index].count = 0;
+        uint64_t hash = keyindex.hash;
+
+        uint32_t h0 = xor32_get_h0(hash, filter);
+        uint32_t h1 = xor32_get_h1(hash, filter);
+        keyindex.index += 2 * (uint32_t)blockLength;
+
+        stack[stack_size] = keyindex;
+        stack_size++;
+        sets0[h0].xormask ^= hash;
+        sets0[h0].count--;
+        if (sets0[h0].count == 1) {
+          Q0[Q0size].index = h0;
+          Q0[Q0size].hash = sets0[h0].xormask;
+          Q0size++;
+        }
+        sets1[h1].xormask ^= hash;
+        sets1[h1].count--;
+        if (sets1[h1].count == 1) {
+          Q1[Q1size].index = h1;
+          Q1[Q1size].hash = sets1[h1].xormask;
+          Q1size++;
+        }
+
+      }
+    }
+    if (stack_size == size) {
+      // success
+      break;
+    }
+
+    filter->seed = xor_rng_splitmix64(&rng_counter);
+  }
+  uint32_t * fingerprints0 = filter->fingerprints;
+  uint32_t * fingerprints1 = filter->fingerprints + blockLength;
+  uint32_t * fingerprints2 = filter->fingerprints + 2 * blockLength;
+
+  size_t stack_size = size;
+  while (stack_size > 0) {
+    xor_keyindex_t ki = stack[--stack_size];
+    uint64_t val = xor_fingerprint(ki.hash);
+    if(ki.index < blockLength) {
+      val ^= (uint32_t)fingerprints1[xor32_get_h1(ki.hash,filter)] ^ fingerprints2[xor32_get_h2(ki.hash,filter)];
+    } else if(ki.index < 2 * blockLength) {
+      val ^= (uint32_t)fingerprints0[xor32_get_h0(ki.hash,filter)] ^ fingerprints2[xor32_get_h2(ki.hash,filter)];
+    } else {
+      val ^= (uint32_t)fingerprints0[xor32_get_h0(ki.hash,filter)] ^ fingerprints1[xor32_get_h1(ki.hash,filter)];
+    }
+    filter->fingerprints[ki.index] = (uint32_t)val;
+    // the set the key was peeled from is the only one left with a key
+    sets[ki.index].xormask = 0;
+    sets[ki.index].count = 0;
+  }
+  return true;
+}
+
+// Construct the filter, returns true on success, false on failure.
+// The algorithm fails when there is insufficient memory.
+// The caller is responsable for calling xor32_allocate(size,filter)
+// before. For best performance, the caller should ensure that there are not too
+// many duplicated keys.
+static inline bool xor32_populate(uint64_t *keys, uint32_t size, xor32_t *filter) {
+  xor_workspace_t workspace = {0, 0, NULL, NULL, NULL};
+  bool ok = xor32_populate_with_workspace(keys, size, filter, &workspace);
+  xor_workspace_free(&workspace);
+  return ok;
+}
+
+//////////////////
+// batch queries with SIMD kernels
+//////////////////
+
+// Kernels for the batch queries, see xor_kernel().
+#define XOR_KERNEL_SCALAR 0
+#define XOR_KERNEL_AVX2 1
+#define XOR_KERNEL_AVX512 2
+
+#ifdef XOR_X64_SIMD
+#define XOR_TARGET_AVX2 __attribute__((target("avx2")))
+#define XOR_TARGET_AVX512 __attribute__((target("avx2,avx512f,avx512dq")))
+
+/**
+ * AVX2 kernels: eight keys per iteration.
+ ***/
+
+// low 64 bits of the lane-wise product, AVX2 lacks a 64-bit multiplication
+XOR_TARGET_AVX2
+static inline __m256i xor_avx2_mullo64(__m256i a, __m256i b) {
+  __m256i lo = _mm256_mul_epu32(a, b);
+  __m256i cross = _mm256_add_epi64(_mm256_mul_epu32(_mm256_srli_epi64(a, 32), b),
+                                   _mm256_mul_epu32(a, _mm256_srli_epi64(b, 32)));
+  return _mm256_add_epi64(lo, _mm256_slli_epi64(cross, 32));
+}
+
+XOR_TARGET_AVX2
+static inline __m256i xor_avx2_murmur64(__m256i h) {
+  h = _mm256_xor_si256(h, _mm256_srli_epi64(h, 33));
+  h = xor_avx2_mullo64(h, _mm256_set1_epi64x((long long)UINT64_C(0xff51afd7ed558ccd)));
+  h = _mm256_xor_si256(h, _mm256_srli_epi64(h, 33));
+  h = xor_avx2_mullo64(h, _mm256_set1_epi64x((long long)UINT64_C(0xc4ceb9fe1a85ec53)));
+  h = _mm256_xor_si256(h, _mm256_srli_epi64(h, 33));
+  return h;
+}
+
+// Concatenate the low 32 bits of the lanes of a (lanes 0-3) and b (lanes 4-7).
+XOR_TARGET_AVX2
+static inline __m256i xor_avx2_narrow(__m256i a, __m256i b) {
+  const __m256i perm = _mm256_setr_epi32(0, 2, 4, 6, 1, 3, 5, 7);
+  return _mm256_permute2x128_si256(_mm256_permutevar8x32_epi32(a, perm),
+                                   _mm256_permutevar8x32_epi32(b, perm), 0x20);
+}
+
+// xor_reduce of the low 32 bits of each lane (_mm256_mul_epu32 ignores the others)
+XOR_TARGET_AVX2
+static inline __m256i xor_avx2_reduce(__m256i a, __m256i b, __m256i vbl) {
+  return xor_avx2_narrow(_mm256_srli_epi64(_mm256_mul_epu32(a, vbl), 32),
+                         _mm256_srli_epi64(_mm256_mul_epu32(b, vbl), 32));
+}
+
+XOR_TARGET_AVX2
+static inline __m256i xor_avx2_rotl64(__m256i h, int c) {
+  return _mm256_or_si256(_mm256_slli_epi64(h, c), _mm256_srli_epi64(h, 64 - c));
+}
+
+// Hash eight keys and compute their fingerprints and locations (32-bit lanes),
+// following xor8_contain.
+XOR_TARGET_AVX2
+static inline void xor_avx2_hash8(const uint64_t *keys, uint64_t seed, uint32_t blockLength,
+                                  __m256i *f, __m256i *h0, __m256i *h1, __m256i *h2) {
+  const __m256i vseed = _mm256_set1_epi64x((long long)seed);
+  const __m256i vbl = _mm256_set1_epi64x((long long)blockLength);
+  __m256i ha = xor_avx2_murmur64(
+      _mm256_add_epi64(_mm256_loadu_si256((const __m256i *)(const void *)keys), vseed));
+  __m256i hb = xor_avx2_murmur64(
+      _mm256_add_epi64(_mm256_loadu_si256((const __m256i *)(const void *)(keys + 4)), vseed));
+  const __m256i vbl32 = _mm256_set1_epi32((int)blockLength);
+  *f = _mm256_xor_si256(xor_avx2_narrow(ha, hb),
+                        xor_avx2_narrow(_mm256_srli_epi64(ha, 32), _mm256_srli_epi64(hb, 32)));
+  *h0 = xor_avx2_reduce(ha, hb, vbl);
+  *h1 = _mm256_add_epi32(xor_avx2_reduce(xor_avx2_rotl64(ha, 21), xor_avx2_rotl64(hb, 21), vbl),
+                         vbl32);
+  *h2 = _mm256_add_epi32(xor_avx2_reduce(xor_avx2_rotl64(ha, 42), xor_avx2_rotl64(hb, 42), vbl),
+                         _mm256_add_epi32(vbl32, vbl32));
+}
+
+// Returns a nonzero value when all eight lanes of idx are no larger than limit.
+XOR_TARGET_AVX2
+static inline int xor_avx2_all_le(__m256i idx, uint32_t limit) {
+  const __m256i vlimit = _mm256_set1_epi32((int)limit);
+  __m256i ok = _mm256_cmpeq_epi32(_mm256_max_epu32(idx, vlimit), vlimit);
+  return _mm256_movemask_epi8(ok) == -1;
+}
+
+// Report, for each of the 'count' keys, if it is in the set, with false
+// positive rate, using AVX2 gathers eight keys at a time. The answer for
+// keys[i] is written to out[i] and is identical to xor8_contain.
+// The processor must support AVX2, xor8_contain_batch checks it for you.
+XOR_TARGET_AVX2
+static inline void xor8_contain_batch_avx2(const uint64_t *keys, size_t count,
+                                           bool *out, const xor8_t *filter) {
+  const uint32_t blockLength = (uint32_t)filter->blockLength;
+  size_t i = 0;
+  // The gathers load 32 bits at each byte location, and use signed indexes.
+  if (3 * (uint64_t)blockLength <= INT32_MAX) {
+    const int *base = (const int *)(const void *)filter->fingerprints;
+    const __m256i fmask = _mm256_set1_epi32(0xFF);
+    for (; i + 8 <= count; i += 8) {
+      __m256i f, h0, h1, h2;
+      xor_avx2_hash8(keys + i, filter->seed, blockLength, &f, &h0, &h1, &h2);
+      // h2 is the largest location: at the end of the array, we fall back
+      // on the scalar code rather than reading past the fingerprints
+      if (!xor_avx2_all_le(h2, 3 * blockLength - 4)) {
+        for (size_t j = 0; j < 8; j++) {
+          out[i + j] = xor8_contain(keys[i + j], filter);
+        }
+        continue;
+      }
+      __m256i x = _mm256_xor_si256(f, _mm256_i32gather_epi32(base, h0, 1));
+      x = _mm256_xor_si256(x, _mm256_i32gather_epi32(base, h1, 1));
+      x = _mm256_xor_si256(x, _mm256_i32gather_epi32(base, h2, 1));
+      __m256i hit = _mm256_cmpeq_epi32(_mm256_and_si256(x, fmask), _mm256_setzero_si256());
+      unsigned bits = (unsigned)_mm256_movemask_ps(_mm256_castsi256_ps(hit));
+      for (size_t j = 0; j < 8; j++) {
+        out[i + j] = (bits >> j) & 1;
+      }
+    }
+  }
+  for (; i < count; i++) {
+    out[i] = xor8_contain(keys[i], filter);
+  }
+}
+
+// Report, for each of the 'count' keys, if it is in the set, with false
+// positive rate, using AVX2 gathers eight keys at a time. The answer for
+// keys[i] is written to out[i] and is identical to xor16_contain.
+// The processor must support AVX2, xor16_contain_batch checks it for you.
+XOR_TARGET_AVX2
+static inline void xor16_contain_batch_avx2(const uint64_t *keys, size_t count,
+                                            bool *out, const xor16_t *filter) {
+  const uint32_t blockLength = (uint32_t)filter->blockLength;
+  size_t i = 0;
+  // The gathers load 32 bits at each 16-bit location, and use signed indexes.
+  if (3 * (uint64_t)blockLength <= INT32_MAX) {
+    const int *base = (const int *)(const void *)filter->fingerprints;
+    const __m256i fmask = _mm256_set1_epi32(0xFFFF);
+    for (; i + 8 <= count; i += 8) {
+      __m256i f, h0, h1, h2;
+      xor_avx2_hash8(keys + i, filter->seed, blockLength, &f, &h0, &h1, &h2);
+      if (!xor_avx2_all_le(h2, 3 * blockLength - 2)) {
+        for (size_t j = 0; j < 8; j++) {
+          out[i + j] = xor16_contain(keys[i + j], filter);
+        }
+        continue;
+      }
+      __m256i x = _mm256_xor_si256(f, _mm256_i32gather_epi32(base, h0, 2));
+      x = _mm256_xor_si256(x, _mm256_i32gather_epi32(base, h1, 2));
+      x = _mm256_xor_si256(x, _mm256_i32gather_epi32(base, h2, 2));
+      __m256i hit = _mm256_cmpeq_epi32(_mm256_and_si256(x, fmask), _mm256_setzero_si256());
+      unsigned bits = (unsigned)_mm256_movemask_ps(_mm256_castsi256_ps(hit));
+      for (size_t j = 0; j < 8; j++) {
+        out[i + j] = (bits >> j) & 1;
+      }
+    }
+  }
+  for (; i < count; i++) {
+    out[i] = xor16_contain(keys[i], filter);
+  }
+}
+
+/**
+ * AVX-512 kernels: sixteen keys per iteration. The keys are hashed with the
+ * native 64-bit multiplication (vpmullq) in two halves of eight, and the
+ * locations, narrowed to 32 bits, feed 16-lane masked gathers.
+ ***/
+
+XOR_TARGET_AVX512
+static inline __m512i xor_avx512_murmur64(__m512i h) {
+  h = _mm512_xor_si512(h, _mm512_srli_epi64(h, 33));
+  h = _mm512_mullo_epi64(h, _mm512_set1_epi64((long long)UINT64_C(0xff51afd7ed558ccd)));
+  h = _mm512_xor_si512(h, _mm512_srli_epi64(h, 33));
+  h = _mm512_mullo_epi64(h, _mm512_set1_epi64((long long)UINT64_C(0xc4ceb9fe1a85ec53)));
+  h = _mm512_xor_si512(h, _mm512_srli_epi64(h, 33));
+  return h;
+}
+
+// Concatenate the low 32 bits of the lanes of a (lanes 0-7) and b (lanes 8-15).
+XOR_TARGET_AVX512
+static inline __m512i xor_avx512_narrow(__m512i a, __m512i b) {
+  return _mm512_inserti64x4(_mm512_castsi256_si512(_mm512_cvtepi64_epi32(a)),
+                            _mm512_cvtepi64_epi32(b), 1);
+}
+
+// xor_reduce of the low 32 bits of each lane (_mm512_mul_epu32 ignores the others)
+XOR_TARGET_AVX512
+static inline __m512i xor_avx512_reduce(__m512i a, __m512i b, __m512i vbl) {
+  return xor_avx512_narrow(_mm512_srli_epi64(_mm512_mul_epu32(a, vbl), 32),
+                           _mm512_srli_epi64(_mm512_mul_epu32(b, vbl), 32));
+}
+
+// 32-bit gathers at the byte offsets (gather8) or the 16-bit offsets (gather16)
+// of 'index', zero in the lanes outside 'mask'. Without optimization, GCC
+// expands _mm512_mask_i32gather_epi32 to a macro that converts the mask to the
+// signed type of its builtin, which -Wsign-conversion reports.
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wsign-conversion"
+#endif
+XOR_TARGET_AVX512
+static inline __m512i xor_avx512_gather8(__mmask16 mask, __m512i index, const void *base) {
+  return _mm512_mask_i32gather_epi32(_mm512_setzero_si512(), mask, index, base, 1);
+}
+
+XOR_TARGET_AVX512
+static inline __m512i xor_avx512_gather16(__mmask16 mask, __m512i index, const void *base) {
+  return _mm512_mask_i32gather_epi32(_mm512_setzero_si512(), mask, index, base, 2);
+}
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+// Hash the keys selected by 'valid' and compute their fingerprints and
+// locations (32-bit lanes), following xor8_contain.
+XOR_TARGET_AVX512
+static inline void xor_avx512_hash16(const uint64_t *keys, __mmask16 valid,
+                                     uint64_t seed, uint32_t blockLength,
+                                     __m512i *f, __m512i *h0, __m512i *h1,
+                                     __m512i *h2) {
+  const __m512i vseed = _mm512_set1_epi64((long long)seed);
+  const __m512i vbl = _mm512_set1_epi64((long long)blockLength);
+  __m512i ha = xor_avx512_murmur64(
+      _mm512_add_epi64(_mm512_maskz_loadu_epi64((__mmask8)valid, keys), vseed));
+  __m512i hb = xor_avx512_murmur64(
+      _mm512_add_epi64(_mm512_maskz_loadu_epi64((__mmask8)(valid >> 8), keys + 8), vseed));
+  const __m512i vbl32 = _mm512_set1_epi32((int)blockLength);
+  *f = _mm512_xor_si512(xor_avx512_narrow(ha, hb),
+                        xor_avx512_narrow(_mm512_srli_epi64(ha, 32),
+                                          _mm512_srli_epi64(hb, 32)));
+  *h0 = xor_avx512_reduce(ha, hb, vbl);
+  *h1 = _mm512_add_epi32(xor_avx512_reduce(_mm512_rol_epi64(ha, 21),
+                                           _mm512_rol_epi64(hb, 21), vbl), vbl32);
+  *h2 = _mm512_add_epi32(xor_avx512_reduce(_mm512_rol_epi64(ha, 42),
+                                           _mm512_rol_epi64(hb, 42), vbl),
+                         _mm512_add_epi32(vbl32, vbl32));
+}
+
+// Write the answers of the lanes in 'valid' to out, one bool per lane.
+XOR_TARGET_AVX512
+static inline void xor_avx512_store16(bool *out, __mmask16 valid, __mmask16 hits) {
+  _mm512_mask_cvtepi32_storeu_epi8(out, valid, _mm512_maskz_set1_epi32(hits, 1));
+}
+
+// Report, for each of the 'count' keys, if it is in the set, with false
+// positive rate, using AVX-512 sixteen keys at a time. The answer for keys[i]
+// is written to out[i] and is identical to xor8_contain.
+// The processor must support AVX-512 F and DQ, xor8_contain_batch checks it
+// for you.
+XOR_TARGET_AVX512
+static inline void xor8_contain_batch_avx512(const uint64_t *keys, size_t count,
+                                             bool *out, const xor8_t *filter) {
+  const uint32_t blockLength = (uint32_t)filter->blockLength;
+  // The gathers load 32 bits at each byte location, and use signed indexes.
+  if (3 * (uint64_t)blockLength > INT32_MAX) {
+    xor8_contain_batch_scalar(keys, count, out, filter);
+    return;
+  }
+  // The lanes too close to the end of the array are left out of the gathers
+  // and computed one by one.
+  const __m512i vlimit = _mm512_set1_epi32((int)(3 * blockLength - 4));
+  const __m512i fmask = _mm512_set1_epi32(0xFF);
+  for (size_t i = 0; i < count; i += 16) {
+    size_t n = count - i < 16 ? count - i : 16;
+    __mmask16 valid = (__mmask16)((1U << n) - 1);
+    __m512i f, h0, h1, h2;
+    xor_avx512_hash16(keys + i, valid, filter->seed, blockLength, &f, &h0, &h1, &h2);
+    __mmask16 safe = _mm512_mask_cmple_epu32_mask(valid, h2, vlimit);
+    __m512i x = _mm512_xor_si512(f, xor_avx512_gather8(safe, h0, filter->fingerprints));
+    x = _mm512_xor_si512(x, xor_avx512_gather8(safe, h1, filter->fingerprints));
+    x = _mm512_xor_si512(x, xor_avx512_gather8(safe, h2, filter->fingerprints));
+    __mmask16 hits = _mm512_mask_testn_epi32_mask(safe, x, fmask);
+    xor_avx512_store16(out + i, valid, hits);
+    for (unsigned rest = (unsigned)(valid & ~safe); rest != 0; rest &= rest - 1) {
+      size_t j = (size_t)__builtin_ctz(rest);
+      out[i + j] = xor8_contain(keys[i + j], filter);
+    }
+  }
+}
+
+// Report, for each of the 'count' keys, if it is in the set, with false
+// positive rate, using AVX-512 sixteen keys at a time. The answer for keys[i]
+// is written to out[i] and is identical to xor16_contain.
+// The processor must support AVX-512 F and DQ, xor16_contain_batch checks it
+// for you.
+XOR_TARGET_AVX512
+static inline void xor16_contain_batch_avx512(const uint64_t *keys, size_t count,
+                                              bool *out, const xor16_t *filter) {
+  const uint32_t blockLength = (uint32_t)filter->blockLength;
+  // The gathers load 32 bits at each 16-bit location, and use signed indexes.
+  if (3 * (uint64_t)blockLength > INT32_MAX) {
+    xor16_contain_batch_scalar(keys, count, out, filter);
+    return;
+  }
+  const __m512i vlimit = _mm512_set1_epi32((int)(3 * blockLength - 2));
+  const __m512i fmask = _mm512_set1_epi32(0xFFFF);
+  for (size_t i = 0; i < count; i += 16) {
+    size_t n = count - i < 16 ? count - i : 16;
+    __mmask16 valid = (__mmask16)((1U << n) - 1);
+    __m512i f, h0, h1, h2;
+    xor_avx512_hash16(keys + i, valid, filter->seed, blockLength, &f, &h0, &h1, &h2);
+    __mmask16 safe = _mm512_mask_cmple_epu32_mask(valid, h2, vlimit);
+    __m512i x = _mm512_xor_si512(f, xor_avx512_gather16(safe, h0, filter->fingerprints));
+    x = _mm512_xor_si512(x, xor_avx512_gather16(safe, h1, filter->fingerprints));
+    x = _mm512_xor_si512(x, xor_avx512_gather16(safe, h2, filter->fingerprints));
+    __mmask16 hits = _mm512_mask_testn_epi32_mask(safe, x, fmask);
+    xor_avx512_store16(out + i, valid, hits);
+    for (unsigned rest = (unsigned)(valid & ~safe); rest != 0; rest &= rest - 1) {
+      size_t j = (size_t)__builtin_ctz(rest);
+      out[i + j] = xor16_contain(keys[i + j], filter);
+    }
+  }
+}
+#endif // XOR_X64_SIMD
+
+// Returns the fastest kernel supported by both the compiler and the processor.
+static inline int xor_detect_kernel(void) {
+#ifdef XOR_X64_SIMD
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512dq")) {
+    return XOR_KERNEL_AVX512;
+  }
+  if (__builtin_cpu_supports("avx2")) {
+    return XOR_KERNEL_AVX2;
+  }
+#endif
+  return XOR_KERNEL_SCALAR;
+}
+
+// Returns the kernel used by the batch queries. It is detected on first use,
+// and then remains the same for the life of the program.
+static inline int xor_kernel(void) {
+  static int kernel = -1;
+#if defined(__GNUC__) || defined(__clang__)
+  // the batch queries may run on several threads at once (see
+  // binary_fuse_parallel.h), they all detect the same kernel
+  int detected = __atomic_load_n(&kernel, __ATOMIC_RELAXED);
+  if (detected < 0) {
+    detected = xor_detect_kernel();
+    __atomic_store_n(&kernel, detected, __ATOMIC_RELAXED);
+  }
+  return detected;
+#else
+  if (kernel < 0) {
+    kernel = xor_detect_kernel();
+  }
+  return kernel;
+#endif
+}
+
+static inline const char *xor_kernel_name(int kernel) {
+  switch (kernel) {
+  case XOR_KERNEL_AVX2:
+    return "avx2";
+  case XOR_KERNEL_AVX512:
+    return "avx512";
+  default:
+    return "scalar";
+  }
+}
+
+// Report, for each of the 'count' keys, if it is in the set, with false
+// positive rate. The answer for keys[i] is written to out[i].
+// This is much faster than calling xor8_contain in a loop: depending on the
+// processor, it uses AVX-512 or AVX2 gathers, or scalar code with software
+// prefetching (see xor_kernel()).
+static inline void xor8_contain_batch(const uint64_t *keys, size_t count,
+                                      bool *out, const xor8_t *filter) {
+#ifdef XOR_X64_SIMD
+  switch (xor_kernel()) {
+  case XOR_KERNEL_AVX512:
+    xor8_contain_batch_avx512(keys, count, out, filter);
+    return;
+  case XOR_KERNEL_AVX2:
+    xor8_contain_batch_avx2(keys, count, out, filter);
+    return;
+  default:
+    break;
+  }
+#endif
+  xor8_contain_batch_scalar(keys, count, out, filter);
+}
+
+// Report, for each of the 'count' keys, if it is in the set, with false
+// positive rate. The answer for keys[i] is written to out[i].
+// See xor8_contain_batch.
+static inline void xor16_contain_batch(const uint64_t *keys, size_t count,
+                                       bool *out, const xor16_t *filter) {
+#ifdef XOR_X64_SIMD
+  switch (xor_kernel()) {
+  case XOR_KERNEL_AVX512:
+    xor16_contain_batch_avx512(keys, count, out, filter);
+    return;
+  case XOR_KERNEL_AVX2:
+    xor16_contain_batch_avx2(keys, count, out, filter);
+    return;
+  default:
+    break;
+  }
+#endif
+  xor16_contain_batch_scalar(keys, count, out, filter);
+}
+
+//////////////////
+// bitmap and selection vector queries
+//////////////////
+
+// number of keys queried at once by the bitmap and selection vector queries,
+// a multiple of 64
+#define XOR_SELECT_BLOCK 256
+
+static inline uint64_t xor_popcount64(uint64_t x) {
+#if defined(__GNUC__) || defined(__clang__)
+  return (uint64_t)__builtin_popcountll(x);
+#else
+  x = x - ((x >> 1) & UINT64_C(0x5555555555555555));
+  x = (x & UINT64_C(0x3333333333333333)) + ((x >> 2) & UINT64_C(0x3333333333333333));
+  x = (x + (x >> 4)) & UINT64_C(0x0f0f0f0f0f0f0f0f);
+  return (x * UINT64_C(0x0101010101010101)) >> 56;
+#endif
+}
+
+// Pack the 'n' (at most 64) answers of a batch query into the low bits of a
+// word: bit j is set when answers[j] is true.
+static inline uint64_t xor_pack_answers(const bool *answers, size_t n) {
+  uint64_t bits = 0;
+  size_t j = 0;
+  for (; j + 8 <= n; j += 8) {
+    uint64_t bytes;
+    memcpy(&bytes, answers + j, sizeof(bytes));
+    // each byte is 0 or 1: the multiplication moves byte k to bit 56 + k
+    bits |= ((bytes * UINT64_C(0x0102040810204080)) >> 56) << j;
+  }
+  for (; j < n; j++) {
+    bits |= (uint64_t)answers[j] << j;
+  }
+  return bits;
+}
+
+#ifdef XOR_X64_SIMD
+// xor_select_bits with the AVX-512 compress instruction
+XOR_TARGET_AVX512
+static inline size_t xor_select_bits_avx512(uint64_t bits, uint32_t base,
+                                            uint32_t *sel) {
+  __m512i idx = _mm512_add_epi32(_mm512_set1_epi32((int)base),
+                                 _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10,
+                                                   11, 12, 13, 14, 15));
+  const __m512i sixteen = _mm512_set1_epi32(16);
+  size_t n = 0;
+  for (int k = 0; k < 4; k++) {
+    __mmask16 m = (__mmask16)(bits >> (16 * k));
+    _mm512_mask_compressstoreu_epi32(sel + n, m, idx);
+    n += (size_t)xor_popcount64(m);
+    idx = _mm512_add_epi32(idx, sixteen);
+  }
+  return n;
+}
+#endif
+
+// Append base + j to sel for each bit j set in 'bits', and return how many
+// positions were appended. There is no branch per bit, but up to 64 entries
+// of sel may be written.
+static inline size_t xor_select_bits(uint64_t bits, uint32_t base, uint32_t *sel) {
+#ifdef XOR_X64_SIMD
+  if (xor_kernel() == XOR_KERNEL_AVX512) {
+    return xor_select_bits_avx512(bits, base, sel);
+  }
+#endif
+  size_t n = 0;
+  for (uint32_t j = 0; j < 64; j++) {
+    sel[n] = base + j;
+    n += (bits >> j) & 1;
+  }
+  return n;
+}
+
+// Query the 'count' keys and set bit i % 64 of bitmap[i / 64] when keys[i] is in
+// the set (with false positive rate), clearing it otherwise. The bitmap must hold
+// (count + 63) / 64 words; the unused bits of the last word are cleared.
+// Returns the number of keys found.
+static inline size_t xor8_contain_bitmap(const uint64_t *keys, size_t count,
+                                         uint64_t *bitmap,
+                                         const xor8_t *filter) {
+  bool answers[XOR_SELECT_BLOCK];
+  size_t hits = 0;
+  for (size_t start = 0; start < count; start += XOR_SELECT_BLOCK) {
+    size_t m = count - start < XOR_SELECT_BLOCK ? count - start : XOR_SELECT_BLOCK;
+    xor8_contain_batch(keys + start, m, answers, filter);
+    for (size_t j = 0; j < m; j += 64) {
+      uint64_t bits = xor_pack_answers(answers + j, m - j < 64 ? m - j : 64);
+      bitmap[(start + j) / 64] = bits;
+      hits += (size_t)xor_popcount64(bits);
+    }
+  }
+  return hits;
+}
+
+// Query the 'count' keys and write the positions i of the keys found in the set
+// (with false positive rate) to sel, in increasing order. Returns the number of
+// positions written. The count must be less than 2^32 and sel must have room
+// for 'count' positions, rounded up to a multiple of 64.
+static inline size_t xor8_contain_select(const uint64_t *keys, size_t count,
+                                         uint32_t *sel,
+                                         const xor8_t *filter) {
+  bool answers[XOR_SELECT_BLOCK];
+  size_t hits = 0;
+  for (size_t start = 0; start < count; start += XOR_SELECT_BLOCK) {
+    size_t m = count - start < XOR_SELECT_BLOCK ? count - start : XOR_SELECT_BLOCK;
+    xor8_contain_batch(keys + start, m, answers, filter);
+    for (size_t j = 0; j < m; j += 64) {
+      uint64_t bits = xor_pack_answers(answers + j, m - j < 64 ? m - j : 64);
+      hits += xor_select_bits(bits, (uint32_t)(start + j), sel + hits);
+    }
+  }
+  return hits;
+}
+
+// See xor8_contain_bitmap.
+static inline size_t xor16_contain_bitmap(const uint64_t *keys, size_t count,
+                                          uint64_t *bitmap,
+                                          const xor16_t *filter) {
+  bool answers[XOR_SELECT_BLOCK];
+  size_t hits = 0;
+  for (size_t start = 0; start < count; start += XOR_SELECT_BLOCK) {
+    size_t m = count - start < XOR_SELECT_BLOCK ? count - start : XOR_SELECT_BLOCK;
+    xor16_contain_batch(keys + start, m, answers, filter);
+    for (size_t j = 0; j < m; j += 64) {
+      uint64_t bits = xor_pack_answers(answers + j, m - j < 64 ? m - j : 64);
+      bitmap[(start + j) / 64] = bits;
+      hits += (size_t)xor_popcount64(bits);
+    }
+  }
+  return hits;
+}
+
+// See xor8_contain_select.
+static inline size_t xor16_contain_select(const uint64_t *keys, size_t count,
+                                          uint32_t *sel,
+                                          const xor16_t *filter) {
+  bool answers[XOR_SELECT_BLOCK];
+  size_t hits = 0;
+  for (size_t start = 0; start < count; start += XOR_SELECT_BLOCK) {
+    size_t m = count - start < XOR_SELECT_BLOCK ? count - start : XOR_SELECT_BLOCK;
+    xor16_contain_batch(keys + start, m, answers, filter);
+    for (size_t j = 0; j < m; j += 64) {
+      uint64_t bits = xor_pack_answers(answers + j, m - j < 64 ? m - j : 64);
+      hits += xor_select_bits(bits, (uint32_t)(start + j), sel + hits);
+    }
+  }
+  return hits;
+}
+
+static inline size_t xor16_serialization_bytes(xor16_t *filter) {
+  return sizeof(filter->seed) + sizeof(filter->blockLength) +
+      sizeof(uint16_t) * 3 * (size_t)(filter->blockLength);
+}
+
+static inline size_t xor8_serialization_bytes(const xor8_t *filter) {
+  return sizeof(filter->seed) + sizeof(filter->blockLength) +
+      sizeof(uint8_t) * 3 * (size_t)(filter->blockLength);
+}
+
+// serialize a filter to a buffer, the buffer should have a capacity of at least
+// xor16_serialization_bytes(filter) bytes.
+// Native endianess only.
+static inline void xor16_serialize(const xor16_t *filter, char *buffer) {
+  memcpy(buffer, &filter->seed, sizeof(filter->seed));
+  buffer += sizeof(filter->seed);
+  uint64_t block_length = xor_tag_mixer(filter->blockLength);
+  memcpy(buffer, &block_length, sizeof(block_length));
+  buffer += sizeof(filter->blockLength);
+  memcpy(buffer, filter->fingerprints, (size_t)(filter->blockLength) * 3 * sizeof(uint16_t));
+}
+
+// serialize a filter to a buffer, the buffer should have a capacity of at least
+// xor8_serialization_bytes(filter) bytes.
+// Native endianess only.
+static inline void xor8_serialize(const xor8_t *filter, char *buffer) {
+  memcpy(buffer, &filter->seed, sizeof(filter->seed));
+  buffer += sizeof(filter->seed);
+  uint64_t block_length = xor_tag_mixer(filter->blockLength);
+  memcpy(buffer, &block_length, sizeof(block_length));
+  buffer += sizeof(filter->blockLength);
+  memcpy(buffer, filter->fingerprints, (size_t)(filter->blockLength) * 3 * sizeof(uint8_t));
+}
+
+// deserialize a filter from a buffer, returns true on success, false on failure.
+// The output will be reallocated, so the caller should call xor16_free(filter) before
+// if the filter was already allocated. The caller needs to call xor16_free(filter) after.
+// The number of bytes read is xor16_serialization_bytes(filter).
+// Native endianess only.
+static inline bool xor16_deserialize(xor16_t * filter, const char *buffer) {
+  memcpy(&filter->seed, buffer, sizeof(filter->seed));
+  buffer += sizeof(filter->seed);
+  memcpy(&filter->blockLength, buffer, sizeof(filter->blockLength));
+  buffer += sizeof(filter->blockLength);
+  if (!xor_untag_mixer(&filter->blockLength)) {
+    filter->fingerprints = NULL;
+    return false;
+  }
+  filter->fingerprints = (uint16_t*)malloc((size_t)(filter->blockLength) * 3 * sizeof(uint16_t));
+  if(filter->fingerprints == NULL) {
+    return false;
+  }
+  memcpy(filter->fingerprints, buffer, (size_t)(filter->blockLength) * 3 * sizeof(uint16_t));
+  return true;
+}
+
+
+// deserialize a filter from a buffer, returns true on success, false on failure.
+// The output will be reallocated, so the caller should call xor8_free(filter) before
+// if the filter was already allocated. The caller needs to call xor8_free(filter) after.
+// The number of bytes read is xor8_serialization_bytes(filter).
+// Native endianess only.
+static inline bool xor8_deserialize(xor8_t * filter, const char *buffer) {
+  memcpy(&filter->seed, buffer, sizeof(filter->seed));
+  buffer += sizeof(filter->seed);
+  memcpy(&filter->blockLength, buffer, sizeof(filter->blockLength));
+  buffer += sizeof(filter->blockLength);
+  if (!xor_untag_mixer(&filter->blockLength)) {
+    filter->fingerprints = NULL;
+    return false;
+  }
+  filter->fingerprints = (uint8_t*)malloc((size_t)(filter->blockLength) * 3 * sizeof(uint8_t));
+  if(filter->fingerprints == NULL) {
+    return false;
+  }
+  memcpy(filter->fingerprints, buffer, (size_t)(filter->blockLength) * 3 * sizeof(uint8_t));
+  return true;
+}
+
+static inline size_t xor32_serialization_bytes(const xor32_t *filter) {
+  return sizeof(filter->seed) + sizeof(filter->blockLength) +
+      sizeof(uint32_t) * 3 * (size_t)(filter->blockLength);
+}
+
+// serialize a filter to a buffer, the buffer should have a capacity of at least
+// xor32_serialization_bytes(filter) bytes.
+// Native endianess only.
+static inline void xor32_serialize(const xor32_t *filter, char *buffer) {
+  memcpy(buffer, &filter->seed, sizeof(filter->seed));
+  buffer += sizeof(filter->seed);
+  uint64_t block_length = xor_tag_mixer(filter->blockLength);
+  memcpy(buffer, &block_length, sizeof(block_length));
+  buffer += sizeof(filter->blockLength);
+  memcpy(buffer, filter->fingerprints, (size_t)(filter->blockLength) * 3 * sizeof(uint32_t));
+}
+
+// deserialize a filter from a buffer, returns true on success, false on failure.
+// The output will be reallocated, so the caller should call xor32_free(filter) before
+// if the filter was already allocated. The caller needs to call xor32_free(filter) after.
+// The number of bytes read is xor32_serialization_bytes(filter).
+// Native endianess only.
+static inline bool xor32_deserialize(xor32_t * filter, const char *buffer) {
+  memcpy(&filter->seed, buffer, sizeof(filter->seed));
+  buffer += sizeof(filter->seed);
+  memcpy(&filter->blockLength, buffer, sizeof(filter->blockLength));
+  buffer += sizeof(filter->blockLength);
+  if (!xor_untag_mixer(&filter->blockLength)) {
+    filter->fingerprints = NULL;
+    return false;
+  }
+  filter->fingerprints = (uint32_t*)malloc((size_t)(filter->blockLength) * 3 * sizeof(uint32_t));
+  if(filter->fingerprints == NULL) {
+    return false;
+  }
+  memcpy(filter->fingerprints, buffer, (size_t)(filter->blockLength) * 3 * sizeof(uint32_t));
+  return true;
+}
+
+// minimal bitfield implementation
+#define XOR_bitf_w (sizeof(uint8_t) * 8)
+#define XOR_bitf_sz(bits) (((bits) + XOR_bitf_w - 1) / XOR_bitf_w)
+#define XOR_bitf_word(bit) (bit / XOR_bitf_w)
+#define XOR_bitf_bit(bit) ((1U << (bit % XOR_bitf_w)) % 256)
+
+#define XOR_ser(buf, lim, src) do {			\
+	if ((buf) + sizeof src > (lim))		\
+	  return (0);				\
+	memcpy(buf, &src, sizeof src);		\
+	buf += sizeof src;			\
+} while (0)
+
+#define XOR_deser(dst, buf, lim) do {		\
+	if ((buf) + sizeof dst > (lim))		\
+	  return (false);			\
+	memcpy(&dst, buf, sizeof dst);		\
+	buf += sizeof dst;			\
+} while (0)
+
+// return required space for binary_xor{8,16,32}_pack()
+#define XOR_bytesf(xbits) \
+static inline size_t xor ## xbits ## _pack_bytes(const xor ## xbits ## _t *filter) \
+{ \
+  size_t sz = 0; \
+  size_t capacity = (size_t)(3 * filter->blockLength); \
+  sz += sizeof filter->seed; \
   sz += sizeof filter->blockLength; \
   sz += XOR_bitf_sz(capacity); \
   for (size_t i = 0; i < capacity; i++) { \
@@ -1394,7 +2712,8 @@ static inline size_t xor ## xbits ## _pack(const xor ## xbits ## _t *filter, cha
   size_t capacity = (size_t)(3 * filter->blockLength); \
  \
   XOR_ser(buf, e, filter->seed); \
-  XOR_ser(buf, e, filter->blockLength); \
+  uint64_t block_length = xor_tag_mixer(filter->blockLength); \
+  XOR_ser(buf, e, block_length); \
   size_t bsz = XOR_bitf_sz(capacity); \
   if (buf + bsz > e) \
     return (0); \
@@ -1420,6 +2739,8 @@ static inline bool xor ## xbits ## _unpack(xor ## xbits ## _t *filter, const cha
   memset(filter, 0, sizeof *filter); \
   XOR_deser(filter->seed, buf, e); \
   XOR_deser(filter->blockLength, buf, e); \
+  if (!xor_untag_mixer(&filter->blockLength)) \
+    return (false); \
   size_t capacity = (size_t)(3 * filter->blockLength); \
   filter->fingerprints = (uint ## xbits ## _t *)calloc(capacity, sizeof filter->fingerprints[0]); \
   if (filter->fingerprints == NULL) \
@@ -1441,6 +2762,7 @@ XOR_unpackf(xbits) \
 
 XOR_packers(8)
 XOR_packers(16)
+XOR_packers(32)
 
 #undef XOR_packers
 #undef XOR_bytesf
@@ -1,5 +1,8 @@
 #include "binaryfusefilter.h"
 #include "xorfilter.h"
+#if !defined(_WIN32)
+#include "binary_fuse_parallel.h"
+#endif
 #include <assert.h>
 
 #define FNAM(type, action) type##_##action
@@ -31,6 +34,8 @@ GEN_THUNKS(xor8)
 GEN_THUNKS(xor16)
 GEN_THUNKS(binary_fuse8)
 GEN_THUNKS(binary_fuse16)
+GEN_THUNKS(xor32)
+GEN_THUNKS(binary_fuse32)
 
 F3(xor8, buffered_populate, bool, uint64_t*, keys, uint32_t, size, void*, filter)
 F3(xor16, buffered_populate, bool, uint64_t*, keys, uint32_t, size, void*, filter)
@@ -44,7 +49,7 @@ bool test(size_t size, size_t repeated_size, void *filter,
           bool (*deserialize)(void *filter, const char *buffer, size_t len),
           bool (*populate)(uint64_t *keys, uint32_t size, void *filter),
           bool (*contain)(uint64_t key, const void *filter)) {
-  allocate((uint32_t)size, filter);
+  if (!allocate((uint32_t)size, filter)) { return false; }
   // we need some set of values
   uint64_t *big_set = (uint64_t *)malloc(sizeof(uint64_t) * size);
   for (size_t i = 0; i < size - repeated_size; i++) {
@@ -304,6 +309,1505 @@ bool testbinaryfuse16pack(size_t size, size_t repeated_size) {
               binary_fuse16_contain_gen);
 }
 
+bool testxor32(size_t size) {
+  printf("testing xor32\n");
+  xor32_t filter = {0};
+  return test(size, 0, &filter,
+              xor32_allocate_gen,
+              xor32_free_gen,
+              xor32_size_in_bytes_gen,
+              xor32_serialization_bytes_gen,
+              xor32_serialize_gen,
+              xor32_deserialize_gen,
+              xor32_populate_gen,
+              xor32_contain_gen);
+}
+
+bool testxor32pack(size_t size) {
+  printf("testing xor32 pack/unpack\n");
+  xor32_t filter = {0};
+  return test(size, 0, &filter,
+              xor32_allocate_gen,
+              xor32_free_gen,
+              xor32_size_in_bytes_gen,
+              xor32_pack_bytes_gen,
+              xor32_pack_gen,
+              xor32_unpack_gen,
+              xor32_populate_gen,
+              xor32_contain_gen);
+}
+
+bool testbinaryfuse32(size_t size, size_t repeated_size) {
+  printf("testing binary fuse32 with size %zu and %zu duplicates\n", size, repeated_size);
+  binary_fuse32_t filter;
+  return test(size, repeated_size, &filter,
+              binary_fuse32_allocate_gen,
+              binary_fuse32_free_gen,
+              binary_fuse32_size_in_bytes_gen,
+              binary_fuse32_serialization_bytes_gen,
+              binary_fuse32_serialize_gen,
+              binary_fuse32_deserialize_gen,
+              binary_fuse32_populate_gen,
+              binary_fuse32_contain_gen);
+}
+
+bool testbinaryfuse32pack(size_t size, size_t repeated_size) {
+  printf("testing binary fuse32 pack/unpack with size %zu and %zu duplicates\n", size, repeated_size);
+  binary_fuse32_t filter;
+  return test(size, repeated_size, &filter,
+              binary_fuse32_allocate_gen,
+              binary_fuse32_free_gen,
+              binary_fuse32_size_in_bytes_gen,
+              binary_fuse32_pack_bytes_gen,
+              binary_fuse32_pack_gen,
+              binary_fuse32_unpack_gen,
+              binary_fuse32_populate_gen,
+              binary_fuse32_contain_gen);
+}
+
+// A false positive rate of 2^-32 cannot be measured with a few million
+// queries, so we check the residual (the fingerprint of a random key xor its
+// three slots) instead: its low 16 bits must vanish about once in 65536
+// queries, and all 32 bits (a false positive) almost never.
+bool testfpr32(size_t size) {
+  printf("testing the false positive rate of the 32-bit filters with size %zu\n", size);
+  uint64_t *big_set = (uint64_t *)malloc(sizeof(uint64_t) * size);
+  for (size_t i = 0; i < size; i++) {
+    big_set[i] = i;
+  }
+  binary_fuse32_t fuse = {0};
+  xor32_t x = {0};
+  bool ok = binary_fuse32_allocate((uint32_t)size, &fuse) &&
+            binary_fuse32_populate(big_set, (uint32_t)size, &fuse) &&
+            xor32_allocate((uint32_t)size, &x) && xor32_populate(big_set, (uint32_t)size, &x);
+  free(big_set);
+  size_t trials = 10000000;
+  size_t fuse_low = 0, fuse_all = 0, xor_low = 0, xor_all = 0;
+  uint64_t rng = 5678;
+  for (size_t i = 0; i < trials && ok; i++) {
+    uint64_t random_key = binary_fuse_rng_splitmix64(&rng) | (UINT64_C(1) << 63);
+    binary_fuse32_probe_t fp;
+    binary_fuse32_probe_prepare(random_key, &fuse, &fp);
+    uint32_t r = fp.fingerprint ^ fuse.Fingerprints[fp.hashes.h0] ^
+                 fuse.Fingerprints[fp.hashes.h1] ^ fuse.Fingerprints[fp.hashes.h2];
+    fuse_low += (r & 0xFFFF) == 0;
+    fuse_all += r == 0;
+    xor32_probe_t xp;
+    xor32_probe_prepare(random_key, &x, &xp);
+    r = xp.fingerprint ^ x.fingerprints[xp.h0] ^ x.fingerprints[xp.h1] ^ x.fingerprints[xp.h2];
+    xor_low += (r & 0xFFFF) == 0;
+    xor_all += r == 0;
+  }
+  printf(" fuse32 %zu and xor32 %zu false positives out of %zu (16-bit residual: %zu %zu)\n",
+         fuse_all, xor_all, trials, fuse_low, xor_low);
+  printf(" bits per entry %3.2f %3.2f\n",
+         (double)binary_fuse32_size_in_bytes(&fuse) * 8.0 / (double)size,
+         (double)xor32_size_in_bytes(&x) * 8.0 / (double)size);
+  double expected = (double)trials / 65536;
+  ok = ok && fuse_all <= 2 && xor_all <= 2 &&
+       (double)fuse_low > 0.7 * expected && (double)fuse_low < 1.3 * expected &&
+       (double)xor_low > 0.7 * expected && (double)xor_low < 1.3 * expected;
+  binary_fuse32_free(&fuse);
+  xor32_free(&x);
+  return ok;
+}
+
+// queries mixing the keys 0..size-1 with random (mostly absent) keys
+uint64_t *make_batch_queries(size_t size, size_t count) {
+  uint64_t *queries = (uint64_t *)malloc(sizeof(uint64_t) * count);
+  for (size_t i = 0; i < count; i++) {
+    queries[i] = (i % 3 == 0) ? ((uint64_t)rand() << 32U) + (uint64_t)rand()
+                              : (uint64_t)(size == 0 ? i : i % size);
+  }
+  return queries;
+}
+
+// runs the batch query function pointed to by 'kernel' on a filter
+typedef void (*batch_gen_t)(const void *kernel, const uint64_t *keys, size_t count, bool *out,
+                            const void *filter);
+
+// compare a batch query function against the contain function of its filter,
+// with counts below, at and above the prefetch window
+bool test_batch(size_t size, size_t window, void *filter, const void *kernel,
+                bool (*allocate)(uint32_t size, void *filter),
+                void (*free_filter)(void *filter),
+                bool (*populate)(uint64_t *keys, uint32_t size, void *filter),
+                bool (*contain)(uint64_t key, const void *filter),
+                batch_gen_t batch) {
+  if (!allocate((uint32_t)size, filter)) { return false; }
+  uint64_t *big_set = (uint64_t *)malloc(sizeof(uint64_t) * size);
+  for (size_t i = 0; i < size; i++) {
+    big_set[i] = i;
+  }
+  bool populated = populate(big_set, (uint32_t)size, filter);
+  free(big_set);
+  if (!populated) {
+    free_filter(filter);
+    return false;
+  }
+  size_t count = 3 * size + window / 2;
+  uint64_t *queries = make_batch_queries(size, count);
+  bool *out = (bool *)malloc(sizeof(bool) * count);
+  bool ok = true;
+  for (size_t c = 0; c <= count && ok; c = (c < 2 * window) ? c + 1 : c * 2 + 1) {
+    batch(kernel, queries, c, out, filter);
+    for (size_t i = 0; i < c; i++) {
+      if (out[i] != contain(queries[i], filter)) {
+        printf("batch mismatch at %zu (count %zu)\n", i, c);
+        ok = false;
+        break;
+      }
+    }
+  }
+  batch(kernel, queries, count, out, filter);
+  for (size_t i = 0; i < count && ok; i++) {
+    ok = (out[i] == contain(queries[i], filter));
+  }
+  free(out);
+  free(queries);
+  free_filter(filter);
+  return ok;
+}
+
+typedef void (*binary_fuse8_batch_t)(const uint64_t *keys, size_t count, bool *out,
+                                    const binary_fuse8_t *filter);
+
+void binary_fuse8_batch_gen(const void *kernel, const uint64_t *keys, size_t count, bool *out,
+                            const void *filter) {
+  (*(const binary_fuse8_batch_t *)kernel)(keys, count, out, (const binary_fuse8_t *)filter);
+}
+
+// compare a batch query function against binary_fuse8_contain
+bool testbinaryfuse8batch(size_t size, binary_fuse8_batch_t batch, const char *name) {
+  printf("testing binary fuse8 %s queries with size %zu\n", name, size);
+  binary_fuse8_t filter = {0};
+  return test_batch(size, BINARY_FUSE_BATCH_WINDOW, &filter, &batch,
+                    binary_fuse8_allocate_gen,
+                    binary_fuse8_free_gen,
+                    binary_fuse8_populate_gen,
+                    binary_fuse8_contain_gen,
+                    binary_fuse8_batch_gen);
+}
+
+typedef void (*binary_fuse16_batch_t)(const uint64_t *keys, size_t count, bool *out,
+                                    const binary_fuse16_t *filter);
+
+void binary_fuse16_batch_gen(const void *kernel, const uint64_t *keys, size_t count, bool *out,
+                             const void *filter) {
+  (*(const binary_fuse16_batch_t *)kernel)(keys, count, out, (const binary_fuse16_t *)filter);
+}
+
+// compare a batch query function against binary_fuse16_contain
+bool testbinaryfuse16batch(size_t size, binary_fuse16_batch_t batch, const char *name) {
+  printf("testing binary fuse16 %s queries with size %zu\n", name, size);
+  binary_fuse16_t filter = {0};
+  return test_batch(size, BINARY_FUSE_BATCH_WINDOW, &filter, &batch,
+                    binary_fuse16_allocate_gen,
+                    binary_fuse16_free_gen,
+                    binary_fuse16_populate_gen,
+                    binary_fuse16_contain_gen,
+                    binary_fuse16_batch_gen);
+}
+
+typedef void (*xor8_batch_t)(const uint64_t *keys, size_t count, bool *out,
+                             const xor8_t *filter);
+
+void xor8_batch_gen(const void *kernel, const uint64_t *keys, size_t count, bool *out,
+                    const void *filter) {
+  (*(const xor8_batch_t *)kernel)(keys, count, out, (const xor8_t *)filter);
+}
+
+// compare a batch query function against xor8_contain
+bool testxor8batch(size_t size, xor8_batch_t batch, const char *name) {
+  printf("testing xor8 %s queries with size %zu\n", name, size);
+  xor8_t filter = {0};
+  return test_batch(size, XOR_BATCH_WINDOW, &filter, &batch,
+                    xor8_allocate_gen,
+                    xor8_free_gen,
+                    xor8_populate_gen,
+                    xor8_contain_gen,
+                    xor8_batch_gen);
+}
+
+typedef void (*xor16_batch_t)(const uint64_t *keys, size_t count, bool *out,
+                              const xor16_t *filter);
+
+void xor16_batch_gen(const void *kernel, const uint64_t *keys, size_t count, bool *out,
+                     const void *filter) {
+  (*(const xor16_batch_t *)kernel)(keys, count, out, (const xor16_t *)filter);
+}
+
+// compare a batch query function against xor16_contain
+bool testxor16batch(size_t size, xor16_batch_t batch, const char *name) {
+  printf("testing xor16 %s queries with size %zu\n", name, size);
+  xor16_t filter = {0};
+  return test_batch(size, XOR_BATCH_WINDOW, &filter, &batch,
+                    xor16_allocate_gen,
+                    xor16_free_gen,
+                    xor16_populate_gen,
+                    xor16_contain_gen,
+                    xor16_batch_gen);
+}
+
+// the two-phase queries must agree with the one-shot queries, even when many
+// probes are prepared before the first one is finished
+bool testprobes(size_t size) {
+  printf("testing two-phase queries with size %zu\n", size);
+  uint64_t *big_set = (uint64_t *)malloc(sizeof(uint64_t) * size);
+  for (size_t i = 0; i < size; i++) {
+    big_set[i] = i;
+  }
+  binary_fuse8_t f8;
+  binary_fuse16_t f16;
+  xor8_t x8;
+  xor16_t x16;
+  binary_fuse8_allocate((uint32_t)size, &f8);
+  binary_fuse16_allocate((uint32_t)size, &f16);
+  xor8_allocate((uint32_t)size, &x8);
+  xor16_allocate((uint32_t)size, &x16);
+  bool ok = binary_fuse8_populate(big_set, (uint32_t)size, &f8) &&
+            binary_fuse16_populate(big_set, (uint32_t)size, &f16) &&
+            xor8_populate(big_set, (uint32_t)size, &x8) &&
+            xor16_populate(big_set, (uint32_t)size, &x16);
+  free(big_set);
+  const size_t window = 64;
+  size_t count = 2 * size + window;
+  uint64_t *queries = make_batch_queries(size, count);
+  binary_fuse8_probe_t p8[64];
+  binary_fuse16_probe_t p16[64];
+  xor8_probe_t px8[64];
+  xor16_probe_t px16[64];
+  for (size_t start = 0; start + window <= count && ok; start += window) {
+    for (size_t i = 0; i < window; i++) {
+      binary_fuse8_probe_prepare(queries[start + i], &f8, &p8[i]);
+      binary_fuse16_probe_prepare(queries[start + i], &f16, &p16[i]);
+      xor8_probe_prepare(queries[start + i], &x8, &px8[i]);
+      xor16_probe_prepare(queries[start + i], &x16, &px16[i]);
+    }
+    // finish in the reverse order
+    for (size_t i = window; i-- > 0 && ok;) {
+      uint64_t key = queries[start + i];
+      ok = (binary_fuse8_probe_finish(&p8[i], &f8) == binary_fuse8_contain(key, &f8)) &&
+           (binary_fuse16_probe_finish(&p16[i], &f16) == binary_fuse16_contain(key, &f16)) &&
+           (xor8_probe_finish(&px8[i], &x8) == xor8_contain(key, &x8)) &&
+           (xor16_probe_finish(&px16[i], &x16) == xor16_contain(key, &x16));
+      if (!ok) {
+        printf("probe mismatch for key %llu\n", (unsigned long long)key);
+      }
+    }
+  }
+  free(queries);
+  binary_fuse8_free(&f8);
+  binary_fuse16_free(&f16);
+  xor8_free(&x8);
+  xor16_free(&x16);
+  return ok;
+}
+
+// the constructions hash their keys with binary_fuse_hash_keys, every kernel
+// must give binary_fuse_mix_split, whatever the count and the alignment
+bool testhashkeys(void) {
+  printf("testing the construction hashing kernels\n");
+  uint64_t keys[300];
+  uint64_t out[300];
+  uint64_t rng = 5;
+  for (size_t i = 0; i < 300; i++) {
+    keys[i] = binary_fuse_rng_splitmix64(&rng);
+  }
+  bool ok = true;
+  for (size_t n = 0; n < 290 && ok; n += n < 20 ? 1 : 37) {
+    for (size_t offset = 0; offset < 3 && ok; offset++) {
+      const uint64_t seed = keys[n];
+      binary_fuse_hash_keys(keys + offset, n, seed, out);
+      for (size_t i = 0; i < n; i++) {
+        ok = ok && out[i] == binary_fuse_mix_split(keys[offset + i], seed);
+      }
+#ifdef BINARY_FUSE_X64_SIMD
+      if (binary_fuse_detect_kernel() >= BINARY_FUSE_KERNEL_AVX2) {
+        binary_fuse_hash_keys_avx2(keys + offset, n, seed, out);
+        for (size_t i = 0; i < n; i++) {
+          ok = ok && out[i] == binary_fuse_mix_split(keys[offset + i], seed);
+        }
+      }
+      if (binary_fuse_detect_kernel() >= BINARY_FUSE_KERNEL_AVX512) {
+        binary_fuse_hash_keys_avx512(keys + offset, n, seed, out);
+        for (size_t i = 0; i < n; i++) {
+          ok = ok && out[i] == binary_fuse_mix_split(keys[offset + i], seed);
+        }
+      }
+#endif
+    }
+  }
+  return ok;
+}
+
+// a serialized filter records its mixer: the reader accepts its own buffers
+// and rejects one that claims another mixer
+bool testmixertag(void) {
+  printf("testing the mixer tag of the serialized filters (%s)\n", binary_fuse_mixer_name());
+  const uint32_t size = 1000;
+  uint64_t *big_set = (uint64_t *)malloc(sizeof(uint64_t) * size);
+  for (uint32_t i = 0; i < size; i++) {
+    big_set[i] = i;
+  }
+  binary_fuse8_t f8 = {0}, g8 = {0};
+  xor8_t x8 = {0}, y8 = {0};
+  bool ok = binary_fuse8_allocate(size, &f8) && binary_fuse8_populate(big_set, size, &f8) &&
+            xor8_allocate(size, &x8) && xor8_populate(big_set, size, &x8);
+  if (!ok) {
+    binary_fuse8_free(&f8);
+    xor8_free(&x8);
+    free(big_set);
+    return false;
+  }
+  char *fbuffer = (char *)malloc(binary_fuse8_serialization_bytes(&f8));
+  char *xbuffer = (char *)malloc(xor8_serialization_bytes(&x8));
+  binary_fuse8_serialize(&f8, fbuffer);
+  xor8_serialize(&x8, xbuffer);
+  ok = ok && binary_fuse8_deserialize(&g8, fbuffer) && g8.SegmentLength == f8.SegmentLength &&
+       binary_fuse8_contain(size - 1, &g8);
+  binary_fuse8_free(&g8);
+  ok = ok && xor8_deserialize(&y8, xbuffer) && y8.blockLength == x8.blockLength &&
+       xor8_contain(size - 1, &y8);
+  xor8_free(&y8);
+  // the tag is the most significant byte of SegmentLength and of blockLength
+  size_t ftag = sizeof(f8.Seed) + sizeof(f8.Size) + sizeof(f8.SegmentLength) - 1;
+  size_t xtag = sizeof(x8.seed) + sizeof(x8.blockLength) - 1;
+  fbuffer[ftag] = (char)(BINARY_FUSE_MIXER + 1);
+  xbuffer[xtag] = (char)(XOR_MIXER + 1);
+  ok = ok && binary_fuse8_deserialize_header(&g8, fbuffer) == NULL &&
+       !binary_fuse8_deserialize(&g8, fbuffer) && !xor8_deserialize(&y8, xbuffer);
+  free(fbuffer);
+  free(xbuffer);
+  binary_fuse8_free(&f8);
+  xor8_free(&x8);
+  free(big_set);
+  return ok;
+}
+
+// test the batch queries with every kernel the processor supports
+bool testbatchkernels(size_t size) {
+  if(!testbinaryfuse8batch(size, binary_fuse8_contain_batch, "batch")) { return false; }
+  if(!testbinaryfuse16batch(size, binary_fuse16_contain_batch, "batch")) { return false; }
+  if(!testbinaryfuse8batch(size, binary_fuse8_contain_batch_scalar, "scalar")) { return false; }
+  if(!testbinaryfuse16batch(size, binary_fuse16_contain_batch_scalar, "scalar")) { return false; }
+  if(!testxor8batch(size, xor8_contain_batch, "batch")) { return false; }
+  if(!testxor16batch(size, xor16_contain_batch, "batch")) { return false; }
+  if(!testxor8batch(size, xor8_contain_batch_scalar, "scalar")) { return false; }
+  if(!testxor16batch(size, xor16_contain_batch_scalar, "scalar")) { return false; }
+#ifdef BINARY_FUSE_X64_SIMD
+  if(binary_fuse_detect_kernel() >= BINARY_FUSE_KERNEL_AVX2) {
+    if(!testbinaryfuse8batch(size, binary_fuse8_contain_batch_avx2, "avx2")) { return false; }
+    if(!testbinaryfuse16batch(size, binary_fuse16_contain_batch_avx2, "avx2")) { return false; }
+  }
+  if(binary_fuse_detect_kernel() >= BINARY_FUSE_KERNEL_AVX512) {
+    if(!testbinaryfuse8batch(size, binary_fuse8_contain_batch_avx512, "avx512")) { return false; }
+    if(!testbinaryfuse16batch(size, binary_fuse16_contain_batch_avx512, "avx512")) { return false; }
+  }
+#endif
+#ifdef XOR_X64_SIMD
+  if(xor_detect_kernel() >= XOR_KERNEL_AVX2) {
+    if(!testxor8batch(size, xor8_contain_batch_avx2, "avx2")) { return false; }
+    if(!testxor16batch(size, xor16_contain_batch_avx2, "avx2")) { return false; }
+  }
+  if(xor_detect_kernel() >= XOR_KERNEL_AVX512) {
+    if(!testxor8batch(size, xor8_contain_batch_avx512, "avx512")) { return false; }
+    if(!testxor16batch(size, xor16_contain_batch_avx512, "avx512")) { return false; }
+  }
+#endif
+  return true;
+}
+
+// contain_multi must agree with contain on every filter, whether the
+// filters share their seed (family) or not
+bool testmulti(size_t size, size_t n) {
+  printf("testing contain_multi with %zu filters of size %zu\n", n, size);
+  uint64_t *big_set = (uint64_t *)malloc(sizeof(uint64_t) * size);
+  binary_fuse8_t *f8 = (binary_fuse8_t *)malloc(sizeof(binary_fuse8_t) * n);
+  binary_fuse16_t *f16 = (binary_fuse16_t *)malloc(sizeof(binary_fuse16_t) * n);
+  const binary_fuse8_t **p8 = (const binary_fuse8_t **)malloc(sizeof(binary_fuse8_t *) * n);
+  const binary_fuse16_t **p16 = (const binary_fuse16_t **)malloc(sizeof(binary_fuse16_t *) * n);
+  uint64_t *bitmap = (uint64_t *)malloc(sizeof(uint64_t) * ((n + 63) / 64));
+  bool ok = true;
+  size_t shared = 0;
+  for (size_t l = 0; l < n && ok; l++) {
+    // level l holds the multiples of l + 1
+    for (size_t i = 0; i < size; i++) {
+      big_set[i] = i * (l + 1);
+    }
+    binary_fuse8_allocate((uint32_t)size, &f8[l]);
+    binary_fuse16_allocate((uint32_t)size, &f16[l]);
+    if (l % 5 == 4) {
+      // not part of the family
+      ok = binary_fuse8_populate(big_set, (uint32_t)size, &f8[l]) &&
+           binary_fuse16_populate(big_set, (uint32_t)size, &f16[l]);
+    } else {
+      ok = binary_fuse8_populate_family(big_set, (uint32_t)size, 1234, &f8[l]) &&
+           binary_fuse16_populate_family(big_set, (uint32_t)size, 1234, &f16[l]);
+      shared += (f8[l].Seed == f8[0].Seed);
+    }
+    p8[l] = &f8[l];
+    p16[l] = &f16[l];
+  }
+  // most of the family share the seed
+  ok = ok && (shared * 2 > n);
+  for (uint64_t key = 0; key < 4 * size && ok; key += 3) {
+    binary_fuse8_contain_multi(key, p8, n, bitmap);
+    for (size_t l = 0; l < n && ok; l++) {
+      ok = (((bitmap[l / 64] >> (l % 64)) & 1) == binary_fuse8_contain(key, &f8[l]));
+    }
+    binary_fuse16_contain_multi(key, p16, n, bitmap);
+    for (size_t l = 0; l < n && ok; l++) {
+      ok = (((bitmap[l / 64] >> (l % 64)) & 1) == binary_fuse16_contain(key, &f16[l]));
+    }
+  }
+  for (size_t l = 0; l < n; l++) {
+    binary_fuse8_free(&f8[l]);
+    binary_fuse16_free(&f16[l]);
+  }
+  free(bitmap);
+  free(p16);
+  free(p8);
+  free(f16);
+  free(f8);
+  free(big_set);
+  return ok;
+}
+
+// check a bitmap and a selection vector against the answers of contain
+static bool check_select(const bool *expected, size_t count, const uint64_t *bitmap,
+                         size_t bitmap_hits, const uint32_t *sel, size_t sel_hits) {
+  size_t hits = 0;
+  for (size_t i = 0; i < count; i++) {
+    if (((bitmap[i / 64] >> (i % 64)) & 1) != expected[i]) {
+      printf("bitmap mismatch at %zu\n", i);
+      return false;
+    }
+    if (expected[i]) {
+      if (hits >= sel_hits || sel[hits] != i) {
+        printf("selection vector mismatch at %zu\n", i);
+        return false;
+      }
+      hits++;
+    }
+  }
+  if (count % 64 != 0 && (bitmap[count / 64] >> (count % 64)) != 0) {
+    printf("unused bitmap bits are set\n");
+    return false;
+  }
+  return hits == bitmap_hits && hits == sel_hits;
+}
+
+bool testselect(size_t size) {
+  printf("testing bitmap and selection vector queries with size %zu\n", size);
+  uint64_t *big_set = (uint64_t *)malloc(sizeof(uint64_t) * size);
+  for (size_t i = 0; i < size; i++) {
+    big_set[i] = i;
+  }
+  binary_fuse8_t f8;
+  binary_fuse16_t f16;
+  xor8_t x8;
+  xor16_t x16;
+  binary_fuse8_allocate((uint32_t)size, &f8);
+  binary_fuse16_allocate((uint32_t)size, &f16);
+  xor8_allocate((uint32_t)size, &x8);
+  xor16_allocate((uint32_t)size, &x16);
+  bool ok = binary_fuse8_populate(big_set, (uint32_t)size, &f8) &&
+            binary_fuse16_populate(big_set, (uint32_t)size, &f16) &&
+            xor8_populate(big_set, (uint32_t)size, &x8) &&
+            xor16_populate(big_set, (uint32_t)size, &x16);
+  free(big_set);
+  size_t max_count = 2 * size + 300;
+  uint64_t *queries = make_batch_queries(size, max_count);
+  bool *expected = (bool *)malloc(sizeof(bool) * max_count);
+  uint64_t *bitmap = (uint64_t *)malloc(sizeof(uint64_t) * ((max_count + 63) / 64));
+  uint32_t *sel = (uint32_t *)malloc(sizeof(uint32_t) * ((max_count + 63) / 64 * 64));
+  size_t counts[] = {0, 1, 63, 64, 65, 256, 257, max_count};
+  for (size_t c = 0; c < sizeof(counts) / sizeof(counts[0]) && ok; c++) {
+    size_t count = counts[c];
+    for (size_t i = 0; i < count; i++) expected[i] = binary_fuse8_contain(queries[i], &f8);
+    size_t bh = binary_fuse8_contain_bitmap(queries, count, bitmap, &f8);
+    size_t sh = binary_fuse8_contain_select(queries, count, sel, &f8);
+    ok = ok && check_select(expected, count, bitmap, bh, sel, sh);
+    for (size_t i = 0; i < count; i++) expected[i] = binary_fuse16_contain(queries[i], &f16);
+    bh = binary_fuse16_contain_bitmap(queries, count, bitmap, &f16);
+    sh = binary_fuse16_contain_select(queries, count, sel, &f16);
+    ok = ok && check_select(expected, count, bitmap, bh, sel, sh);
+    for (size_t i = 0; i < count; i++) expected[i] = xor8_contain(queries[i], &x8);
+    bh = xor8_contain_bitmap(queries, count, bitmap, &x8);
+    sh = xor8_contain_select(queries, count, sel, &x8);
+    ok = ok && check_select(expected, count, bitmap, bh, sel, sh);
+    for (size_t i = 0; i < count; i++) expected[i] = xor16_contain(queries[i], &x16);
+    bh = xor16_contain_bitmap(queries, count, bitmap, &x16);
+    sh = xor16_contain_select(queries, count, sel, &x16);
+    ok = ok && check_select(expected, count, bitmap, bh, sel, sh);
+  }
+  free(sel);
+  free(bitmap);
+  free(expected);
+  free(queries);
+  binary_fuse8_free(&f8);
+  binary_fuse16_free(&f16);
+  xor8_free(&x8);
+  xor16_free(&x16);
+  return ok;
+}
+
+// the blocked filters must contain every key, agree with their batch queries,
+// and have about the false positive rate of the unblocked filters
+bool testblocked(size_t size, size_t repeated_size) {
+  printf("testing blocked binary fuse with size %zu and %zu duplicates\n", size, repeated_size);
+  uint64_t *big_set = (uint64_t *)malloc(sizeof(uint64_t) * (size + 1));
+  for (size_t i = 0; i < size - repeated_size; i++) {
+    big_set[i] = i;
+  }
+  for (size_t i = 0; i < repeated_size; i++) {
+    big_set[size - i - 1] = i;
+  }
+  binary_fuse8_blocked_t f8 = {0};
+  binary_fuse16_blocked_t f16 = {0};
+  bool ok = binary_fuse8_blocked_allocate((uint32_t)size, &f8) &&
+            binary_fuse16_blocked_allocate((uint32_t)size, &f16) &&
+            binary_fuse8_blocked_populate(big_set, (uint32_t)size, &f8) &&
+            binary_fuse16_blocked_populate(big_set, (uint32_t)size, &f16);
+  for (size_t i = 0; i < size && ok; i++) {
+    ok = binary_fuse8_blocked_contain(big_set[i], &f8) &&
+         binary_fuse16_blocked_contain(big_set[i], &f16);
+  }
+  free(big_set);
+  size_t count = 3 * size + BINARY_FUSE_BATCH_WINDOW / 2;
+  uint64_t *queries = make_batch_queries(size, count);
+  bool *out = (bool *)malloc(sizeof(bool) * count);
+  for (size_t c = 0; c <= count && ok; c = (c < 2 * BINARY_FUSE_BATCH_WINDOW) ? c + 1 : c * 2 + 1) {
+    binary_fuse8_blocked_contain_batch(queries, c, out, &f8);
+    for (size_t i = 0; i < c; i++) {
+      ok = ok && (out[i] == binary_fuse8_blocked_contain(queries[i], &f8));
+    }
+    binary_fuse16_blocked_contain_batch(queries, c, out, &f16);
+    for (size_t i = 0; i < c; i++) {
+      ok = ok && (out[i] == binary_fuse16_blocked_contain(queries[i], &f16));
+    }
+  }
+  free(out);
+  free(queries);
+  if (ok) {
+    size_t matches8 = 0, matches16 = 0;
+    size_t trials = 10000000;
+    uint64_t rng = 1234;
+    for (size_t i = 0; i < trials; i++) {
+      uint64_t random_key = binary_fuse_rng_splitmix64(&rng) | (UINT64_C(1) << 63);
+      matches8 += binary_fuse8_blocked_contain(random_key, &f8);
+      matches16 += binary_fuse16_blocked_contain(random_key, &f16);
+    }
+    double fpp8 = (double)matches8 / (double)trials;
+    double fpp16 = (double)matches16 / (double)trials;
+    printf(" fpp %3.5f %3.7f (estimated), bits per entry %3.2f %3.2f\n", fpp8, fpp16,
+           (double)binary_fuse8_blocked_size_in_bytes(&f8) * 8.0 / (double)size,
+           (double)binary_fuse16_blocked_size_in_bytes(&f16) * 8.0 / (double)size);
+    ok = fpp8 < 1.5 / 256 && fpp16 < 1.5 / 65536;
+  }
+  binary_fuse8_blocked_free(&f8);
+  binary_fuse16_blocked_free(&f16);
+  return ok;
+}
+
+typedef void (*binary_fuse8_4wise_batch_t)(const uint64_t *, size_t, bool *,
+                                           const binary_fuse8_4wise_t *);
+typedef void (*binary_fuse16_4wise_batch_t)(const uint64_t *, size_t, bool *,
+                                            const binary_fuse16_4wise_t *);
+
+// every batch kernel must agree with contain, including on the keys whose
+// locations are at the very end of the array
+static bool check_4wise_batch(size_t size, binary_fuse8_4wise_batch_t batch8,
+                              binary_fuse16_4wise_batch_t batch16,
+                              const binary_fuse8_4wise_t *f8,
+                              const binary_fuse16_4wise_t *f16) {
+  size_t count = 3 * size + BINARY_FUSE_BATCH_WINDOW / 2;
+  uint64_t *queries = make_batch_queries(size, count);
+  bool *out = (bool *)malloc(sizeof(bool) * count);
+  bool ok = true;
+  for (size_t c = 0; c <= count && ok; c = (c < 2 * BINARY_FUSE_BATCH_WINDOW) ? c + 1 : c * 2 + 1) {
+    batch8(queries, c, out, f8);
+    for (size_t i = 0; i < c; i++) {
+      ok = ok && (out[i] == binary_fuse8_4wise_contain(queries[i], f8));
+    }
+    batch16(queries, c, out, f16);
+    for (size_t i = 0; i < c; i++) {
+      ok = ok && (out[i] == binary_fuse16_4wise_contain(queries[i], f16));
+    }
+  }
+  free(out);
+  free(queries);
+  return ok;
+}
+
+bool test4wise(size_t size, size_t repeated_size) {
+  printf("testing 4-wise binary fuse with size %zu and %zu duplicates\n", size, repeated_size);
+  uint64_t *big_set = (uint64_t *)malloc(sizeof(uint64_t) * (size + 1));
+  for (size_t i = 0; i < size - repeated_size; i++) {
+    big_set[i] = i;
+  }
+  for (size_t i = 0; i < repeated_size; i++) {
+    big_set[size - i - 1] = i;
+  }
+  binary_fuse8_4wise_t f8 = {0};
+  binary_fuse16_4wise_t f16 = {0};
+  bool ok = binary_fuse8_4wise_allocate((uint32_t)size, &f8) &&
+            binary_fuse16_4wise_allocate((uint32_t)size, &f16) &&
+            binary_fuse8_4wise_populate(big_set, (uint32_t)size, &f8) &&
+            binary_fuse16_4wise_populate(big_set, (uint32_t)size, &f16);
+  for (size_t i = 0; i < size && ok; i++) {
+    ok = binary_fuse8_4wise_contain(big_set[i], &f8) &&
+         binary_fuse16_4wise_contain(big_set[i], &f16);
+  }
+  free(big_set);
+  ok = ok && check_4wise_batch(size, binary_fuse8_4wise_contain_batch,
+                               binary_fuse16_4wise_contain_batch, &f8, &f16);
+  ok = ok && check_4wise_batch(size, binary_fuse8_4wise_contain_batch_scalar,
+                               binary_fuse16_4wise_contain_batch_scalar, &f8, &f16);
+#ifdef BINARY_FUSE_X64_SIMD
+  if(binary_fuse_detect_kernel() >= BINARY_FUSE_KERNEL_AVX2) {
+    ok = ok && check_4wise_batch(size, binary_fuse8_4wise_contain_batch_avx2,
+                                 binary_fuse16_4wise_contain_batch_avx2, &f8, &f16);
+  }
+  if(binary_fuse_detect_kernel() >= BINARY_FUSE_KERNEL_AVX512) {
+    ok = ok && check_4wise_batch(size, binary_fuse8_4wise_contain_batch_avx512,
+                                 binary_fuse16_4wise_contain_batch_avx512, &f8, &f16);
+  }
+#endif
+  if (ok) {
+    size_t matches8 = 0, matches16 = 0;
+    size_t trials = 10000000;
+    uint64_t rng = 1234;
+    for (size_t i = 0; i < trials; i++) {
+      uint64_t random_key = binary_fuse_rng_splitmix64(&rng) | (UINT64_C(1) << 63);
+      matches8 += binary_fuse8_4wise_contain(random_key, &f8);
+      matches16 += binary_fuse16_4wise_contain(random_key, &f16);
+    }
+    double fpp8 = (double)matches8 / (double)trials;
+    double fpp16 = (double)matches16 / (double)trials;
+    printf(" fpp %3.5f %3.7f (estimated), bits per entry %3.2f %3.2f\n", fpp8, fpp16,
+           (double)binary_fuse8_4wise_size_in_bytes(&f8) * 8.0 / (double)size,
+           (double)binary_fuse16_4wise_size_in_bytes(&f16) * 8.0 / (double)size);
+    ok = fpp8 < 1.5 / 256 && fpp16 < 1.5 / 65536;
+  }
+  binary_fuse8_4wise_free(&f8);
+  binary_fuse16_4wise_free(&f16);
+  return ok;
+}
+
+typedef void (*binary_fuse_bitpacked_batch_t)(const uint64_t *, size_t, bool *,
+                                              const binary_fuse_bitpacked_t *);
+
+// every fingerprint width must keep all the keys, have a false positive rate
+// of about 2^-bits, survive serialization, and every batch kernel must agree
+// with contain
+bool testbitpacked(size_t size) {
+  printf("testing bit-packed binary fuse with size %zu\n", size);
+  const uint32_t widths[] = {4, 7, 10, 12, 16, 20};
+  binary_fuse_bitpacked_batch_t kernels[3] = {binary_fuse_bitpacked_contain_batch,
+                                              binary_fuse_bitpacked_contain_batch_scalar, NULL};
+#ifdef BINARY_FUSE_X64_SIMD
+  if(binary_fuse_detect_kernel() >= BINARY_FUSE_KERNEL_AVX512) {
+    kernels[2] = binary_fuse_bitpacked_contain_batch_avx512;
+  } else if(binary_fuse_detect_kernel() >= BINARY_FUSE_KERNEL_AVX2) {
+    kernels[2] = binary_fuse_bitpacked_contain_batch_avx2;
+  }
+#endif
+  uint64_t *big_set = (uint64_t *)malloc(sizeof(uint64_t) * (size + 1));
+  size_t count = 3 * size + BINARY_FUSE_BATCH_WINDOW / 2;
+  uint64_t *queries = make_batch_queries(size, count);
+  bool *out = (bool *)malloc(sizeof(bool) * count);
+  bool ok = true;
+  binary_fuse_bitpacked_t filter;
+  if (binary_fuse_bitpacked_allocate((uint32_t)size, 3, &filter) ||
+      binary_fuse_bitpacked_allocate((uint32_t)size, 21, &filter)) {
+    printf("widths out of range should be rejected\n");
+    ok = false;
+  }
+  for (size_t w = 0; w < sizeof(widths) / sizeof(widths[0]) && ok; w++) {
+    for (size_t i = 0; i < size; i++) {
+      big_set[i] = i;
+    }
+    ok = binary_fuse_bitpacked_allocate((uint32_t)size, widths[w], &filter) &&
+         binary_fuse_bitpacked_populate(big_set, (uint32_t)size, &filter);
+    size_t buffer_size = binary_fuse_bitpacked_serialization_bytes(&filter);
+    char *buffer = (char *)malloc(buffer_size);
+    binary_fuse_bitpacked_serialize(&filter, buffer);
+    binary_fuse_bitpacked_free(&filter);
+    ok = ok && binary_fuse_bitpacked_deserialize(&filter, buffer);
+    free(buffer);
+    for (size_t i = 0; i < size && ok; i++) {
+      ok = binary_fuse_bitpacked_contain(big_set[i], &filter);
+    }
+    for (size_t k = 0; k < 3 && ok; k++) {
+      if (kernels[k] == NULL) {
+        continue;
+      }
+      kernels[k](queries, count, out, &filter);
+      for (size_t i = 0; i < count; i++) {
+        ok = ok && (out[i] == binary_fuse_bitpacked_contain(queries[i], &filter));
+      }
+    }
+    if (ok) {
+      size_t matches = 0;
+      size_t trials = 2000000;
+      uint64_t rng = 1234;
+      for (size_t i = 0; i < trials; i++) {
+        uint64_t random_key = binary_fuse_rng_splitmix64(&rng) | (UINT64_C(1) << 63);
+        matches += binary_fuse_bitpacked_contain(random_key, &filter);
+      }
+      double expected = (double)trials / (double)(UINT64_C(1) << widths[w]);
+      printf(" %2u bits: fpp %3.7f (estimated), bits per entry %3.2f\n", widths[w],
+             (double)matches / (double)trials,
+             (double)binary_fuse_bitpacked_size_in_bytes(&filter) * 8.0 / (double)size);
+      ok = (double)matches < 1.5 * expected + 10;
+    }
+    binary_fuse_bitpacked_free(&filter);
+  }
+  free(out);
+  free(queries);
+  free(big_set);
+  return ok;
+}
+
+// below 2^32 keys, the 64-bit filters must be the 32-bit ones; above, their
+// mapping must stay in the array
+bool testlarge(size_t size, size_t repeated_size) {
+  printf("testing 64-bit binary fuse with size %zu and %zu duplicates\n", size, repeated_size);
+  uint64_t *keys = (uint64_t *)malloc(sizeof(uint64_t) * (size + 1));
+  uint64_t *copy = (uint64_t *)malloc(sizeof(uint64_t) * (size + 1));
+  uint64_t rng = 14;
+  for (size_t i = 0; i < size - repeated_size; i++) {
+    keys[i] = binary_fuse_rng_splitmix64(&rng);
+  }
+  for (size_t i = 0; i < repeated_size; i++) {
+    keys[size - i - 1] = keys[i];
+  }
+  binary_fuse8_large_t l8 = {0};
+  binary_fuse16_large_t l16 = {0};
+  binary_fuse8_t s8 = {0};
+  binary_fuse16_t s16 = {0};
+  bool ok = binary_fuse8_large_allocate(size, &l8) && binary_fuse16_large_allocate(size, &l16) &&
+            binary_fuse8_allocate((uint32_t)size, &s8) &&
+            binary_fuse16_allocate((uint32_t)size, &s16);
+  if (ok) {
+    memcpy(copy, keys, sizeof(uint64_t) * size);
+    ok = binary_fuse8_large_populate(copy, size, &l8);
+    memcpy(copy, keys, sizeof(uint64_t) * size);
+    ok = ok && binary_fuse16_large_populate(copy, size, &l16);
+    memcpy(copy, keys, sizeof(uint64_t) * size);
+    ok = ok && binary_fuse8_populate(copy, (uint32_t)size, &s8);
+    memcpy(copy, keys, sizeof(uint64_t) * size);
+    ok = ok && binary_fuse16_populate(copy, (uint32_t)size, &s16);
+  }
+  ok = ok && l8.Seed == s8.Seed && l8.ArrayLength == s8.ArrayLength &&
+       l16.Seed == s16.Seed && l16.ArrayLength == s16.ArrayLength &&
+       memcmp(l8.Fingerprints, s8.Fingerprints, s8.ArrayLength * sizeof(uint8_t)) == 0 &&
+       memcmp(l16.Fingerprints, s16.Fingerprints, s16.ArrayLength * sizeof(uint16_t)) == 0;
+  if (ok) {
+    size_t bytes8 = binary_fuse8_large_serialization_bytes(&l8);
+    size_t bytes16 = binary_fuse16_large_serialization_bytes(&l16);
+    char *buffer = (char *)malloc(bytes8 > bytes16 ? bytes8 : bytes16);
+    binary_fuse8_large_serialize(&l8, buffer);
+    binary_fuse8_large_free(&l8);
+    ok = binary_fuse8_large_deserialize(&l8, buffer);
+    binary_fuse16_large_serialize(&l16, buffer);
+    binary_fuse16_large_free(&l16);
+    ok = ok && binary_fuse16_large_deserialize(&l16, buffer);
+    free(buffer);
+  }
+  for (size_t i = 0; i < size && ok; i++) {
+    ok = binary_fuse8_large_contain(keys[i], &l8) && binary_fuse16_large_contain(keys[i], &l16);
+  }
+  // the mapping of about 6 billion keys, without the memory of such a filter
+  binary_fuse8_large_t big;
+  memset(&big, 0, sizeof(big));
+  big.SegmentLength = 262144;
+  big.SegmentLengthMask = big.SegmentLength - 1;
+  big.SegmentCount = 25748;
+  big.SegmentCountLength = big.SegmentCount * big.SegmentLength;
+  big.ArrayLength = (big.SegmentCount + 2) * big.SegmentLength;
+  size_t above = 0;
+  for (size_t i = 0; i < 100000 && ok; i++) {
+    uint64_t hash = binary_fuse_rng_splitmix64(&rng);
+    binary_large_hashes_t h = binary_fuse8_large_hash_batch(hash, &big);
+    ok = h.h0 < h.h1 && h.h1 < h.h2 && h.h2 < big.ArrayLength &&
+         h.h2 - h.h0 < 3 * (uint64_t)big.SegmentLength &&
+         h.h0 == binary_fuse8_large_hash(0, hash, &big) &&
+         h.h1 == binary_fuse8_large_hash(1, hash, &big) &&
+         h.h2 == binary_fuse8_large_hash(2, hash, &big);
+    above += h.h2 > UINT32_MAX;
+  }
+  ok = ok && above > 0;
+  binary_fuse8_large_free(&l8);
+  binary_fuse16_large_free(&l16);
+  binary_fuse8_free(&s8);
+  binary_fuse16_free(&s16);
+  free(copy);
+  free(keys);
+  return ok;
+}
+
+// the low-memory construction must contain every key, with the false
+// positive rate of the standard one
+bool testlowmem(size_t size, size_t repeated_size) {
+  printf("testing binary fuse populate_lowmem with size %zu and %zu duplicates\n", size,
+         repeated_size);
+  uint64_t *keys = (uint64_t *)malloc(sizeof(uint64_t) * (size + 1));
+  uint64_t rng = 15;
+  for (size_t i = 0; i < size - repeated_size; i++) {
+    keys[i] = binary_fuse_rng_splitmix64(&rng);
+  }
+  for (size_t i = 0; i < repeated_size; i++) {
+    keys[size - i - 1] = keys[i];
+  }
+  binary_fuse8_t f8 = {0};
+  binary_fuse16_t f16 = {0};
+  bool ok = binary_fuse8_allocate((uint32_t)size, &f8) &&
+            binary_fuse16_allocate((uint32_t)size, &f16);
+  // the filters are not cleared, as when they are built again
+  if (ok) {
+    memset(f8.Fingerprints, 0xA5, f8.ArrayLength * sizeof(uint8_t));
+    memset(f16.Fingerprints, 0xA5, f16.ArrayLength * sizeof(uint16_t));
+  }
+  ok = ok && binary_fuse8_populate_lowmem(keys, (uint32_t)size, &f8);
+  ok = ok && binary_fuse16_populate_lowmem(keys, (uint32_t)size, &f16);
+  for (size_t i = 0; i < size && ok; i++) {
+    ok = binary_fuse8_contain(keys[i], &f8) && binary_fuse16_contain(keys[i], &f16);
+  }
+  size_t matches8 = 0, matches16 = 0, trials = 1000000;
+  for (size_t i = 0; i < trials && ok; i++) {
+    uint64_t key = binary_fuse_rng_splitmix64(&rng);
+    matches8 += binary_fuse8_contain(key, &f8);
+    matches16 += binary_fuse16_contain(key, &f16);
+  }
+  if (ok && size >= 1000 && (matches8 * 200 > trials || matches16 * 20000 > trials)) {
+    printf("false positive rates %f %f\n", (double)matches8 / (double)trials,
+           (double)matches16 / (double)trials);
+    ok = false;
+  }
+  // a filter of another size is rejected
+  ok = ok && !binary_fuse8_populate_lowmem(keys, (uint32_t)size + 1, &f8);
+  binary_fuse8_free(&f8);
+  binary_fuse16_free(&f16);
+  free(keys);
+  return ok;
+}
+
+// a workspace reused across filters of several sizes, duplicated keys
+// included, must build the filters populate builds and be left cleared
+static bool workspace_cleared(const binary_fuse_workspace_t *fw, const xor_workspace_t *xw) {
+  for (size_t i = 0; i <= fw->KeyCapacity; i++) {
+    if (fw->reverseOrder[i] != 0) { return false; }
+  }
+  for (size_t i = 0; i < fw->CellCapacity; i++) {
+    if (fw->t2count[i] != 0 || fw->t2hash[i] != 0) { return false; }
+  }
+  for (size_t i = 0; i < xw->cellCapacity; i++) {
+    if (xw->sets[i].count != 0 || xw->sets[i].xormask != 0) { return false; }
+  }
+  return true;
+}
+
+bool testworkspace(size_t size, size_t repeated_size) {
+  printf("testing construction workspaces with size %zu and %zu duplicates\n", size,
+         repeated_size);
+  uint64_t *keys = (uint64_t *)malloc(sizeof(uint64_t) * (size + 1));
+  uint64_t rng = 17;
+  binary_fuse_workspace_t fw = {0};
+  xor_workspace_t xw = {0};
+  // sized for a quarter of the keys, the workspaces must grow
+  bool ok = binary_fuse_workspace_allocate((uint32_t)(size / 4), &fw) &&
+            xor_workspace_allocate((uint32_t)(size / 4), &xw);
+  // the xor filters cannot be built without keys
+  size_t sizes[] = {size / 4 + 1, size, size / 2 + 1, 1, size};
+  for (size_t t = 0; t < sizeof(sizes) / sizeof(sizes[0]) && ok; t++) {
+    size_t n = sizes[t];
+    size_t repeated = repeated_size < n ? repeated_size : 0;
+    for (size_t i = 0; i < n - repeated; i++) {
+      keys[i] = binary_fuse_rng_splitmix64(&rng);
+    }
+    for (size_t i = 0; i < repeated; i++) {
+      keys[n - i - 1] = keys[i];
+    }
+    binary_fuse16_t f1 = {0}, f2 = {0};
+    xor8_t x1 = {0}, x2 = {0};
+    ok = binary_fuse16_allocate((uint32_t)n, &f1) && binary_fuse16_allocate((uint32_t)n, &f2) &&
+         xor8_allocate((uint32_t)n, &x1) && xor8_allocate((uint32_t)n, &x2);
+    // the xor constructions do not write the cells left free
+    if (ok) {
+      memset(x1.fingerprints, 0, x1.blockLength * 3);
+      memset(x2.fingerprints, 0, x2.blockLength * 3);
+    }
+    ok = ok && binary_fuse16_populate(keys, (uint32_t)n, &f1) &&
+         binary_fuse16_populate_with_workspace(keys, (uint32_t)n, &f2, &fw) &&
+         xor8_populate(keys, (uint32_t)n, &x1) &&
+         xor8_populate_with_workspace(keys, (uint32_t)n, &x2, &xw);
+    ok = ok && f1.Seed == f2.Seed &&
+         memcmp(f1.Fingerprints, f2.Fingerprints, f1.ArrayLength * sizeof(uint16_t)) == 0 &&
+         x1.seed == x2.seed && memcmp(x1.fingerprints, x2.fingerprints, x1.blockLength * 3) == 0;
+    for (size_t i = 0; i < n && ok; i++) {
+      ok = binary_fuse16_contain(keys[i], &f2) && xor8_contain(keys[i], &x2);
+    }
+    ok = ok && workspace_cleared(&fw, &xw);
+    binary_fuse16_free(&f1);
+    binary_fuse16_free(&f2);
+    xor8_free(&x1);
+    xor8_free(&x2);
+  }
+  ok = ok && fw.KeyCapacity >= size && xw.keyCapacity >= size;
+  binary_fuse_workspace_free(&fw);
+  xor_workspace_free(&xw);
+  free(keys);
+  return ok;
+}
+
+// the map must return the value of every key, in the batch too and after
+// serialization; a repeated key is fine when its values agree
+bool testmap(size_t size, uint32_t bits) {
+  printf("testing binary fuse map with size %zu and %u-bit values\n", size, bits);
+  uint64_t *keys = (uint64_t *)malloc(sizeof(uint64_t) * (size + 1));
+  uint32_t *values = (uint32_t *)malloc(sizeof(uint32_t) * (size + 1));
+  uint32_t *out = (uint32_t *)malloc(sizeof(uint32_t) * (size + 1));
+  uint64_t rng = 99;
+  for (size_t i = 0; i < size; i++) {
+    keys[i] = binary_fuse_rng_splitmix64(&rng);
+    values[i] = (uint32_t)binary_fuse_rng_splitmix64(&rng);
+  }
+  if (size > 10) {
+    keys[size - 1] = keys[0];
+    values[size - 1] = values[0] ^ (UINT32_C(1) << bits); // same low bits
+  }
+  binary_fuse_map_t map;
+  bool ok = binary_fuse_map_allocate((uint32_t)size, bits, &map) &&
+            binary_fuse_map_populate(keys, values, (uint32_t)size, &map);
+  if (ok) {
+    size_t buffer_size = binary_fuse_map_serialization_bytes(&map);
+    char *buffer = (char *)malloc(buffer_size);
+    binary_fuse_map_serialize(&map, buffer);
+    binary_fuse_map_free(&map);
+    ok = binary_fuse_map_deserialize(&map, buffer);
+    free(buffer);
+  }
+  uint32_t mask = (UINT32_C(1) << bits) - 1;
+  for (size_t i = 0; i < size && ok; i++) {
+    ok = binary_fuse_map_get(keys[i], &map) == (values[i] & mask);
+  }
+  if (ok) {
+    binary_fuse_map_get_batch(keys, size, out, &map);
+  }
+  for (size_t i = 0; i < size && ok; i++) {
+    ok = out[i] == (values[i] & mask);
+  }
+  if (ok && size > 0) {
+    printf(" bits per entry %3.2f\n",
+           (double)binary_fuse_map_size_in_bytes(&map) * 8.0 / (double)size);
+  }
+  binary_fuse_map_free(&map);
+  if (ok && size > 10) {
+    // a key with two different values cannot be stored
+    values[size - 1] = values[0] ^ 1;
+    ok = binary_fuse_map_allocate((uint32_t)size, bits, &map) &&
+         !binary_fuse_map_populate(keys, values, (uint32_t)size, &map);
+    binary_fuse_map_free(&map);
+  }
+  free(out);
+  free(values);
+  free(keys);
+  return ok;
+}
+
+// replaying the construction plan with new values must give the map that
+// binary_fuse_map_populate builds from them
+bool testmapreplay(size_t size, uint32_t bits) {
+  printf("testing binary fuse map replay with size %zu and %u-bit values\n", size, bits);
+  uint64_t *keys = (uint64_t *)malloc(sizeof(uint64_t) * (size + 1));
+  uint32_t *values = (uint32_t *)malloc(sizeof(uint32_t) * (size + 1));
+  uint64_t rng = 123;
+  for (size_t i = 0; i < size; i++) {
+    keys[i] = binary_fuse_rng_splitmix64(&rng);
+    values[i] = (uint32_t)binary_fuse_rng_splitmix64(&rng);
+  }
+  if (size > 10) {
+    keys[size - 1] = keys[0];
+    values[size - 1] = values[0];
+  }
+  binary_fuse_map_t map = {0}, fresh = {0}, replayed = {0}, other = {0};
+  binary_fuse_map_plan_t plan = {0};
+  bool ok = binary_fuse_map_allocate((uint32_t)size, bits, &map) &&
+            binary_fuse_map_allocate((uint32_t)size, bits, &fresh) &&
+            binary_fuse_map_allocate((uint32_t)size, bits, &replayed) &&
+            binary_fuse_map_allocate((uint32_t)size + 1, bits, &other) &&
+            binary_fuse_map_populate_plan(keys, values, (uint32_t)size, &map, &plan);
+  if (!ok) {
+    printf("allocation or construction failed\n");
+    binary_fuse_map_plan_free(&plan);
+    binary_fuse_map_free(&map);
+    binary_fuse_map_free(&fresh);
+    binary_fuse_map_free(&replayed);
+    binary_fuse_map_free(&other);
+    free(values);
+    free(keys);
+    return false;
+  }
+  for (size_t i = 0; i < size; i++) {
+    values[i] = (uint32_t)binary_fuse_rng_splitmix64(&rng);
+  }
+  if (size > 10) {
+    values[size - 1] = values[0];
+  }
+  ok = binary_fuse_map_replay(&plan, keys, values, &map) &&
+       binary_fuse_map_replay(&plan, keys, values, &replayed) &&
+       binary_fuse_map_populate(keys, values, (uint32_t)size, &fresh) &&
+       replayed.Seed == fresh.Seed &&
+       memcmp(replayed.Values, fresh.Values, binary_fuse_map_array_bytes(&fresh)) == 0 &&
+       !binary_fuse_map_replay(&plan, keys, values, &other);
+  uint32_t mask = (UINT32_C(1) << bits) - 1;
+  for (size_t i = 0; i < size && ok; i++) {
+    ok = binary_fuse_map_get(keys[i], &map) == (values[i] & mask);
+  }
+  if (ok && size > 0) {
+    printf(" plan bytes per key %3.2f\n",
+           (double)binary_fuse_map_plan_size_in_bytes(&plan) / (double)size);
+  }
+  binary_fuse_map_plan_free(&plan);
+  binary_fuse_map_free(&map);
+  binary_fuse_map_free(&fresh);
+  binary_fuse_map_free(&replayed);
+  binary_fuse_map_free(&other);
+  free(values);
+  free(keys);
+  return ok;
+}
+
+// the function must map the distinct keys to distinct values in [0, n), in
+// the batch too and after serialization
+bool testmphf(size_t size, size_t repeated_size) {
+  printf("testing binary fuse mphf with size %zu and %zu duplicates\n", size, repeated_size);
+  uint64_t *keys = (uint64_t *)malloc(sizeof(uint64_t) * (size + 1));
+  uint32_t *out = (uint32_t *)malloc(sizeof(uint32_t) * (size + 1));
+  uint8_t *seen = (uint8_t *)calloc(size + 1, 1);
+  uint64_t rng = 7;
+  for (size_t i = 0; i < size - repeated_size; i++) {
+    keys[i] = binary_fuse_rng_splitmix64(&rng);
+  }
+  for (size_t i = 0; i < repeated_size; i++) {
+    keys[size - i - 1] = keys[i];
+  }
+  size_t distinct = size - repeated_size;
+  // populate may reorder the keys, the first 'distinct' ones of the copy are
+  // distinct
+  uint64_t *copy = (uint64_t *)malloc(sizeof(uint64_t) * (size + 1));
+  memcpy(copy, keys, sizeof(uint64_t) * size);
+  binary_fuse_mphf_t mphf;
+  bool ok = binary_fuse_mphf_allocate((uint32_t)size, &mphf) &&
+            binary_fuse_mphf_populate(keys, (uint32_t)size, &mphf) &&
+            mphf.Size == distinct;
+  if (ok) {
+    size_t buffer_size = binary_fuse_mphf_serialization_bytes(&mphf);
+    char *buffer = (char *)malloc(buffer_size);
+    binary_fuse_mphf_serialize(&mphf, buffer);
+    binary_fuse_mphf_free(&mphf);
+    ok = binary_fuse_mphf_deserialize(&mphf, buffer);
+    free(buffer);
+  }
+  for (size_t i = 0; i < distinct && ok; i++) {
+    uint32_t v = binary_fuse_mphf_get(copy[i], &mphf);
+    ok = v < distinct && !seen[v];
+    seen[v] = 1;
+  }
+  if (ok) {
+    binary_fuse_mphf_get_batch(keys, size, out, &mphf);
+  }
+  for (size_t i = 0; i < size && ok; i++) {
+    ok = out[i] == binary_fuse_mphf_get(keys[i], &mphf);
+  }
+  if (ok && size > 0) {
+    printf(" bits per entry %3.2f\n",
+           (double)binary_fuse_mphf_size_in_bytes(&mphf) * 8.0 / (double)size);
+  }
+  binary_fuse_mphf_free(&mphf);
+  free(seen);
+  free(out);
+  free(copy);
+  free(keys);
+  return ok;
+}
+
+// one peeling for three widths must give the filters of the three populate
+// functions
+bool testpopulatemulti(size_t size, size_t repeated_size) {
+  printf("testing binary fuse populate_multi with size %zu and %zu duplicates\n", size,
+         repeated_size);
+  uint64_t *keys = (uint64_t *)malloc(sizeof(uint64_t) * (size + 1));
+  uint64_t *copy = (uint64_t *)malloc(sizeof(uint64_t) * (size + 1));
+  uint64_t rng = 11;
+  for (size_t i = 0; i < size - repeated_size; i++) {
+    keys[i] = binary_fuse_rng_splitmix64(&rng);
+  }
+  for (size_t i = 0; i < repeated_size; i++) {
+    keys[size - i - 1] = keys[i];
+  }
+  binary_fuse8_t m8 = {0}, s8 = {0};
+  binary_fuse16_t m16 = {0}, s16 = {0};
+  binary_fuse32_t m32 = {0}, s32 = {0};
+  bool ok = binary_fuse8_allocate((uint32_t)size, &m8) &&
+            binary_fuse16_allocate((uint32_t)size, &m16) &&
+            binary_fuse32_allocate((uint32_t)size, &m32) &&
+            binary_fuse8_allocate((uint32_t)size, &s8) &&
+            binary_fuse16_allocate((uint32_t)size, &s16) &&
+            binary_fuse32_allocate((uint32_t)size, &s32);
+  if (ok) {
+    memcpy(copy, keys, sizeof(uint64_t) * size);
+    ok = binary_fuse_populate_multi(copy, (uint32_t)size, &m8, &m16, &m32);
+  }
+  if (ok) {
+    memcpy(copy, keys, sizeof(uint64_t) * size);
+    ok = binary_fuse8_populate(copy, (uint32_t)size, &s8);
+  }
+  if (ok) {
+    memcpy(copy, keys, sizeof(uint64_t) * size);
+    ok = binary_fuse16_populate(copy, (uint32_t)size, &s16);
+  }
+  if (ok) {
+    memcpy(copy, keys, sizeof(uint64_t) * size);
+    ok = binary_fuse32_populate(copy, (uint32_t)size, &s32);
+  }
+  ok = ok && m8.Seed == s8.Seed && m16.Seed == s16.Seed && m32.Seed == s32.Seed &&
+       memcmp(m8.Fingerprints, s8.Fingerprints, m8.ArrayLength * sizeof(uint8_t)) == 0 &&
+       memcmp(m16.Fingerprints, s16.Fingerprints, m16.ArrayLength * sizeof(uint16_t)) == 0 &&
+       memcmp(m32.Fingerprints, s32.Fingerprints, m32.ArrayLength * sizeof(uint32_t)) == 0;
+  for (size_t i = 0; i < size && ok; i++) {
+    ok = binary_fuse8_contain(keys[i], &m8) && binary_fuse16_contain(keys[i], &m16) &&
+         binary_fuse32_contain(keys[i], &m32);
+  }
+  // a missing width is skipped, a width of another size is rejected
+  if (ok) {
+    memcpy(copy, keys, sizeof(uint64_t) * size);
+    ok = binary_fuse_populate_multi(copy, (uint32_t)size, NULL, &m16, NULL) &&
+         !binary_fuse_populate_multi(copy, (uint32_t)size, NULL, NULL, NULL) &&
+         !binary_fuse_populate_multi(copy, (uint32_t)size + 1, &m8, NULL, NULL);
+  }
+  for (size_t i = 0; i < size && ok; i++) {
+    ok = binary_fuse16_contain(keys[i], &m16);
+  }
+  binary_fuse8_free(&m8);
+  binary_fuse16_free(&m16);
+  binary_fuse32_free(&m32);
+  binary_fuse8_free(&s8);
+  binary_fuse16_free(&s16);
+  binary_fuse32_free(&s32);
+  free(copy);
+  free(keys);
+  return ok;
+}
+
+// string keys, with a repeated one, in both widths
+bool testbytes(size_t size) {
+  printf("testing binary fuse byte-string keys with size %zu\n", size);
+  char *text = (char *)malloc(48 * (size + 1));
+  const void **ptrs = (const void **)malloc(sizeof(void *) * (size + 1));
+  size_t *lens = (size_t *)malloc(sizeof(size_t) * (size + 1));
+  bool *out = (bool *)malloc(sizeof(bool) * (size + 1));
+  for (size_t i = 0; i < size; i++) {
+    // lengths from 0 to about 40 bytes
+    int n = snprintf(text + 48 * i, 48, "https://example.com/%zu", i * 7919);
+    ptrs[i] = text + 48 * i;
+    lens[i] = i % 7 == 0 ? (size_t)n % 5 + i % 3 : (size_t)n;
+  }
+  if (size > 10) {
+    ptrs[size - 1] = ptrs[3];
+    lens[size - 1] = lens[3];
+  }
+  binary_fuse8_t filter8 = {0};
+  binary_fuse16_t filter16 = {0};
+  bool ok = binary_fuse8_allocate((uint32_t)size, &filter8) &&
+            binary_fuse16_allocate((uint32_t)size, &filter16) &&
+            binary_fuse8_populate_bytes(ptrs, lens, (uint32_t)size, &filter8) &&
+            binary_fuse16_populate_bytes(ptrs, lens, (uint32_t)size, &filter16);
+  for (size_t i = 0; i < size && ok; i++) {
+    ok = binary_fuse8_contain_bytes(ptrs[i], lens[i], &filter8) &&
+         binary_fuse16_contain_bytes(ptrs[i], lens[i], &filter16);
+  }
+  if (ok) {
+    binary_fuse8_contain_bytes_batch(ptrs, lens, size, out, &filter8);
+  }
+  for (size_t i = 0; i < size && ok; i++) {
+    ok = out[i];
+  }
+  // the same bytes at another address, then other strings
+  char copy[48];
+  if (ok && size > 0) {
+    memcpy(copy, ptrs[0], lens[0]);
+    ok = binary_fuse16_contain_bytes(copy, lens[0], &filter16);
+  }
+  size_t matches = 0;
+  size_t trials = 100000;
+  for (size_t i = 0; i < trials && ok; i++) {
+    int n = snprintf(copy, sizeof(copy), "https://example.org/%zu", i);
+    matches += binary_fuse16_contain_bytes(copy, (size_t)n, &filter16);
+  }
+  if (ok) {
+    printf(" fpp %3.5f\n", (double)matches / (double)trials);
+    ok = matches < 20;
+  }
+  binary_fuse8_free(&filter8);
+  binary_fuse16_free(&filter16);
+  free(out);
+  free(lens);
+  free(ptrs);
+  free(text);
+  return ok;
+}
+
+#ifdef BINARY_FUSE_PARALLEL_H
+// the multithreaded queries must agree with the batch queries, and account
+// for every key exactly once
+bool testparallel(size_t size, size_t nthreads) {
+  printf("testing parallel queries with size %zu and %zu threads\n", size, nthreads);
+  uint64_t *big_set = (uint64_t *)malloc(sizeof(uint64_t) * size);
+  for (size_t i = 0; i < size; i++) {
+    big_set[i] = i;
+  }
+  binary_fuse8_t f8 = {0};
+  binary_fuse16_t f16 = {0};
+  bool ok = binary_fuse8_allocate((uint32_t)size, &f8) &&
+            binary_fuse16_allocate((uint32_t)size, &f16) &&
+            binary_fuse8_populate(big_set, (uint32_t)size, &f8) &&
+            binary_fuse16_populate(big_set, (uint32_t)size, &f16);
+  free(big_set);
+  binary_fuse_pool_t pool;
+  if (!ok || !binary_fuse_pool_create(&pool, nthreads)) {
+    binary_fuse8_free(&f8);
+    binary_fuse16_free(&f16);
+    return false;
+  }
+  size_t count = 3 * BINARY_FUSE_PARALLEL_CHUNK + 1000;
+  uint64_t *queries = make_batch_queries(size, count);
+  bool *out = (bool *)malloc(sizeof(bool) * count);
+  bool *expected = (bool *)malloc(sizeof(bool) * count);
+  binary_fuse_parallel_stats_t stats;
+  memset(&stats, 0, sizeof(stats));
+  for (int width = 8; width <= 16 && ok; width += 8) {
+    size_t hits, counted;
+    if (width == 8) {
+      binary_fuse8_contain_batch(queries, count, expected, &f8);
+      hits = binary_fuse8_contain_parallel(&pool, queries, count, out, &f8, &stats);
+      counted = binary_fuse8_contain_parallel(&pool, queries, count, NULL, &f8, NULL);
+    } else {
+      binary_fuse16_contain_batch(queries, count, expected, &f16);
+      hits = binary_fuse16_contain_parallel(&pool, queries, count, out, &f16, &stats);
+      counted = binary_fuse16_contain_parallel(&pool, queries, count, NULL, &f16, NULL);
+    }
+    size_t expected_hits = 0;
+    for (size_t i = 0; i < count; i++) {
+      expected_hits += expected[i];
+      ok = ok && (out[i] == expected[i]);
+    }
+    size_t thread_hits = 0, thread_keys = 0;
+    for (size_t t = 0; t < stats.nthreads; t++) {
+      thread_hits += stats.thread_hits[t];
+      thread_keys += stats.thread_keys[t];
+    }
+    ok = ok && hits == expected_hits && counted == expected_hits && stats.hits == hits &&
+         thread_hits == hits && thread_keys == count && stats.nthreads == nthreads;
+  }
+  binary_fuse_pool_destroy(&pool);
+  free(expected);
+  free(out);
+  free(queries);
+  binary_fuse8_free(&f8);
+  binary_fuse16_free(&f16);
+  return ok;
+}
+
+// the multithreaded construction must not depend on the number of threads,
+// and must contain every key
+bool testpopulateparallel(size_t size, size_t repeated_size) {
+  printf("testing binary fuse populate_parallel with size %zu and %zu duplicates\n", size,
+         repeated_size);
+  uint64_t *keys = (uint64_t *)malloc(sizeof(uint64_t) * (size + 1));
+  uint64_t *copy = (uint64_t *)malloc(sizeof(uint64_t) * (size + 1));
+  uint64_t rng = 12;
+  for (size_t i = 0; i < size - repeated_size; i++) {
+    keys[i] = binary_fuse_rng_splitmix64(&rng);
+  }
+  for (size_t i = 0; i < repeated_size; i++) {
+    keys[size - i - 1] = keys[i];
+  }
+  binary_fuse8_t r8 = {0}, p8 = {0};
+  binary_fuse16_t r16 = {0}, p16 = {0};
+  bool ok = binary_fuse8_allocate((uint32_t)size, &r8) &&
+            binary_fuse16_allocate((uint32_t)size, &r16) &&
+            binary_fuse8_allocate((uint32_t)size, &p8) &&
+            binary_fuse16_allocate((uint32_t)size, &p16);
+  if (ok) {
+    memcpy(copy, keys, sizeof(uint64_t) * size);
+    ok = binary_fuse8_populate_parallel(copy, (uint32_t)size, &r8, 1);
+  }
+  if (ok) {
+    memcpy(copy, keys, sizeof(uint64_t) * size);
+    ok = binary_fuse16_populate_parallel(copy, (uint32_t)size, &r16, 1);
+  }
+  for (size_t i = 0; i < size && ok; i++) {
+    ok = binary_fuse8_contain(keys[i], &r8) && binary_fuse16_contain(keys[i], &r16);
+  }
+  for (size_t nthreads = 2; nthreads <= 5 && ok; nthreads += 3) {
+    memset(p8.Fingerprints, 0, p8.ArrayLength * sizeof(uint8_t));
+    memset(p16.Fingerprints, 0, p16.ArrayLength * sizeof(uint16_t));
+    memcpy(copy, keys, sizeof(uint64_t) * size);
+    ok = binary_fuse8_populate_parallel(copy, (uint32_t)size, &p8, nthreads);
+    memcpy(copy, keys, sizeof(uint64_t) * size);
+    ok = ok && binary_fuse16_populate_parallel(copy, (uint32_t)size, &p16, nthreads);
+    ok = ok && p8.Seed == r8.Seed && p16.Seed == r16.Seed &&
+         memcmp(p8.Fingerprints, r8.Fingerprints, r8.ArrayLength * sizeof(uint8_t)) == 0 &&
+         memcmp(p16.Fingerprints, r16.Fingerprints, r16.ArrayLength * sizeof(uint16_t)) == 0;
+  }
+  // a filter of another size is rejected
+  ok = ok && !binary_fuse8_populate_parallel(copy, (uint32_t)size + 1, &p8, 2);
+  binary_fuse8_free(&r8);
+  binary_fuse16_free(&r16);
+  binary_fuse8_free(&p8);
+  binary_fuse16_free(&p16);
+  free(copy);
+  free(keys);
+  return ok;
+}
+
+// the multithreaded xor construction must build the filter of the serial one
+bool testxorpopulateparallel(size_t size, size_t repeated_size) {
+  printf("testing xor populate_parallel with size %zu and %zu duplicates\n", size,
+         repeated_size);
+  uint64_t *keys = (uint64_t *)malloc(sizeof(uint64_t) * (size + 1));
+  uint64_t *copy = (uint64_t *)malloc(sizeof(uint64_t) * (size + 1));
+  uint64_t rng = 13;
+  for (size_t i = 0; i < size - repeated_size; i++) {
+    keys[i] = binary_fuse_rng_splitmix64(&rng);
+  }
+  for (size_t i = 0; i < repeated_size; i++) {
+    keys[size - i - 1] = keys[i];
+  }
+  xor8_t s8 = {0}, p8 = {0};
+  xor16_t s16 = {0}, p16 = {0};
+  bool ok = xor8_allocate((uint32_t)size, &s8) && xor16_allocate((uint32_t)size, &s16) &&
+            xor8_allocate((uint32_t)size, &p8) && xor16_allocate((uint32_t)size, &p16);
+  // the cells that no key uses are not written
+  size_t cells = ok ? 3 * (size_t)s8.blockLength : 0;
+  if (ok) {
+    memset(s8.fingerprints, 0, cells * sizeof(uint8_t));
+    memset(s16.fingerprints, 0, cells * sizeof(uint16_t));
+    memcpy(copy, keys, sizeof(uint64_t) * size);
+    ok = xor8_populate(copy, (uint32_t)size, &s8);
+  }
+  if (ok) {
+    memcpy(copy, keys, sizeof(uint64_t) * size);
+    ok = xor16_populate(copy, (uint32_t)size, &s16);
+  }
+  for (size_t nthreads = 1; nthreads <= 4 && ok; nthreads += 3) {
+    memset(p8.fingerprints, 0, cells * sizeof(uint8_t));
+    memset(p16.fingerprints, 0, cells * sizeof(uint16_t));
+    memcpy(copy, keys, sizeof(uint64_t) * size);
+    ok = xor8_populate_parallel(copy, (uint32_t)size, &p8, nthreads);
+    memcpy(copy, keys, sizeof(uint64_t) * size);
+    ok = ok && xor16_populate_parallel(copy, (uint32_t)size, &p16, nthreads);
+    ok = ok && p8.seed == s8.seed && p16.seed == s16.seed &&
+         memcmp(p8.fingerprints, s8.fingerprints, cells * sizeof(uint8_t)) == 0 &&
+         memcmp(p16.fingerprints, s16.fingerprints, cells * sizeof(uint16_t)) == 0;
+  }
+  for (size_t i = 0; i < size && ok; i++) {
+    ok = xor8_contain(keys[i], &p8) && xor16_contain(keys[i], &p16);
+  }
+  xor8_free(&s8);
+  xor16_free(&s16);
+  xor8_free(&p8);
+  xor16_free(&p16);
+  free(copy);
+  free(keys);
+  return ok;
+}
+
+// every key of a sharded set is found, in every shard, after a round trip
+// through the container, with the shards loaded one at a time, and after a
+// shard is rebuilt alone
+bool testsharded(size_t size, uint32_t shard_count, size_t repeated_size) {
+  printf("testing sharded binary fuse with size %zu, %u shards and %zu duplicates\n", size,
+         shard_count, repeated_size);
+  uint64_t *keys = (uint64_t *)malloc(sizeof(uint64_t) * (size + 1));
+  uint64_t *routed = (uint64_t *)malloc(sizeof(uint64_t) * (size + 1));
+  bool *answers = (bool *)malloc(sizeof(bool) * (size + 1));
+  uint64_t rng = 14;
+  for (size_t i = 0; i < size - repeated_size; i++) {
+    keys[i] = binary_fuse_rng_splitmix64(&rng);
+  }
+  for (size_t i = 0; i < repeated_size; i++) {
+    keys[size - i - 1] = keys[i];
+  }
+  binary_fuse_sharded_t s = {0}, d = {0};
+  bool ok = binary_fuse_sharded_allocate(size, shard_count, &s) &&
+            binary_fuse_sharded_populate_parallel(keys, size, &s, 3);
+  for (size_t i = 0; i < size && ok; i++) {
+    ok = binary_fuse_sharded_contain(keys[i], &s);
+  }
+  size_t matches = 0, trials = 100000;
+  for (size_t i = 0; i < trials && ok; i++) {
+    matches += binary_fuse_sharded_contain(binary_fuse_rng_splitmix64(&rng), &s);
+  }
+  if (ok && size >= 1000 && matches * 100 > trials) {
+    printf("false positive rate %f\n", (double)matches / (double)trials);
+    ok = false;
+  }
+  if (ok) {
+    binary_fuse_sharded_contain_batch(keys, size, answers, &s);
+  }
+  for (size_t i = 0; i < size && ok; i++) {
+    ok = answers[i];
+  }
+  char *buffer = NULL;
+  if (ok) {
+    buffer = (char *)malloc(binary_fuse_sharded_serialization_bytes(&s));
+    binary_fuse_sharded_serialize(&s, buffer);
+    ok = binary_fuse_sharded_deserialize(&d, buffer);
+    ok = ok && d.Seed == s.Seed && d.Size == s.Size && d.ShardCount == s.ShardCount;
+    for (uint32_t i = 0; i < s.ShardCount && ok; i++) {
+      ok = d.Shards[i].Seed == s.Shards[i].Seed &&
+           memcmp(d.Shards[i].Fingerprints, s.Shards[i].Fingerprints,
+                  s.Shards[i].ArrayLength) == 0;
+    }
+    binary_fuse_sharded_free(&d);
+  }
+  // the shards of a container are loaded one at a time, and rebuilt alone
+  ok = ok && binary_fuse_sharded_deserialize_header(&d, buffer);
+  for (uint32_t shard = 0; shard < s.ShardCount && ok; shard++) {
+    uint32_t n = 0;
+    for (size_t i = 0; i < size; i++) {
+      if (binary_fuse_sharded_shard_of(keys[i], &s) == shard) {
+        routed[n++] = keys[i];
+      }
+    }
+    ok = n == s.Shards[shard].Size && binary_fuse_sharded_load_shard(shard, &d, buffer);
+    for (uint32_t i = 0; i < n && ok; i++) {
+      ok = binary_fuse_sharded_contain(routed[i], &d);
+    }
+    binary_fuse_sharded_evict_shard(shard, &d);
+    ok = ok && binary_fuse_sharded_populate_shard(routed, n, shard, &d) && d.Size == s.Size;
+    for (uint32_t i = 0; i < n && ok; i++) {
+      ok = binary_fuse_sharded_contain(routed[i], &d);
+    }
+    binary_fuse_sharded_evict_shard(shard, &d);
+  }
+  binary_fuse_sharded_free(&d);
+  // a set of another size is rejected
+  ok = ok && !binary_fuse_sharded_populate_parallel(keys, size + 1, &s, 2);
+  binary_fuse_sharded_free(&s);
+  free(buffer);
+  free(answers);
+  free(routed);
+  free(keys);
+  return ok;
+}
+#endif
+
 void failure_rate_binary_fuse16() {
   printf("testing binary fuse16 for failure rate\n");
   // we construct many 5000-long input cases and check the probability of failure.
@@ -355,6 +1859,8 @@ void readme_pack() {
 
 int main() {
   readme_pack();
+  if(!testhashkeys()) { abort(); }
+  if(!testmixertag()) { abort(); }
   failure_rate_binary_fuse16();
   for(size_t size = 1000; size <= 1000000; size *= 300) {
     printf("== size = %zu \n", size);
@@ -382,6 +1888,34 @@ int main() {
     printf("\n");
     if(!testxor16pack(size)) { abort(); }
     printf("\n");
+    if(!testbinaryfuse32(size, 10)) { abort(); }
+    printf("\n");
+    if(!testbinaryfuse32pack(size, 0)) { abort(); }
+    printf("\n");
+    if(!testxor32(size)) { abort(); }
+    printf("\n");
+    if(!testxor32pack(size)) { abort(); }
+    printf("\n");
+    if(!testfpr32(size)) { abort(); }
+    printf("\n");
+    if(!testbatchkernels(size)) { abort(); }
+    if(!testprobes(size)) { abort(); }
+    if(!testselect(size)) { abort(); }
+    if(!testblocked(size, 10)) { abort(); }
+    if(!test4wise(size, 10)) { abort(); }
+    if(!testbitpacked(size)) { abort(); }
+    if(!testlarge(size, 10)) { abort(); }
+    if(!testlowmem(size, 10)) { abort(); }
+    if(!testworkspace(size, 10)) { abort(); }
+    if(!testmap(size, 1)) { abort(); }
+    if(!testmap(size, 9)) { abort(); }
+    if(!testmap(size, 20)) { abort(); }
+    if(!testmapreplay(size, 12)) { abort(); }
+    if(!testmphf(size, 0)) { abort(); }
+    if(!testmphf(size, 10)) { abort(); }
+    if(!testpopulatemulti(size, 10)) { abort(); }
+    if(!testbytes(size)) { abort(); }
+    printf("\n");
     printf("======\n");
   }
 
@@ -392,4 +1926,66 @@ int main() {
   if(!testbinaryfuse16(0, 0)) { abort(); }
   if(!testbinaryfuse16(1, 0)) { abort(); }
   if(!testbinaryfuse16(2, 0)) { abort(); }
+  if(!testbinaryfuse32(0, 0)) { abort(); }
+  if(!testbinaryfuse32(1, 0)) { abort(); }
+  if(!testbinaryfuse32(2, 0)) { abort(); }
+  if(!testblocked(0, 0)) { abort(); }
+  if(!testblocked(1, 0)) { abort(); }
+  if(!testblocked(2, 0)) { abort(); }
+  if(!test4wise(0, 0)) { abort(); }
+  if(!test4wise(1, 0)) { abort(); }
+  if(!test4wise(2, 0)) { abort(); }
+  if(!testbitpacked(2)) { abort(); }
+  if(!testbitpacked(3)) { abort(); }
+  if(!testlarge(0, 0)) { abort(); }
+  if(!testlarge(1, 0)) { abort(); }
+  if(!testlarge(2, 1)) { abort(); }
+  if(!testlowmem(0, 0)) { abort(); }
+  if(!testlowmem(1, 0)) { abort(); }
+  if(!testlowmem(2, 1)) { abort(); }
+  if(!testworkspace(1, 0)) { abort(); }
+  if(!testworkspace(2, 1)) { abort(); }
+  if(!testmap(0, 8)) { abort(); }
+  if(!testmap(1, 8)) { abort(); }
+  if(!testmap(2, 8)) { abort(); }
+  if(!testmapreplay(0, 8)) { abort(); }
+  if(!testmapreplay(1, 8)) { abort(); }
+  if(!testmapreplay(2, 8)) { abort(); }
+  if(!testmphf(0, 0)) { abort(); }
+  if(!testmphf(1, 0)) { abort(); }
+  if(!testmphf(2, 0)) { abort(); }
+  if(!testmphf(2, 1)) { abort(); }
+  if(!testpopulatemulti(0, 0)) { abort(); }
+  if(!testpopulatemulti(1, 0)) { abort(); }
+  if(!testpopulatemulti(2, 0)) { abort(); }
+  if(!testbytes(0)) { abort(); }
+  if(!testbytes(1)) { abort(); }
+  if(!testbytes(2)) { abort(); }
+#ifdef BINARY_FUSE_PARALLEL_H
+  if(!testparallel(100000, 1)) { abort(); }
+  if(!testparallel(100000, 3)) { abort(); }
+  if(!testpopulateparallel(0, 0)) { abort(); }
+  if(!testpopulateparallel(1, 0)) { abort(); }
+  if(!testpopulateparallel(2, 0)) { abort(); }
+  if(!testpopulateparallel(2, 1)) { abort(); }
+  if(!testpopulateparallel(1000, 10)) { abort(); }
+  if(!testpopulateparallel(300000, 0)) { abort(); }
+  if(!testpopulateparallel(300000, 10)) { abort(); }
+  if(!testxorpopulateparallel(1, 0)) { abort(); }
+  if(!testxorpopulateparallel(2, 1)) { abort(); }
+  if(!testxorpopulateparallel(1000, 10)) { abort(); }
+  if(!testxorpopulateparallel(300000, 0)) { abort(); }
+  if(!testxorpopulateparallel(300000, 10)) { abort(); }
+  if(!testsharded(0, 1, 0)) { abort(); }
+  if(!testsharded(1, 2, 0)) { abort(); }
+  if(!testsharded(1000, 3, 10)) { abort(); }
+  if(!testsharded(300000, 0, 0)) { abort(); }
+  if(!testsharded(300000, 7, 10)) { abort(); }
+#endif
+  if(!testmulti(10000, 70)) { abort(); }
+  if(!testmulti(3, 5)) { abort(); }
+  for (size_t size = 2; size <= 16; size++) {
+    if(!testbatchkernels(size)) { abort(); }
+    if(!testprobes(size)) { abort(); }
+  }
 }